@@ -11,6 +11,7 @@
 #include "ARecord.h"
 #include "ILog.h"
 #include "MiscUtils.h"
+#include "RecordSealer.h"
 
 #include <sstream>
 #include <algorithm>
@@ -23,9 +24,15 @@ extern ILog *log;
 
 using namespace std;
 
+RecordSealer *ARecord::s_sealer = 0;
+thread_local bool ARecord::s_sealingDeferred = false;
+mutex ARecord::s_payloadMutex;
+
 ARecord::ARecord()
 {
   m_accountId = 0;
+  m_sealed = false;
+  m_hasPayload = false;
   //set creation time to current system time
   SetCreationTime();
   SetLock(UNLOCKED);
@@ -33,23 +40,82 @@ ARecord::ARecord()
 
 ARecord::~ARecord()
 {
+  if (s_sealer)
+    s_sealer->Forget(this);
+  if (not m_sealed)
+    for (TFieldsIterator itf = m_fields.begin(); itf != m_fields.end(); ++itf)
+      std::fill(itf->second.begin(), itf->second.end(), '\0');
+  std::fill(m_foldedFields.begin(), m_foldedFields.end(), '\0');
 }
 
 ARecord::ARecord(const ARecord& pARecord)
 {
+  //fields and their sealing are copied at once: no other thread seals them meanwhile
+  unique_lock<recursive_mutex> lock;
+  if (s_sealer)
+    lock = unique_lock<recursive_mutex>(s_sealer->GetMutex());
   m_accountName = pARecord.m_accountName;
   m_fields = pARecord.m_fields;
   m_labels = pARecord.m_labels;
   m_essentials = pARecord.m_essentials;
+  m_uuid = pARecord.m_uuid;
   m_accountId = pARecord.m_accountId;
   m_creationTime = pARecord.m_creationTime;
   m_lastModificationTime = pARecord.m_lastModificationTime;
+  m_sealed = pARecord.m_sealed;
+  m_foldedName = pARecord.m_foldedName;
+  m_nameSortKey = pARecord.m_nameSortKey;
+  m_foldedLabels = pARecord.m_foldedLabels;
+  m_foldedFields = pARecord.m_foldedFields;
+  m_payload = pARecord.m_payload;
+  m_payloadOpener = pARecord.m_payloadOpener;
+  m_hasPayload = not m_payload.empty();
   SetLock(UNLOCKED); // New record UNLOCKED by default
+  if (not m_sealed)
+    OpenFields(); //count it among the open records
+}
+
+ARecord &ARecord::operator=(const ARecord& pARecord)
+{
+  if (this == &pARecord)
+    return *this;
+  unique_lock<recursive_mutex> lock;
+  if (s_sealer)
+    lock = unique_lock<recursive_mutex>(s_sealer->GetMutex());
+  //values replaced are wiped, as when the record is deleted
+  if (not m_sealed)
+    for (TFieldsIterator itf = m_fields.begin(); itf != m_fields.end(); ++itf)
+      std::fill(itf->second.begin(), itf->second.end(), '\0');
+  m_accountName = pARecord.m_accountName;
+  m_creationTime = pARecord.m_creationTime;
+  m_lastModificationTime = pARecord.m_lastModificationTime;
+  m_fields = pARecord.m_fields;
+  m_labels = pARecord.m_labels;
+  m_essentials = pARecord.m_essentials;
+  m_uuid = pARecord.m_uuid;
+  m_accountId = pARecord.m_accountId;
+  m_foldedName = pARecord.m_foldedName;
+  m_foldedLabels = pARecord.m_foldedLabels;
+  m_foldedFields = pARecord.m_foldedFields;
+  m_nameSortKey = pARecord.m_nameSortKey;
+  m_sealed = pARecord.m_sealed;
+  m_payload = pARecord.m_payload;
+  m_payloadOpener = pARecord.m_payloadOpener;
+  m_hasPayload = not m_payload.empty();
+  m_lock = pARecord.m_lock;
+  //same bookkeeping of the open records as the copy constructor
+  if (not m_sealed)
+    OpenFields();
+  else if (s_sealer)
+    s_sealer->Forget(this);
+  return *this;
 }
 
 ARecord::ARecord(string pAccountName, string pFields, string pDelim) : 
   m_accountName(pAccountName)
 {
+  m_sealed = false;
+  m_hasPayload = false;
   if (pDelim == "*") {
     //whooo.. did you really have to choose this one?
     if (log)
@@ -73,6 +139,7 @@ ARecord::ARecord(string pAccountName, string pFields, string pDelim) :
   if(str.length() > 0) {
     m_fields.push_back(make_pair(str, string("")));
   }  
+  UpdateSearchText();
 }
 
 void ARecord::SetAccountName(string pAccountName)
@@ -83,9 +150,11 @@ void ARecord::SetAccountName(string pAccountName)
     return;
   }
   //does not allow empty names
-  if (!pAccountName.empty())
+  if (!pAccountName.empty()) {
     m_accountName = pAccountName;
-  else {
+    m_foldedName = CSMUtils::FoldCase(m_accountName);
+    m_nameSortKey = CSMUtils::CollationKey(m_accountName);
+  } else {
     string msgWarning;
     msgWarning = "Tried to set null name to ARecord ";
     msgWarning += m_accountName;
@@ -118,8 +187,15 @@ void ARecord::AddField(string pTitle, string &pContent)
       log->say(ILog::ERROR, string("Tried to add field of a locked ARecord ") + m_accountName, "ARecord");
     return;
   }
-  if (!title.empty())
+  if (!title.empty()) {
+    //the record must not be sealed meanwhile
+    unique_lock<recursive_mutex> lock;
+    if (s_sealer)
+      lock = unique_lock<recursive_mutex>(s_sealer->GetMutex());
+    OpenFields();
     m_fields.push_back( make_pair(title, content));
+    AppendFoldedField(m_foldedFields, title, content);
+  }
   else
     if (log)
       log->say(ILog::WARNING, string("Trying to add empty element to ARecord") + m_accountName, "ARecord");
@@ -134,6 +210,11 @@ void ARecord::EraseFields()
       log->say(ILog::ERROR, string("Tried to change account name of locked ARecord ") + m_accountName, "ARecord");
   } else {
     m_fields.clear();
+    m_sealed = false;
+    m_foldedFields.clear();
+    m_payload.clear();
+    m_payloadOpener.reset();
+    m_hasPayload = false;
   }
 }
 
@@ -146,6 +227,7 @@ void ARecord::EraseField(string pTitle)
       log->say(ILog::ERROR, string("Tried to change account name of locked ARecord ") + m_accountName, "ARecord");
     return;
   }
+  OpenFields();
   TFieldsIterator recordToDelete;
   for (recordToDelete = m_fields.begin(); recordToDelete != m_fields.end(); ++recordToDelete) {
     if (recordToDelete->first == pTitle) {
@@ -154,23 +236,27 @@ void ARecord::EraseField(string pTitle)
       m_fields.erase(recordToDelete);
     }
   }
+  FoldFields();
 }
 
 void ARecord::EraseField(TFieldsIterator pField)
 {
-  m_fields.erase(pField);
   if (log)
     log->say(ILog::DEBUG, string("Erased field: ") + pField->first, "ARecord");
+  m_fields.erase(pField);
+  FoldFields();
 }
 
 
 ARecord::TFieldsIterator ARecord::GetFieldsIterBegin()
 {
+  OpenFields();
   return m_fields.begin();
 }
 
 ARecord::TFieldsIterator ARecord::GetFieldsIterEnd()
 {
+  OpenFields();
   return m_fields.end();
 }
 
@@ -180,16 +266,257 @@ string ARecord::GetField(string pTitle)
   if (log)
     log->say(ILog::DEBUG, string("Requesting field'")+pTitle+string("' of record:")+ m_accountName,"ARecord");
   TFieldsIterator recordToFind;
-  for (recordToFind = m_fields.begin(); recordToFind != m_fields.end(); ++recordToFind)
-    if (recordToFind->first == pTitle)
-      return recordToFind->second;
+  if (s_sealer) {
+    //copy the content before anybody else can seal it again
+    lock_guard<recursive_mutex> lock(s_sealer->GetMutex());
+    OpenFields();
+    for (recordToFind = m_fields.begin(); recordToFind != m_fields.end(); ++recordToFind)
+      if (recordToFind->first == pTitle)
+	return recordToFind->second;
+  } else {
+    OpenFields();
+    for (recordToFind = m_fields.begin(); recordToFind != m_fields.end(); ++recordToFind)
+      if (recordToFind->first == pTitle)
+	return recordToFind->second;
+  }
   if (log)
     log->say(ILog::WARNING, string("Field ") + pTitle + string(" not found in ARecord ") + m_accountName, "ARecord");
   return string(""); // Field not found
 }
 
+void ARecord::OpenFields()
+{
+  if (!s_sealer) {
+    if (m_hasPayload) {
+      //the same record can be searched by several threads: only one decodes it
+      lock_guard<mutex> lock(s_payloadMutex);
+      if (m_hasPayload)
+	LoadPayload();
+    }
+    return;
+  }
+  lock_guard<recursive_mutex> lock(s_sealer->GetMutex());
+  if (m_hasPayload) {
+    LoadPayload();
+  } else if (m_sealed) {
+    for (TFieldsIterator itf = m_fields.begin(); itf != m_fields.end(); ++itf) {
+      string content;
+      if (not s_sealer->Open(itf->second, itf->first, content)) {
+	if (log)
+	  log->say(ILog::ERROR, string("Cannot open sealed field ") + itf->first + string(" of record ") + m_accountName, "ARecord");
+	content.clear();
+      }
+      itf->second.swap(content);
+    }
+    m_sealed = false;
+  }
+  if (not s_sealingDeferred)
+    s_sealer->Touch(this);
+}
+
+void ARecord::SealFields()
+{
+  if (!s_sealer)
+    return;
+  lock_guard<recursive_mutex> lock(s_sealer->GetMutex());
+  if (m_sealed || s_sealer->IsPinned(this))
+    return; //pinned: fields are being iterated
+  for (TFieldsIterator itf = m_fields.begin(); itf != m_fields.end(); ++itf) {
+    string sealed = s_sealer->Seal(itf->second, itf->first);
+    std::fill(itf->second.begin(), itf->second.end(), '\0');
+    itf->second.swap(sealed);
+  }
+  m_sealed = true;
+  s_sealer->Forget(this);
+}
+
+bool ARecord::IsSealed()
+{
+  return m_sealed;
+}
+
+void ARecord::SetSealer(RecordSealer *pSealer)
+{
+  s_sealer = pSealer;
+}
+
+RecordSealer *ARecord::GetSealer()
+{
+  return s_sealer;
+}
+
+ARecord::SealingDeferral::SealingDeferral()
+{
+  s_sealingDeferred = true;
+}
+
+ARecord::SealingDeferral::~SealingDeferral()
+{
+  s_sealingDeferred = false;
+}
+
+ARecord::FieldsPin::FieldsPin(ARecord *pRecord) : m_record(pRecord)
+{
+  if (!s_sealer) {
+    m_record->OpenFields();
+    return;
+  }
+  //opened and pinned at once: no other thread can seal it in between
+  lock_guard<recursive_mutex> lock(s_sealer->GetMutex());
+  m_record->OpenFields();
+  s_sealer->Pin(m_record);
+}
+
+ARecord::FieldsPin::~FieldsPin()
+{
+  if (s_sealer)
+    s_sealer->Unpin(m_record);
+}
+
+void ARecord::LoadPayload()
+{
+  TFieldsType fields;
+  if (not m_payloadOpener || not m_payloadOpener->Open(m_payload, m_uuid, fields)) {
+    //keep the payload, so that it is written back unchanged
+    if (log)
+      log->say(ILog::ERROR, string("Cannot load fields of record ") + m_accountName, "ARecord");
+    return;
+  }
+  if (not m_sealed)
+    for (TFieldsIterator itf = m_fields.begin(); itf != m_fields.end(); ++itf)
+      std::fill(itf->second.begin(), itf->second.end(), '\0');
+  m_fields.swap(fields);
+  m_sealed = false;
+  m_payload.clear();
+  m_payloadOpener.reset();
+  FoldFields();
+  m_hasPayload = false; //fields are ready for the other threads
+}
+
+void ARecord::SetPayload(const string &pPayload, shared_ptr<PayloadOpener> pOpener)
+{
+  if (not m_sealed)
+    for (TFieldsIterator itf = m_fields.begin(); itf != m_fields.end(); ++itf)
+      std::fill(itf->second.begin(), itf->second.end(), '\0');
+  m_fields.clear();
+  m_sealed = false;
+  m_payload = pPayload;
+  m_payloadOpener = pOpener;
+  m_hasPayload = not m_payload.empty();
+  FoldFields();
+}
+
+bool ARecord::HasPayload()
+{
+  return m_hasPayload;
+}
+
+const string &ARecord::GetPayload()
+{
+  return m_payload;
+}
+
+shared_ptr<ARecord::PayloadOpener> ARecord::GetPayloadOpener()
+{
+  return m_payloadOpener;
+}
+
+void ARecord::FoldLabels()
+{
+  FoldLabels(m_foldedLabels);
+}
+
+void ARecord::FoldLabels(string &pFolded) const
+{
+  pFolded.clear();
+  for (TLabelsType::const_iterator itl = m_labels.begin(); itl != m_labels.end(); ++itl) {
+    if (itl != m_labels.begin())
+      pFolded += '\n';
+    pFolded += CSMUtils::FoldCase(*itl);
+  }
+}
+
+void ARecord::AppendFoldedField(string &pFolded, const string &pTitle, const string &pContent)
+{
+  if (s_sealer)
+    return; //would be a clear copy of sealed values
+  if (not pFolded.empty())
+    pFolded += '\n';
+  pFolded += CSMUtils::FoldCase(pTitle);
+  pFolded += '\n';
+  pFolded += CSMUtils::FoldCase(pContent);
+}
+
+void ARecord::FoldFields()
+{
+  FoldFields(m_foldedFields);
+}
+
+void ARecord::FoldFields(string &pFolded) const
+{
+  std::fill(pFolded.begin(), pFolded.end(), '\0');
+  pFolded.clear();
+  if (s_sealer)
+    return;
+  for (TFieldsType::const_iterator itf = m_fields.begin(); itf != m_fields.end(); ++itf)
+    AppendFoldedField(pFolded, itf->first, itf->second);
+}
+
+void ARecord::UpdateSearchText()
+{
+  //only replace the texts which changed: unchanged records may be searched by other threads (see RecordSnapshot)
+  string folded = CSMUtils::FoldCase(m_accountName);
+  if (folded != m_foldedName) {
+    m_foldedName.swap(folded);
+    m_nameSortKey = CSMUtils::CollationKey(m_accountName);
+  }
+  FoldLabels(folded);
+  if (folded != m_foldedLabels)
+    m_foldedLabels.swap(folded);
+  FoldFields(folded);
+  if (folded != m_foldedFields)
+    m_foldedFields.swap(folded);
+  std::fill(folded.begin(), folded.end(), '\0');
+}
+
+const string &ARecord::GetFoldedName()
+{
+  return m_foldedName;
+}
+
+const string &ARecord::GetNameSortKey()
+{
+  return m_nameSortKey;
+}
+
+const string &ARecord::GetFoldedLabels()
+{
+  return m_foldedLabels;
+}
+
+const string &ARecord::GetFoldedFields(string &pBuffer)
+{
+  if (not s_sealer) {
+    OpenFields();
+    return m_foldedFields;
+  }
+  //values are sealed: fold them now, without keeping a copy
+  string &folded = pBuffer;
+  folded.clear();
+  FieldsPin pin(this); //other searches are not blocked meanwhile
+  for (TFieldsIterator itf = m_fields.begin(); itf != m_fields.end(); ++itf) {
+    if (not folded.empty())
+      folded += '\n';
+    folded += CSMUtils::FoldCase(itf->first);
+    folded += '\n';
+    folded += CSMUtils::FoldCase(itf->second);
+  }
+  return folded;
+}
+
 vector<string> ARecord::GetFieldNameList()
 {
+  OpenFields();
   vector<string> rList;
   for (TFieldsIterator its = m_fields.begin(); its != m_fields.end(); ++its) 
     rList.push_back(its->first);
@@ -198,11 +525,13 @@ vector<string> ARecord::GetFieldNameList()
 
 size_t ARecord::GetNumberOfFields()
 {
+  OpenFields();
   return m_fields.size();
 }
 
 bool ARecord::HasField(std::string pTitle)
 {
+  OpenFields();
   for (TFieldsIterator its = m_fields.begin(); its != m_fields.end(); ++its) 
     if (its->first == pTitle)
       return true;
@@ -232,9 +561,10 @@ void ARecord::AddLabel(string pLabel)
       log->say(ILog::ERROR, string("Tried to change account name of locked ARecord ") + m_accountName, "ARecord");
     return;
   }
-  if (!lab.empty()) 
+  if (!lab.empty()) {
     m_labels.push_back(lab);
-  else 
+    FoldLabels();
+  } else 
     if (log)
       log->say(ILog::WARNING, "Tried to add an empty label to ARecord object.", "ARecord");
 }
@@ -249,10 +579,11 @@ void ARecord::ClearLabels()
   } else {
     //delete list of labels
     m_labels.clear();
+    m_foldedLabels.clear();
   }
 }
 
-vector<string> ARecord::GetLabels()
+const vector<string> &ARecord::GetLabels()
 {
   return m_labels;
 }
@@ -297,6 +628,7 @@ void ARecord::AddEssential(string pEssential, bool pForce)
 	m_essentials.push_back(ess);    
 	return;
     }
+    OpenFields();
     for (TFieldsIterator itf = m_fields.begin(); itf != m_fields.end(); ++itf)
       if (itf->first == ess) {
 	m_essentials.push_back(ess);    
@@ -364,6 +696,44 @@ unsigned long ARecord::GetAccountId()
   return m_accountId;
 }
 
+int ARecord::SetUUID(string pUUID)
+{
+  if (GetLockStatus() != UNLOCKED) {
+    if (log)
+      log->say(ILog::ERROR, string("Tried to change UUID of locked ARecord ") + m_accountName, "ARecord");
+    return 1;
+  }
+  if (not IsValidUUID(pUUID)) {
+    if (log)
+      log->say(ILog::ERROR, string("UUID not valid for ARecord ") + m_accountName + ": " + pUUID, "ARecord");
+    return 1;
+  }
+  //the payload was written for the previous UUID
+  if (m_hasPayload)
+    OpenFields();
+  m_uuid = pUUID;
+  return 0;
+}
+
+const string &ARecord::GetUUID()
+{
+  return m_uuid;
+}
+
+bool ARecord::IsValidUUID(const string &pUUID)
+{
+  if (pUUID.size() != 36)
+    return false;
+  for (size_t pos=0; pos < pUUID.size(); pos++) {
+    if (pos == 8 || pos == 13 || pos == 18 || pos == 23) {
+      if (pUUID[pos] != '-')
+	return false;
+    } else if (not ((pUUID[pos] >= '0' && pUUID[pos] <= '9') || (pUUID[pos] >= 'a' && pUUID[pos] <= 'f')))
+      return false;
+  }
+  return true;
+}
+
 ARecord::LockStatus ARecord::SetLock(LockStatus pLock)
 {
   if (pLock >= UNLOCKED && pLock < NLOCKSTATES)
@@ -13,9 +13,13 @@
 
 class IIOService;
 class SingleSourceIOSvc;
+class RecordSealer;
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
 #include <time.h>
 
 /** Define the basic data model for an account record.
@@ -31,10 +35,31 @@ class ARecord {
   std::vector<std::pair<std::string, std::string> >m_fields; ///< Informations associated with the record, in the form of <Title, Content>
   std::vector<std::string> m_labels; ///< Labels associated to this record
   std::vector<std::string> m_essentials; ///< Store list of m_fields.first which are marked as essentials
+  std::string m_uuid; ///< Identifier of the record which never changes, as text (RFC 4122 version 4). Empty until added to a source
 
   // --- Data-Model fields -- these are the transient members
   unsigned long m_accountId; ///< Stores unique account ID to be eventually used by IIOService for identification
 
+  // --- Case-folded copies of the searchable text (see CSMUtils::FoldCase), kept up-to-date by the modifiers
+  std::string m_foldedName; ///< m_accountName
+  std::string m_foldedLabels; ///< m_labels, one per line
+  std::string m_foldedFields; ///< field names and values, one per line (empty when values are sealed)
+  std::string m_nameSortKey; ///< collation key of m_accountName, used to sort records by name
+  void FoldLabels(); ///< update m_foldedLabels
+  void FoldFields(); ///< update m_foldedFields
+  void FoldLabels(std::string &pFolded) const; ///< case-folded m_labels into pFolded
+  void FoldFields(std::string &pFolded) const; ///< case-folded m_fields into pFolded
+  static void AppendFoldedField(std::string &pFolded, const std::string &pTitle, const std::string &pContent); ///< add a field to pFolded
+
+  // --- Sealing of field values in memory
+  bool m_sealed; ///< m_fields contents are sealed by s_sealer
+  static RecordSealer *s_sealer; ///< if set, field contents are kept sealed when not in use
+  static thread_local bool s_sealingDeferred; ///< records of this thread are not registered with s_sealer (see SealingDeferral)
+  /** Open field contents (if sealed) and mark the record as recently used.
+   * Called by all the accessors of field contents.
+   */
+  void OpenFields();
+
  public:
   //Public type reference
   typedef std::vector<std::pair<std::string, std::string> > TFieldsType;
@@ -44,6 +69,30 @@ class ARecord {
   typedef std::vector<std::string> TEssentialsType;
   typedef std::vector<std::string>::iterator TEssentialsIterator;
 
+  /** Decodes the field contents of records loaded without them (see SetPayload()).
+   * Implemented by the formatter which read the record, e.g. FormatterTieredTool.
+   */
+  class PayloadOpener {
+  public:
+    virtual ~PayloadOpener() {}
+    /** Decode a payload.
+     * @param pPayload payload, as given to SetPayload()
+     * @param pUUID UUID of the record, the payload may be bound to it
+     * @param pFields decoded fields
+     * @return false if the payload cannot be decoded
+     */
+    virtual bool Open(const std::string &pPayload, const std::string &pUUID, TFieldsType &pFields) = 0;
+  };
+
+ protected:
+  // --- Field contents not loaded yet
+  std::string m_payload; ///< encoded field contents, empty once loaded
+  std::shared_ptr<PayloadOpener> m_payloadOpener; ///< decodes m_payload
+  std::atomic<bool> m_hasPayload; ///< m_payload is not loaded yet (checked without locks)
+  static std::mutex s_payloadMutex; ///< serializes LoadPayload() of records searched by several threads
+  /// Decode m_payload into m_fields, called on the first access to the fields
+  void LoadPayload();
+
   // --- Locking of data values
  public:  
 
@@ -81,6 +130,7 @@ class ARecord {
    * Create a copy of the record. The new record is not locked!
    */
   ARecord(const ARecord& pARecord); ///< define a copy constructor to unlock the copied object data
+  ARecord &operator=(const ARecord& pARecord); ///< copy all data, as it is (m_hasPayload is not copyable), open records registered with the sealer
 
   /** init record with name and fields.
    * Create a new ARecord object and fills name and list of fields from a pDelim-separated string
@@ -107,18 +157,77 @@ class ARecord {
   void EraseFields(); ///< Erase all the content of m_fields
   void EraseField(std::string pTitle); ///< erase elements with title pTitle from m_fields
   void EraseField(TFieldsIterator pField); ///< erase elements 
-  TFieldsIterator GetFieldsIterBegin(); ///< Return iterator for m_fields at the begin of the map
+  /// Return iterator for m_fields at the begin of the map. Keep a FieldsPin while iterating, if records are sealed.
+  TFieldsIterator GetFieldsIterBegin();
   TFieldsIterator GetFieldsIterEnd(); ///<  Return iterator for m_fields at the end of the map
   std::string GetField(std::string pTitle); ///< Get Content of m_fields element with key pTitle
   std::vector<std::string> GetFieldNameList(); ///< return a list of field names stored in ARecord::m_fields
   size_t GetNumberOfFields(); ///< return the number of fields
   bool HasField(std::string pTitle); ///< returns if field pTitle exists
 
+  // case-folded text, used by case-insensitive searches
+  /** Update the case-folded copies of the searchable text.
+   * Called by all modifiers; to be called after changing field values through field iterators.
+   */
+  void UpdateSearchText();
+  const std::string &GetFoldedName(); ///< case-folded account name
+  const std::string &GetNameSortKey(); ///< collation key of the account name (see CSMUtils::CollationKey)
+  const std::string &GetFoldedLabels(); ///< case-folded labels, one per line
+  /** case-folded field names and values, one per line.
+   * If values are sealed, the text is computed in pBuffer (to be wiped by the caller), which is returned.
+   */
+  const std::string &GetFoldedFields(std::string &pBuffer);
+
+  // sealing of m_fields contents
+  /** Seal field contents in memory.
+   * Called by the RecordSealer when the record is the least recently used one.
+   * Field names, labels and essentials are not sealed.
+   */
+  void SealFields();
+  bool IsSealed(); ///< true if field contents are currently sealed
+  /** Set the tool used to keep field contents sealed when not in use (0: disable sealing).
+   * It must be set before any record is created and outlive all records.
+   */
+  static void SetSealer(RecordSealer *pSealer);
+  static RecordSealer *GetSealer(); ///< see s_sealer
+  /** While it exists, records built by the calling thread are not registered as open with the sealer.
+   * Other threads sealing their least recently used records cannot then seal them while they are changed:
+   * used to decode sources concurrently. Their owner seals them afterwards (SealFields()).
+   */
+  class SealingDeferral {
+  public:
+    SealingDeferral();
+    ~SealingDeferral();
+  };
+  /** While it exists, field contents of a record stay open: they are not sealed, even by other threads.
+   * To be kept while iterating the fields (GetFieldsIterBegin()), so that values read or written through
+   * the iterators are the plain ones. Pins should be short-lived: they can keep more records open than
+   * the capacity of the sealer.
+   */
+  class FieldsPin {
+    ARecord *m_record;
+    FieldsPin(const FieldsPin&);
+    FieldsPin &operator=(const FieldsPin&);
+  public:
+    FieldsPin(ARecord *pRecord);
+    ~FieldsPin();
+  };
+
+  // loading of m_fields on demand
+  /** Set the encoded fields of the record, decoded by pOpener the first time they are used.
+   * Used by formatters which load records without decoding their fields (see FormatterTieredTool).
+   * Current fields are replaced.
+   */
+  void SetPayload(const std::string &pPayload, std::shared_ptr<PayloadOpener> pOpener);
+  bool HasPayload(); ///< true while the fields set by SetPayload() are not loaded
+  const std::string &GetPayload(); ///< encoded fields, empty once loaded
+  std::shared_ptr<PayloadOpener> GetPayloadOpener(); ///< tool decoding GetPayload()
+
   // m_labels
   void AddLabels(std::vector<std::string> pLabels); ///< Append to m_labels
   void AddLabel(std::string pLabel); ///< add single label to the list m_labels
   void ClearLabels(); ///< clear m_labels list
-  std::vector<std::string> GetLabels(); ///< get all m_labels list
+  const std::vector<std::string> &GetLabels(); ///< get all m_labels list
   TLabelsIterator GetLabelsIterBegin(); ///< Return iterator for m_labels at the begin of the vector
   TLabelsIterator GetLabelsIterEnd(); ///< Return iterator for m_labels at the end of the vector
   bool HasLabel(std::string pLabel); ///< check if this ARecord has pLabel set
@@ -136,6 +245,16 @@ class ARecord {
   void SetAccountId(unsigned long pAccountId); ///< set m_accountId
   unsigned long GetAccountId(); ///< Get m_accountId
 
+  // m_uuid
+  /** Set the UUID of the record.
+   * Validates input as well (see IsValidUUID()).
+   * @return zero on success
+   */
+  int SetUUID(std::string pUUID);
+  const std::string &GetUUID(); ///< Get m_uuid, empty if not assigned yet
+  /// check pUUID is a UUID as text, lower-case: xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx
+  static bool IsValidUUID(const std::string &pUUID);
+
   // creation/modification time
   /** Set creation (and last modification) time. 
    * Validates input as well.
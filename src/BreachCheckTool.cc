@@ -0,0 +1,559 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: BreachCheckTool.cc
+ Description: Offline check of passwords against a corpus of breached password hashes
+ Last Modified: $Id$
+*/
+
+#include "BreachCheckTool.h"
+
+#include "ILog.h"
+
+#include <fstream>
+#include <algorithm>
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern ILog *log;
+
+using namespace std;
+
+static const char FILTER_MAGIC[8] = {'C','S','M','B','L','O','O','M'};
+static const char FENCE_MAGIC[8] = {'C','S','M','F','E','N','C','1'};
+static const size_t LINEAR_SCAN_BYTES = 4096; ///< below this range size, lines are simply scanned
+static const int MAX_INTERPOLATION_PROBES = 3; ///< then fall back to bisection
+
+// ----------------------------------------
+// Helpers
+// ----------------------------------------
+
+static inline int HexValue(char pCh)
+{
+  if (pCh >= '0' && pCh <= '9') return pCh - '0';
+  if (pCh >= 'A' && pCh <= 'F') return pCh - 'A' + 10;
+  if (pCh >= 'a' && pCh <= 'f') return pCh - 'a' + 10;
+  return -1;
+}
+
+/// First 64 bits of an hex string (missing or invalid digits are taken as 0)
+static uint64_t HexKey(const char *pHex, size_t pMaxLen)
+{
+  uint64_t key = 0;
+  for (size_t k=0; k < 16; k++) {
+    int v = (k < pMaxLen) ? HexValue(pHex[k]) : -1;
+    key = (key << 4) | (v < 0 ? 0 : v);
+  }
+  return key;
+}
+
+static inline uint32_t Rol(uint32_t pX, int pN)
+{
+  return (pX << pN) | (pX >> (32 - pN));
+}
+
+/// Merkle-Damgard padding shared by SHA-1 (big-endian length) and MD4 (little-endian length)
+static string PadMessage(const string &pStr, bool pBigEndian)
+{
+  string msg(pStr);
+  msg += (char)0x80;
+  while (msg.size() % 64 != 56)
+    msg += (char)0;
+  uint64_t bitLength = (uint64_t)pStr.size() * 8;
+  for (int k=0; k < 8; k++)
+    msg += (char)(bitLength >> (8 * (pBigEndian ? 7 - k : k)));
+  return msg;
+}
+
+// ----------------------------------------
+// Hash functions
+// ----------------------------------------
+
+string BreachCheckTool::Sha1(const string &pStr)
+{
+  uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  string msg = PadMessage(pStr, true);
+  uint32_t w[80];
+  for (size_t block = 0; block < msg.size(); block += 64) {
+    for (int t=0; t < 16; t++)
+      w[t] = ((uint32_t)(unsigned char)msg[block + 4*t] << 24) | ((uint32_t)(unsigned char)msg[block + 4*t + 1] << 16) |
+	((uint32_t)(unsigned char)msg[block + 4*t + 2] << 8) | (uint32_t)(unsigned char)msg[block + 4*t + 3];
+    for (int t=16; t < 80; t++)
+      w[t] = Rol(w[t-3] ^ w[t-8] ^ w[t-14] ^ w[t-16], 1);
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int t=0; t < 80; t++) {
+      uint32_t f, k;
+      if (t < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+      else if (t < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+      else if (t < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+      else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+      uint32_t temp = Rol(a, 5) + f + e + k + w[t];
+      e = d;
+      d = c;
+      c = Rol(b, 30);
+      b = a;
+      a = temp;
+    }
+    h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+  }
+  string digest(20, '\0');
+  for (int k=0; k < 20; k++)
+    digest[k] = (char)(h[k/4] >> (24 - 8 * (k % 4)));
+  //wipe intermediate copies of the password
+  std::fill(msg.begin(), msg.end(), '\0');
+  std::fill(w, w + 80, 0);
+  return digest;
+}
+
+string BreachCheckTool::Ntlm(const string &pStr)
+{
+  // - UTF-8 to UTF-16LE (invalid bytes are taken as Latin-1)
+  string utf16;
+  utf16.reserve(pStr.size() * 2);
+  for (size_t k=0; k < pStr.size(); ) {
+    unsigned char c = pStr[k];
+    uint32_t cp = c;
+    size_t len = 1;
+    if (c >= 0xC0 && c < 0xE0) len = 2;
+    else if (c >= 0xE0 && c < 0xF0) len = 3;
+    else if (c >= 0xF0 && c < 0xF8) len = 4;
+    if (len > 1 && k + len <= pStr.size()) {
+      cp = c & (0xFF >> (len + 1));
+      for (size_t n=1; n < len; n++) {
+	if ((pStr[k+n] & 0xC0) != 0x80) {
+	  len = 1;
+	  cp = c;
+	  break;
+	}
+	cp = (cp << 6) | (pStr[k+n] & 0x3F);
+      }
+    } else {
+      len = 1;
+    }
+    k += len;
+    if (cp >= 0x10000) {
+      cp -= 0x10000;
+      uint32_t hi = 0xD800 + (cp >> 10), lo = 0xDC00 + (cp & 0x3FF);
+      utf16 += (char)(hi & 0xFF); utf16 += (char)(hi >> 8);
+      utf16 += (char)(lo & 0xFF); utf16 += (char)(lo >> 8);
+    } else {
+      utf16 += (char)(cp & 0xFF); utf16 += (char)(cp >> 8);
+    }
+  }
+
+  // - MD4
+  uint32_t h[4] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476 };
+  string msg = PadMessage(utf16, false);
+  std::fill(utf16.begin(), utf16.end(), '\0');
+  static const int order2[16] = { 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15 };
+  static const int order3[16] = { 0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15 };
+  static const int shift1[4] = { 3, 7, 11, 19 };
+  static const int shift2[4] = { 3, 5, 9, 13 };
+  static const int shift3[4] = { 3, 9, 11, 15 };
+  uint32_t x[16];
+  for (size_t block = 0; block < msg.size(); block += 64) {
+    for (int t=0; t < 16; t++)
+      x[t] = (uint32_t)(unsigned char)msg[block + 4*t] | ((uint32_t)(unsigned char)msg[block + 4*t + 1] << 8) |
+	((uint32_t)(unsigned char)msg[block + 4*t + 2] << 16) | ((uint32_t)(unsigned char)msg[block + 4*t + 3] << 24);
+    uint32_t v[4] = { h[0], h[1], h[2], h[3] };
+    // each step updates one of the four words, in the order A, D, C, B
+    for (int i=0; i < 16; i++) {
+      uint32_t &a = v[(16-i)%4], b = v[(17-i)%4], c = v[(18-i)%4], d = v[(19-i)%4];
+      a = Rol(a + ((b & c) | (~b & d)) + x[i], shift1[i%4]);
+    }
+    for (int i=0; i < 16; i++) {
+      uint32_t &a = v[(16-i)%4], b = v[(17-i)%4], c = v[(18-i)%4], d = v[(19-i)%4];
+      a = Rol(a + ((b & c) | (b & d) | (c & d)) + x[order2[i]] + 0x5A827999, shift2[i%4]);
+    }
+    for (int i=0; i < 16; i++) {
+      uint32_t &a = v[(16-i)%4], b = v[(17-i)%4], c = v[(18-i)%4], d = v[(19-i)%4];
+      a = Rol(a + (b ^ c ^ d) + x[order3[i]] + 0x6ED9EBA1, shift3[i%4]);
+    }
+    for (int k=0; k < 4; k++)
+      h[k] += v[k];
+  }
+  string digest(16, '\0');
+  for (int k=0; k < 16; k++)
+    digest[k] = (char)(h[k/4] >> (8 * (k % 4)));
+  std::fill(msg.begin(), msg.end(), '\0');
+  std::fill(x, x + 16, 0);
+  return digest;
+}
+
+string BreachCheckTool::Hash(const string &pStr, HashType pType)
+{
+  if (pType == HASH_NTLM)
+    return Ntlm(pStr);
+  return Sha1(pStr);
+}
+
+string BreachCheckTool::ToHex(const string &pDigest)
+{
+  static const char hexDigits[] = "0123456789ABCDEF";
+  string hex(pDigest.size() * 2, '0');
+  for (size_t k=0; k < pDigest.size(); k++) {
+    hex[2*k] = hexDigits[(unsigned char)pDigest[k] >> 4];
+    hex[2*k + 1] = hexDigits[(unsigned char)pDigest[k] & 0xF];
+  }
+  return hex;
+}
+
+// ----------------------------------------
+// BreachCheckTool
+// ----------------------------------------
+
+BreachCheckTool::BreachCheckTool(string pName) : IErrorHandler(pName)
+{
+  m_corpusMap = 0;
+  m_corpusSize = 0;
+  m_corpusType = HASH_SHA1;
+  m_hexLength = 40;
+  m_filterMap = 0;
+  m_filterSize = 0;
+  m_filterHeader = 0;
+  m_filterBits = 0;
+}
+
+BreachCheckTool::~BreachCheckTool()
+{
+  FreeCorpus();
+  FreeFilter();
+}
+
+void BreachCheckTool::FreeCorpus()
+{
+  if (m_corpusMap)
+    munmap(const_cast<char*>(m_corpusMap), m_corpusSize);
+  m_corpusMap = 0;
+  m_corpusSize = 0;
+  m_fence.clear();
+}
+
+void BreachCheckTool::FreeFilter()
+{
+  if (m_filterMap)
+    munmap(const_cast<char*>(m_filterMap), m_filterSize);
+  m_filterMap = 0;
+  m_filterSize = 0;
+  m_filterHeader = 0;
+  m_filterBits = 0;
+}
+
+bool BreachCheckTool::IsReady() const
+{
+  return (m_corpusMap != 0 || m_filterMap != 0);
+}
+
+size_t BreachCheckTool::NextLine(size_t pPos) const
+{
+  if (pPos == 0)
+    return 0;
+  if (pPos >= m_corpusSize)
+    return m_corpusSize;
+  const char *newLine = static_cast<const char*>(memchr(m_corpusMap + pPos - 1, '\n', m_corpusSize - pPos + 1));
+  return newLine ? (newLine - m_corpusMap + 1) : m_corpusSize;
+}
+
+uint64_t BreachCheckTool::LineKey(size_t pPos) const
+{
+  if (pPos >= m_corpusSize)
+    return ~(uint64_t)0;
+  return HexKey(m_corpusMap + pPos, min(m_hexLength, m_corpusSize - pPos));
+}
+
+int BreachCheckTool::CompareLine(size_t pPos, const string &pHex) const
+{
+  for (size_t k=0; k < m_hexLength; k++) {
+    if (pPos + k >= m_corpusSize)
+      return -1;
+    int diff = toupper((unsigned char)m_corpusMap[pPos + k]) - (unsigned char)pHex[k];
+    if (diff != 0)
+      return diff;
+  }
+  return 0;
+}
+
+size_t BreachCheckTool::LowerBound(const string &pHex, size_t pLo, size_t pHi, uint64_t pLoKey, uint64_t pHiKey) const
+{
+  uint64_t key = HexKey(pHex.c_str(), pHex.size());
+  int probes = 0;
+  while (pHi - pLo > LINEAR_SCAN_BYTES) {
+    // guess the position assuming uniformly distributed hashes, then bisect
+    size_t pos;
+    if (probes < MAX_INTERPOLATION_PROBES && pHiKey > pLoKey && key >= pLoKey && key <= pHiKey)
+      pos = pLo + (size_t)((long double)(key - pLoKey) / (long double)(pHiKey - pLoKey) * (pHi - pLo));
+    else
+      pos = pLo + (pHi - pLo) / 2;
+    probes++;
+    pos = max(pos, pLo + 1);
+    pos = min(pos, pHi - 1);
+    size_t mid = NextLine(pos);
+    if (mid >= pHi) {
+      mid = NextLine(pLo + (pHi - pLo) / 2);
+      if (mid >= pHi)
+	break; //very long lines: scan them
+    }
+    if (CompareLine(mid, pHex) < 0) {
+      pLo = mid;
+      pLoKey = LineKey(mid);
+    } else {
+      pHi = mid;
+      pHiKey = LineKey(mid);
+    }
+  }
+  while (pLo < pHi && CompareLine(pLo, pHex) < 0)
+    pLo = NextLine(pLo + 1);
+  return min(pLo, pHi);
+}
+
+IErrorHandler::StatusCode BreachCheckTool::LoadCorpus(string pFileName)
+{
+  FreeCorpus();
+  if (pFileName.empty())
+    return m_statusCode = SC_OK;
+  int fd = open(pFileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    *log << ILog::ERROR << "Cannot open breach corpus: " << pFileName << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+    *log << ILog::ERROR << "Invalid breach corpus: " << pFileName << this << ILog::endmsg;
+    close(fd);
+    return m_statusCode = SC_ERROR;
+  }
+  void *map = mmap(0, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    *log << ILog::ERROR << "Cannot map breach corpus: " << pFileName << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  m_corpusMap = static_cast<const char*>(map);
+  m_corpusSize = fileStat.st_size;
+  madvise(map, m_corpusSize, MADV_RANDOM); //lookups touch a few pages each
+
+  // - detect hash type from the first line
+  size_t hexLength = 0;
+  while (hexLength < m_corpusSize && HexValue(m_corpusMap[hexLength]) >= 0)
+    hexLength++;
+  if (hexLength == 40) {
+    m_corpusType = HASH_SHA1;
+  } else if (hexLength == 32) {
+    m_corpusType = HASH_NTLM;
+  } else {
+    *log << ILog::ERROR << "Unknown hash type in breach corpus (SHA-1 or NTLM expected): " << pFileName << this << ILog::endmsg;
+    FreeCorpus();
+    return m_statusCode = SC_ERROR;
+  }
+  m_hexLength = hexLength;
+
+  // - fence index: reuse the cached one if still valid, otherwise build and cache it
+  size_t nFence = ((size_t)1 << FENCE_BITS) + 1;
+  string fenceFile = pFileName + ".fence";
+  ifstream fenceIn(fenceFile.c_str(), ios::binary);
+  if (fenceIn.is_open()) {
+    char magic[8];
+    uint64_t cachedSize = 0;
+    int64_t cachedTime = 0;
+    fenceIn.read(magic, sizeof(magic));
+    fenceIn.read(reinterpret_cast<char*>(&cachedSize), sizeof(cachedSize));
+    fenceIn.read(reinterpret_cast<char*>(&cachedTime), sizeof(cachedTime));
+    if (fenceIn.good() && memcmp(magic, FENCE_MAGIC, sizeof(magic)) == 0 &&
+	cachedSize == m_corpusSize && cachedTime == (int64_t)fileStat.st_mtime) {
+      vector<uint64_t> offsets(nFence);
+      fenceIn.read(reinterpret_cast<char*>(&offsets[0]), nFence * sizeof(uint64_t));
+      if (fenceIn.good() && offsets.back() == m_corpusSize)
+	m_fence.assign(offsets.begin(), offsets.end());
+    }
+  }
+  if (m_fence.empty()) {
+    *log << ILog::INFO << "Building fence index of breach corpus " << pFileName << this << ILog::endmsg;
+    m_fence.resize(nFence);
+    m_fence[0] = 0;
+    m_fence[nFence - 1] = m_corpusSize;
+    for (size_t b=1; b < nFence - 1; b++) {
+      uint64_t prefix = (uint64_t)b << (64 - FENCE_BITS);
+      char prefixHex[17];
+      snprintf(prefixHex, sizeof(prefixHex), "%016llX", (unsigned long long)prefix);
+      string target = string(prefixHex) + string(m_hexLength - 16, '0');
+      m_fence[b] = LowerBound(target, m_fence[b-1], m_corpusSize, LineKey(m_fence[b-1]), ~(uint64_t)0);
+    }
+    vector<uint64_t> offsets(m_fence.begin(), m_fence.end());
+    uint64_t corpusSize = m_corpusSize;
+    int64_t corpusTime = fileStat.st_mtime;
+    ofstream fenceOut(fenceFile.c_str(), ios::binary | ios::trunc);
+    fenceOut.write(FENCE_MAGIC, sizeof(FENCE_MAGIC));
+    fenceOut.write(reinterpret_cast<const char*>(&corpusSize), sizeof(corpusSize));
+    fenceOut.write(reinterpret_cast<const char*>(&corpusTime), sizeof(corpusTime));
+    fenceOut.write(reinterpret_cast<const char*>(&offsets[0]), offsets.size() * sizeof(uint64_t));
+    fenceOut.close();
+    if (fenceOut.fail()) {
+      //not fatal: it will be rebuilt next time
+      *log << ILog::VERBOSE << "Cannot cache fence index in " << fenceFile << this << ILog::endmsg;
+      unlink(fenceFile.c_str());
+    }
+  }
+  *log << ILog::VERBOSE << "Loaded breach corpus " << pFileName << " (" << (m_corpusType == HASH_SHA1 ? "SHA-1" : "NTLM")
+       << ", " << (unsigned long)(m_corpusSize >> 20) << " MB)" << this << ILog::endmsg;
+  return m_statusCode = SC_OK;
+}
+
+IErrorHandler::StatusCode BreachCheckTool::LoadFilter(string pFileName)
+{
+  FreeFilter();
+  if (pFileName.empty())
+    return m_statusCode = SC_OK;
+  int fd = open(pFileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    *log << ILog::ERROR << "Cannot open breach filter: " << pFileName << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || (size_t)fileStat.st_size < sizeof(FilterHeader)) {
+    *log << ILog::ERROR << "Invalid breach filter: " << pFileName << this << ILog::endmsg;
+    close(fd);
+    return m_statusCode = SC_ERROR;
+  }
+  void *map = mmap(0, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    *log << ILog::ERROR << "Cannot map breach filter: " << pFileName << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  m_filterMap = static_cast<const char*>(map);
+  m_filterSize = fileStat.st_size;
+  m_filterHeader = reinterpret_cast<const FilterHeader*>(m_filterMap);
+  if (memcmp(m_filterHeader->magic, FILTER_MAGIC, sizeof(FILTER_MAGIC)) != 0 || m_filterHeader->nBits == 0 ||
+      m_filterHeader->nHashes == 0 || m_filterHeader->hashType > HASH_NTLM ||
+      m_filterSize != sizeof(FilterHeader) + (m_filterHeader->nBits + 7) / 8) {
+    *log << ILog::ERROR << "Not a breach filter (use csm --build-breach-filter): " << pFileName << this << ILog::endmsg;
+    FreeFilter();
+    return m_statusCode = SC_ERROR;
+  }
+  m_filterBits = reinterpret_cast<const unsigned char*>(m_filterMap + sizeof(FilterHeader));
+  madvise(map, m_filterSize, MADV_RANDOM);
+  *log << ILog::VERBOSE << "Loaded breach filter " << pFileName << this << ILog::endmsg;
+  return m_statusCode = SC_OK;
+}
+
+/// Bit positions of a digest in the filter (double hashing on the digest itself, already uniform)
+static inline void FilterPositions(const unsigned char *pDigest, uint64_t &pH1, uint64_t &pH2)
+{
+  pH1 = 0;
+  pH2 = 0;
+  for (int k=0; k < 8; k++) {
+    pH1 = (pH1 << 8) | pDigest[k];
+    pH2 = (pH2 << 8) | pDigest[8 + k];
+  }
+  pH2 |= 1;
+}
+
+bool BreachCheckTool::FilterMayContain(const string &pDigest) const
+{
+  uint64_t h1, h2;
+  FilterPositions(reinterpret_cast<const unsigned char*>(pDigest.data()), h1, h2);
+  for (uint32_t i=0; i < m_filterHeader->nHashes; i++) {
+    uint64_t bit = (h1 + i * h2) % m_filterHeader->nBits;
+    if (not (m_filterBits[bit >> 3] & (1 << (bit & 7))))
+      return false;
+  }
+  return true;
+}
+
+long BreachCheckTool::Check(const string &pPwd) const
+{
+  if (m_filterMap) {
+    string digest = Hash(pPwd, (HashType)m_filterHeader->hashType);
+    bool mayContain = FilterMayContain(digest);
+    std::fill(digest.begin(), digest.end(), '\0');
+    if (not mayContain)
+      return 0;
+    if (!m_corpusMap)
+      return BREACH_POSSIBLE;
+  }
+  if (!m_corpusMap)
+    return 0;
+  string digest = Hash(pPwd, m_corpusType);
+  string hex = ToHex(digest);
+  std::fill(digest.begin(), digest.end(), '\0');
+  uint64_t key = HexKey(hex.c_str(), hex.size());
+  size_t bucket = key >> (64 - FENCE_BITS);
+  uint64_t loKey = (uint64_t)bucket << (64 - FENCE_BITS);
+  uint64_t hiKey = loKey | (~(uint64_t)0 >> FENCE_BITS);
+  size_t pos = LowerBound(hex, m_fence[bucket], m_fence[bucket + 1], loKey, hiKey);
+  long count = 0;
+  if (pos < m_corpusSize && CompareLine(pos, hex) == 0) {
+    count = 1;
+    size_t countPos = pos + m_hexLength;
+    if (countPos < m_corpusSize && m_corpusMap[countPos] == ':') {
+      //read count (file is not null-terminated)
+      count = 0;
+      for (countPos++; countPos < m_corpusSize && isdigit((unsigned char)m_corpusMap[countPos]); countPos++)
+	count = count * 10 + (m_corpusMap[countPos] - '0');
+      count = max(count, 1L);
+    }
+  }
+  std::fill(hex.begin(), hex.end(), '\0');
+  return count;
+}
+
+IErrorHandler::StatusCode BreachCheckTool::BuildFilter(string pCorpusFile, string pOutputFile, int pBitsPerEntry)
+{
+  if (pBitsPerEntry < 1) {
+    m_errorMsg = "Invalid filter size";
+    return m_statusCode = SC_ERROR;
+  }
+  BreachCheckTool corpus(m_name + "Corpus");
+  if (corpus.LoadCorpus(pCorpusFile) != SC_OK) {
+    m_errorMsg = "Cannot load breach corpus " + pCorpusFile;
+    return m_statusCode = SC_ERROR;
+  }
+  madvise(const_cast<char*>(corpus.m_corpusMap), corpus.m_corpusSize, MADV_SEQUENTIAL);
+  // - size the filter
+  uint64_t nLines = count(corpus.m_corpusMap, corpus.m_corpusMap + corpus.m_corpusSize, '\n');
+  if (corpus.m_corpusMap[corpus.m_corpusSize - 1] != '\n')
+    nLines++;
+  FilterHeader header;
+  memcpy(header.magic, FILTER_MAGIC, sizeof(FILTER_MAGIC));
+  header.hashType = corpus.m_corpusType;
+  header.nHashes = max(1, (pBitsPerEntry * 69 + 50) / 100); //optimal: ln(2) bits per entry
+  header.nBits = max((uint64_t)64, nLines * pBitsPerEntry);
+  vector<unsigned char> bits((header.nBits + 7) / 8, 0);
+  // - add all hashes
+  unsigned char digest[16];
+  for (size_t pos = 0; pos < corpus.m_corpusSize; pos = corpus.NextLine(pos + 1)) {
+    if (pos + 32 > corpus.m_corpusSize)
+      break;
+    for (int k=0; k < 16; k++)
+      digest[k] = (HexValue(corpus.m_corpusMap[pos + 2*k]) << 4) | HexValue(corpus.m_corpusMap[pos + 2*k + 1]);
+    uint64_t h1, h2;
+    FilterPositions(digest, h1, h2);
+    for (uint32_t i=0; i < header.nHashes; i++) {
+      uint64_t bit = (h1 + i * h2) % header.nBits;
+      bits[bit >> 3] |= (1 << (bit & 7));
+    }
+  }
+  // - write to a temporary file, then replace
+  string tmpFile = pOutputFile + ".tmp";
+  ofstream out(tmpFile.c_str(), ios::binary | ios::trunc);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(&bits[0]), bits.size());
+  out.close();
+  if (out.fail() || rename(tmpFile.c_str(), pOutputFile.c_str()) != 0) {
+    unlink(tmpFile.c_str());
+    m_errorMsg = "Cannot write breach filter " + pOutputFile;
+    *log << ILog::ERROR << m_errorMsg << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  *log << ILog::INFO << "Built breach filter " << pOutputFile << ": " << (unsigned long)nLines << " hashes, "
+       << (unsigned long)(bits.size() >> 20) << " MB" << this << ILog::endmsg;
+  return m_statusCode = SC_OK;
+}
@@ -0,0 +1,132 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: BreachCheckTool.h
+ Description: Offline check of passwords against a corpus of breached password hashes
+ Last Modified: $Id$
+*/
+
+#ifndef __BREACH_CHECK_TOOL__
+#define __BREACH_CHECK_TOOL__
+
+#include "IErrorHandler.h"
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/** Offline check of passwords against a corpus of breached password hashes.
+ * The corpus is a text file sorted by hash, one "HASH:count" line per password,
+ * with SHA-1 (40 hex digits) or NTLM (32 hex digits) hashes, as the ones
+ * distributed by "Have I Been Pwned". The file is memory-mapped and never parsed as a whole:
+ * a fence index of the offsets of 2^FENCE_BITS hash prefixes is built at load time, then
+ * each lookup is an interpolation search inside one fence bucket (hashes are uniformly
+ * distributed, so a couple of page reads are enough).
+ *
+ * When there is no room for the full corpus, a Bloom filter built once from it
+ * with BuildFilter() can be used instead: it answers "not breached" or "possibly breached".
+ * If both are loaded, the filter is used to skip most lookups on the corpus.
+ *
+ * Check() does not modify the tool and can be called from several threads.
+ */
+class BreachCheckTool : public IErrorHandler {
+ public:
+  /// Hash functions used by corpus files
+  enum HashType {
+    HASH_SHA1=0,
+    HASH_NTLM
+  };
+
+  /// Returned by Check() when only the Bloom filter is available and it matches
+  static const long BREACH_POSSIBLE = -1;
+
+ protected:
+  /// Number of leading hash bits indexed by the fence
+  static const int FENCE_BITS = 12;
+
+  /// Layout of the Bloom filter file
+  struct FilterHeader {
+    char magic[8];
+    uint32_t hashType;
+    uint32_t nHashes; ///< bits set per entry
+    uint64_t nBits;
+  };
+
+  /// Memory-mapped corpus
+  const char *m_corpusMap;
+  size_t m_corpusSize;
+  HashType m_corpusType;
+  size_t m_hexLength; ///< number of hex digits of each hash
+  /// Offset of the first line of each hash prefix (last entry is the end of file)
+  std::vector<size_t> m_fence;
+
+  /// Memory-mapped Bloom filter
+  const char *m_filterMap;
+  size_t m_filterSize;
+  const FilterHeader *m_filterHeader;
+  const unsigned char *m_filterBits;
+
+  void FreeCorpus();
+  void FreeFilter();
+
+  /// Start of the first line at or after pPos
+  size_t NextLine(size_t pPos) const;
+  /// First 64 bits of the hash of the line starting at pPos
+  uint64_t LineKey(size_t pPos) const;
+  /// Compare the hash of the line starting at pPos with pHex (upper-case): <0, 0, >0
+  int CompareLine(size_t pPos, const std::string &pHex) const;
+  /** First line in [pLo, pHi) with hash not smaller than pHex.
+   * pLoKey and pHiKey are the keys at the range boundaries, used for interpolation.
+   */
+  size_t LowerBound(const std::string &pHex, size_t pLo, size_t pHi, uint64_t pLoKey, uint64_t pHiKey) const;
+
+  /// Check the Bloom filter for a digest
+  bool FilterMayContain(const std::string &pDigest) const;
+
+ public:
+  BreachCheckTool(std::string pName);
+  ~BreachCheckTool();
+
+  /** Load a sorted corpus of hashes.
+   * The hash type is detected from the first line.
+   * @param pFileName corpus file; if empty, unload the current one
+   */
+  StatusCode LoadCorpus(std::string pFileName);
+
+  /** Load a Bloom filter built with BuildFilter().
+   * @param pFileName filter file; if empty, unload the current one
+   */
+  StatusCode LoadFilter(std::string pFileName);
+
+  /// True if a corpus or a filter is loaded
+  bool IsReady() const;
+
+  /** Check a password.
+   * @param pPwd password to be checked
+   * @return number of times the password appears in the corpus (0 if not found),
+   *  or BREACH_POSSIBLE if only the filter is loaded and matches the password
+   */
+  long Check(const std::string &pPwd) const;
+
+  /** Build a Bloom filter from the corpus.
+   * The filter is built in memory, needing pBitsPerEntry/8 bytes per corpus line.
+   * @param pCorpusFile sorted corpus of hashes
+   * @param pOutputFile filter file
+   * @param pBitsPerEntry filter size: 10 gives about 1% false positives, 16 about 0.05%
+   */
+  StatusCode BuildFilter(std::string pCorpusFile, std::string pOutputFile, int pBitsPerEntry=10);
+
+  // --- hash functions, returning raw digests
+  /// SHA-1 of the password
+  static std::string Sha1(const std::string &pStr);
+  /// NTLM hash (MD4 of the UTF-16LE encoding) of the password, assumed UTF-8
+  static std::string Ntlm(const std::string &pStr);
+  /// Digest of the password for a given hash type
+  static std::string Hash(const std::string &pStr, HashType pType);
+  /// Upper-case hexadecimal representation of a digest
+  static std::string ToHex(const std::string &pDigest);
+};
+
+#endif
@@ -19,13 +19,14 @@ using namespace std;
 
 FormatterPlainTextTool::FormatterPlainTextTool(string pName) : IFormatterTool(pName)
 {
-  m_versionNumber = "2.0"; //set default version of format
+  m_versionNumber = "3.0"; //set default version of format
   InitSeparators();
 }
 
 
 FormatterPlainTextTool::FormatterPlainTextTool(string pName, string pFormat) : IFormatterTool(pName, pFormat)
 {
+  m_versionNumber = "3.0"; //set default version of format
   InitSeparators();
 }
 
@@ -42,6 +43,7 @@ void FormatterPlainTextTool::InitSeparators() {
   m_modificationTimeField = "MODIFICATION_TIME";
   m_labelsField = "LABELS";
   m_essentialsField = "ESSENTIALS";
+  m_uuidField = "UUID";
 }
 
 bool FormatterPlainTextTool::CheckFieldValue(std::string pFieldValue)
@@ -87,6 +89,9 @@ IErrorHandler::StatusCode FormatterPlainTextTool::Code(std::vector<ARecord *> pD
     string strBuf; //temporary buffer
     //Start a new record
     outStream << m_recordSep << (*r)->GetAccountName() << endl;
+    //Write the UUID (assigned when the record was added to its source)
+    outStream << m_fieldSep << m_uuidField << endl;
+    outStream << (*r)->GetUUID() << endl;
     //Write creation and last modification time (write as plain string)
     outStream << m_fieldSep << m_creationTimeField << endl;
     outStream << (*r)->GetCreationTimeStr() << endl;
@@ -130,6 +135,7 @@ IErrorHandler::StatusCode FormatterPlainTextTool::Code(std::vector<ARecord *> pD
       outStream<<strBuf<<endl;
     } // end writing essentials
     //Write fields
+    ARecord::FieldsPin pin(*r); //records are written while other threads search
     for (ARecord::TFieldsIterator fit = (*r)->GetFieldsIterBegin(); fit != (*r)->GetFieldsIterEnd(); ++fit) {
       strBuf = fit->first;
       //check field name
@@ -182,12 +188,18 @@ IErrorHandler::StatusCode FormatterPlainTextTool::Decode(std::string &pFormatted
       ISecurityTool::ClearString(bufStr);
       return Decode_v1(inStream, pData, pBruteForce);
     }
+    //version 2.0 was also written without its number
+    if (bufStr == "---->>CSM_PLAIN_TEXT_FORMATTER Version 2.0" || bufStr == "---->>CSM_PLAIN_TEXT_FORMATTER Version ") {
+      *log << ILog::INFO << "Detected format 'ct' version 2.0 source. Records get their UUID when stored again." << this << ILog::endmsg;
+      ISecurityTool::ClearString(bufStr);
+      return Decode_v2(inStream, pData, pBruteForce);
+    }
     log->say(ILog::ERROR, string("Error reading source. Header mismatch: ")+bufStr, this);
     return m_statusCode = SC_ERROR;
   }
   //using current version of the format
   ISecurityTool::ClearString(bufStr);
-  return Decode_v2(inStream, pData, pBruteForce);
+  return Decode_v2(inStream, pData, pBruteForce, true);
 }
 
 IErrorHandler::StatusCode FormatterPlainTextTool::Decode_v1(istringstream &inStream, std::vector<ARecord *> &pData, int pBruteForce) {
@@ -373,7 +385,7 @@ IErrorHandler::StatusCode FormatterPlainTextTool::Decode_v1(istringstream &inStr
 }
 
 
-IErrorHandler::StatusCode FormatterPlainTextTool::Decode_v2(istringstream &inStream, std::vector<ARecord *> &pData, int pBruteForce) {
+IErrorHandler::StatusCode FormatterPlainTextTool::Decode_v2(istringstream &inStream, std::vector<ARecord *> &pData, int pBruteForce, bool pWithUUID) {
   string bufStr;  
   inStream.exceptions ( istringstream::eofbit );
   bool startedNewRecord=false;
@@ -406,9 +418,29 @@ IErrorHandler::StatusCode FormatterPlainTextTool::Decode_v2(istringstream &inStr
 	bool end_labels = false;
 	bool end_essentials = false;
 	*log << ILog::DEBUG << "Adding record: " << newRec->GetAccountName() << this << ILog::endmsg;
-	//now read creation and last modification time
+	//now read UUID, creation and last modification time
 	ISecurityTool::ClearString(bufStr);
 	getline(inStream, bufStr);
+	if (pWithUUID) {
+	  if (bufStr != (m_fieldSep + m_uuidField)) {
+	    if (!pBruteForce) {
+	      *log << ILog::ERROR << "Expecting UUID, found: " << bufStr << this << ILog::endmsg;
+	      ISecurityTool::ClearString(bufStr);
+	      ISecurityTool::ClearStrBuffer(inStream);
+	      return m_statusCode = SC_ERROR;
+	    }
+	    *log << ILog::WARNING << "Not found UUID. A new one is given to record: " << newRec->GetAccountName() << this << ILog::endmsg;
+	  } else {
+	    getline(inStream, bufStr);
+	    if (newRec->SetUUID(bufStr) != 0 && !pBruteForce) {
+	      *log << ILog::ERROR << "UUID not valid: " << bufStr << this << ILog::endmsg;
+	      ISecurityTool::ClearString(bufStr);
+	      ISecurityTool::ClearStrBuffer(inStream);
+	      return m_statusCode = SC_ERROR;
+	    }
+	    getline(inStream, bufStr);
+	  }
+	}
 	if (bufStr != (m_fieldSep + string("CREATION_TIME"))) {
 	  if (!pBruteForce) {
 	    *log << ILog::ERROR << "Expecting CREATION_TIME, found: " << bufStr << this << ILog::endmsg;
@@ -501,24 +533,16 @@ IErrorHandler::StatusCode FormatterPlainTextTool::Decode_v2(istringstream &inStr
 	    end_essentials = true;
 	  }	  
 	}
+	//fields are optional: the record is complete from here
+	recordRequiredFields = not skip_record;
 	while (!end_essentials) {
 	  //read all essentials
 	  ISecurityTool::ClearString(bufStr);
 	  getline(inStream, bufStr);
 	  if (bufStr.find(m_recordSep) == 0) {
-	    //we were not expecting this here!
-	    if (!pBruteForce) {
-	      log->say(ILog::ERROR, string("Not expecting new record here: ") + bufStr, this);
-	      ISecurityTool::ClearString(bufStr);
-	      ISecurityTool::ClearStrBuffer(inStream);
-	      return m_statusCode = SC_ERROR;
-	    } else {
-	      //whatever.. let's skip to the new one
-	      log->say(ILog::WARNING, string("Skipping to a new record without all info from the previous one: ")+newRec->GetAccountName(), this);
-	      end_labels = true;
-	      end_essentials = true;
-	      skip_record = true;
-	    }
+	    //record without fields, go on with the new one
+	    end_essentials = true;
+	    skip_record = true;
 	  } else {
 	    if (bufStr.find(m_fieldSep) == 0) {
 	      end_essentials=true;
@@ -527,7 +551,6 @@ IErrorHandler::StatusCode FormatterPlainTextTool::Decode_v2(istringstream &inStr
 	    } //add new essential
 	  }	  
 	} // end essentials
-	recordRequiredFields = true;
       } // new record     
       // now read fields. Can be multi-line and optional
       if (bufStr.find(m_fieldSep) == 0) {
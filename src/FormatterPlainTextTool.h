@@ -19,8 +19,14 @@
 /** Implements IFormatterTool with a simple plain text format.
  * Code/decode a ARecord vector to/from a plain text string. 
  * The format of the file is the following:
- * ---->>CSM_PLAIN_TEXT_FORMATTER Version 1.0
+ * ---->>CSM_PLAIN_TEXT_FORMATTER Version 3.0
  * ---->><AccountName>
+ * @@UUID
+ * <UUID>
+ * @@CREATION_TIME
+ * <CreationTime>
+ * @@MODIFICATION_TIME
+ * <ModificationTime>
  * @@LABELS
  * Labels_1
  * Labels_2
@@ -59,6 +65,8 @@ class FormatterPlainTextTool : public IFormatterTool {
   std::string m_labelsField;
   /// Special field for ARecord::m_essentials
   std::string m_essentialsField;
+  /// Special field for ARecord::m_uuid
+  std::string m_uuidField;
 
   /// Init separators values
   void InitSeparators();
@@ -72,8 +80,10 @@ class FormatterPlainTextTool : public IFormatterTool {
 
   /// Decoding function evolution schema for m_format = "1.0"
   StatusCode Decode_v1(std::istringstream &inStream, std::vector<ARecord *> &pData, int pBruteForce=0);
-  /// Decoding function for m_format = "2.0"
-  StatusCode Decode_v2(std::istringstream &inStream, std::vector<ARecord *> &pData, int pBruteForce=0);
+  /** Decoding function for m_format = "2.0" and "3.0".
+   * Version 3.0 only adds the UUID of each record, before its creation time (pWithUUID).
+   */
+  StatusCode Decode_v2(std::istringstream &inStream, std::vector<ARecord *> &pData, int pBruteForce=0, bool pWithUUID=false);
 
  public:
   FormatterPlainTextTool(std::string pName);
@@ -0,0 +1,460 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: FormatterTieredTool.cc
+ Description: Implements IFormatterTool with a small index and separately encrypted record payloads
+ Last Modified: $Id$
+*/
+
+#include "FormatterTieredTool.h"
+#include "ISecurityTool.h"
+
+#include <sstream>
+#include <algorithm>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+extern ILog *log;
+
+using namespace std;
+
+namespace {
+  const string TIERED_HEADER = "---->>CSM_TIERED_FORMATTER Version 1.2";
+  /// Same layout, payloads not bound to their record
+  const string TIERED_HEADER_V1_1 = "---->>CSM_TIERED_FORMATTER Version 1.1";
+  /// Same layout, without the UUIDs of the records
+  const string TIERED_HEADER_V1_0 = "---->>CSM_TIERED_FORMATTER Version 1.0";
+  /// Associated data of the payload blocks, before version 1.2
+  const string PAYLOAD_AAD = "CSM_TIERED_PAYLOAD";
+  /// Version written in the encrypted index, which the header cannot downgrade
+  const string INDEX_VERSION = "1.2";
+
+  /// Associated data of the payload block of a record: it cannot be given to another record
+  string PayloadAAD(const string &pUUID)
+  {
+    return PAYLOAD_AAD + " 1.2\n" + pUUID;
+  }
+
+  string HexEncode(const unsigned char *pData, size_t pSize)
+  {
+    static const char digits[] = "0123456789abcdef";
+    string hex;
+    hex.reserve(2 * pSize);
+    for (size_t k=0; k < pSize; k++) {
+      hex += digits[pData[k] >> 4];
+      hex += digits[pData[k] & 0xF];
+    }
+    return hex;
+  }
+
+  int HexDigit(char pDigit)
+  {
+    if (pDigit >= '0' && pDigit <= '9')
+      return pDigit - '0';
+    if (pDigit >= 'a' && pDigit <= 'f')
+      return pDigit - 'a' + 10;
+    if (pDigit >= 'A' && pDigit <= 'F')
+      return pDigit - 'A' + 10;
+    return -1;
+  }
+
+  bool HexDecode(const string &pHex, unsigned char *pData, size_t pSize)
+  {
+    if (pHex.size() != 2 * pSize)
+      return false;
+    for (size_t k=0; k < pSize; k++) {
+      int high = HexDigit(pHex[2*k]), low = HexDigit(pHex[2*k+1]);
+      if (high < 0 || low < 0)
+	return false;
+      pData[k] = (high << 4) | low;
+    }
+    return true;
+  }
+
+  /// Parse a non-negative decimal number filling all pText
+  bool ParseSize(const string &pText, unsigned long long &pValue)
+  {
+    if (pText.empty() || pText.find_first_not_of("0123456789") != string::npos)
+      return false;
+    pValue = strtoull(pText.c_str(), 0, 10);
+    return true;
+  }
+}
+
+// ----------------------------------------
+// PayloadKey
+// ----------------------------------------
+
+FormatterTieredTool::PayloadKey::PayloadKey()
+{
+  memset(key, 0, sizeof(key));
+  bound = true;
+}
+
+FormatterTieredTool::PayloadKey::~PayloadKey()
+{
+  memset(key, 0, sizeof(key));
+}
+
+bool FormatterTieredTool::PayloadKey::Open(const string &pPayload, const string &pUUID, ARecord::TFieldsType &pFields)
+{
+  pFields.clear();
+  if (pPayload.size() < RecordSealer::NONCE_SIZE + RecordSealer::TAG_SIZE)
+    return false;
+  string plain;
+  //payloads of another record do not authenticate
+  if (not RecordSealer::AeadDecrypt(key, reinterpret_cast<const unsigned char*>(pPayload.data()),
+				    pPayload.substr(RecordSealer::NONCE_SIZE), bound ? PayloadAAD(pUUID) : PAYLOAD_AAD, plain))
+    return false;
+  bool valid = true;
+  size_t pos = 0;
+  while (pos < plain.size()) {
+    //"<name size> <value size>\n<name><value>"
+    size_t eol = plain.find('\n', pos);
+    unsigned long nameSize, valueSize;
+    if (eol == string::npos || sscanf(plain.c_str() + pos, "%lu %lu", &nameSize, &valueSize) != 2 ||
+	nameSize > plain.size() - eol - 1 || valueSize > plain.size() - eol - 1 - nameSize) {
+      valid = false;
+      break;
+    }
+    pFields.push_back(make_pair(plain.substr(eol + 1, nameSize), plain.substr(eol + 1 + nameSize, valueSize)));
+    pos = eol + 1 + nameSize + valueSize;
+  }
+  ISecurityTool::ClearString(plain);
+  if (not valid) {
+    for (ARecord::TFieldsIterator itf = pFields.begin(); itf != pFields.end(); ++itf)
+      ISecurityTool::ClearString(itf->second);
+    pFields.clear();
+  }
+  return valid;
+}
+
+string FormatterTieredTool::PayloadKey::Seal(ARecord *pRecord, PasswordGeneratorTool::EntropyPool &pPool)
+{
+  string plain;
+  ARecord::FieldsPin pin(pRecord); //records are encoded while other threads search
+  for (ARecord::TFieldsIterator itf = pRecord->GetFieldsIterBegin(); itf != pRecord->GetFieldsIterEnd(); ++itf) {
+    char sizes[64];
+    snprintf(sizes, sizeof(sizes), "%lu %lu\n", (unsigned long)itf->first.size(), (unsigned long)itf->second.size());
+    plain += sizes;
+    plain += itf->first;
+    plain += itf->second;
+  }
+  unsigned char nonce[RecordSealer::NONCE_SIZE];
+  for (size_t k=0; k < RecordSealer::NONCE_SIZE; k++)
+    nonce[k] = pPool.Uniform(256);
+  string block(reinterpret_cast<char*>(nonce), RecordSealer::NONCE_SIZE);
+  block += RecordSealer::AeadEncrypt(key, nonce, plain, PayloadAAD(pRecord->GetUUID()));
+  ISecurityTool::ClearString(plain);
+  return block;
+}
+
+// ----------------------------------------
+// FormatterTieredTool
+// ----------------------------------------
+
+FormatterTieredTool::FormatterTieredTool(string pName, string pFormat) : IFormatterTool(pName, pFormat)
+{
+  m_recordSep = "---->>";
+  m_fieldSep = "@@";
+}
+
+FormatterTieredTool::~FormatterTieredTool()
+{
+
+}
+
+IErrorHandler::StatusCode FormatterTieredTool::CheckLine(string &pLine, int pBruteForce)
+{
+  bool valid = (pLine.find('\n') == string::npos) && (pLine.find(m_recordSep) != 0) && (pLine.find(m_fieldSep) != 0);
+  if (valid)
+    return SC_OK;
+  if (!pBruteForce) {
+    log->say(ILog::ERROR, string("Error while writing source. Name, label or essential not valid: ") + pLine, this);
+    return SC_ERROR;
+  }
+  //who cares.. write what we can
+  for (size_t pos = pLine.find('\n'); pos != string::npos; pos = pLine.find('\n'))
+    pLine.erase(pos, 1);
+  while (pLine.find(m_recordSep) == 0 || pLine.find(m_fieldSep) == 0)
+    pLine.erase(0, 1);
+  log->say(ILog::WARNING, string("Name, label or essential modified to be written: ") + pLine, this);
+  return SC_WARNING;
+}
+
+IErrorHandler::StatusCode FormatterTieredTool::NewPayloadKey()
+{
+  shared_ptr<PayloadKey> payloadKey(new PayloadKey());
+  PasswordGeneratorTool::EntropyPool pool;
+  for (size_t k=0; k < RecordSealer::KEY_SIZE; k++)
+    payloadKey->key[k] = pool.Uniform(256);
+  if (pool.Failed()) {
+    log->say(ILog::ERROR, "Cannot get random bytes for the data key.", this);
+    return m_statusCode = SC_ERROR;
+  }
+  m_payloadKey = payloadKey;
+  return m_statusCode = SC_OK;
+}
+
+IErrorHandler::StatusCode FormatterTieredTool::Code(vector<ARecord *> pData, string &pFormattedString, int pBruteForce)
+{
+  m_statusCode = SC_OK;
+  pFormattedString.clear();
+  //a source upgraded from an older version gets a new data key: its unbound blocks cannot be reused
+  if ((not m_payloadKey || not m_payloadKey->bound) && NewPayloadKey() != SC_OK)
+    return m_statusCode;
+  PasswordGeneratorTool::EntropyPool pool;
+  string index, payloads;
+  index = m_fieldSep + "VERSION\n" + INDEX_VERSION + "\n";
+  index += m_fieldSep + "KEY\n" + HexEncode(m_payloadKey->key, RecordSealer::KEY_SIZE) + "\n";
+  for (vector<ARecord *>::iterator r = pData.begin(); r != pData.end(); ++r) {
+    string name = (*r)->GetAccountName();
+    StatusCode sc = CheckLine(name, pBruteForce);
+    if (sc >= SC_ERROR) {
+      ISecurityTool::ClearString(index);
+      return m_statusCode = sc;
+    }
+    m_statusCode = max(m_statusCode, sc);
+    index += m_recordSep + name + "\n";
+    index += m_fieldSep + "UUID\n" + (*r)->GetUUID() + "\n";
+    index += m_fieldSep + "CREATION_TIME\n" + to_string((long long)(*r)->GetCreationTime()) + "\n";
+    index += m_fieldSep + "MODIFICATION_TIME\n" + to_string((long long)(*r)->GetModificationTime()) + "\n";
+    for (int section=0; section < 2; section++) {
+      index += m_fieldSep + (section == 0 ? "LABELS\n" : "ESSENTIALS\n");
+      vector<string> lines = (section == 0) ? (*r)->GetLabels() : (*r)->GetEssentials();
+      for (vector<string>::iterator itl = lines.begin(); itl != lines.end(); ++itl) {
+	sc = CheckLine(*itl, pBruteForce);
+	if (sc >= SC_ERROR) {
+	  ISecurityTool::ClearString(index);
+	  return m_statusCode = sc;
+	}
+	m_statusCode = max(m_statusCode, sc);
+	index += *itl + "\n";
+      }
+    }
+    //payloads not opened since they were read are written back as they are, if bound to their record
+    string block;
+    if ((*r)->HasPayload() && (*r)->GetPayloadOpener().get() == m_payloadKey.get() && m_payloadKey->bound) {
+      block = (*r)->GetPayload();
+    } else {
+      block = m_payloadKey->Seal(*r, pool);
+      if ((*r)->HasPayload()) {
+	//fields from another source, which could not be loaded
+	log->say(ILog::ERROR, string("Error while writing source. Cannot load fields of record: ") + name, this);
+	ISecurityTool::ClearString(index);
+	return m_statusCode = SC_ERROR;
+      }
+    }
+    index += m_fieldSep + "PAYLOAD\n" + to_string((unsigned long long)payloads.size()) + " " +
+      to_string((unsigned long long)block.size()) + "\n";
+    payloads += block;
+  }
+  if (pool.Failed()) {
+    log->say(ILog::ERROR, "Cannot get random bytes to encrypt the records.", this);
+    ISecurityTool::ClearString(index);
+    return m_statusCode = SC_ERROR;
+  }
+  pFormattedString = JoinIndex(TIERED_HEADER, index, payloads);
+  ISecurityTool::ClearString(index);
+  return m_statusCode;
+}
+
+IErrorHandler::StatusCode FormatterTieredTool::Decode(string &pFormattedString, vector<ARecord *> &pData, int pBruteForce)
+{
+  m_statusCode = SC_OK;
+  string header, index, payloads;
+  if (not SplitIndex(pFormattedString, header, index, payloads)) {
+    log->say(ILog::ERROR, string("Error reading source. Header mismatch: ") + pFormattedString.substr(0, pFormattedString.find('\n')), this);
+    return m_statusCode = SC_ERROR;
+  }
+  StatusCode sc = DecodeIndex(index, payloads, header, pData, pBruteForce);
+  ISecurityTool::ClearString(index);
+  return m_statusCode = sc;
+}
+
+IErrorHandler::StatusCode FormatterTieredTool::DecodeIndex(const string &pIndex, const string &pPayloads, const string &pHeader,
+							 vector<ARecord *> &pData, int pBruteForce)
+{
+  istringstream inStream(pIndex);
+  string bufStr;
+  StatusCode sc = SC_OK;
+  // --- Version: the header is not encrypted, the version of the index is the one trusted
+  shared_ptr<PayloadKey> payloadKey(new PayloadKey());
+  bool hasLine = static_cast<bool>(getline(inStream, bufStr));
+  if (hasLine && bufStr == m_fieldSep + "VERSION") {
+    if (not getline(inStream, bufStr) || bufStr != INDEX_VERSION) {
+      log->say(ILog::ERROR, string("Error reading source. Unknown index version: ") + bufStr, this);
+      ISecurityTool::ClearStrBuffer(inStream);
+      return SC_ERROR;
+    }
+    if (pHeader != TIERED_HEADER) {
+      log->say(pBruteForce ? ILog::WARNING : ILog::ERROR, string("Header does not match the index version: ") + pHeader, this);
+      if (not pBruteForce) {
+	ISecurityTool::ClearStrBuffer(inStream);
+	return SC_ERROR;
+      }
+      sc = SC_WARNING;
+    }
+    payloadKey->bound = true;
+    hasLine = static_cast<bool>(getline(inStream, bufStr));
+  } else {
+    //index written before the version was stored in it
+    payloadKey->bound = (pHeader == TIERED_HEADER);
+  }
+  // --- Data key
+  bool hasKey = hasLine && (bufStr == m_fieldSep + "KEY");
+  hasKey = hasKey && getline(inStream, bufStr) && HexDecode(bufStr, payloadKey->key, RecordSealer::KEY_SIZE);
+  ISecurityTool::ClearString(bufStr);
+  if (not hasKey) {
+    log->say(ILog::ERROR, "Error reading source. Data key not found.", this);
+    ISecurityTool::ClearStrBuffer(inStream);
+    return SC_ERROR;
+  }
+  // --- Records
+  enum {SEC_NONE, SEC_UUID, SEC_CREATION, SEC_MODIFICATION, SEC_LABELS, SEC_ESSENTIALS, SEC_PAYLOAD} section = SEC_NONE;
+  vector<ARecord *> records;
+  ARecord *newRec = 0;
+  bool complete = false; //payload of newRec read
+  string error;
+  while (getline(inStream, bufStr)) {
+    if (bufStr.find(m_recordSep) == 0) {
+      if (newRec && not complete) {
+	error = string("Record is not complete: ") + newRec->GetAccountName();
+	if (pBruteForce) {
+	  //drop it and go on with the new one
+	  log->say(ILog::WARNING, error, this);
+	  error.clear();
+	  sc = SC_WARNING;
+	  records.pop_back();
+	  delete newRec;
+	}
+      }
+      if (error.empty()) {
+	newRec = new ARecord;
+	records.push_back(newRec);
+	newRec->SetAccountName(bufStr.substr(m_recordSep.size()));
+	section = SEC_NONE;
+	complete = false;
+      }
+    } else if (not newRec) {
+      error = string("Expecting a new record: ") + bufStr;
+    } else if (bufStr.find(m_fieldSep) == 0) {
+      string name = bufStr.substr(m_fieldSep.size());
+      if (name == "UUID")
+	section = SEC_UUID;
+      else if (name == "CREATION_TIME")
+	section = SEC_CREATION;
+      else if (name == "MODIFICATION_TIME")
+	section = SEC_MODIFICATION;
+      else if (name == "LABELS")
+	section = SEC_LABELS;
+      else if (name == "ESSENTIALS")
+	section = SEC_ESSENTIALS;
+      else if (name == "PAYLOAD")
+	section = SEC_PAYLOAD;
+      else
+	error = string("Unknown section: ") + bufStr;
+    } else if (section == SEC_UUID) {
+      if (newRec->SetUUID(bufStr) != 0)
+	error = string("UUID not valid for record: ") + newRec->GetAccountName();
+      section = SEC_NONE;
+    } else if (section == SEC_CREATION || section == SEC_MODIFICATION) {
+      unsigned long long seconds;
+      if (not ParseSize(bufStr, seconds))
+	error = string("Time not valid: ") + bufStr;
+      else if (section == SEC_CREATION)
+	newRec->SetCreationTime((time_t)seconds);
+      else
+	newRec->SetModificationTime((time_t)seconds);
+      section = SEC_NONE;
+    } else if (section == SEC_LABELS) {
+      newRec->AddLabel(bufStr);
+    } else if (section == SEC_ESSENTIALS) {
+      newRec->AddEssential(bufStr, true); //need to force, since fields are not loaded yet
+    } else if (section == SEC_PAYLOAD) {
+      size_t sep = bufStr.find(' ');
+      unsigned long long offset, size;
+      if (sep == string::npos || not ParseSize(bufStr.substr(0, sep), offset) || not ParseSize(bufStr.substr(sep + 1), size) ||
+	  offset > pPayloads.size() || size > pPayloads.size() - offset)
+	error = string("Payload not valid for record: ") + newRec->GetAccountName();
+      else {
+	newRec->SetPayload(pPayloads.substr(offset, size), payloadKey);
+	complete = true;
+      }
+      section = SEC_NONE;
+    } else {
+      error = string("Unexpected line in record: ") + newRec->GetAccountName();
+    }
+    if (error.empty())
+      continue;
+    if (!pBruteForce)
+      break;
+    //drop the record and go on with the next one
+    log->say(ILog::WARNING, error, this);
+    error.clear();
+    sc = SC_WARNING;
+    if (newRec) {
+      records.pop_back();
+      delete newRec;
+      newRec = 0;
+    }
+    while (getline(inStream, bufStr) && bufStr.find(m_recordSep) != 0) {}
+    if (inStream)
+      inStream.seekg(-(streamoff)(bufStr.size() + 1), ios_base::cur); //read the new record again
+  }
+  if (error.empty() && newRec && not complete) {
+    error = string("Last record read is not complete: ") + newRec->GetAccountName();
+    if (pBruteForce) {
+      log->say(ILog::WARNING, error, this);
+      error.clear();
+      records.pop_back();
+      delete newRec;
+      sc = SC_WARNING;
+    }
+  }
+  ISecurityTool::ClearString(bufStr);
+  ISecurityTool::ClearStrBuffer(inStream);
+  if (not error.empty()) {
+    log->say(ILog::ERROR, string("Error reading source. ") + error, this);
+    for (vector<ARecord *>::iterator itr = records.begin(); itr != records.end(); ++itr)
+      delete *itr;
+    return SC_ERROR;
+  }
+  m_payloadKey = payloadKey;
+  pData.insert(pData.end(), records.begin(), records.end());
+  if (records.empty()) {
+    log->say(ILog::WARNING, "Source is empty", this);
+    return SC_WARNING;
+  }
+  return sc;
+}
+
+bool FormatterTieredTool::SplitIndex(const string &pFormattedString, string &pHeader, string &pIndex, string &pPayloads)
+{
+  size_t headerEnd = pFormattedString.find('\n');
+  if (headerEnd == string::npos)
+    return false;
+  pHeader = pFormattedString.substr(0, headerEnd);
+  if (pHeader != TIERED_HEADER && pHeader != TIERED_HEADER_V1_1 && pHeader != TIERED_HEADER_V1_0)
+    return false; //records of older versions are upgraded when stored again
+  size_t sizeEnd = pFormattedString.find('\n', headerEnd + 1);
+  unsigned long long size;
+  if (sizeEnd == string::npos || not ParseSize(pFormattedString.substr(headerEnd + 1, sizeEnd - headerEnd - 1), size) ||
+      size > pFormattedString.size() - sizeEnd - 1)
+    return false;
+  pIndex = pFormattedString.substr(sizeEnd + 1, size);
+  pPayloads = pFormattedString.substr(sizeEnd + 1 + size);
+  return true;
+}
+
+string FormatterTieredTool::JoinIndex(const string &pHeader, const string &pIndex, const string &pPayloads)
+{
+  string formatted = pHeader + "\n" + to_string((unsigned long long)pIndex.size()) + "\n";
+  formatted.reserve(formatted.size() + pIndex.size() + pPayloads.size());
+  formatted += pIndex;
+  formatted += pPayloads;
+  return formatted;
+}
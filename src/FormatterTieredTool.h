@@ -0,0 +1,114 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: FormatterTieredTool.h
+ Description: Implements IFormatterTool with a small index and separately encrypted record payloads
+ Last Modified: $Id$
+*/
+
+#ifndef __FORMATTERTIERED_TOOL__
+#define __FORMATTERTIERED_TOOL__
+
+#include "IFormatterTool.h"
+#include "RecordSealer.h"
+#include "PasswordGeneratorTool.h"
+
+#include <string>
+#include <memory>
+
+/** Implements IFormatterTool with a two-tier layout: a small index and separately encrypted payloads.
+ * The index holds what is needed to list, browse and search records by name or label: account names,
+ * creation and modification times, labels and essentials. The fields of each record are encrypted
+ * in their own payload block with ChaCha20-Poly1305 (see RecordSealer::AeadEncrypt), under a random
+ * data key stored in the index. Decoding only reads the index: payloads are decrypted when the fields
+ * of a record are used (see ARecord::SetPayload), and payloads never opened are written back as they are.
+ *
+ * The formatted string is:
+ * ---->>CSM_TIERED_FORMATTER Version 1.2
+ * <size of the index in bytes>
+ * <index><payload blocks>
+ * The source only passes the index through its security tool (see SplitIndex() and JoinIndex()),
+ * so that the cost of decrypting it does not depend on the size of the fields. The index is:
+ * @@VERSION
+ * 1.2
+ * @@KEY
+ * <data key, hexadecimal>
+ * ---->><AccountName>
+ * @@UUID
+ * <UUID>
+ * @@CREATION_TIME
+ * <seconds since the epoch>
+ * @@MODIFICATION_TIME
+ * <seconds since the epoch>
+ * @@LABELS
+ * Label_1
+ * ...
+ * @@ESSENTIALS
+ * Essential_1
+ * ...
+ * @@PAYLOAD
+ * <offset> <size>
+ * Version 1.1 is the same, with payloads not bound to their record. Version 1.0 has no UUIDs either
+ * (their records get one when added to the source). Neither has the version in the index: since the
+ * header is not encrypted, the version of the index is the one trusted, and an index claiming 1.2
+ * behind an older header is rejected. Older sources are written as version 1.2 with a new data key,
+ * so that their unbound blocks cannot be spliced into the upgraded source.
+ * Offsets are relative to the first payload block. A block is a random nonce, the encrypted fields
+ * and the authentication tag. The associated data of the encryption holds the format version and
+ * the UUID of the record, which comes from the encrypted index: a block moved to another record
+ * does not authenticate, and is not loaded. Fields are encoded as "<name size> <value size>\n<name><value>".
+ * Names, labels and essentials cannot contain new lines nor start with '---->>' or '@@': if
+ * pBruteForce is set these are removed, otherwise an error is returned.
+ */
+class FormatterTieredTool : public IFormatterTool {
+ protected:
+  /// Data key of a source, decrypting the payloads of the records loaded from it
+  class PayloadKey : public ARecord::PayloadOpener {
+  public:
+    unsigned char key[RecordSealer::KEY_SIZE];
+    bool bound; ///< payloads are bound to the UUID of their record (false before version 1.2)
+    PayloadKey();
+    ~PayloadKey(); ///< wipes the key
+    /// See ARecord::PayloadOpener::Open
+    virtual bool Open(const std::string &pPayload, const std::string &pUUID, ARecord::TFieldsType &pFields);
+    /// Encrypt the fields of a record, with a nonce from pPool, bound to its UUID
+    std::string Seal(ARecord *pRecord, PasswordGeneratorTool::EntropyPool &pPool);
+  };
+
+  /// Lines starting with these characters define the start of a new record
+  std::string m_recordSep;
+  /// Used inside a record to start a new section
+  std::string m_fieldSep;
+  /// Data key of the source, shared with the records loaded from it
+  std::shared_ptr<PayloadKey> m_payloadKey;
+
+  /// Check an index line respects the rules, fixing it if pBruteForce
+  StatusCode CheckLine(std::string &pLine, int pBruteForce);
+  /// Create a new random data key
+  StatusCode NewPayloadKey();
+  /// Decode the index, attaching to the records their payloads (bound to their UUID from version 1.2)
+  StatusCode DecodeIndex(const std::string &pIndex, const std::string &pPayloads, const std::string &pHeader,
+			 std::vector<ARecord *> &pData, int pBruteForce);
+
+ public:
+  FormatterTieredTool(std::string pName, std::string pFormat);
+  ~FormatterTieredTool();
+
+  /// See IFormatterTool::Code and class description
+  virtual StatusCode Code(std::vector<ARecord *> pData, std::string &pFormattedString, int pBruteForce=0);
+
+  /// See IFormatterTool::Decode and class description. Payloads are decoded later.
+  virtual StatusCode Decode(std::string &pFormattedString, std::vector<ARecord *> &pData, int pBruteForce=0);
+
+  /** Split a formatted string into its header line, its index and its payload blocks.
+   * The header tells the version, which must be kept: see JoinIndex().
+   * @return false if pFormattedString is not in this format
+   */
+  static bool SplitIndex(const std::string &pFormattedString, std::string &pHeader, std::string &pIndex, std::string &pPayloads);
+  /// Inverse of SplitIndex()
+  static std::string JoinIndex(const std::string &pHeader, const std::string &pIndex, const std::string &pPayloads);
+};
+
+#endif
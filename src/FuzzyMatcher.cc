@@ -0,0 +1,231 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: FuzzyMatcher.cc
+ Description: Fuzzy matching and ranking of records, used by FUZZY searches
+ Last Modified: $Id$
+*/
+
+#include "FuzzyMatcher.h"
+
+#include "ARecord.h"
+#include "MiscUtils.h"
+
+#include <algorithm>
+#include <string.h>
+#include <ctype.h>
+
+using namespace std;
+
+namespace {
+  // --- Scores, as in fzf
+  const int SCORE_MATCH = 16;
+  const int SCORE_GAP_START = -3;
+  const int SCORE_GAP_EXTENSION = -1;
+  /// Match at the beginning of a word
+  const int BONUS_BOUNDARY = 8;
+  /// Match right after the previous one
+  const int BONUS_CONSECUTIVE = 4;
+  /// The first character of the pattern counts more
+  const int BONUS_FIRST_CHAR_MULTIPLIER = 2;
+  /// Alignments which cannot happen
+  const int UNREACHABLE = -1000000;
+
+  inline bool IsWordByte(unsigned char pByte)
+  {
+    return isalnum(pByte) || pByte >= 0x80;
+  }
+
+  /// Comparison for the min-heap of the best matches (worst at the front)
+  inline bool Better(const FuzzyMatcher::Match &a, const FuzzyMatcher::Match &b)
+  {
+    return b < a;
+  }
+}
+
+bool FuzzyMatcher::Match::operator<(const Match &pOther) const
+{
+  if (tier != pOther.tier)
+    return tier < pOther.tier;
+  if (score != pOther.score)
+    return score < pOther.score;
+  //shorter names first, then older records
+  size_t nameSize = record->GetFoldedName().size(), otherNameSize = pOther.record->GetFoldedName().size();
+  if (nameSize != otherNameSize)
+    return nameSize > otherNameSize;
+  return record->GetAccountId() > pOther.record->GetAccountId();
+}
+
+FuzzyMatcher::FuzzyMatcher(const string &pPattern, size_t pMaxResults)
+{
+  m_pattern = CSMUtils::FoldCase(pPattern);
+  m_maxResults = pMaxResults;
+}
+
+FuzzyMatcher::~FuzzyMatcher()
+{
+
+}
+
+int FuzzyMatcher::ScoreText(const char *pBegin, const char *pEnd)
+{
+  if (m_pattern.empty())
+    return 0;
+  if ((size_t)(pEnd - pBegin) > MAX_TEXT_SIZE)
+    pEnd = pBegin + MAX_TEXT_SIZE;
+  // --- Quick rejection: the pattern must be a subsequence of the text.
+  // Plain loop: texts are short, a function call per character costs more
+  const char *pattern = m_pattern.data(), *patternEnd = pattern + m_pattern.size();
+  const char *start = 0;
+  for (const char *pos = pBegin; pos != pEnd; ++pos)
+    if (*pos == *pattern) {
+      if (!start)
+	start = pos;
+      if (++pattern == patternEnd)
+	break;
+    }
+  if (pattern != patternEnd)
+    return NO_MATCH;
+  // and the last possible position of its last character
+  pattern = m_pattern.data() + m_pattern.size() - 1;
+  while (*(pEnd - 1) != *pattern)
+    --pEnd;
+  // --- Alignment, between the first and the last possible positions.
+  // m_prevRow[j] is the best score of the pattern up to i-1, its last character matched at text position j
+  const unsigned char *text = (const unsigned char*)start;
+  size_t n = pEnd - start;
+  m_prevRow.assign(n, UNREACHABLE);
+  m_row.assign(n, UNREACHABLE);
+  unsigned char first = m_pattern[0];
+  for (size_t j=0; j < n; j++)
+    if (text[j] == first) {
+      bool boundary = (start + j == pBegin) || not IsWordByte(text[j-1]);
+      m_prevRow[j] = SCORE_MATCH + (boundary ? BONUS_BOUNDARY * BONUS_FIRST_CHAR_MULTIPLIER : 0);
+    }
+  for (size_t i=1; i < m_pattern.size(); i++) {
+    unsigned char current = m_pattern[i];
+    bool continuation = ((current & 0xC0) == 0x80); //rest of a multi-byte character: no gap allowed
+    int gap = UNREACHABLE; //best previous match at least two characters before, with its gap penalty
+    m_row[0] = UNREACHABLE;
+    for (size_t j=1; j < n; j++) {
+      if (j >= 2)
+	gap = max(gap + SCORE_GAP_EXTENSION, m_prevRow[j-2] + SCORE_GAP_START);
+      int score = UNREACHABLE;
+      if (text[j] == current) {
+	int consecutive = m_prevRow[j-1];
+	if (continuation)
+	  score = consecutive;
+	else {
+	  int best = max(consecutive + BONUS_CONSECUTIVE, gap);
+	  if (best > UNREACHABLE / 2)
+	    score = best + SCORE_MATCH + (IsWordByte(text[j-1]) ? 0 : BONUS_BOUNDARY);
+	}
+      }
+      m_row[j] = (score > UNREACHABLE / 2) ? score : UNREACHABLE;
+    }
+    m_row.swap(m_prevRow);
+  }
+  int best = *max_element(m_prevRow.begin(), m_prevRow.end());
+  if (best <= UNREACHABLE / 2)
+    return NO_MATCH; //only partial multi-byte characters
+  return max(best, 0);
+}
+
+int FuzzyMatcher::ScoreLines(const string &pFoldedText)
+{
+  int best = NO_MATCH;
+  const char *begin = pFoldedText.data(), *end = begin + pFoldedText.size();
+  while (begin <= end) {
+    const char *lineEnd = (const char*)memchr(begin, '\n', end - begin);
+    if (!lineEnd)
+      lineEnd = end;
+    if (lineEnd > begin || m_pattern.empty())
+      best = max(best, ScoreText(begin, lineEnd));
+    begin = lineEnd + 1;
+  }
+  return best;
+}
+
+int FuzzyMatcher::Score(const string &pText)
+{
+  string folded = CSMUtils::FoldCase(pText);
+  return ScoreLines(folded);
+}
+
+bool FuzzyMatcher::ScoreRecord(ARecord *pRecord, Match &pMatch)
+{
+  pMatch.record = pRecord;
+  pMatch.tier = TIER_NONE;
+  pMatch.score = NO_MATCH;
+  //the best tier matching wins, no need to look further
+  const string &name = pRecord->GetFoldedName();
+  int score = ScoreText(name.data(), name.data() + name.size());
+  if (score != NO_MATCH) {
+    pMatch.tier = TIER_NAME;
+    pMatch.score = score;
+    return true;
+  }
+  score = ScoreLines(pRecord->GetFoldedLabels());
+  if (score != NO_MATCH) {
+    pMatch.tier = TIER_LABELS;
+    pMatch.score = score;
+    return true;
+  }
+  string buffer;
+  score = ScoreLines(pRecord->GetFoldedFields(buffer));
+  std::fill(buffer.begin(), buffer.end(), '\0');
+  if (score != NO_MATCH) {
+    pMatch.tier = TIER_FIELDS;
+    pMatch.score = score;
+    return true;
+  }
+  return false;
+}
+
+void FuzzyMatcher::Add(ARecord *pRecord)
+{
+  Match match;
+  if (ScoreRecord(pRecord, match))
+    Keep(match);
+}
+
+void FuzzyMatcher::Merge(const FuzzyMatcher &pOther)
+{
+  for (vector<Match>::const_iterator itm = pOther.m_best.begin(); itm != pOther.m_best.end(); ++itm)
+    Keep(*itm);
+}
+
+void FuzzyMatcher::Keep(const Match &pMatch)
+{
+  if (m_maxResults == 0) {
+    m_best.push_back(pMatch);
+    return;
+  }
+  if (m_best.size() < m_maxResults) {
+    m_best.push_back(pMatch);
+    push_heap(m_best.begin(), m_best.end(), Better);
+  } else if (m_best.front() < pMatch) {
+    //replace the worst one
+    pop_heap(m_best.begin(), m_best.end(), Better);
+    m_best.back() = pMatch;
+    push_heap(m_best.begin(), m_best.end(), Better);
+  }
+}
+
+vector<ARecord*> FuzzyMatcher::GetResults() const
+{
+  vector<Match> sorted(m_best);
+  sort(sorted.begin(), sorted.end(), Better);
+  vector<ARecord*> results;
+  results.reserve(sorted.size());
+  for (vector<Match>::iterator itm = sorted.begin(); itm != sorted.end(); ++itm)
+    results.push_back(itm->record);
+  return results;
+}
+
+size_t FuzzyMatcher::GetMaxResults() const
+{
+  return m_maxResults;
+}
@@ -0,0 +1,98 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: FuzzyMatcher.h
+ Description: Fuzzy matching and ranking of records, used by FUZZY searches
+ Last Modified: $Id$
+*/
+
+#ifndef __FUZZY_MATCHER__
+#define __FUZZY_MATCHER__
+
+#include <string>
+#include <vector>
+
+class ARecord;
+
+/** Fuzzy matching and ranking of records, used by FUZZY searches.
+ * A text matches if it contains the characters of the pattern in the same order (case-insensitive).
+ * Matches are scored by a Smith-Waterman-like alignment (as fzf does): matched characters
+ * gain points, with bonuses at the beginning of words and for consecutive characters,
+ * while gaps cost points. Texts which do not contain the pattern as a subsequence are
+ * rejected by a memchr() scan before scoring.
+ *
+ * Records are ranked by where the best match is: account name first, then labels, then
+ * field names and values; then by score. Only the best GetMaxResults() records are kept
+ * (bounded heap), so that ranking thousands of records only materializes the few shown.
+ */
+class FuzzyMatcher {
+ public:
+  /// Score of texts not matching
+  static const int NO_MATCH = -1;
+  /// Longest part of a text scored (the rest is ignored)
+  static const size_t MAX_TEXT_SIZE = 1024;
+
+  /// Where the best match of a record was found, better last
+  enum MatchTier {
+    TIER_NONE = 0,
+    TIER_FIELDS = 1,
+    TIER_LABELS = 2,
+    TIER_NAME = 3
+  };
+
+  /// A matching record
+  struct Match {
+    int tier;
+    int score;
+    ARecord *record;
+    bool operator<(const Match &pOther) const; ///< worse match
+  };
+
+ protected:
+  /// Folded pattern
+  std::string m_pattern;
+  /// Maximum number of results kept (0 for all)
+  size_t m_maxResults;
+  /// Best matches so far: min-heap (worst at the front) when bounded
+  std::vector<Match> m_best;
+
+  /// Score rows of the alignment, reused between calls
+  std::vector<int> m_row, m_prevRow;
+
+  /// Best score of the matches in the lines of pFoldedText ('\n'-separated)
+  int ScoreLines(const std::string &pFoldedText);
+  /// Best score of a match in [pBegin, pEnd)
+  int ScoreText(const char *pBegin, const char *pEnd);
+  /// Keep a match if among the best ones
+  void Keep(const Match &pMatch);
+
+ public:
+  /** Prepare for matching pPattern.
+   * @param pMaxResults number of best results to be kept, 0 for all
+   */
+  FuzzyMatcher(const std::string &pPattern, size_t pMaxResults=0);
+  ~FuzzyMatcher();
+
+  /// Score of pText (not folded), NO_MATCH if it does not match
+  int Score(const std::string &pText);
+
+  /// Score a record, fill pMatch. Return false if it does not match.
+  bool ScoreRecord(ARecord *pRecord, Match &pMatch);
+
+  /// Score a record and keep it if among the best ones
+  void Add(ARecord *pRecord);
+  /** Keep also the best matches of another matcher of the same pattern.
+   * Records can be scored by several matchers concurrently (e.g. one per source), then merged.
+   */
+  void Merge(const FuzzyMatcher &pOther);
+
+  /// Records kept so far, best first
+  std::vector<ARecord*> GetResults() const;
+
+  /// Number of best results kept (0 for all)
+  size_t GetMaxResults() const;
+};
+
+#endif
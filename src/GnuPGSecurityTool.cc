@@ -21,6 +21,7 @@ using namespace GNUPG;
 
 //Declaration of static member for first gpgme initialization
 bool GnuPGSecurityTool::m_gpgme_initialized = false;
+std::mutex GnuPGSecurityTool::m_gpgme_initMutex;
 
 GnuPGSecurityTool::GnuPGSecurityTool(string pName) : ISecurityTool(pName)
 {
@@ -37,6 +38,7 @@ IErrorHandler::StatusCode GnuPGSecurityTool::InitGpgMe()
   /*First we need to set-up general settings for the first usage of gpgme
    * This is needed only the first time. */
   gpgme_error_t err;
+  std::unique_lock<std::mutex> initLock(m_gpgme_initMutex);
   if (!m_gpgme_initialized) {
     /* Initialize the locale environment.  */  
     m_gpgme_version = gpgme_check_version (NULL); //no explicit version requirement
@@ -57,6 +59,7 @@ IErrorHandler::StatusCode GnuPGSecurityTool::InitGpgMe()
     //ok, set initialized static flag
     m_gpgme_initialized = true;
   }
+  initLock.unlock();
 
   //print some information about the current settings    
   if ((err = gpgme_get_engine_info(&m_engInfo)) != GPG_ERR_NO_ERROR) {
@@ -267,6 +270,20 @@ IErrorHandler::StatusCode GnuPGSecurityTool::SetKey(std::string pKey)
   return SC_OK;    
 }
 
+bool GnuPGSecurityTool::IsSameKey(std::string pKeyA, std::string pKeyB)
+{
+  if (pKeyA.empty() || pKeyB.empty())
+    return false;
+  if (pKeyA == pKeyB)
+    return true;
+  //resolve both in the key-ring, sub-keys are reported with their primary key fingerprint
+  GpgKeyInfo keyInfoA = GetKeyInfo(pKeyA);
+  GpgKeyInfo keyInfoB = GetKeyInfo(pKeyB);
+  if (keyInfoA.fingerprint.empty() || keyInfoB.fingerprint.empty())
+    return false;
+  return (keyInfoA.fingerprint == keyInfoB.fingerprint);
+}
+
 void GnuPGSecurityTool::FillKeyInfo(const gpgme_key_t &key, GpgKeyInfo &keyInfo)
 {
   //key info
@@ -346,6 +363,7 @@ IErrorHandler::StatusCode GnuPGSecurityTool::Decrypt(const std::string &pSource,
   gpgme_data_t source;
   gpgme_data_t dest;
   gpgme_decrypt_result_t  decryptResult = 0;
+  m_lastRecipient.clear();
   
   //point to source buffer
   err = gpgme_data_new_from_mem(&source, pSource.c_str(), pSource.size(), 0);  
@@ -396,10 +414,24 @@ IErrorHandler::StatusCode GnuPGSecurityTool::Decrypt(const std::string &pSource,
 	 << decryptResult->unsupported_algorithm 
 	 << this << ILog::endmsg;
   }
-  //save the key used to decrypt for future usage
-  if (decryptResult && decryptResult->recipients) {
-    //save the key of the first recipient, if a key was not already set
-    SetKey(decryptResult->recipients->keyid);
+  //save the key used to decrypt for future usage: the first recipient whose secret key we have
+  gpgme_recipient_t usedRecipient = 0;
+  if (decryptResult) {
+    for (gpgme_recipient_t recipient = decryptResult->recipients; recipient; recipient = recipient->next) {
+      if (not recipient->keyid)
+	continue;
+      bool hasSecretKey = (gpgme_err_code(recipient->status) != GPG_ERR_NO_SECKEY);
+      *log << ILog::DEBUG << "Data encrypted for key: " << recipient->keyid
+	   << (hasSecretKey ? "" : " (no secret key)") << this << ILog::endmsg;
+      if (hasSecretKey && not usedRecipient)
+	usedRecipient = recipient;
+    }
+  }
+  if (usedRecipient) {
+    //SetKey() refuses keys which cannot encrypt any more: the recipient is kept anyway
+    m_lastRecipient = usedRecipient->keyid;
+    //save the key, if a key was not already set
+    SetKey(usedRecipient->keyid);
     *log << ILog::DEBUG << "Saving auto-determined key for source: "
 	 << m_key << this << ILog::endmsg;
   }
@@ -15,6 +15,7 @@
 
 #include <vector>
 #include <string>
+#include <mutex>
 
 /** Containes GnuPG C libraries
  * In particular we use:
@@ -51,6 +52,8 @@ class GnuPGSecurityTool : public ISecurityTool {
 
   /// Keep track of the first initialization of gpgme library
   static bool m_gpgme_initialized;
+  /// Protect the first initialization when instances are created by concurrent threads
+  static std::mutex m_gpgme_initMutex;
 
   // Members used to talk to gpgme library and store info
   GNUPG::gpgme_ctx_t m_context; ///< Context used by class instance for gpg operations
@@ -107,6 +110,12 @@ class GnuPGSecurityTool : public ISecurityTool {
   /// Override base function to check if key is present in accessible keyrings
   virtual StatusCode SetKey(std::string pKey);
 
+  /** Check if two key identifiers refer to the same key.
+   * Identifiers can be anything gpg understands (key id, sub-key id, user id..),
+   * they are resolved in the key-ring and their fingerprints compared.
+   */
+  virtual bool IsSameKey(std::string pKeyA, std::string pKeyB);
+
   /** Get detailed list of keys in the key-ring
    * Only keys with public+secrey key are returned by default.
    * @param showAllKeys if true all keys in the key-ring are showed.
@@ -14,6 +14,8 @@
 #include "TuiSvc.h"
 #include "ILog.h"
 
+#include <strings.h>
+
 extern TuiSvc *tuiSvc;
 extern ILog *log;
 
@@ -29,10 +31,17 @@ void IConfigurationService::InitValues()
 {
   version="0.0.1";
   bruteForce=false;
-  // -- Running Security Service minimum requirement: strongest checks!
-  minRunSecurityLevel = IRunningSecurityService::SAFE;
+  // -- IIOService
+  writeBehind = false;
+  writeBehindDelay = 1000;
+  loadOnDemand = false;
+  sourceIdleTimeout = 0;
+  sourceMemoryBudget = 0;
+  // -- Running Security Service minimum requirement: refuse to run only in unsafe environments
+  minRunSecurityLevel = IRunningSecurityService::WARNING;
   // -- Search Tool
   searchType = SearchRequest::TXT;
+  fuzzyMaxResults = 10;
   // -- SourceURI
   defaultDataType = "file"; // local file
   //defaultDataFormat = "czx"; // crypted zipeed xml
@@ -50,6 +59,21 @@ void IConfigurationService::InitValues()
   //predefinedAccountTypes.push_back(ARecord("Security Question", "Question*,Answer*,Service,Description"));
   // View settings
   accountFieldNameSize = 20;
+  secretFieldNames.clear();
+  secretFieldNames.push_back("Password");
+  secretFieldNames.push_back("Passphrase");
+  secretFieldNames.push_back("PIN");
+  secretFieldNames.push_back("CVV");
+  secretFieldNames.push_back("Answer");
+  secretFieldNames.push_back("Secret");
+  // -- Password generator
+  passwordPolicies.clear(); //built-in default used if none given
+  dicewareWordList.clear();
+  strengthDictionary.clear();
+  breachCorpus.clear();
+  breachFilter.clear();
+  sealRecords = false;
+  sealCacheSize = 64;
 }
 
 IConfigurationService::~IConfigurationService()
@@ -113,6 +137,76 @@ IErrorHandler::StatusCode IConfigurationService::SetTopMessage(string msg)
   return SC_OK;
 }
 
+// ----------------------------------------
+// IIOService settings
+
+bool IConfigurationService::GetWriteBehind()
+{
+  return writeBehind;
+}
+
+IErrorHandler::StatusCode IConfigurationService::SetWriteBehind(bool pFlag)
+{
+  writeBehind = pFlag;
+  return SC_OK;
+}
+
+int IConfigurationService::GetWriteBehindDelay()
+{
+  return writeBehindDelay;
+}
+
+IErrorHandler::StatusCode IConfigurationService::SetWriteBehindDelay(int pDelay)
+{
+  if (pDelay < 0) {
+    m_errorMsg = "Delay before writing changes cannot be negative";
+    return m_statusCode = SC_ERROR;
+  }
+  writeBehindDelay = pDelay;
+  return SC_OK;
+}
+
+bool IConfigurationService::GetLoadOnDemand()
+{
+  return loadOnDemand;
+}
+
+IErrorHandler::StatusCode IConfigurationService::SetLoadOnDemand(bool pFlag)
+{
+  loadOnDemand = pFlag;
+  return SC_OK;
+}
+
+int IConfigurationService::GetSourceIdleTimeout()
+{
+  return sourceIdleTimeout;
+}
+
+IErrorHandler::StatusCode IConfigurationService::SetSourceIdleTimeout(int pTimeout)
+{
+  if (pTimeout < 0) {
+    m_errorMsg = "Idle time before evicting sources cannot be negative";
+    return m_statusCode = SC_ERROR;
+  }
+  sourceIdleTimeout = pTimeout;
+  return SC_OK;
+}
+
+int IConfigurationService::GetSourceMemoryBudget()
+{
+  return sourceMemoryBudget;
+}
+
+IErrorHandler::StatusCode IConfigurationService::SetSourceMemoryBudget(int pBudget)
+{
+  if (pBudget < 0) {
+    m_errorMsg = "Memory budget of sources cannot be negative";
+    return m_statusCode = SC_ERROR;
+  }
+  sourceMemoryBudget = pBudget;
+  return SC_OK;
+}
+
 // ----------------------------------------
 // Running security Service settings
 
@@ -143,6 +237,21 @@ IErrorHandler::StatusCode IConfigurationService::SetSearchType(SearchRequest::Se
   return SC_OK;
 }
 
+int IConfigurationService::GetFuzzyMaxResults()
+{
+  return fuzzyMaxResults;
+}
+
+IErrorHandler::StatusCode IConfigurationService::SetFuzzyMaxResults(int pMaxResults)
+{
+  if (pMaxResults < 0) {
+    m_errorMsg = "Number of fuzzy search results cannot be negative";
+    return m_statusCode = SC_ERROR;
+  }
+  fuzzyMaxResults = pMaxResults;
+  return SC_OK;
+}
+
 // ----------------------------------------
 // SourceURI settings
 
@@ -241,6 +350,122 @@ IErrorHandler::StatusCode IConfigurationService::SetAccountFieldNameSize(int pSi
   return m_statusCode = SC_OK;
 }
 
+vector<string> &IConfigurationService::GetSecretFieldNames()
+{
+  return secretFieldNames;
+}
+
+bool IConfigurationService::IsSecretField(string pFieldName)
+{
+  for (vector<string>::iterator it = secretFieldNames.begin(); it != secretFieldNames.end(); ++it) {
+    if (strcasecmp(it->c_str(), pFieldName.c_str()) == 0)
+      return true;
+  }
+  return false;
+}
+
+// ----------------------------------------
+// Password generator settings
+
+PasswordGeneratorTool::PasswordPolicy IConfigurationService::GetPasswordPolicy(string pName)
+{
+  vector<PasswordGeneratorTool::PasswordPolicy>::iterator defaultPolicy = passwordPolicies.end();
+  for (vector<PasswordGeneratorTool::PasswordPolicy>::iterator it = passwordPolicies.begin(); it != passwordPolicies.end(); ++it) {
+    if (it->name == pName)
+      return *it;
+    if (it->name == "Default")
+      defaultPolicy = it;
+  }
+  if (defaultPolicy != passwordPolicies.end())
+    return *defaultPolicy;
+  return PasswordGeneratorTool::PasswordPolicy(); //built-in default
+}
+
+IErrorHandler::StatusCode IConfigurationService::AddPasswordPolicy(PasswordGeneratorTool::PasswordPolicy pPolicy)
+{
+  for (vector<PasswordGeneratorTool::PasswordPolicy>::iterator it = passwordPolicies.begin(); it != passwordPolicies.end(); ++it) {
+    if (it->name == pPolicy.name) {
+      *it = pPolicy;
+      return SC_OK;
+    }
+  }
+  passwordPolicies.push_back(pPolicy);
+  return SC_OK;
+}
+
+string IConfigurationService::GetDicewareWordList()
+{
+  return dicewareWordList;
+}
+
+IErrorHandler::StatusCode IConfigurationService::SetDicewareWordList(string pFileName)
+{
+  dicewareWordList = pFileName;
+  return SC_OK;
+}
+
+string IConfigurationService::GetStrengthDictionary()
+{
+  return strengthDictionary;
+}
+
+IErrorHandler::StatusCode IConfigurationService::SetStrengthDictionary(string pFileName)
+{
+  strengthDictionary = pFileName;
+  return SC_OK;
+}
+
+string IConfigurationService::GetBreachCorpus()
+{
+  return breachCorpus;
+}
+
+IErrorHandler::StatusCode IConfigurationService::SetBreachCorpus(string pFileName)
+{
+  breachCorpus = pFileName;
+  return SC_OK;
+}
+
+string IConfigurationService::GetBreachFilter()
+{
+  return breachFilter;
+}
+
+IErrorHandler::StatusCode IConfigurationService::SetBreachFilter(string pFileName)
+{
+  breachFilter = pFileName;
+  return SC_OK;
+}
+
+bool IConfigurationService::GetSealRecords()
+{
+  return sealRecords;
+}
+
+IErrorHandler::StatusCode IConfigurationService::SetSealRecords(bool pFlag)
+{
+  sealRecords = pFlag;
+  return SC_OK;
+}
+
+int IConfigurationService::GetSealCacheSize()
+{
+  return sealCacheSize;
+}
+
+IErrorHandler::StatusCode IConfigurationService::SetSealCacheSize(int pSize)
+{
+  if (pSize <= 0) {
+    m_errorMsg = "Size of the cache of open records must be positive";
+    return m_statusCode = SC_ERROR;
+  }
+  sealCacheSize = pSize;
+  return SC_OK;
+}
+
+// ----------------------------------------
+// Source manager settings
+
 string IConfigurationService::GetUserName()
 {
   return userName;
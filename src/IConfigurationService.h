@@ -15,6 +15,7 @@
 #include "ILog.h"
 #include "ISearchTool.h"
 #include "ARecord.h"
+#include "PasswordGeneratorTool.h"
 #include <string>
 #include <vector>
 
@@ -71,6 +72,11 @@ class IConfigurationService : public IErrorHandler {
 
   // -- IIOService settings
   std::vector<std::string> inputURI; ///< Source(s) for password retrieval/storage  
+  bool writeBehind; ///< In the GUI, write changes in background (see IIOService::SetWriteBehind())
+  int writeBehindDelay; ///< Milliseconds without changes before writing them in background
+  bool loadOnDemand; ///< In the GUI, load each source on its first use (see MultipleSourceIOSvc::Register())
+  int sourceIdleTimeout; ///< In the GUI, seconds of no use before evicting a source from memory, 0 to keep them
+  int sourceMemoryBudget; ///< In the GUI, MB of records kept in memory before evicting sources, 0 for no limit
 
   // -- Running Security Service settings
 
@@ -78,6 +84,7 @@ class IConfigurationService : public IErrorHandler {
 
   // -- Search Tool settings
   SearchRequest::SearchType searchType; ///< Default search type, see SearchRequest::SearchOptions for details
+  int fuzzyMaxResults; ///< Number of best records shown by FUZZY searches (0 for all)
 
   // -- SourceURI settings
   std::string defaultDataType; ///< See SourceURI::SourceFields
@@ -91,6 +98,24 @@ class IConfigurationService : public IErrorHandler {
   std::vector<ARecord> predefinedAccountTypes; ///< Define standard fields for given account types
   // - viewer settings for account windows
   int accountFieldNameSize;
+  /// Name of fields holding secrets (passwords, PINs, ...), case insensitive
+  std::vector<std::string> secretFieldNames;
+
+  // -- Password generator settings
+  /// Password policies, by name. "Default" is used when no policy matches the account type
+  std::vector<PasswordGeneratorTool::PasswordPolicy> passwordPolicies;
+  /// Word list used by diceware policies
+  std::string dicewareWordList;
+  /// Compiled dictionary used by the password strength check
+  std::string strengthDictionary;
+  /// Sorted corpus of breached password hashes
+  std::string breachCorpus;
+  /// Bloom filter built from the breach corpus
+  std::string breachFilter;
+  /// Keep field values of records encrypted in memory when not in use
+  bool sealRecords;
+  /// Maximum number of records kept open (decrypted) when sealRecords is set
+  int sealCacheSize;
 
   // -- Source manager settings
   /// default user name used to handle the source
@@ -111,6 +136,18 @@ class IConfigurationService : public IErrorHandler {
   std::string GetTopMessage();
   StatusCode SetTopMessage(std::string msg);
 
+  // -- IIOService settings
+  bool GetWriteBehind();
+  StatusCode SetWriteBehind(bool pFlag);
+  int GetWriteBehindDelay();
+  StatusCode SetWriteBehindDelay(int pDelay);
+  bool GetLoadOnDemand();
+  StatusCode SetLoadOnDemand(bool pFlag);
+  int GetSourceIdleTimeout();
+  StatusCode SetSourceIdleTimeout(int pTimeout);
+  int GetSourceMemoryBudget();
+  StatusCode SetSourceMemoryBudget(int pBudget);
+
   // -- Running Security Service settings
   int GetMinRunSecurityLevel(); ///< Set m_minRunSecurityLevel
   int SetMinRunSecurityLevel(int pSecurityLevel); ///< Get m_minRunSecurityLevel
@@ -118,6 +155,8 @@ class IConfigurationService : public IErrorHandler {
   // -- Search Tool settings
   SearchRequest::SearchType GetSearchType();  
   StatusCode SetSearchType(SearchRequest::SearchType pSType);
+  int GetFuzzyMaxResults();
+  StatusCode SetFuzzyMaxResults(int pMaxResults);
 
   // -- SourceURI settings  
   StatusCode SetDefaultDataType(std::string pDataType);
@@ -139,6 +178,26 @@ class IConfigurationService : public IErrorHandler {
   
   int GetAccountFieldNameSize(); ///< Get accountFieldNameSize
   StatusCode SetAccountFieldNameSize(int pSize); ///< Set size of field name for account display
+  std::vector<std::string> &GetSecretFieldNames();
+  bool IsSecretField(std::string pFieldName); ///< true if pFieldName is one of secretFieldNames (case insensitive)
+
+  // -- Password generator settings
+  /// Return the policy named pName, or the "Default" one if not found
+  PasswordGeneratorTool::PasswordPolicy GetPasswordPolicy(std::string pName);
+  /// Add a policy, replacing an existing one with the same name
+  StatusCode AddPasswordPolicy(PasswordGeneratorTool::PasswordPolicy pPolicy);
+  std::string GetDicewareWordList();
+  StatusCode SetDicewareWordList(std::string pFileName);
+  std::string GetStrengthDictionary();
+  StatusCode SetStrengthDictionary(std::string pFileName);
+  std::string GetBreachCorpus();
+  StatusCode SetBreachCorpus(std::string pFileName);
+  std::string GetBreachFilter();
+  StatusCode SetBreachFilter(std::string pFileName);
+  bool GetSealRecords();
+  StatusCode SetSealRecords(bool pFlag);
+  int GetSealCacheSize();
+  StatusCode SetSealCacheSize(int pSize);
 
   // -- Source manager settings
   std::string GetUserName();
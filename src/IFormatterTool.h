@@ -34,6 +34,7 @@ class IFormatterTool : public IErrorHandler {
 
   /** Format vector of records in a string.
    * Streams the vector of ARecord in a string ready to be processed and sent to persistent storage.
+   * The UUID of each record is stored with it (see ARecord::GetUUID()).
    * @param pData input vector of records
    * @param pFormattedString output formatted string
    * @param pBruteForce ignore errors and try to code what we can
@@ -21,12 +21,14 @@ using namespace std;
 
 IIOService::IIOService(string pName) : IErrorHandler(pName)
 {
+  m_idManagerTool = 0;
   m_localIdMgrInstance = false;
 }
 
 IIOService::IIOService(string pName, string owner) : IErrorHandler(pName)
 {
   m_owner = owner;
+  m_idManagerTool = 0;
   m_localIdMgrInstance = false;
 }
 
@@ -51,6 +53,24 @@ IErrorHandler::StatusCode IIOService::SourceExists()
   return SC_NOT_IMPLEMENTED;
 }
 
+void IIOService::SetWriteBehind(bool pEnable, unsigned int pDelay)
+{
+  if (pEnable)
+    log->say(ILog::WARNING, "Writing in background not supported, changes are written at once.", this);
+}
+
+IErrorHandler::StatusCode IIOService::Flush()
+{
+  //nothing written in background
+  return SC_OK;
+}
+
+IIOService::WriteState IIOService::GetWriteState(string &pMsg)
+{
+  pMsg.clear();
+  return WRITE_DONE;
+}
+
 IErrorHandler::StatusCode IIOService::Store(SourceURI pSource)
 {
   SetSource(pSource);
@@ -62,6 +82,10 @@ IErrorHandler::StatusCode IIOService::Store(SourceURI pSource)
 IErrorHandler::StatusCode IIOService::Add(vector<ARecord*> pARecords, bool flushBuffer)
 {
   StatusCode intermediateSC = SC_OK;
+  //write once at the end, unless the caller handles the transaction
+  bool ownTransaction = flushBuffer && not InTransaction();
+  if (ownTransaction && BeginTransaction() >= SC_ERROR)
+    return m_statusCode;
   for (vector<ARecord*>::iterator r=pARecords.begin(); r!=pARecords.end(); ++r) {
     StatusCode curSC = Add(*r, flushBuffer);
     if (curSC != SC_OK) {
@@ -71,6 +95,14 @@ IErrorHandler::StatusCode IIOService::Add(vector<ARecord*> pARecords, bool flush
     }
     intermediateSC = curSC;
   }
+  if (ownTransaction) {
+    StatusCode commitSC = Commit();
+    if (commitSC != SC_OK) {
+      intermediateSC = commitSC;
+      if (commitSC >= SC_ERROR)
+	Rollback(); //nothing written: don't keep records which are not stored
+    }
+  }
   return intermediateSC;
 }
 
@@ -118,6 +150,13 @@ SourceURI IIOService::GetSource()
   return m_source;
 }
 
+std::string IIOService::GetAccountSource(unsigned long pAccountId)
+{
+  if (m_idManagerTool)
+    return m_idManagerTool->GetSource(pAccountId);
+  return m_source.GetFullURI();
+}
+
 void IIOService::SetIdManagerTool(IdManagerTool *mTool)
 {
   m_idManagerTool = mTool;
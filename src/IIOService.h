@@ -18,6 +18,7 @@
 #include "SourceURI.h"
 #include "IdManagerTool.h"
 #include "ISearchTool.h"
+#include "RecordSnapshot.h"
 
 /** Manager layer for loading/storing passwords.
  * This is the logical core of CSM. Use external tools to perform specific operations. 
@@ -48,6 +49,13 @@ class IIOService : public IErrorHandler {
     ACCOUNTS_SORT_BYDATE = 2
   };
 
+  /// State of the changes written in background (see SetWriteBehind())
+  enum WriteState {
+    WRITE_DONE, ///< all changes written
+    WRITE_PENDING, ///< changes waiting to be written, or being written
+    WRITE_FAILED ///< the last write failed
+  };
+
  public:
   IIOService(std::string pName);
   IIOService(std::string pName, std::string owner);
@@ -84,6 +92,47 @@ class IIOService : public IErrorHandler {
    */
   virtual StatusCode Store(SourceURI pSource);
 
+  /** Start a transaction.
+   * Until Commit() or Rollback(), Add(), Remove() and Store() only change data in memory.
+   * Commit() then writes each changed source once (one encryption and one write),
+   * whatever the number of changes.
+   * @return SC_ERROR if a transaction is already started
+   */
+  virtual StatusCode BeginTransaction() = 0;
+  /** Write the changes of the transaction, and end it.
+   * Data is formatted before anything is written: if this or writing fails, the
+   * transaction stays open and Commit() can be tried again, or Rollback() called.
+   * @return SC_ERROR if no transaction is started, or status of the writing
+   */
+  virtual StatusCode Commit() = 0;
+  /** Undo the records added and removed in the transaction, and end it. Nothing is written.
+   * Records added in the transaction belong to the caller again (with no account id).
+   * Removed records are put back: they must not be deleted before the end of the transaction.
+   * Changes to the fields of records are not undone.
+   * @return SC_ERROR if no transaction is started
+   */
+  virtual StatusCode Rollback() = 0;
+  /// True between BeginTransaction() and the end of the transaction
+  virtual bool InTransaction() = 0;
+
+  /** Write changes in background (write-behind).
+   * Store() then only formats data and returns: a background thread encrypts and writes it
+   * after pDelay milliseconds without further changes, so that quick successive changes are
+   * written once. Data is always written before the service is destroyed, use Flush() to
+   * write it earlier and get the result.
+   * The default implementation does not support it: Store() keeps writing at once.
+   */
+  virtual void SetWriteBehind(bool pEnable, unsigned int pDelay=1000);
+  /** Write at once the changes waiting to be written in background, and wait for them.
+   * Changes whose writing failed are written again.
+   * @return status of the last write
+   */
+  virtual StatusCode Flush();
+  /** State of the changes written in background.
+   * @param pMsg reason of the failure, for WRITE_FAILED
+   */
+  virtual WriteState GetWriteState(std::string &pMsg);
+
   /** Store/Modify a new/existing record.
    * If another record with the same ARecord::m_accountId exists, modify it,
    * otherwise store a new one.
@@ -94,6 +143,7 @@ class IIOService : public IErrorHandler {
   virtual StatusCode Add(ARecord *pARecord, bool flushBuffer=true) = 0;
 
   /** Store od mofify a set of records 
+   * If flushing, records are added in a transaction (see BeginTransaction()), so data is written once.
    * @param pARecord record to be added
    * @param if true, flush to media, otherwise just add in memory
    * @return status of operation
@@ -102,11 +152,33 @@ class IIOService : public IErrorHandler {
 
   /** Retrieve a given set of records.
    * Perform a search of records matching the criteria in any field of stored data (including Labels).
+   * With SearchRequest::QUERY, pSearch is a structured query (e.g. "host:db* AND modified:2024..", see QuerySearchTool).
+   * If the search is not valid, the status is set to SC_ERROR and the reason is in the error message.
    * @param pSearch defines the search pattern
    * @param pTypeOfSearch defines the type of search as described in SearchType
    */
   virtual std::vector<ARecord*> Find(std::string pSearch, SearchRequest::SearchType pTypeOfSearch=SearchRequest::TXT) = 0;
 
+  /** Retrieve the records of a search one at a time, as they are found.
+   * Same records as Find(), but not sorted: they are given to pVisitor as they are found, and the
+   * search stops as soon as pVisitor asks it (e.g. when enough records are found), so that finding
+   * the first records does not cost a full search. Fuzzy searches still rank all records first.
+   * If the search is not valid, the status is set to SC_ERROR and the reason is in the error message.
+   * @param pSearch defines the search pattern
+   * @param pTypeOfSearch defines the type of search as described in SearchType
+   * @param pVisitor receives the records found
+   * @return false if pVisitor stopped the search
+   */
+  virtual bool FindEach(std::string pSearch, SearchRequest::SearchType pTypeOfSearch, RecordVisitor &pVisitor) = 0;
+
+  /** Retrieve the records best matching a fuzzy pattern, best first.
+   * Records match if they contain the characters of pSearch in the same order. They are ranked
+   * by where they match (account name, then labels, then fields) and by score (see FuzzyMatcher).
+   * @param pSearch defines the search pattern
+   * @param pMaxResults number of best records returned, 0 for all matching records
+   */
+  virtual std::vector<ARecord*> FindFuzzy(std::string pSearch, size_t pMaxResults=0) = 0;
+
   /** Retrieve a given set of records.
    * Perform a search by account name only
    * @param pSearch defines the search pattern
@@ -121,6 +193,13 @@ class IIOService : public IErrorHandler {
    */
   virtual std::vector<ARecord*> FindByLabel(std::string pSearch, SearchRequest::SearchType pTypeOfSearch=SearchRequest::TXT) = 0;  
 
+  /** Retrieve the records whose labels match a query.
+   * Labels (case-insensitive) are combined with AND, OR, NOT and parentheses, e.g. "work AND ssh AND NOT retired".
+   * If the query is not valid, the status is set to SC_ERROR and the reason is in the error message.
+   * @param pQuery the label query, see LabelIndex
+   */
+  virtual std::vector<ARecord*> FindByLabelQuery(std::string pQuery) = 0;
+
   /** Retrieve a given record.
    * Perform a search by account Id. Exact matched is returned. No duplicates are assumed.
    * @param pAccountId defines the account Id
@@ -128,11 +207,23 @@ class IIOService : public IErrorHandler {
    */
   virtual ARecord* FindByAccountId(unsigned long pAccountId) = 0;
 
+  /** Retrieve a given record by its UUID.
+   * Unlike the account Id, the UUID of a record is stored with it and never changes (see ARecord::GetUUID()).
+   * @param pUUID UUID of the record
+   * @return Pointer to the (locked) record found, null if not found.
+   */
+  virtual ARecord* FindByUUID(const std::string &pUUID) = 0;
+
   /** Retrieve all accounts. 
    * @param sort Sort accounts
    */
   virtual std::vector<ARecord*> GetAllAccounts(int sort=ACCOUNTS_SORT_NOSORT) = 0;
 
+  /** Current snapshot of the records, to be used without locks from any thread.
+   * Changes made after it was taken are not seen: get a new one to see them. The source is not loaded.
+   */
+  virtual RecordSnapshot::Ptr GetSnapshot() = 0;
+
   /** Retrieve all labels list.
    */
   virtual std::vector<std::string> GetLabels() = 0;
@@ -177,6 +268,8 @@ class IIOService : public IErrorHandler {
   virtual std::string GetKey(); ///< see m_key
   virtual StatusCode SetSource(SourceURI pSource); ///< see m_source
   virtual SourceURI GetSource(); ///< see m_source
+  /// Full URI of the source an account belongs to (empty if unknown)
+  virtual std::string GetAccountSource(unsigned long pAccountId);
 
   // --- Tools accessors
   virtual void SetIdManagerTool(IdManagerTool *mTool);
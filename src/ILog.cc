@@ -11,6 +11,7 @@
 #include "ILog.h"
 
 #include <algorithm>
+#include <map>
 
 //#include <typeinfo>
 
@@ -32,10 +33,20 @@ void ILog::InitValues()
   m_msgTypeStr[DEBUG] = "DEBUG";
   // default verbosity
   Mute();
+}
 
-  //internal usage
-  m_bufferMsgType = FATAL; //this default is never used if ILog is properly called
-  m_bufferMsgCaller = "Unknown"; //this default is never used if ILog properly called
+ILog::StreamBuffer::StreamBuffer()
+{
+  msgType = FATAL; //this default is never used if ILog is properly called
+  caller = "Unknown"; //this default is never used if ILog properly called
+  callerPtr = 0;
+}
+
+ILog::StreamBuffer &ILog::GetStreamBuffer()
+{
+  //one buffer per thread (and per log instance)
+  static thread_local map<const ILog*, StreamBuffer> threadBuffers;
+  return threadBuffers[this];
 }
 
 ILog::~ILog()
@@ -100,72 +111,75 @@ void ILog::say(ILogMsgType msgType, std::string msg, IErrorHandler* callerObj)
 ILog &ILog::operator<<(const std::string pMsg)
 {
   //just add to the buffer message
-  m_bufferMsg << pMsg;
+  GetStreamBuffer().msg << pMsg;
   return *this;
 }
 
 ILog &ILog::operator<<(const char* pMsg)
 {
-  m_bufferMsg << pMsg;
+  GetStreamBuffer().msg << pMsg;
   return *this;
 }
 
 ILog &ILog::operator<<(const int pMsg)
 {
-  m_bufferMsg << pMsg;
+  GetStreamBuffer().msg << pMsg;
   return *this;
 }
 
 ILog &ILog::operator<<(const unsigned long pMsg)
 {
-  m_bufferMsg << pMsg;
+  GetStreamBuffer().msg << pMsg;
   return *this;
 }
 
 ILog &ILog::operator<<(const double pMsg)
 {
-  m_bufferMsg << pMsg;
+  GetStreamBuffer().msg << pMsg;
   return *this;
 }
 
 ILog &ILog::operator<<(const ILogMsgType pMsgType)
 {
+  StreamBuffer &buf = GetStreamBuffer();
   if (pMsgType != endmsg) {
     //change message type and create new output
-    if (!m_bufferMsg.str().empty()) {
+    if (!buf.msg.str().empty()) {
       //a previous message is still here.. flush it!
-      if (m_bufferMsgCallerPtr)
-	say(m_bufferMsgType, m_bufferMsg.str(), m_bufferMsgCallerPtr);
+      if (buf.callerPtr)
+	say(buf.msgType, buf.msg.str(), buf.callerPtr);
       else
-	say(m_bufferMsgType, m_bufferMsg.str(), m_bufferMsgCaller);
+	say(buf.msgType, buf.msg.str(), buf.caller);
     }
-    m_bufferMsgType = pMsgType; 
+    buf.msgType = pMsgType; 
   } else {
     //end-of-message detected, it's time to log it
-    if (m_bufferMsgCallerPtr)
-      say(m_bufferMsgType, m_bufferMsg.str(), m_bufferMsgCallerPtr); //no check on content.. user responsibility    
+    if (buf.callerPtr)
+      say(buf.msgType, buf.msg.str(), buf.callerPtr); //no check on content.. user responsibility    
     else
-      say(m_bufferMsgType, m_bufferMsg.str(), m_bufferMsgCaller); //no check on content.. user responsibility          
+      say(buf.msgType, buf.msg.str(), buf.caller); //no check on content.. user responsibility          
   }
   //in any case a new log message is starting
   //set default values
-  m_bufferMsgCaller = string("Unknown");
-  m_bufferMsgCallerPtr = 0;
-  m_bufferMsg.str("");
+  buf.caller = string("Unknown");
+  buf.callerPtr = 0;
+  buf.msg.str("");
   return *this;
 }
 
 ILog &ILog::operator<<(IErrorHandler *pCaller)
 {
-  m_bufferMsgCaller = pCaller->m_name; //we're friends :)
-  m_bufferMsgCallerPtr = pCaller;
+  StreamBuffer &buf = GetStreamBuffer();
+  buf.caller = pCaller->m_name; //we're friends :)
+  buf.callerPtr = pCaller;
   return *this;
 }
 
 ILog &ILog::operator<<(IErrorHandler &pCaller)
 {
-  m_bufferMsgCaller = pCaller.m_name; //we're friends :)
-  m_bufferMsgCallerPtr = &pCaller;
+  StreamBuffer &buf = GetStreamBuffer();
+  buf.caller = pCaller.m_name; //we're friends :)
+  buf.callerPtr = &pCaller;
   return *this;
 }
 
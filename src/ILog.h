@@ -53,10 +53,21 @@ class ILog : public IErrorHandler {
   /// String version of the ILogMsgType enum
   std::string m_msgTypeStr[endmsg];
 
-  std::ostringstream m_bufferMsg; ///< keep message into buffer until an "endmsg" is given in case of streaming with '<<'
-  ILogMsgType m_bufferMsgType; ///< keep message type until an "endmsg" is given in case of streaming with '<<'
-  std::string m_bufferMsgCaller; ///< caller name, can be set streaming an (IErrorHandler *) object.. nice :)
-  IErrorHandler* m_bufferMsgCallerPtr; ///< caller pointer. If present, set m_statusCode and error message.
+  /** Message being composed with operators '<<'.
+   * Each thread gets its own buffer (see GetStreamBuffer()), so that
+   * messages streamed concurrently by different threads are not mixed.
+   */
+  class StreamBuffer {
+  public:
+    std::ostringstream msg; ///< keep message into buffer until an "endmsg" is given in case of streaming with '<<'
+    ILogMsgType msgType; ///< keep message type until an "endmsg" is given in case of streaming with '<<'
+    std::string caller; ///< caller name, can be set streaming an (IErrorHandler *) object.. nice :)
+    IErrorHandler* callerPtr; ///< caller pointer. If present, set m_statusCode and error message.
+    StreamBuffer();
+  };
+
+  /// Get the streaming buffer of the calling thread
+  StreamBuffer &GetStreamBuffer();
 
   // Define statuCode to be set to the caller from log message type
   StatusCode GetStatusCodeFromMsg(ILogMsgType msg);
@@ -88,6 +99,7 @@ class ILog : public IErrorHandler {
    * @param msgType Type of message as defined in ILogMsgType
    * @param msg Message to be logged
    * @param callerObj (optional) object which call the method (useful for error reporting)
+   * Implementations must be safe to call from concurrent threads.
   */
   virtual void say(ILogMsgType msgType, std::string msg, IErrorHandler* callerObj);
   virtual void say(ILogMsgType msgType, std::string msg, std::string callerObj="") = 0;
@@ -0,0 +1,45 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: IRunningSecurityService.cc
+ Description: Interface for running security checks.
+ Last Modified: $Id$
+*/
+
+#include "IRunningSecurityService.h"
+
+using namespace std;
+
+IRunningSecurityService::IRunningSecurityService(string pName) : IErrorHandler(pName)
+{
+  m_result = FATAL;
+}
+
+IRunningSecurityService::~IRunningSecurityService()
+{
+  if (m_thread.joinable())
+    m_thread.join();
+}
+
+void IRunningSecurityService::Start()
+{
+  if (m_thread.joinable())
+    return; //already running
+  m_thread = thread([this]() { m_result = Run(); });
+}
+
+IRunningSecurityService::RunSecurityResult IRunningSecurityService::Wait()
+{
+  if (not m_thread.joinable())
+    return m_result = Run();
+  m_thread.join();
+  return m_result;
+}
+
+void IRunningSecurityService::AddSensitivePath(string pPath)
+{
+  if (not pPath.empty())
+    m_sensitivePaths.push_back(pPath);
+}
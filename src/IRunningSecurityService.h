@@ -13,8 +13,14 @@
 
 #include "ILog.h"
 
+#include <string>
+#include <vector>
+#include <thread>
+
 /** Running security service interface.
  * Defines interface for performing checks on the running environment of CSM.
+ * Checks can be run synchronously with Run(), or started in background with Start()
+ * (e.g. while sources are being loaded) and their result collected with Wait().
  */
 class IRunningSecurityService : public IErrorHandler {
  public:
@@ -25,14 +31,29 @@ class IRunningSecurityService : public IErrorHandler {
     SAFE, ///< As far as I can tell.. it's safe.
     NSECURITYLEVELS 
   };
+ protected:
+  /// Files whose permissions are relevant for security (configuration, sources)
+  std::vector<std::string> m_sensitivePaths;
+  /// Thread running the checks started by Start()
+  std::thread m_thread;
+  /// Result of the checks started by Start()
+  RunSecurityResult m_result;
  public:
- IRunningSecurityService(std::string pName) : IErrorHandler(pName) {};
-  ~IRunningSecurityService() {};
+  IRunningSecurityService(std::string pName);
+  virtual ~IRunningSecurityService(); ///< waits for checks still running
 
   /** Methods which performs all security checks.
    * Returns IRunningSecurityService::SAFE if succesfull. Returns others for reduced security.
    */
   virtual RunSecurityResult Run() = 0;
+
+  /// Start Run() in a background thread. To be followed by Wait().
+  void Start();
+  /// Wait for the checks started with Start() and return their result (run them now if not started)
+  RunSecurityResult Wait();
+
+  /// Add a file to be checked (e.g. for unsafe permissions). To be called before Start().
+  void AddSensitivePath(std::string pPath);
 };
 
 #endif
@@ -26,6 +26,11 @@ SearchRequest::~SearchRequest()
 
 }
 
+RecordVisitor::~RecordVisitor()
+{
+
+}
+
 ISearchTool::ISearchTool(string pName) : IErrorHandler(pName)
 {
 
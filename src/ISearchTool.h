@@ -33,7 +33,9 @@ class SearchRequest {
   enum SearchType {
     TXT=1, ///< default, find substrings
     EXACT=2, ///< find exact match only
-    REGEX=4 ///< use regular expressions
+    REGEX=4, ///< use regular expressions
+    FUZZY=8, ///< characters in the same order, results ranked (see FuzzyMatcher)
+    QUERY=16 ///< structured query: field-scoped terms, dates, AND/OR/NOT (see QuerySearchTool)
   };
  public:
   std::string pattern; ///< pattern to search for
@@ -45,11 +47,22 @@ class SearchRequest {
   ~SearchRequest();
 };
 
+/** Receives the records found by a search, one at a time, as they are found.
+ * Used to stop a search as soon as enough records are found (see IIOService::FindEach()).
+ */
+class RecordVisitor {
+ public:
+  virtual ~RecordVisitor();
+  /** Called for each record found.
+   * @return false to stop the search: no other record is checked
+   */
+  virtual bool Visit(ARecord *pRecord) = 0;
+};
 
 /** Interface to search Tool.
  * Search ARecord objects matching specific criteria from a given dataset of ARecord objects.
  * Can be used by IIOService to search whitthin stored data or externally to refine searches.
- * @todo This class is not used at the moment. We'll come back later, if needed.
+ * See QuerySearchTool, used by the sources.
  */
 class ISearchTool : public IErrorHandler {
 public:
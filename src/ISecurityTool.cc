@@ -12,16 +12,24 @@
 
 // extern declaration for global instance (csm.h)
 #include "ILog.h"
+#include "IConfigurationService.h"
 extern ILog *log;
+extern IConfigurationService *cfgMgr;
 
 ISecurityTool::ISecurityTool(std::string pName) : IErrorHandler(pName)
 {
+  m_pwdGenerator = 0;
+  m_pwdStrength = 0;
   *log << ILog::DEBUG << "Creating new SecurityTool: " << pName << this << ILog::endmsg;
 }
 
 ISecurityTool::~ISecurityTool()
 {
   *log << ILog::DEBUG << "Destroying SecurityTool: " << m_name << this << ILog::endmsg;
+  if (m_pwdGenerator)
+    delete m_pwdGenerator;
+  if (m_pwdStrength)
+    delete m_pwdStrength;
 }
 
 IErrorHandler::StatusCode ISecurityTool::SetKey(std::string pKey)
@@ -36,6 +44,38 @@ std::string ISecurityTool::GetKey()
   return m_key;
 }
 
+bool ISecurityTool::IsSameKey(std::string pKeyA, std::string pKeyB)
+{
+  return (!pKeyA.empty() && pKeyA == pKeyB);
+}
+
+std::string ISecurityTool::GetLastRecipient()
+{
+  return m_lastRecipient;
+}
+
+IErrorHandler::StatusCode ISecurityTool::GenPassword(std::string &pPwd, std::string pPolicy)
+{
+  if (!m_pwdGenerator)
+    m_pwdGenerator = new PasswordGeneratorTool(m_name + "PwdGen");
+  if (pPolicy.empty())
+    pPolicy = "Default";
+  m_statusCode = m_pwdGenerator->Generate(pPolicy, pPwd);
+  if (m_statusCode != SC_OK)
+    m_errorMsg = m_pwdGenerator->GetErrorMsg();
+  return m_statusCode;
+}
+
+int ISecurityTool::PasswordStrength(std::string pPwd)
+{
+  if (!m_pwdStrength) {
+    m_pwdStrength = new PasswordStrengthTool(m_name + "PwdStrength");
+    if (cfgMgr)
+      m_pwdStrength->LoadDictionary(cfgMgr->GetStrengthDictionary()); //fall back to the built-in list on failure
+  }
+  return m_pwdStrength->Evaluate(pPwd).score;
+}
+
 void ISecurityTool::ClearString(std::string& str)
 {
   std::fill(str.begin(), str.end(), '\0');
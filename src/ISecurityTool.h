@@ -12,6 +12,8 @@
 #define __ISECURITY_TOOL__
 
 #include "IErrorHandler.h"
+#include "PasswordGeneratorTool.h"
+#include "PasswordStrengthTool.h"
 
 #include <string>
 
@@ -22,6 +24,9 @@
 class ISecurityTool : public IErrorHandler {
  protected:
   std::string m_key; ///< identifies the key to be used
+  std::string m_lastRecipient; ///< key the data last decrypted was encrypted for, see GetLastRecipient()
+  PasswordGeneratorTool *m_pwdGenerator; ///< created at first use by GenPassword()
+  PasswordStrengthTool *m_pwdStrength; ///< created at first use by PasswordStrength()
  public:
   ISecurityTool(std::string pName);
   ~ISecurityTool();
@@ -33,6 +38,14 @@ class ISecurityTool : public IErrorHandler {
   virtual StatusCode SetKey(std::string pKey);
   /// Get the key associated
   virtual std::string GetKey();
+  /** Check if two key identifiers refer to the same key.
+   * Default implementation compares the identifiers literally.
+   */
+  virtual bool IsSameKey(std::string pKeyA, std::string pKeyB);
+  /** Key the data last decrypted was encrypted for, even if it cannot be used any more (e.g. revoked).
+   * Empty if not known: the default implementation does not set it.
+   */
+  virtual std::string GetLastRecipient();
 
   //------------------------------
   // --- Encryption methods
@@ -56,19 +69,21 @@ class ISecurityTool : public IErrorHandler {
   //------------------------------
   /** Check password strength.
    * Allow an integer to be returned to define password strength.
-   * See derived class for specific meaning.
+   * Default implementation uses PasswordStrengthTool with the dictionary from the configuration.
    * @param pPpwd is the password being checkes
-   * @return integer defining password strength (see derived classes)
+   * @return integer defining password strength, from 0 (too guessable) to 4 (very unguessable)
    */
-  //virtual int PasswordStrength(std::string pPpwd) = 0;
+  virtual int PasswordStrength(std::string pPwd);
 
   /** Generate a password.
    * Routine used to generate a new random and possibly strong password.
+   * Default implementation uses PasswordGeneratorTool with the policies from the configuration.
    * @param pPpwd is the generated password
+   * @param pPolicy name of the password policy (empty: "Default")
    * @return the status of the operation
    * @todo Think to make GenPassword and GetHash as static functions
    */
-  //virtual StatusCode GenPassword(std::string &pPwd) = 0;
+  virtual StatusCode GenPassword(std::string &pPwd, std::string pPolicy="");
 
   // --- Hash functions
   /** Get Hash of the string.
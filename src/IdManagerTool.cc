@@ -25,66 +25,99 @@ IdManagerTool::~IdManagerTool()
 
 }
 
-unsigned long IdManagerTool::GetNewId(std::string pSource)
+IdManagerTool::Slot *IdManagerTool::FindSlot(unsigned long pId)
 {
-  // for now use plain incremental Ids, start from 1.
-  unsigned long newId=0; //zero is reserved, and indicates an error
-  newId = m_idData.size()+1;
-  m_idData[newId] = pSource;
-
-  *log << ILog::DEBUG << "New Id requested: " << newId << " for source: " << pSource << this << ILog::endmsg;
-
-  return newId;
+  unsigned long slot = pId & s_slotMask;
+  if (slot == 0 || slot > m_slots.size())
+    return 0;
+  Slot *pSlot = &m_slots[slot - 1];
+  if (pSlot->source < 0 || pSlot->generation != (pId >> s_slotBits))
+    return 0; //free, or reused since pId was freed
+  return pSlot;
 }
 
-string IdManagerTool::GetSource(unsigned long pId)
+void IdManagerTool::Free(unsigned long pSlot)
 {
-  string pS;
-  idDataType::iterator idx = m_idData.find(pId);
+  m_slots[pSlot].source = -1;
+  if (m_slots[pSlot].generation == s_maxGeneration)
+    return; //no generation left: ids of the slot would be given again
+  //ids of the slot given so far are not valid any more
+  m_slots[pSlot].generation++;
+  m_freeSlots.push_back(pSlot);
+}
 
-  //debug
-  *log << ILog::DEBUG << "List of accounts in Id Manager." << this << ILog::endmsg;
-  for (idDataType::iterator itId = m_idData.begin(); itId != m_idData.end(); ++itId) {
-    *log << ILog::DEBUG << itId->first << " - " << itId->second << this << ILog::endmsg;
+unsigned long IdManagerTool::GetNewId(std::string pSource)
+{
+  lock_guard<mutex> lock(m_mutex);
+  // reuse a free slot if any, start from 1.
+  unsigned long slot;
+  if (not m_freeSlots.empty()) {
+    slot = m_freeSlots.back();
+    m_freeSlots.pop_back();
+  } else {
+    if (m_slots.size() >= s_slotMask) {
+      *log << ILog::ERROR << "No more Ids available for source: " << pSource << this << ILog::endmsg;
+      return 0; //zero is reserved, and indicates an error
+    }
+    slot = m_slots.size();
+    Slot newSlot;
+    newSlot.generation = 0;
+    m_slots.push_back(newSlot);
   }
-
-
-  if (idx != m_idData.end()) {
-    //found
-    pS = idx->second;
-    *log << ILog::DEBUG << "Requested source for Id: " << pId << ". Found it: " << pS << this << ILog::endmsg;
+  map<string, int>::iterator its = m_sourceIndex.find(pSource);
+  if (its == m_sourceIndex.end()) {
+    its = m_sourceIndex.insert(make_pair(pSource, (int)m_sources.size())).first;
+    m_sources.push_back(pSource);
   }
-  return pS;
+  m_slots[slot].source = its->second;
+  return (m_slots[slot].generation << s_slotBits) | (slot + 1);
+}
+
+string IdManagerTool::GetSource(unsigned long pId)
+{
+  lock_guard<mutex> lock(m_mutex);
+  Slot *pSlot = FindSlot(pId);
+  if (!pSlot)
+    return string();
+  return m_sources[pSlot->source];
 }
 
 vector<unsigned long> IdManagerTool::GetIdList(std::string pSource)
 {
+  lock_guard<mutex> lock(m_mutex);
   vector<unsigned long> rIds;
-  for (idDataType::iterator idx = m_idData.begin(); idx != m_idData.end(); ++idx) {
-    if (idx->second == pSource)
-      rIds.push_back(idx->first);
+  map<string, int>::iterator its = m_sourceIndex.find(pSource);
+  if (its == m_sourceIndex.end())
+    return rIds;
+  for (unsigned long slot=0; slot < m_slots.size(); slot++) {
+    if (m_slots[slot].source == its->second)
+      rIds.push_back((m_slots[slot].generation << s_slotBits) | (slot + 1));
   }
   return rIds;
 }
 
 IErrorHandler::StatusCode IdManagerTool::FreeId(unsigned long pId)
 {
-  idDataType::iterator idx = m_idData.find(pId);
-  if (idx == m_idData.end()) {
+  lock_guard<mutex> lock(m_mutex);
+  Slot *pSlot = FindSlot(pId);
+  if (!pSlot) {
     //not found
     log->say(ILog::WARNING, string("Requested to free un-managed Id."));
     return SC_WARNING;
   }
-  m_idData.erase(idx);
+  Free(pSlot - &m_slots[0]);
   return SC_OK;
 }
   
 IErrorHandler::StatusCode IdManagerTool::FreeIdBySource(std::string pSource)
 {
-  for (idDataType::iterator idx = m_idData.begin(); idx != m_idData.end(); ++idx) {
-    if (idx->second == pSource) {
-      m_idData.erase(idx); 
-    }
+  lock_guard<mutex> lock(m_mutex);
+  map<string, int>::iterator its = m_sourceIndex.find(pSource);
+  if (its == m_sourceIndex.end())
+    return SC_OK;
+  for (unsigned long slot=0; slot < m_slots.size(); slot++) {
+    if (m_slots[slot].source == its->second)
+      Free(slot);
   }
   return SC_OK;
 }
@@ -16,15 +16,46 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <mutex>
 
 /** Tool for managing id <--> source connections
  * Provides unique id for new records, allows association Id <--> source.
+ * Shared by all the sources, which can use it from different threads.
+ *
+ * Ids are slots of a table, reused once freed: the lower bits of an id are its slot (plus one,
+ * zero is not a valid id), the upper bits the generation of the slot, increased at each FreeId().
+ * An id freed is then never valid again, even when its slot is reused: a slot whose generation
+ * reached s_maxGeneration is not reused, so ids always fit an unsigned long and never wrap.
+ * Sources are stored once, each slot keeps the index of its source.
  */
 class IdManagerTool : public IErrorHandler {
  protected:
-  typedef std::map<unsigned long, std::string> idDataType;
-  ///map to store id <--> source associations
-  std::map<unsigned long, std::string> m_idData;  
+  /// Bits of an id for the slot, the remaining ones are for its generation
+  static const unsigned int s_slotBits = 24;
+  static const unsigned long s_slotMask = (1UL << s_slotBits) - 1;
+  /// Last generation of a slot
+  static const unsigned long s_maxGeneration = ~0UL >> s_slotBits;
+
+  /// Slot of the table of ids
+  struct Slot {
+    unsigned long generation; ///< increased when the id of the slot is freed
+    int source; ///< index of the source in m_sources, -1 if the slot is free
+  };
+  ///slots of the ids, the slot of an id is at (id & s_slotMask) - 1
+  std::vector<Slot> m_slots;
+  ///free slots, the last one is reused first
+  std::vector<unsigned long> m_freeSlots;
+  ///sources of the ids, each stored once
+  std::vector<std::string> m_sources;
+  ///index of each source in m_sources
+  std::map<std::string, int> m_sourceIndex;
+  ///protects all data members
+  std::mutex m_mutex;
+
+  /// Slot of a valid id, 0 if it is not valid (freed or never given)
+  Slot *FindSlot(unsigned long pId);
+  /// Free a slot in use
+  void Free(unsigned long pSlot);
  public:
   IdManagerTool(std::string pName);
   virtual ~IdManagerTool();
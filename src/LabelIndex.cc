@@ -0,0 +1,287 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: LabelIndex.cc
+ Description: Index of the records by label, with boolean label queries
+ Last Modified: $Id$
+*/
+
+#include "LabelIndex.h"
+
+#include "ARecord.h"
+#include "MiscUtils.h"
+
+#include <algorithm>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+  /// Error message with the position in the query
+  bool QueryError(string &pError, const string &pReason, size_t pPos)
+  {
+    ostringstream msg;
+    msg << pReason << " at position " << pPos;
+    pError = msg.str();
+    return false;
+  }
+}
+
+LabelIndex::LabelIndex()
+{
+
+}
+
+LabelIndex::~LabelIndex()
+{
+
+}
+
+uint32_t LabelIndex::GetId(const string &pLabel)
+{
+  map<string, uint32_t>::iterator itId = m_ids.find(pLabel);
+  if (itId != m_ids.end())
+    return itId->second;
+  uint32_t id = m_labels.size();
+  m_ids[pLabel] = id;
+  m_labels.push_back(pLabel);
+  m_foldedLabels.push_back(CSMUtils::FoldCase(pLabel));
+  m_slots.push_back(RoaringBitmap());
+  return id;
+}
+
+vector<uint32_t> LabelIndex::GetIds(ARecord *pRecord)
+{
+  vector<uint32_t> ids;
+  for (ARecord::TLabelsIterator itL = pRecord->GetLabelsIterBegin(); itL != pRecord->GetLabelsIterEnd(); ++itL)
+    ids.push_back(GetId(*itL));
+  sort(ids.begin(), ids.end());
+  ids.erase(unique(ids.begin(), ids.end()), ids.end());
+  return ids;
+}
+
+bool LabelIndex::Set(size_t pSlot, ARecord *pRecord)
+{
+  if (pSlot >= m_slotLabels.size())
+    m_slotLabels.resize(pSlot + 1);
+  vector<uint32_t> ids = GetIds(pRecord);
+  vector<uint32_t> &oldIds = m_slotLabels[pSlot];
+  if (ids == oldIds)
+    return false;
+  //only touch the labels which changed
+  vector<uint32_t> removed, added;
+  set_difference(oldIds.begin(), oldIds.end(), ids.begin(), ids.end(), back_inserter(removed));
+  set_difference(ids.begin(), ids.end(), oldIds.begin(), oldIds.end(), back_inserter(added));
+  for (vector<uint32_t>::iterator itId = removed.begin(); itId != removed.end(); ++itId)
+    m_slots[*itId].Remove(pSlot);
+  for (vector<uint32_t>::iterator itId = added.begin(); itId != added.end(); ++itId)
+    m_slots[*itId].Add(pSlot);
+  oldIds.swap(ids);
+  return true;
+}
+
+void LabelIndex::RemoveSlot(size_t pSlot)
+{
+  if (pSlot >= m_slotLabels.size())
+    return;
+  size_t last = m_slotLabels.size() - 1;
+  for (vector<uint32_t>::iterator itId = m_slotLabels[pSlot].begin(); itId != m_slotLabels[pSlot].end(); ++itId)
+    m_slots[*itId].Remove(pSlot);
+  if (pSlot != last) {
+    //move the last record in the free slot
+    for (vector<uint32_t>::iterator itId = m_slotLabels[last].begin(); itId != m_slotLabels[last].end(); ++itId) {
+      m_slots[*itId].Remove(last);
+      m_slots[*itId].Add(pSlot);
+    }
+    m_slotLabels[pSlot].swap(m_slotLabels[last]);
+  }
+  m_slotLabels.pop_back();
+}
+
+void LabelIndex::Clear()
+{
+  m_ids.clear();
+  m_labels.clear();
+  m_foldedLabels.clear();
+  m_slots.clear();
+  m_slotLabels.clear();
+}
+
+size_t LabelIndex::GetNumberOfSlots() const
+{
+  return m_slotLabels.size();
+}
+
+vector<string> LabelIndex::GetLabels() const
+{
+  vector<string> labels;
+  for (map<string, uint32_t>::const_iterator itId = m_ids.begin(); itId != m_ids.end(); ++itId)
+    if (not m_slots[itId->second].IsEmpty())
+      labels.push_back(itId->first);
+  return labels;
+}
+
+size_t LabelIndex::GetNumberOfLabels() const
+{
+  return m_labels.size();
+}
+
+const string &LabelIndex::GetLabel(uint32_t pId) const
+{
+  return m_labels[pId];
+}
+
+const string &LabelIndex::GetFoldedLabel(uint32_t pId) const
+{
+  return m_foldedLabels[pId];
+}
+
+const RoaringBitmap &LabelIndex::GetSlots(uint32_t pId) const
+{
+  return m_slots[pId];
+}
+
+RoaringBitmap LabelIndex::LabelSlots(const string &pFoldedLabel) const
+{
+  //labels differing only by case are the same for queries
+  RoaringBitmap slots;
+  for (size_t id=0; id < m_foldedLabels.size(); id++)
+    if (m_foldedLabels[id] == pFoldedLabel)
+      slots.Or(m_slots[id]);
+  return slots;
+}
+
+bool LabelIndex::Tokenize(const string &pQuery, vector<Token> &pTokens, string &pError) const
+{
+  size_t pos = 0;
+  while (pos < pQuery.size()) {
+    char c = pQuery[pos];
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+      pos++;
+      continue;
+    }
+    Token token;
+    token.pos = pos;
+    if (c == '(' || c == ')') {
+      token.type = (c == '(') ? TK_OPEN : TK_CLOSE;
+      pos++;
+    } else if (c == '"') {
+      //quoted label
+      size_t end = pQuery.find('"', pos + 1);
+      if (end == string::npos)
+	return QueryError(pError, "Missing closing quote", pos);
+      token.type = TK_LABEL;
+      token.text = CSMUtils::FoldCase(pQuery.substr(pos + 1, end - pos - 1));
+      pos = end + 1;
+    } else {
+      size_t end = pos;
+      while (end < pQuery.size() && string(" \t\n\r()\"").find(pQuery[end]) == string::npos)
+	end++;
+      string word = pQuery.substr(pos, end - pos);
+      string keyword = CSMUtils::FoldCase(word);
+      if (keyword == "and")
+	token.type = TK_AND;
+      else if (keyword == "or")
+	token.type = TK_OR;
+      else if (keyword == "not")
+	token.type = TK_NOT;
+      else {
+	token.type = TK_LABEL;
+	token.text = keyword;
+      }
+      pos = end;
+    }
+    pTokens.push_back(token);
+  }
+  return true;
+}
+
+bool LabelIndex::ParseOr(const vector<Token> &pTokens, size_t &pPos, int pDepth, RoaringBitmap &pResult, string &pError) const
+{
+  if (not ParseAnd(pTokens, pPos, pDepth, pResult, pError))
+    return false;
+  while (pPos < pTokens.size() && pTokens[pPos].type == TK_OR) {
+    pPos++;
+    RoaringBitmap operand;
+    if (not ParseAnd(pTokens, pPos, pDepth, operand, pError))
+      return false;
+    pResult.Or(operand);
+  }
+  return true;
+}
+
+bool LabelIndex::ParseAnd(const vector<Token> &pTokens, size_t &pPos, int pDepth, RoaringBitmap &pResult, string &pError) const
+{
+  if (not ParseNot(pTokens, pPos, pDepth, pResult, pError))
+    return false;
+  while (pPos < pTokens.size()) {
+    TokenType type = pTokens[pPos].type;
+    if (type == TK_AND)
+      pPos++;
+    else if (type != TK_LABEL && type != TK_NOT && type != TK_OPEN)
+      break; //not an implicit AND either
+    RoaringBitmap operand;
+    if (not ParseNot(pTokens, pPos, pDepth, operand, pError))
+      return false;
+    pResult.And(operand);
+  }
+  return true;
+}
+
+bool LabelIndex::ParseNot(const vector<Token> &pTokens, size_t &pPos, int pDepth, RoaringBitmap &pResult, string &pError) const
+{
+  if (pPos >= pTokens.size())
+    return QueryError(pError, "Missing label", pTokens.empty() ? 0 : pTokens.back().pos);
+  const Token &token = pTokens[pPos];
+  if (pDepth > MAX_QUERY_DEPTH)
+    return QueryError(pError, "Query too complex", token.pos);
+  switch (token.type) {
+  case TK_NOT:
+    {
+      pPos++;
+      RoaringBitmap operand;
+      if (not ParseNot(pTokens, pPos, pDepth + 1, operand, pError))
+	return false;
+      pResult = RoaringBitmap::Range(m_slotLabels.size());
+      pResult.AndNot(operand);
+      return true;
+    }
+  case TK_OPEN:
+    pPos++;
+    if (not ParseOr(pTokens, pPos, pDepth + 1, pResult, pError))
+      return false;
+    if (pPos >= pTokens.size() || pTokens[pPos].type != TK_CLOSE)
+      return QueryError(pError, "Missing closing parenthesis", token.pos);
+    pPos++;
+    return true;
+  case TK_LABEL:
+    pPos++;
+    pResult = LabelSlots(token.text);
+    return true;
+  default:
+    return QueryError(pError, "Missing label", token.pos);
+  }
+}
+
+bool LabelIndex::Query(const string &pQuery, RoaringBitmap &pSlots, string &pError) const
+{
+  pSlots.Clear();
+  pError.clear();
+  vector<Token> tokens;
+  if (not Tokenize(pQuery, tokens, pError))
+    return false;
+  if (tokens.empty())
+    return QueryError(pError, "Empty query", 0);
+  size_t pos = 0;
+  if (not ParseOr(tokens, pos, 0, pSlots, pError)) {
+    pSlots.Clear();
+    return false;
+  }
+  if (pos < tokens.size()) {
+    pSlots.Clear();
+    return QueryError(pError, "Unexpected token", tokens[pos].pos);
+  }
+  return true;
+}
@@ -0,0 +1,103 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: LabelIndex.h
+ Description: Index of the records by label, with boolean label queries
+ Last Modified: $Id$
+*/
+
+#ifndef __LABEL_INDEX__
+#define __LABEL_INDEX__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <stdint.h>
+
+#include "RoaringBitmap.h"
+
+class ARecord;
+
+/** Index of the records by label, with boolean label queries.
+ * Records are identified by their slot (position in the list of records of a source).
+ * Each label gets a dense id in a dictionary, and a bitmap of the slots of the records having it.
+ * The index is updated incrementally: only the labels which changed touch the bitmaps.
+ *
+ * Queries combine labels (case-insensitive) with AND, OR, NOT and parentheses, e.g.
+ * "work AND ssh AND NOT retired". Adjacent labels are implicitly joined by AND, and
+ * labels with spaces or named like an operator can be quoted: "\"home banking\" OR not".
+ */
+class LabelIndex {
+ public:
+  /// Maximum nesting of parentheses and NOT in a query
+  static const int MAX_QUERY_DEPTH = 200;
+
+ protected:
+  /// label -> id (sorted by label)
+  std::map<std::string, uint32_t> m_ids;
+  /// id -> label
+  std::vector<std::string> m_labels;
+  /// id -> case-folded label, used by queries
+  std::vector<std::string> m_foldedLabels;
+  /// id -> slots of the records having the label
+  std::vector<RoaringBitmap> m_slots;
+  /// slot -> sorted ids of the labels of its record
+  std::vector<std::vector<uint32_t> > m_slotLabels;
+
+  /// Id of pLabel, added to the dictionary if needed
+  uint32_t GetId(const std::string &pLabel);
+  /// Sorted, unique ids of the labels of a record
+  std::vector<uint32_t> GetIds(ARecord *pRecord);
+
+  // --- Queries
+  enum TokenType {TK_LABEL, TK_AND, TK_OR, TK_NOT, TK_OPEN, TK_CLOSE};
+  struct Token {
+    TokenType type;
+    std::string text; ///< folded label (TK_LABEL)
+    size_t pos; ///< position in the query, for errors
+  };
+  bool Tokenize(const std::string &pQuery, std::vector<Token> &pTokens, std::string &pError) const;
+  bool ParseOr(const std::vector<Token> &pTokens, size_t &pPos, int pDepth, RoaringBitmap &pResult, std::string &pError) const;
+  bool ParseAnd(const std::vector<Token> &pTokens, size_t &pPos, int pDepth, RoaringBitmap &pResult, std::string &pError) const;
+  bool ParseNot(const std::vector<Token> &pTokens, size_t &pPos, int pDepth, RoaringBitmap &pResult, std::string &pError) const;
+  /// Slots of the records having a label (folded)
+  RoaringBitmap LabelSlots(const std::string &pFoldedLabel) const;
+
+ public:
+  LabelIndex();
+  ~LabelIndex();
+
+  /** Index the record in pSlot (a new slot if pSlot is the number of slots).
+   * @return true if its labels changed
+   */
+  bool Set(size_t pSlot, ARecord *pRecord);
+  /// Remove the record in pSlot: the one in the last slot takes its place (see SingleSourceIOSvc::Remove)
+  void RemoveSlot(size_t pSlot);
+  /// Remove all records
+  void Clear();
+  /// Number of slots indexed
+  size_t GetNumberOfSlots() const;
+
+  /// Labels used by at least one record, sorted
+  std::vector<std::string> GetLabels() const;
+  /// Number of label ids (including labels not used any more)
+  size_t GetNumberOfLabels() const;
+  /// Label with id pId
+  const std::string &GetLabel(uint32_t pId) const;
+  /// Case-folded label with id pId
+  const std::string &GetFoldedLabel(uint32_t pId) const;
+  /// Slots of the records with label pId
+  const RoaringBitmap &GetSlots(uint32_t pId) const;
+
+  /** Evaluate a label query.
+   * @param pQuery the query, see LabelIndex
+   * @param pSlots slots of the matching records
+   * @param pError reason why the query is not valid
+   * @return false if the query is not valid
+   */
+  bool Query(const std::string &pQuery, RoaringBitmap &pSlots, std::string &pError) const;
+};
+
+#endif
@@ -154,6 +154,77 @@ IErrorHandler::StatusCode LocalConfigSimpleTxt::SetLocalVar(string key, vector<s
       predefinedAccountTypes.push_back(ARecord(accName, accFormStr));
       *log << ILog::VERBOSE << "New predefined account type: " << accName << " -> " << accFormStr << this << ILog::endmsg;
     }
+  } else if (key == "secretfieldnames") {
+    m_statusCode = GetKeyValue(secretFieldNames, values);
+    *log << ILog::VERBOSE << "Set " << key << " to: " << CSMUtils::CreateListStr(secretFieldNames) << this << ILog::endmsg;
+  } else if (key == "passwordpolicy") {
+    //special syntax: policy name, then comma-separated option=value pairs
+    PasswordGeneratorTool::PasswordPolicy policy;
+    m_statusCode = GetKeyValue(policy, values);
+    if (m_statusCode == SC_OK) {
+      AddPasswordPolicy(policy);
+      *log << ILog::VERBOSE << "New password policy: " << policy.str() << this << ILog::endmsg;
+    }
+  } else if (key == "dicewarewordlist") {
+    resolveEnvVariables(values);
+    m_statusCode = GetKeyValue(dicewareWordList, values);
+    *log << ILog::VERBOSE << "Set " << key << " to: " << dicewareWordList << this << ILog::endmsg;
+  } else if (key == "strengthdictionary") {
+    resolveEnvVariables(values);
+    m_statusCode = GetKeyValue(strengthDictionary, values);
+    *log << ILog::VERBOSE << "Set " << key << " to: " << strengthDictionary << this << ILog::endmsg;
+  } else if (key == "breachcorpus") {
+    resolveEnvVariables(values);
+    m_statusCode = GetKeyValue(breachCorpus, values);
+    *log << ILog::VERBOSE << "Set " << key << " to: " << breachCorpus << this << ILog::endmsg;
+  } else if (key == "breachfilter") {
+    resolveEnvVariables(values);
+    m_statusCode = GetKeyValue(breachFilter, values);
+    *log << ILog::VERBOSE << "Set " << key << " to: " << breachFilter << this << ILog::endmsg;
+  } else if (key == "fuzzymaxresults") {
+    m_statusCode = GetKeyValue(fuzzyMaxResults, values);
+    if (fuzzyMaxResults < 0) {
+      *log << ILog::WARNING << "Invalid value for " << key << ", using 10" << this << ILog::endmsg;
+      fuzzyMaxResults = 10;
+    }
+    *log << ILog::VERBOSE << "Set " << key << " to: " << fuzzyMaxResults << this << ILog::endmsg;
+  } else if (key == "writebehind") {
+    m_statusCode = GetKeyValue(writeBehind, values);
+    *log << ILog::VERBOSE << "Set " << key << " to: " << writeBehind << this << ILog::endmsg;
+  } else if (key == "writebehinddelay") {
+    m_statusCode = GetKeyValue(writeBehindDelay, values);
+    if (writeBehindDelay < 0) {
+      *log << ILog::WARNING << "Invalid value for " << key << ", using 1000" << this << ILog::endmsg;
+      writeBehindDelay = 1000;
+    }
+    *log << ILog::VERBOSE << "Set " << key << " to: " << writeBehindDelay << this << ILog::endmsg;
+  } else if (key == "loadondemand") {
+    m_statusCode = GetKeyValue(loadOnDemand, values);
+    *log << ILog::VERBOSE << "Set " << key << " to: " << loadOnDemand << this << ILog::endmsg;
+  } else if (key == "sourceidletimeout") {
+    m_statusCode = GetKeyValue(sourceIdleTimeout, values);
+    if (sourceIdleTimeout < 0) {
+      *log << ILog::WARNING << "Invalid value for " << key << ", using 0" << this << ILog::endmsg;
+      sourceIdleTimeout = 0;
+    }
+    *log << ILog::VERBOSE << "Set " << key << " to: " << sourceIdleTimeout << this << ILog::endmsg;
+  } else if (key == "sourcememorybudget") {
+    m_statusCode = GetKeyValue(sourceMemoryBudget, values);
+    if (sourceMemoryBudget < 0) {
+      *log << ILog::WARNING << "Invalid value for " << key << ", using 0" << this << ILog::endmsg;
+      sourceMemoryBudget = 0;
+    }
+    *log << ILog::VERBOSE << "Set " << key << " to: " << sourceMemoryBudget << this << ILog::endmsg;
+  } else if (key == "sealrecords") {
+    m_statusCode = GetKeyValue(sealRecords, values);
+    *log << ILog::VERBOSE << "Set " << key << " to: " << sealRecords << this << ILog::endmsg;
+  } else if (key == "sealcachesize") {
+    m_statusCode = GetKeyValue(sealCacheSize, values);
+    if (sealCacheSize <= 0) {
+      *log << ILog::WARNING << "Invalid value for " << key << ", using 64" << this << ILog::endmsg;
+      sealCacheSize = 64;
+    }
+    *log << ILog::VERBOSE << "Set " << key << " to: " << sealCacheSize << this << ILog::endmsg;
   } else if (key == "topmessage") {
     m_statusCode = GetKeyValue(topMessage, values);
     *log << ILog::VERBOSE << "Set " << key << " to: " << topMessage << this << ILog::endmsg;
@@ -216,6 +287,8 @@ IErrorHandler::StatusCode LocalConfigSimpleTxt::GetKeyValue(SearchRequest::Searc
   if (searchTypeStr == "TXT") target=SearchRequest::TXT;
   else if (searchTypeStr == "EXACT") target = SearchRequest::EXACT;
   else if (searchTypeStr == "REGEX") target = SearchRequest::REGEX;
+  else if (searchTypeStr == "FUZZY") target = SearchRequest::FUZZY;
+  else if (searchTypeStr == "QUERY") target = SearchRequest::QUERY;
   else {
     *log << ILog::WARNING << "Invalid SearchType value: " << input[0] << this << ILog::endmsg;
     return SC_WARNING;
@@ -245,6 +318,54 @@ IErrorHandler::StatusCode LocalConfigSimpleTxt::GetKeyValue(ILog::ILogMsgType& t
   return SC_OK;
 }
 
+IErrorHandler::StatusCode LocalConfigSimpleTxt::GetKeyValue(PasswordGeneratorTool::PasswordPolicy& target, vector<string> input)
+{
+  if (input.size() == 0 || CSMUtils::TrimStr(input[0]).empty()) {
+    *log << ILog::WARNING << "Password policy without a name" << this << ILog::endmsg;
+    return SC_WARNING;
+  }
+  PasswordGeneratorTool::PasswordPolicy policy(CSMUtils::TrimStr(input[0]));
+  for (vector<string>::iterator itV = input.begin()+1; itV != input.end(); ++itV) {
+    size_t idxSep = itV->find('=');
+    if (idxSep == string::npos) {
+      *log << ILog::WARNING << "Invalid password policy option: " << *itV << this << ILog::endmsg;
+      return SC_WARNING;
+    }
+    string option = CSMUtils::TrimStr(itV->substr(0, idxSep));
+    string value = CSMUtils::TrimStr(itV->substr(idxSep+1));
+    vector<string> valueList(1, value);
+    std::transform(option.begin(), option.end(), option.begin(), ::tolower);
+    StatusCode sc = SC_OK;
+    if (option == "length") {
+      sc = GetKeyValue(policy.length, valueList);
+    } else if (option == "words") {
+      sc = GetKeyValue(policy.words, valueList);
+    } else if (option == "classes") {
+      policy.classes = value;
+    } else if (option == "separator") {
+      policy.separator = (value == "space") ? string(" ") : value;
+    } else if (option == "mode") {
+      std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+      if (value == "random") policy.mode = PasswordGeneratorTool::GEN_RANDOM;
+      else if (value == "pronounceable") policy.mode = PasswordGeneratorTool::GEN_PRONOUNCEABLE;
+      else if (value == "diceware") policy.mode = PasswordGeneratorTool::GEN_DICEWARE;
+      else sc = SC_WARNING;
+    } else {
+      sc = SC_WARNING;
+    }
+    if (sc != SC_OK) {
+      *log << ILog::WARNING << "Invalid password policy option: " << *itV << this << ILog::endmsg;
+      return SC_WARNING;
+    }
+  }
+  if (not policy.IsValid()) {
+    *log << ILog::WARNING << "Password policy can't generate any password: " << policy.str() << this << ILog::endmsg;
+    return SC_WARNING;
+  }
+  target = policy;
+  return SC_OK;
+}
+
 IErrorHandler::StatusCode LocalConfigSimpleTxt::resolveEnvVariables(std::vector<std::string>& values)
 {
   for (vector<string>::iterator itV = values.begin(); itV != values.end(); ++itV) {
@@ -12,6 +12,7 @@
 
 #include "ILocalConfigurationService.h"
 #include "ISearchTool.h"
+#include "PasswordGeneratorTool.h"
 
 #include <fstream>
 #include <string>
@@ -48,6 +49,7 @@ class LocalConfigSimpleTxt : public ILocalConfigurationService {
   StatusCode GetKeyValue(int &target, std::vector<std::string> input);
   StatusCode GetKeyValue(SearchRequest::SearchType& target, std::vector<std::string> input);
   StatusCode GetKeyValue(ILog::ILogMsgType& target, std::vector<std::string> input);
+  StatusCode GetKeyValue(PasswordGeneratorTool::PasswordPolicy& target, std::vector<std::string> input);
 
   //Translate environment variables
   StatusCode resolveEnvVariables(std::vector<std::string>& values);
@@ -14,6 +14,9 @@
 #include <string>
 #include <sstream>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
 
 
 extern ILog *log;
@@ -67,23 +70,47 @@ IErrorHandler::StatusCode LocalFileStorageTool::Store(std::string &pData)
     }    
   } //FileExists(...)
 
-  //ok, now open, write and return
-  log->say(ILog::INFO, string("Opening file ") + fileName, "LocalFileStorageTool");  
-  m_file.open(fileName.c_str(), fstream::out | fstream::trunc);
+  //ok, now write to a temporary file and move it over the original one:
+  // an interrupted write never leaves a truncated source behind
+  string tmpFileName = fileName + string(".tmp");
+  log->say(ILog::INFO, string("Opening file ") + tmpFileName, "LocalFileStorageTool");  
+  m_file.open(tmpFileName.c_str(), fstream::out | fstream::trunc);
   if (!m_file.is_open()) {
     //Error opening output file
-    log->say(ILog::ERROR, string("Error opening output file ") + fileName, this);
+    log->say(ILog::ERROR, string("Error opening output file ") + tmpFileName, this);
     return m_statusCode = SC_ERROR;
   }
   try {
     m_file << pData;
+    m_file.flush();
   } catch (char *str) {
     //Error I/O
-    log->say(ILog::ERROR, string("I/O Error while writing output file ") + fileName + 
-	     string(". You can recovery backup file (if exists) in ") + backupFileName, this);
-    return m_statusCode = SC_ERROR;
+    m_file.setstate(ios::badbit);
   }
+  bool writeFailed = m_file.fail();
   m_file.close();
+  if (writeFailed) {
+    log->say(ILog::ERROR, string("I/O Error while writing output file ") + tmpFileName + 
+	     string(". Original file left untouched: ") + fileName, this);
+    unlink(tmpFileName.c_str());
+    return m_statusCode = SC_ERROR;
+  }
+  //keep permissions of the file being replaced
+  struct stat origFileInfo;
+  if (stat(fileName.c_str(), &origFileInfo) == 0)
+    chmod(tmpFileName.c_str(), origFileInfo.st_mode & 07777);
+  //make sure data reached the disk before swapping
+  int tmpFd = open(tmpFileName.c_str(), O_RDONLY);
+  if (tmpFd >= 0) {
+    fsync(tmpFd);
+    close(tmpFd);
+  }
+  if (rename(tmpFileName.c_str(), fileName.c_str()) != 0) {
+    log->say(ILog::ERROR, string("Cannot move ") + tmpFileName + string(" to ") + fileName + 
+	     string(". Original file left untouched."), this);
+    unlink(tmpFileName.c_str());
+    return m_statusCode = SC_ERROR;
+  }
 
   return SC_OK;
 }
@@ -35,7 +35,9 @@ class LocalFileStorageTool : public IStorageTool {
 
   /** Store to file.
    * See IStorageTool::Store for parameters.
-   * Overwrites previous data.
+   * Overwrites previous data. A copy of the previous file is kept with extension '.bak'.
+   * Data is written to a temporary file first, then renamed over the original one,
+   * so that the file is always either the old or the new version.
    */
   virtual StatusCode Store(std::string &pData);  
 
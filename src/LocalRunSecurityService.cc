@@ -0,0 +1,250 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: LocalRunSecurityService.cc
+ Description: Implementation of IRunningSecurityService checking the local running environment
+ Last Modified: $Id$
+*/
+
+#include "LocalRunSecurityService.h"
+#include "ILog.h"
+
+#include <fstream>
+#include <sstream>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#include <sys/sysmacros.h>
+#endif
+
+//external definitions
+extern ILog *log;
+
+using namespace std;
+
+namespace {
+  inline void Downgrade(IRunningSecurityService::RunSecurityResult &pResult, IRunningSecurityService::RunSecurityResult pCheck)
+  {
+    if (pCheck < pResult)
+      pResult = pCheck;
+  }
+}
+
+LocalRunSecurityService::LocalRunSecurityService(string pName) : IRunningSecurityService(pName)
+{
+  Harden();
+}
+
+LocalRunSecurityService::~LocalRunSecurityService()
+{
+
+}
+
+void LocalRunSecurityService::Harden()
+{
+  //cheap system calls only: this runs at start-up, before any secret is loaded
+  struct rlimit noCore;
+  noCore.rlim_cur = 0;
+  noCore.rlim_max = 0;
+  setrlimit(RLIMIT_CORE, &noCore);
+#ifdef __linux__
+  prctl(PR_SET_DUMPABLE, 0, 0, 0, 0);
+#endif
+}
+
+IRunningSecurityService::RunSecurityResult LocalRunSecurityService::CheckTracer()
+{
+  ifstream status("/proc/self/status");
+  if (!status.is_open()) {
+    *log << ILog::VERBOSE << "Cannot check if the process is traced" << this << ILog::endmsg;
+    return SAFE;
+  }
+  string line;
+  while (getline(status, line)) {
+    if (line.compare(0, 10, "TracerPid:") != 0)
+      continue;
+    long tracerPid = atol(line.c_str() + 10);
+    if (tracerPid != 0) {
+      *log << ILog::ERROR << "Process is being traced by process " << (int)tracerPid << this << ILog::endmsg;
+      return FATAL;
+    }
+    return SAFE;
+  }
+  return SAFE;
+}
+
+IRunningSecurityService::RunSecurityResult LocalRunSecurityService::CheckCoreDumps()
+{
+  RunSecurityResult result = SAFE;
+  struct rlimit coreLimit;
+  if (getrlimit(RLIMIT_CORE, &coreLimit) == 0 && coreLimit.rlim_cur != 0) {
+    *log << ILog::WARNING << "Core dumps are enabled: memory may be written to disk on crashes" << this << ILog::endmsg;
+    result = WARNING;
+  }
+#ifdef __linux__
+  if (prctl(PR_GET_DUMPABLE, 0, 0, 0, 0) != 0) {
+    *log << ILog::WARNING << "Process is dumpable: other processes of the user may read its memory" << this << ILog::endmsg;
+    result = WARNING;
+  }
+#endif
+  return result;
+}
+
+IRunningSecurityService::RunSecurityResult LocalRunSecurityService::CheckPreload()
+{
+  RunSecurityResult result = SAFE;
+  const char *preloadVars[] = {"LD_PRELOAD", "LD_AUDIT", "DYLD_INSERT_LIBRARIES", 0};
+  for (int k=0; preloadVars[k]; k++) {
+    const char *value = getenv(preloadVars[k]);
+    if (value && *value) {
+      *log << ILog::WARNING << preloadVars[k] << " is set, libraries are injected: " << value << this << ILog::endmsg;
+      result = WARNING;
+    }
+  }
+  struct stat preloadInfo;
+  if (stat("/etc/ld.so.preload", &preloadInfo) == 0 && preloadInfo.st_size > 0) {
+    *log << ILog::WARNING << "Libraries are injected in every process by /etc/ld.so.preload" << this << ILog::endmsg;
+    result = WARNING;
+  }
+  return result;
+}
+
+IRunningSecurityService::RunSecurityResult LocalRunSecurityService::CheckPermissions(string pPath)
+{
+  struct stat fileInfo;
+  if (stat(pPath.c_str(), &fileInfo) != 0)
+    return SAFE; //not there (yet)
+  RunSecurityResult result = SAFE;
+  if (fileInfo.st_mode & S_IWOTH) {
+    *log << ILog::ERROR << "File can be modified by any user: " << pPath << this << ILog::endmsg;
+    return FATAL;
+  }
+  if (fileInfo.st_uid != getuid() && fileInfo.st_uid != 0) {
+    *log << ILog::WARNING << "File is owned by another user: " << pPath << this << ILog::endmsg;
+    result = WARNING;
+  }
+  //anybody able to write in one of the parent directories can replace the file
+  string dir = pPath;
+  while (true) {
+    size_t slash = dir.find_last_of('/');
+    if (slash == string::npos)
+      dir = ".";
+    else
+      dir = (slash == 0 ? string("/") : dir.substr(0, slash));
+    struct stat dirInfo;
+    if (stat(dir.c_str(), &dirInfo) == 0 && (dirInfo.st_mode & S_IWOTH) && not (dirInfo.st_mode & S_ISVTX)) {
+      *log << ILog::WARNING << "Directory can be modified by any user: " << dir << " (contains " << pPath << ")"
+	   << this << ILog::endmsg;
+      result = WARNING;
+    }
+    if (dir == "/" || dir == ".")
+      break;
+  }
+  return result;
+}
+
+IRunningSecurityService::RunSecurityResult LocalRunSecurityService::CheckMemoryLock()
+{
+  long pageSize = sysconf(_SC_PAGESIZE);
+  if (pageSize <= 0)
+    pageSize = 4096;
+  void *page = mmap(0, pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (page == MAP_FAILED)
+    return SAFE; //cannot tell
+  RunSecurityResult result = SAFE;
+  if (mlock(page, pageSize) != 0) {
+    *log << ILog::WARNING << "Memory cannot be locked: keys may be written to swap" << this << ILog::endmsg;
+    result = WARNING;
+  } else {
+    munlock(page, pageSize);
+  }
+  munmap(page, pageSize);
+  return result;
+}
+
+bool LocalRunSecurityService::IsEncryptedDevice(string pSysPath, int pDepth)
+{
+  if (pDepth > 8)
+    return false; //no such stacks of devices
+  ifstream uuidFile((pSysPath + "/dm/uuid").c_str());
+  string uuid;
+  if (uuidFile.is_open() && getline(uuidFile, uuid) && uuid.compare(0, 6, "CRYPT-") == 0)
+    return true;
+  //partition: look at the whole device
+  struct stat partInfo;
+  if (stat((pSysPath + "/partition").c_str(), &partInfo) == 0 && IsEncryptedDevice(pSysPath + "/..", pDepth + 1))
+    return true;
+  //device mapper or md on top of other devices (e.g. LVM on LUKS)
+  DIR *slaves = opendir((pSysPath + "/slaves").c_str());
+  if (!slaves)
+    return false;
+  bool encrypted = false;
+  struct dirent *entry;
+  while (not encrypted && (entry = readdir(slaves)) != 0) {
+    string name = entry->d_name;
+    if (name == "." || name == "..")
+      continue;
+    encrypted = IsEncryptedDevice("/sys/class/block/" + name, pDepth + 1);
+  }
+  closedir(slaves);
+  return encrypted;
+}
+
+IRunningSecurityService::RunSecurityResult LocalRunSecurityService::CheckSwap()
+{
+  ifstream swaps("/proc/swaps");
+  if (!swaps.is_open()) {
+    *log << ILog::VERBOSE << "Cannot check swap encryption" << this << ILog::endmsg;
+    return SAFE;
+  }
+  RunSecurityResult result = SAFE;
+  string line;
+  getline(swaps, line); //header
+  while (getline(swaps, line)) {
+    istringstream fields(line);
+    string swapName;
+    fields >> swapName;
+    if (swapName.empty())
+      continue;
+    if (swapName.compare(0, 9, "/dev/zram") == 0)
+      continue; //compressed RAM, never on disk
+#ifdef __linux__
+    struct stat swapInfo;
+    if (stat(swapName.c_str(), &swapInfo) == 0) {
+      dev_t dev = S_ISBLK(swapInfo.st_mode) ? swapInfo.st_rdev : swapInfo.st_dev; //device or file system holding the file
+      ostringstream sysPath;
+      sysPath << "/sys/dev/block/" << major(dev) << ":" << minor(dev);
+      if (IsEncryptedDevice(sysPath.str()))
+	continue;
+    }
+#endif
+    *log << ILog::WARNING << "Swap is not encrypted (or cannot tell): " << swapName << this << ILog::endmsg;
+    result = WARNING;
+  }
+  return result;
+}
+
+IRunningSecurityService::RunSecurityResult LocalRunSecurityService::Run()
+{
+  RunSecurityResult result = SAFE;
+  Downgrade(result, CheckTracer());
+  Downgrade(result, CheckCoreDumps());
+  Downgrade(result, CheckPreload());
+  for (vector<string>::iterator itp = m_sensitivePaths.begin(); itp != m_sensitivePaths.end(); ++itp)
+    Downgrade(result, CheckPermissions(*itp));
+  Downgrade(result, CheckMemoryLock());
+  Downgrade(result, CheckSwap());
+  if (result == SAFE)
+    log->say(ILog::INFO, "Running security checks: Passed.", this);
+  else
+    *log << ILog::WARNING << "Running security checks: reduced security (" << (int)result << ")" << this << ILog::endmsg;
+  return result;
+}
@@ -0,0 +1,48 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: LocalRunSecurityService.h
+ Description: Implementation of IRunningSecurityService checking the local running environment
+ Last Modified: $Id$
+*/
+
+#ifndef __LOCALRUNSECURITY_SERVICE__
+#define __LOCALRUNSECURITY_SERVICE__
+
+#include "IRunningSecurityService.h"
+
+/** Implementation of IRunningSecurityService checking the local running environment.
+ * The process is hardened at construction (no core dumps, not dumpable, hence not
+ * traceable by other processes of the user). Run() then checks:
+ * - FATAL: the process is being traced; a sensitive file is world-writable
+ * - WARNING: the hardening could not be applied; libraries are pre-loaded (LD_PRELOAD,
+ *   /etc/ld.so.preload); a directory containing a sensitive file can be written by anyone;
+ *   memory cannot be locked; swap is not encrypted
+ * Checks which are not available on the system are skipped.
+ */
+class LocalRunSecurityService : public IRunningSecurityService {
+ protected:
+  /// Disable core dumps and make the process non-dumpable
+  void Harden();
+
+  // --- Single checks, each logs its own findings
+  RunSecurityResult CheckTracer();
+  RunSecurityResult CheckCoreDumps();
+  RunSecurityResult CheckPreload();
+  RunSecurityResult CheckPermissions(std::string pPath);
+  RunSecurityResult CheckMemoryLock();
+  RunSecurityResult CheckSwap();
+
+  /// True if the block device in /sys (pSysPath) is, or sits on top of, an encrypted (dm-crypt) device
+  bool IsEncryptedDevice(std::string pSysPath, int pDepth=0);
+ public:
+  LocalRunSecurityService(std::string pName); ///< applies Harden()
+  ~LocalRunSecurityService();
+
+  /// Perform all checks, return the worst result. Log findings.
+  virtual RunSecurityResult Run();
+};
+
+#endif
@@ -74,6 +74,7 @@ void LogLocalFile::say(ILogMsgType msgType, std::string msg, std::string callerO
   }
 
   //Log the event
+  std::lock_guard<std::mutex> lock(m_writeMutex);
   m_localFile << "[" << m_msgTypeStr[msgType] << "] ";
   for (int i=m_msgTypeStr[msgType].size(); i<= 12; i++)
     m_localFile << " "; //fill space
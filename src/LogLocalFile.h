@@ -15,6 +15,7 @@
 
 #include <iostream>
 #include <fstream>
+#include <mutex>
 
 /// Implements ILog interface on local files. 
 class LogLocalFile : public ILog {
@@ -23,6 +24,8 @@ class LogLocalFile : public ILog {
   std::string m_localFileName;
   /// ofstream object to write to local file
   std::ofstream m_localFile;
+  /// Serialize writes to m_localFile from concurrent threads
+  std::mutex m_writeMutex;
 
  public:
   /// Open/close logging file
@@ -11,6 +11,10 @@
 #include "MiscUtils.h"
 
 #include <sstream>
+#include <thread>
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
 
 using namespace std;
 
@@ -105,3 +109,244 @@ int CSMUtils::parseStrDate(std::string timeStr, struct tm *returnTime)
   if (not hasValidTime) return 1;
   return 0;
 }
+
+void CSMUtils::ParallelFor(size_t pN, std::function<void(size_t)> pTask, size_t pMaxThreads)
+{
+  size_t nThreads = pMaxThreads;
+  if (nThreads == 0)
+    nThreads = std::thread::hardware_concurrency();
+  if (nThreads > pN)
+    nThreads = pN;
+  if (nThreads <= 1) {
+    //nothing to parallelize
+    for (size_t idx=0; idx < pN; idx++)
+      pTask(idx);
+    return;
+  }
+  std::atomic<size_t> nextIdx(0);
+  vector<std::thread> workers;
+  for (size_t t=0; t < nThreads; t++) {
+    workers.push_back(std::thread([&nextIdx, &pTask, pN]() {
+	  size_t idx;
+	  while ((idx = nextIdx++) < pN)
+	    pTask(idx);
+	}));
+  }
+  for (vector<std::thread>::iterator itw = workers.begin(); itw != workers.end(); ++itw)
+    itw->join();
+}
+
+// ----------------------------------------
+// --- Text utilities
+// ----------------------------------------  
+
+namespace {
+  /// Simple case folding of a code point (ß and ẞ are handled by the caller)
+  uint32_t FoldCodePoint(uint32_t c)
+  {
+    if (c < 0x80)
+      return (c >= 'A' && c <= 'Z') ? c + 32 : c;
+    // - Latin
+    if (c >= 0xC0 && c <= 0xDE && c != 0xD7)
+      return c + 32;
+    if (c == 0xB5)
+      return 0x3BC; //micro sign -> mu
+    if (c >= 0x100 && c <= 0x17F) {
+      if (c == 0x130) return 'i';
+      if (c == 0x131 || c == 0x138 || c == 0x149) return c;
+      if (c == 0x178) return 0xFF;
+      if (c == 0x17F) return 's';
+      if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E))
+	return (c & 1) ? c + 1 : c;
+      return (c & 1) ? c : c + 1;
+    }
+    if (c >= 0x1CD && c <= 0x1DC)
+      return (c & 1) ? c + 1 : c;
+    if ((c >= 0x1DE && c <= 0x1EF) || (c >= 0x1F8 && c <= 0x21F) ||
+	(c >= 0x1E00 && c <= 0x1E95) || (c >= 0x1EA0 && c <= 0x1EFF))
+      return (c & 1) ? c : c + 1;
+    // - Greek
+    if (c == 0x386) return 0x3AC;
+    if (c >= 0x388 && c <= 0x38A) return c + 37;
+    if (c == 0x38C) return 0x3CC;
+    if (c == 0x38E || c == 0x38F) return c + 63;
+    if (c >= 0x391 && c <= 0x3AB && c != 0x3A2) return c + 32;
+    if (c == 0x3C2) return 0x3C3; //final sigma
+    // - Cyrillic
+    if (c >= 0x400 && c <= 0x40F) return c + 80;
+    if (c >= 0x410 && c <= 0x42F) return c + 32;
+    if ((c >= 0x460 && c <= 0x481) || (c >= 0x48A && c <= 0x4BF) || (c >= 0x4D0 && c <= 0x52F))
+      return (c & 1) ? c : c + 1;
+    if (c == 0x4C0) return 0x4CF;
+    if (c >= 0x4C1 && c <= 0x4CE)
+      return (c & 1) ? c + 1 : c;
+    // - Armenian
+    if (c >= 0x531 && c <= 0x556) return c + 48;
+    // - Full-width Latin
+    if (c >= 0xFF21 && c <= 0xFF3A) return c + 32;
+    return c;
+  }
+
+  /// Letter + combining mark -> precomposed letter (lower-case letters only: folding comes first)
+  struct Composition {
+    uint32_t base, mark, composed;
+  };
+  const Composition compositions[] = {
+    // grave
+    {'a',0x300,0xE0}, {'e',0x300,0xE8}, {'i',0x300,0xEC}, {'o',0x300,0xF2}, {'u',0x300,0xF9},
+    {'n',0x300,0x1F9}, {'w',0x300,0x1E81}, {'y',0x300,0x1EF3},
+    // acute
+    {'a',0x301,0xE1}, {'e',0x301,0xE9}, {'i',0x301,0xED}, {'o',0x301,0xF3}, {'u',0x301,0xFA},
+    {'y',0x301,0xFD}, {'c',0x301,0x107}, {'l',0x301,0x13A}, {'n',0x301,0x144}, {'r',0x301,0x155},
+    {'s',0x301,0x15B}, {'z',0x301,0x17A}, {'g',0x301,0x1F5}, {'k',0x301,0x1E31}, {'m',0x301,0x1E3F},
+    {'p',0x301,0x1E55}, {'w',0x301,0x1E83},
+    {0x3B1,0x301,0x3AC}, {0x3B5,0x301,0x3AD}, {0x3B7,0x301,0x3AE}, {0x3B9,0x301,0x3AF},
+    {0x3BF,0x301,0x3CC}, {0x3C5,0x301,0x3CD}, {0x3C9,0x301,0x3CE},
+    // circumflex
+    {'a',0x302,0xE2}, {'e',0x302,0xEA}, {'i',0x302,0xEE}, {'o',0x302,0xF4}, {'u',0x302,0xFB},
+    {'c',0x302,0x109}, {'g',0x302,0x11D}, {'h',0x302,0x125}, {'j',0x302,0x135}, {'s',0x302,0x15D},
+    {'w',0x302,0x175}, {'y',0x302,0x177}, {'z',0x302,0x1E91},
+    // tilde
+    {'a',0x303,0xE3}, {'n',0x303,0xF1}, {'o',0x303,0xF5}, {'i',0x303,0x129}, {'u',0x303,0x169},
+    {'v',0x303,0x1E7D}, {'e',0x303,0x1EBD}, {'y',0x303,0x1EF9},
+    // macron
+    {'a',0x304,0x101}, {'e',0x304,0x113}, {'i',0x304,0x12B}, {'o',0x304,0x14D}, {'u',0x304,0x16B},
+    {'y',0x304,0x233}, {'g',0x304,0x1E21},
+    // breve
+    {'a',0x306,0x103}, {'e',0x306,0x115}, {'g',0x306,0x11F}, {'i',0x306,0x12D}, {'o',0x306,0x14F},
+    {'u',0x306,0x16D}, {0x438,0x306,0x439}, {0x443,0x306,0x45E},
+    // dot above
+    {'c',0x307,0x10B}, {'e',0x307,0x117}, {'g',0x307,0x121}, {'z',0x307,0x17C}, {'b',0x307,0x1E03},
+    {'d',0x307,0x1E0B}, {'f',0x307,0x1E1F}, {'h',0x307,0x1E23}, {'m',0x307,0x1E41}, {'n',0x307,0x1E45},
+    {'p',0x307,0x1E57}, {'r',0x307,0x1E59}, {'s',0x307,0x1E61}, {'t',0x307,0x1E6B}, {'w',0x307,0x1E87},
+    {'x',0x307,0x1E8B}, {'y',0x307,0x1E8F},
+    // diaeresis
+    {'a',0x308,0xE4}, {'e',0x308,0xEB}, {'i',0x308,0xEF}, {'o',0x308,0xF6}, {'u',0x308,0xFC},
+    {'y',0x308,0xFF}, {'h',0x308,0x1E27}, {'w',0x308,0x1E85}, {'x',0x308,0x1E8D}, {'t',0x308,0x1E97},
+    {0x435,0x308,0x451}, {0x456,0x308,0x457}, {0x3B9,0x308,0x3CA}, {0x3C5,0x308,0x3CB},
+    // ring above
+    {'a',0x30A,0xE5}, {'u',0x30A,0x16F}, {'w',0x30A,0x1E98}, {'y',0x30A,0x1E99},
+    // double acute
+    {'o',0x30B,0x151}, {'u',0x30B,0x171},
+    // caron
+    {'c',0x30C,0x10D}, {'d',0x30C,0x10F}, {'e',0x30C,0x11B}, {'n',0x30C,0x148}, {'r',0x30C,0x159},
+    {'s',0x30C,0x161}, {'t',0x30C,0x165}, {'z',0x30C,0x17E}, {'a',0x30C,0x1CE}, {'i',0x30C,0x1D0},
+    {'o',0x30C,0x1D2}, {'u',0x30C,0x1D4}, {'g',0x30C,0x1E7}, {'k',0x30C,0x1E9}, {'j',0x30C,0x1F0},
+    {'h',0x30C,0x21F},
+    // cedilla
+    {'c',0x327,0xE7}, {'g',0x327,0x123}, {'k',0x327,0x137}, {'l',0x327,0x13C}, {'n',0x327,0x146},
+    {'r',0x327,0x157}, {'s',0x327,0x15F}, {'t',0x327,0x163}, {'e',0x327,0x229}, {'d',0x327,0x1E11},
+    {'h',0x327,0x1E29},
+    // ogonek
+    {'a',0x328,0x105}, {'e',0x328,0x119}, {'i',0x328,0x12F}, {'u',0x328,0x173}, {'o',0x328,0x1EB},
+  };
+
+  void AppendUtf8(uint32_t c, string &pOut)
+  {
+    if (c < 0x80) {
+      pOut += (char)c;
+    } else if (c < 0x800) {
+      pOut += (char)(0xC0 | (c >> 6));
+      pOut += (char)(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+      pOut += (char)(0xE0 | (c >> 12));
+      pOut += (char)(0x80 | ((c >> 6) & 0x3F));
+      pOut += (char)(0x80 | (c & 0x3F));
+    } else {
+      pOut += (char)(0xF0 | (c >> 18));
+      pOut += (char)(0x80 | ((c >> 12) & 0x3F));
+      pOut += (char)(0x80 | ((c >> 6) & 0x3F));
+      pOut += (char)(0x80 | (c & 0x3F));
+    }
+  }
+
+  /// Decode the code point at pPos, advancing it. Invalid sequences give the (Latin-1) byte.
+  uint32_t NextCodePoint(const string &pStr, size_t &pPos)
+  {
+    unsigned char b = pStr[pPos];
+    size_t len = 0;
+    uint32_t c = 0;
+    if (b < 0x80) {
+      pPos++;
+      return b;
+    } else if ((b & 0xE0) == 0xC0 && b >= 0xC2) {
+      len = 2; c = b & 0x1F;
+    } else if ((b & 0xF0) == 0xE0) {
+      len = 3; c = b & 0x0F;
+    } else if ((b & 0xF8) == 0xF0 && b <= 0xF4) {
+      len = 4; c = b & 0x07;
+    }
+    if (len == 0 || pPos + len > pStr.size()) {
+      pPos++;
+      return b;
+    }
+    for (size_t k=1; k < len; k++) {
+      unsigned char cont = pStr[pPos + k];
+      if ((cont & 0xC0) != 0x80) {
+	pPos++;
+	return b;
+      }
+      c = (c << 6) | (cont & 0x3F);
+    }
+    if ((len == 3 && c < 0x800) || (len == 4 && (c < 0x10000 || c > 0x10FFFF)) || (c >= 0xD800 && c <= 0xDFFF)) {
+      pPos++; //overlong or invalid
+      return b;
+    }
+    pPos += len;
+    return c;
+  }
+}
+
+string CSMUtils::FoldCase(const string &pStr)
+{
+  string folded;
+  folded.reserve(pStr.size());
+  uint32_t last = 0; //last code point written, candidate base for a combining mark
+  size_t lastPos = 0; //where it starts in folded
+  size_t pos = 0;
+  while (pos < pStr.size()) {
+    //fast path for ASCII
+    unsigned char b = pStr[pos];
+    if (b < 0x80) {
+      last = (b >= 'A' && b <= 'Z') ? b + 32 : b;
+      lastPos = folded.size();
+      folded += (char)last;
+      pos++;
+      continue;
+    }
+    uint32_t c = NextCodePoint(pStr, pos);
+    if (c == 0xDF || c == 0x1E9E) {
+      folded += "ss";
+      last = 0;
+      continue;
+    }
+    if (c >= 0x300 && c <= 0x36F && last != 0) {
+      //combining mark: compose with the previous letter, if possible
+      bool composed = false;
+      for (size_t k=0; k < sizeof(compositions) / sizeof(compositions[0]); k++)
+	if (compositions[k].base == last && compositions[k].mark == c) {
+	  folded.resize(lastPos);
+	  last = compositions[k].composed;
+	  AppendUtf8(last, folded);
+	  composed = true;
+	  break;
+	}
+      if (composed)
+	continue;
+    }
+    c = FoldCodePoint(c);
+    last = c;
+    lastPos = folded.size();
+    AppendUtf8(c, folded);
+  }
+  return folded;
+}
+
+string CSMUtils::CollationKey(const string &pStr)
+{
+  size_t size = strxfrm(0, pStr.c_str(), 0);
+  string key(size + 1, '\0');
+  strxfrm(&key[0], pStr.c_str(), size + 1);
+  key.resize(size);
+  return key;
+}
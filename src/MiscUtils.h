@@ -16,6 +16,7 @@
 #include <sstream>
 #include <stdio.h>
 #include <time.h>
+#include <functional>
 
 /** Namespace for utility contaner.
  * This namespace collects various utilities used inside CSM.
@@ -57,6 +58,36 @@ namespace CSMUtils {
   /** Parse string to check for a valid date and return tm record */
   int parseStrDate(std::string timeStr, struct tm* returnTime);
 
+  // ----------------------------------------
+  // --- Concurrency utilities
+  // ----------------------------------------  
+
+  /** Run pTask for each index in [0, pN) using a pool of worker threads.
+   * Indexes are handed out one at a time, so that a slow item does not hold back the others.
+   * Returns when all the items have been processed.
+   * @param pN number of items
+   * @param pTask function to be called with the item index
+   * @param pMaxThreads maximum number of threads (0: number of available cores)
+   */
+  void ParallelFor(size_t pN, std::function<void(size_t)> pTask, size_t pMaxThreads=0);
+
+  // ----------------------------------------
+  // --- Text utilities
+  // ----------------------------------------  
+
+  /** Case-folded form of a UTF-8 string, to compare strings ignoring case.
+   * Letters followed by combining accents are composed first (NFC), so that
+   * both spellings of the same letter match. Latin, Greek, Cyrillic and Armenian
+   * scripts are folded. Bytes which are not valid UTF-8 are read as Latin-1.
+   */
+  std::string FoldCase(const std::string &pStr);
+
+  /** Collation key of a string, for the current locale (LC_COLLATE).
+   * Comparing keys with < gives the same order as strcoll() on the strings, without
+   * transforming them at each comparison.
+   */
+  std::string CollationKey(const std::string &pStr);
+
 }
 
 #endif
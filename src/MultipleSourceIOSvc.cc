@@ -9,21 +9,93 @@
 */
 
 #include <algorithm>
+#include <iterator>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "MultipleSourceIOSvc.h"
 #include "ILog.h"
 #include "IdManagerTool.h"
+#include "MiscUtils.h"
+#include "FuzzyMatcher.h"
 
 extern ILog *log;
 
 using namespace std;
 
+namespace {
+  /** Records found by the concurrent searches of FindEach(), handed over in the order of the sources.
+   * Searches stop at their next record once the consumer had enough.
+   */
+  class SearchFanOut {
+  protected:
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    vector<vector<ARecord*> > m_found; ///< records found so far, for each source
+    vector<bool> m_done; ///< the search of the source is over
+    bool m_stop;
+  public:
+    SearchFanOut(size_t pNSources) : m_found(pNSources), m_done(pNSources, false), m_stop(false) {}
+    /// Record found in pSource. Returns false once the searches must stop
+    bool Push(size_t pSource, ARecord *pRecord)
+    {
+      lock_guard<mutex> lock(m_mutex);
+      if (m_stop)
+	return false;
+      m_found[pSource].push_back(pRecord);
+      m_changed.notify_all();
+      return true;
+    }
+    /// The search of pSource is over
+    void Done(size_t pSource)
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_done[pSource] = true;
+      m_changed.notify_all();
+    }
+    /// Wait for record pPos of pSource. Returns false if the source has no more records
+    bool Get(size_t pSource, size_t pPos, ARecord *&pRecord)
+    {
+      unique_lock<mutex> lock(m_mutex);
+      while (pPos >= m_found[pSource].size() && not m_done[pSource])
+	m_changed.wait(lock);
+      if (pPos >= m_found[pSource].size())
+	return false;
+      pRecord = m_found[pSource][pPos];
+      return true;
+    }
+    /// Stop all searches
+    void Stop()
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_stop = true;
+    }
+  };
+
+  /// Visitor of a source searched by FindEach(), passing its records to the SearchFanOut
+  class FanOutVisitor : public RecordVisitor {
+  protected:
+    SearchFanOut &m_fanOut;
+    size_t m_source;
+  public:
+    FanOutVisitor(SearchFanOut &pFanOut, size_t pSource) : m_fanOut(pFanOut), m_source(pSource) {}
+    virtual bool Visit(ARecord *pRecord) { return m_fanOut.Push(m_source, pRecord); }
+  };
+}
+
 
-MultipleSourceIOSvc::MultipleSourceIOSvc(std::string pName) : IIOService(pName)
+MultipleSourceIOSvc::MultipleSourceIOSvc(std::string pName) : IIOService(pName), m_queryTool("MultiSourceQuery")
 {
   SetOwner("SourceMgrSvc"); // we're meta-users.. don't need one :D
   //Create the IdManager tool -- shared by all the sources. Memory freed by base IIOService class destructor.
   m_idManagerTool = new IdManagerTool("IdManager");
+  m_localIdMgrInstance = true;
+  m_inTransaction = false;
+  m_writeBehind = false;
+  m_writeBehindDelay = 1000;
+  m_idleTimeout = 0;
+  m_memoryBudget = 0;
 }
 
 MultipleSourceIOSvc::~MultipleSourceIOSvc()
@@ -105,6 +177,14 @@ IErrorHandler::StatusCode MultipleSourceIOSvc::NewSource(SourceURI pSource, std:
 
   //append to the list of existing sources
   m_sourceList.push_back(newIOSvc); 
+  SourceUsage usage;
+  usage.onDemand = false;
+  usage.lastUse = chrono::steady_clock::now();
+  m_usage[newIOSvc] = usage;
+  if (m_inTransaction)
+    newIOSvc->BeginTransaction();
+  if (m_writeBehind)
+    newIOSvc->SetWriteBehind(true, m_writeBehindDelay);
 
   //set as default source
   m_source = pSource; 
@@ -165,6 +245,8 @@ IErrorHandler::StatusCode MultipleSourceIOSvc::Load()
   }
   
   // Load Source
+  m_usage[currentSouce].onDemand = false;
+  m_usage[currentSouce].lastUse = chrono::steady_clock::now();
   m_statusCode = currentSouce->Load();
   if (m_statusCode >= SC_ERROR) {
     *log << ILog::ERROR << "Error loading source " << m_source.GetURI() << this << ILog::endmsg;
@@ -174,6 +256,174 @@ IErrorHandler::StatusCode MultipleSourceIOSvc::Load()
   return m_statusCode;
 }
 
+IErrorHandler::StatusCode MultipleSourceIOSvc::Load(vector<SourceURI> pSources, vector<StatusCode> &pResults)
+{
+  m_statusCode = SC_OK;
+  pResults.assign(pSources.size(), SC_OK);
+  // --- Collect the single sources, creating them if needed. Inherit key and owner from parent
+  vector<SingleSourceIOSvc*> toLoad(pSources.size(), (SingleSourceIOSvc*)0);
+  SourceURI defaultSource = m_source;
+  for (size_t idx=0; idx < pSources.size(); idx++) {
+    if (pSources[idx].GetURI().empty()) {
+      *log << ILog::ERROR << "Loading from empty source." << this << ILog::endmsg;
+      pResults[idx] = SC_ERROR;
+      continue;
+    }
+    if (!IsSourceManaged(pSources[idx]) && NewSource(pSources[idx], m_owner, m_key) >= SC_ERROR) {
+      *log << ILog::ERROR << "Error in creating new object for hosting source " << pSources[idx].GetURI()
+	   << this << ILog::endmsg;
+      pResults[idx] = SC_ERROR;
+      continue;
+    }
+    toLoad[idx] = GetSingleSource(pSources[idx]);
+    if (std::find(toLoad.begin(), toLoad.begin() + idx, toLoad[idx]) != toLoad.begin() + idx)
+      toLoad[idx] = 0; //listed twice: loaded once
+  }
+  m_source = defaultSource; //NewSource changes the default one
+
+  chrono::steady_clock::time_point now = chrono::steady_clock::now();
+  for (vector<SingleSourceIOSvc*>::iterator its = toLoad.begin(); its != toLoad.end(); ++its)
+    if (*its) {
+      m_usage[*its].onDemand = false; //also if it fails: not tried again at each use
+      m_usage[*its].lastUse = now;
+    }
+
+  // --- Read them concurrently, each source is handled by a single thread
+  vector<vector<ARecord*> > records(pSources.size());
+  //sources are mostly waiting for gpg or disk: allow more threads than cores
+  size_t maxThreads = 2 * std::thread::hardware_concurrency();
+  CSMUtils::ParallelFor(pSources.size(), [&](size_t idx) {
+      if (toLoad[idx])
+	pResults[idx] = toLoad[idx]->ReadRecords(records[idx]);
+    }, maxThreads);
+
+  // --- Add the records in turn: ids are given in the order of the sources
+  StatusCode worstSC = SC_OK;
+  for (size_t idx=0; idx < pSources.size(); idx++) {
+    if (toLoad[idx] && pResults[idx] == SC_OK)
+      pResults[idx] = toLoad[idx]->AddLoaded(records[idx]);
+    if (pResults[idx] >= SC_ERROR)
+      *log << ILog::ERROR << "Error loading source " << pSources[idx].GetURI() << this << ILog::endmsg;
+    else if (toLoad[idx])
+      m_source = pSources[idx];
+    if (pResults[idx] > worstSC)
+      worstSC = pResults[idx];
+  }
+  return m_statusCode = worstSC;
+}
+
+IErrorHandler::StatusCode MultipleSourceIOSvc::Register(vector<SourceURI> pSources)
+{
+  StatusCode worstSC = SC_OK;
+  for (vector<SourceURI>::iterator its = pSources.begin(); its != pSources.end(); ++its) {
+    if (its->GetURI().empty()) {
+      *log << ILog::ERROR << "Registering empty source." << this << ILog::endmsg;
+      worstSC = SC_ERROR;
+      continue;
+    }
+    if (!IsSourceManaged(*its)) {
+      if (NewSource(*its, m_owner, m_key) >= SC_ERROR) {
+	*log << ILog::ERROR << "Error in creating new object for hosting source " << its->GetURI()
+	     << this << ILog::endmsg;
+	worstSC = SC_ERROR;
+	continue;
+      }
+      m_usage[GetSingleSource(*its)].onDemand = true;
+      *log << ILog::VERBOSE << "Registered source, loaded on first use: " << its->GetURI() << this << ILog::endmsg;
+    }
+    m_source = *its;
+  }
+  return m_statusCode = worstSC;
+}
+
+IErrorHandler::StatusCode MultipleSourceIOSvc::Use(SourceURI pSource)
+{
+  SingleSourceIOSvc *source = GetSingleSource(pSource);
+  if (!source) {
+    *log << ILog::ERROR << "Trying to use a source not managed: " << pSource.GetURI() << this << ILog::endmsg;
+    return m_statusCode;
+  }
+  return m_statusCode = UseSources(vector<SingleSourceIOSvc*>(1, source));
+}
+
+IErrorHandler::StatusCode MultipleSourceIOSvc::UseSources(const vector<SingleSourceIOSvc*> &pSources)
+{
+  chrono::steady_clock::time_point now = chrono::steady_clock::now();
+  vector<SourceURI> toLoad;
+  for (vector<SingleSourceIOSvc*>::const_iterator its = pSources.begin(); its != pSources.end(); ++its) {
+    SourceUsage &usage = m_usage[*its];
+    usage.lastUse = now;
+    if (usage.onDemand)
+      toLoad.push_back((*its)->GetSource());
+  }
+  if (toLoad.empty())
+    return SC_OK;
+  SourceURI defaultSource = m_source;
+  vector<StatusCode> results;
+  StatusCode sc = Load(toLoad, results);
+  m_source = defaultSource; //Load() changes the default one
+  return sc;
+}
+
+void MultipleSourceIOSvc::SetEviction(unsigned int pIdleTimeout, size_t pMemoryBudget)
+{
+  m_idleTimeout = pIdleTimeout;
+  m_memoryBudget = pMemoryBudget;
+}
+
+bool MultipleSourceIOSvc::IsEvictionEnabled()
+{
+  return m_idleTimeout > 0 || m_memoryBudget > 0;
+}
+
+bool MultipleSourceIOSvc::Evict(SingleSourceIOSvc *pSource)
+{
+  if (pSource->Unload() >= SC_ERROR) {
+    *log << ILog::WARNING << "Cannot evict source: " << pSource->GetSource().GetURI() << this << ILog::endmsg;
+    return false;
+  }
+  m_usage[pSource].onDemand = true;
+  return true;
+}
+
+size_t MultipleSourceIOSvc::EvictIdle()
+{
+  if (m_inTransaction || not IsEvictionEnabled())
+    return 0;
+  // --- Sources in memory, least recently used first
+  vector<SingleSourceIOSvc*> loaded;
+  for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its)
+    if (not m_usage[*its].onDemand && (*its)->IsLoaded())
+      loaded.push_back(*its);
+  std::sort(loaded.begin(), loaded.end(), [this](SingleSourceIOSvc *a, SingleSourceIOSvc *b) {
+      return m_usage[a].lastUse < m_usage[b].lastUse;
+    });
+
+  // --- Evict the idle ones
+  chrono::steady_clock::time_point now = chrono::steady_clock::now();
+  size_t nEvicted = 0;
+  size_t dataSize = 0;
+  vector<SingleSourceIOSvc*> kept;
+  for (vector<SingleSourceIOSvc*>::iterator its = loaded.begin(); its != loaded.end(); ++its) {
+    if (m_idleTimeout > 0 && now - m_usage[*its].lastUse >= chrono::seconds(m_idleTimeout) && Evict(*its)) {
+      nEvicted++;
+      continue;
+    }
+    kept.push_back(*its);
+    dataSize += (*its)->GetDataSize();
+  }
+
+  // --- Above the budget: evict the least recently used ones, but the last one
+  for (size_t idx=0; m_memoryBudget > 0 && dataSize > m_memoryBudget && idx + 1 < kept.size(); idx++) {
+    size_t sourceSize = kept[idx]->GetDataSize();
+    if (Evict(kept[idx])) {
+      nEvicted++;
+      dataSize -= sourceSize;
+    }
+  }
+  return nEvicted;
+}
+
 IErrorHandler::StatusCode MultipleSourceIOSvc::SourceExists(SourceURI pSource)
 {
   //just create a temporary single source and check existence
@@ -201,6 +451,12 @@ IErrorHandler::StatusCode MultipleSourceIOSvc::Store()
     return SC_ERROR;
   }
 
+  if (m_usage[currentSource].onDemand) {
+    //records not in memory: writing would lose them
+    *log << ILog::VERBOSE << "Source not loaded, nothing to store: " << m_source.GetURI() << this << ILog::endmsg;
+    return m_statusCode;
+  }
+
   //check if key is already associated with the SingleSourceIOSvc instance
   if (currentSource->GetKey().empty()) {
     if (!m_key.empty()) {
@@ -214,6 +470,149 @@ IErrorHandler::StatusCode MultipleSourceIOSvc::Store()
   return m_statusCode;
 }
 
+IErrorHandler::StatusCode MultipleSourceIOSvc::BeginTransaction()
+{
+  if (m_inTransaction) {
+    *log << ILog::ERROR << "Transaction already started." << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  m_statusCode = SC_OK;
+  for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its)
+    if (not (*its)->InTransaction())
+      (*its)->BeginTransaction();
+  m_inTransaction = true;
+  return m_statusCode;
+}
+
+IErrorHandler::StatusCode MultipleSourceIOSvc::Commit()
+{
+  if (not m_inTransaction) {
+    *log << ILog::ERROR << "No transaction to commit." << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  m_statusCode = SC_OK;
+  bool failed = false;
+  for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its) {
+    if (not (*its)->InTransaction())
+      continue; //already committed by a previous attempt
+    StatusCode sc = (*its)->Commit();
+    if (sc >= SC_ERROR) {
+      *log << ILog::ERROR << "Error committing changes to source: " << (*its)->GetSource().GetURI() << this << ILog::endmsg;
+      failed = true;
+    }
+    if (sc > m_statusCode)
+      m_statusCode = sc;
+  }
+  if (not failed)
+    m_inTransaction = false;
+  return m_statusCode;
+}
+
+IErrorHandler::StatusCode MultipleSourceIOSvc::Rollback()
+{
+  if (not m_inTransaction) {
+    *log << ILog::ERROR << "No transaction to roll back." << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its)
+    if ((*its)->InTransaction())
+      (*its)->Rollback();
+  m_inTransaction = false;
+  return m_statusCode = SC_OK;
+}
+
+bool MultipleSourceIOSvc::InTransaction()
+{
+  return m_inTransaction;
+}
+
+void MultipleSourceIOSvc::SetWriteBehind(bool pEnable, unsigned int pDelay)
+{
+  m_writeBehind = pEnable;
+  m_writeBehindDelay = pDelay;
+  for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its)
+    (*its)->SetWriteBehind(pEnable, pDelay);
+}
+
+IErrorHandler::StatusCode MultipleSourceIOSvc::Flush()
+{
+  StatusCode sc = SC_OK;
+  for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its) {
+    StatusCode scSource = (*its)->Flush();
+    if (scSource > sc)
+      sc = scSource;
+  }
+  return sc;
+}
+
+IIOService::WriteState MultipleSourceIOSvc::GetWriteState(string &pMsg)
+{
+  WriteState state = WRITE_DONE;
+  pMsg.clear();
+  for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its) {
+    string msg;
+    WriteState sourceState = (*its)->GetWriteState(msg);
+    if (sourceState == WRITE_PENDING)
+      return WRITE_PENDING;
+    if (sourceState == WRITE_FAILED && state == WRITE_DONE) {
+      state = WRITE_FAILED;
+      pMsg = msg;
+    }
+  }
+  return state;
+}
+
+IErrorHandler::StatusCode MultipleSourceIOSvc::Rekey(vector<SourceURI> pSources, string pOldKey, string pNewKey, TRekeyProgress pProgress)
+{
+  m_statusCode = SC_OK;
+  if (m_inTransaction) {
+    //sources are re-encrypted on disk, where the transaction is not written yet
+    *log << ILog::ERROR << "Cannot re-encrypt sources during a transaction." << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  // --- Collect the single sources, creating them if needed (not loaded)
+  vector<SingleSourceIOSvc*> toRekey;
+  bool creationFailed = false;
+  SourceURI defaultSource = m_source;
+  for (vector<SourceURI>::iterator its = pSources.begin(); its != pSources.end(); ++its) {
+    if (!IsSourceManaged(*its)) {
+      if (NewSource(*its, m_owner) >= SC_ERROR) {
+	*log << ILog::ERROR << "Error in creating new object for hosting source " << its->GetURI()
+	     << this << ILog::endmsg;
+	creationFailed = true;
+	continue;
+      }
+    }
+    SingleSourceIOSvc *src = GetSingleSource(*its);
+    if (src && std::find(toRekey.begin(), toRekey.end(), src) == toRekey.end())
+      toRekey.push_back(src);
+  }
+  if (!defaultSource.Empty())
+    m_source = defaultSource; //NewSource changes the default one
+  *log << ILog::INFO << "Re-encrypting " << (unsigned long)toRekey.size() << " sources with new key " << pNewKey << this << ILog::endmsg;
+
+  // --- Now process them concurrently, each source is handled by a single thread
+  std::mutex resultMutex;
+  size_t nDone = 0;
+  StatusCode worstSC = SC_OK;
+  //sources are mostly waiting for gpg or disk: allow more threads than cores
+  size_t maxThreads = 2 * std::thread::hardware_concurrency();
+  CSMUtils::ParallelFor(toRekey.size(), [&](size_t idx) {
+      bool skipped = false;
+      StatusCode sc = toRekey[idx]->Rekey(pOldKey, pNewKey, skipped);
+      std::lock_guard<std::mutex> lock(resultMutex);
+      nDone++;
+      if (sc > worstSC)
+	worstSC = sc;
+      if (pProgress)
+	pProgress(toRekey[idx]->GetSource(), sc, skipped, nDone, toRekey.size());
+    }, maxThreads);
+
+  if (creationFailed && worstSC < SC_ERROR)
+    worstSC = SC_ERROR; //some sources could not even be created
+  return m_statusCode = worstSC;
+}
+
 IErrorHandler::StatusCode MultipleSourceIOSvc::Add(ARecord *pARecord, bool flushBuffer)
 {
   SingleSourceIOSvc *currentIOSvc = 0;
@@ -252,46 +651,179 @@ IErrorHandler::StatusCode MultipleSourceIOSvc::Add(ARecord *pARecord, bool flush
     return m_statusCode;
   }
 
+  //the records of the source must be in memory before changing it
+  StatusCode scLoad = UseSources(vector<SingleSourceIOSvc*>(1, currentIOSvc));
+  if (scLoad >= SC_ERROR && scLoad != SC_NOT_FOUND) { //a source not existing yet is created when stored
+    *log << ILog::ERROR << "Cannot add record to source not loaded: " << currentIOSvc->GetSource().GetURI()
+	 << this << ILog::endmsg;
+    return m_statusCode = scLoad;
+  }
+
   m_statusCode = currentIOSvc->Add(pARecord, flushBuffer);
 
   return m_statusCode;
 }
 
+vector<ARecord*> MultipleSourceIOSvc::SearchAll(const vector<SingleSourceIOSvc*> &pSources, function<vector<ARecord*>(SingleSourceIOSvc*)> pSearch)
+{
+  vector<vector<ARecord*> > results(pSources.size());
+  CSMUtils::ParallelFor(pSources.size(), [&](size_t idx) {
+      results[idx] = pSearch(pSources[idx]);
+    });
+  //keep the order of the sources: append their results one after the other
+  size_t numRecords = 0;
+  for (vector<vector<ARecord*> >::iterator itr = results.begin(); itr != results.end(); ++itr)
+    numRecords += itr->size();
+  vector<ARecord*> sResult;
+  sResult.reserve(numRecords);
+  for (vector<vector<ARecord*> >::iterator itr = results.begin(); itr != results.end(); ++itr)
+    sResult.insert(sResult.end(), itr->begin(), itr->end());
+  return sResult;
+}
+
+bool MultipleSourceIOSvc::SearchedSources(const std::string &pSearch, SearchRequest::SearchType pTypeOfSearch, vector<SingleSourceIOSvc*> &pSources)
+{
+  pSources.clear();
+  if (pTypeOfSearch != SearchRequest::QUERY) {
+    pSources = m_sourceList;
+    return true;
+  }
+  QuerySearchTool::Node query;
+  if (not m_queryTool.Parse(pSearch, query, m_errorMsg)) {
+    //same query for all sources: no need to load them to know it is not valid
+    *log << ILog::ERROR << "Invalid query: " << m_errorMsg << this << ILog::endmsg;
+    m_statusCode = SC_ERROR;
+    return false;
+  }
+  for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its)
+    if (QuerySearchTool::MayMatchSource(query, (*its)->GetSource().GetURI()))
+      pSources.push_back(*its);
+  *log << ILog::VERBOSE << "Query needs " << (unsigned long)pSources.size() << " of " << (unsigned long)m_sourceList.size()
+       << " sources" << this << ILog::endmsg;
+  return true;
+}
+
 vector<ARecord*> MultipleSourceIOSvc::Find(std::string pSearch, SearchRequest::SearchType pTypeOfSearch)
 {
   ///@todo Decide if we want to add an extra-label to the record to identify which source it belongs to (ot store it inside the ARecord class).
-  vector<ARecord*> sResult;
-  vector<ARecord*> tmpResult;
-  //loop over sources and add results together
-  for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its) {
-    tmpResult = (*its)->Find(pSearch, pTypeOfSearch);
-    sResult.insert(sResult.end(), tmpResult.begin(), tmpResult.end());
+  if (pTypeOfSearch == SearchRequest::FUZZY)
+    return FindFuzzy(pSearch); //rank records of all sources together
+  vector<SingleSourceIOSvc*> sources;
+  if (not SearchedSources(pSearch, pTypeOfSearch, sources))
+    return vector<ARecord*>();
+  UseSources(sources);
+  m_statusCode = SC_OK;
+  vector<ARecord*> sResult = SearchAll(sources, [&](SingleSourceIOSvc *pSource) {
+      return pSource->Find(pSearch, pTypeOfSearch);
+    });
+  for (vector<SingleSourceIOSvc*>::iterator its = sources.begin(); its != sources.end(); ++its) {
+    if ((*its)->GetErrorMsg(m_errorMsg) >= SC_ERROR) {
+      //same search for all sources: it is not valid
+      m_statusCode = SC_ERROR;
+      return vector<ARecord*>();
+    }
   }
 
   return sResult;
 }
 
-vector<ARecord*> MultipleSourceIOSvc::FindByAccountName(std::string pSearch, SearchRequest::SearchType pTypeOfSearch)
+bool MultipleSourceIOSvc::FindEach(std::string pSearch, SearchRequest::SearchType pTypeOfSearch, RecordVisitor &pVisitor)
 {
-  vector<ARecord*> sResult;
-  vector<ARecord*> tmpResult;
-  //loop over sources and add results together
-  for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its) {
-    tmpResult = (*its)->FindByAccountName(pSearch, pTypeOfSearch);
-    sResult.insert(sResult.end(), tmpResult.begin(), tmpResult.end());
+  m_statusCode = SC_OK;
+  if (pTypeOfSearch == SearchRequest::FUZZY) {
+    //rank records of all sources together
+    vector<ARecord*> ranked = FindFuzzy(pSearch);
+    for (vector<ARecord*>::iterator itr = ranked.begin(); itr != ranked.end(); ++itr)
+      if (not pVisitor.Visit(*itr))
+	return false;
+    return true;
+  }
+  vector<SingleSourceIOSvc*> sources;
+  if (not SearchedSources(pSearch, pTypeOfSearch, sources))
+    return true;
+  UseSources(sources);
+  m_statusCode = SC_OK;
+  // --- Search the sources in background, each source in a single thread
+  SearchFanOut fanOut(sources.size());
+  thread searcher([&]() {
+      CSMUtils::ParallelFor(sources.size(), [&](size_t idx) {
+	  FanOutVisitor sourceVisitor(fanOut, idx);
+	  sources[idx]->FindEach(pSearch, pTypeOfSearch, sourceVisitor);
+	  fanOut.Done(idx);
+	});
+    });
+  // --- Visit their records in the order of the sources, as they are found
+  bool completed = true;
+  for (size_t idx=0; idx < sources.size() && completed; idx++) {
+    ARecord *record;
+    for (size_t pos=0; fanOut.Get(idx, pos, record); pos++) {
+      if (not pVisitor.Visit(record)) {
+	completed = false; //enough records: other searches stop
+	break;
+      }
+    }
+    if (completed && sources[idx]->GetErrorMsg(m_errorMsg) >= SC_ERROR) {
+      //same search for all sources: it is not valid
+      m_statusCode = SC_ERROR;
+      break;
+    }
   }
+  fanOut.Stop();
+  searcher.join();
+  return completed;
+}
 
-  return sResult;
+RecordSnapshot::Ptr MultipleSourceIOSvc::GetSnapshot()
+{
+  vector<RecordSnapshot::Ptr> parts;
+  for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its)
+    parts.push_back((*its)->GetSnapshot());
+  return make_shared<RecordSnapshot>(parts);
+}
+
+vector<ARecord*> MultipleSourceIOSvc::FindFuzzy(std::string pSearch, size_t pMaxResults)
+{
+  UseSources(m_sourceList);
+  //a matcher for each source, then their best records are ranked together
+  vector<FuzzyMatcher> matchers(m_sourceList.size(), FuzzyMatcher(pSearch, pMaxResults));
+  CSMUtils::ParallelFor(m_sourceList.size(), [&](size_t idx) {
+      m_sourceList[idx]->AddFuzzyMatches(matchers[idx]);
+    });
+  FuzzyMatcher matcher(pSearch, pMaxResults);
+  for (vector<FuzzyMatcher>::iterator itm = matchers.begin(); itm != matchers.end(); ++itm)
+    matcher.Merge(*itm);
+  return matcher.GetResults();
+}
+
+vector<ARecord*> MultipleSourceIOSvc::FindByAccountName(std::string pSearch, SearchRequest::SearchType pTypeOfSearch)
+{
+  UseSources(m_sourceList);
+  return SearchAll(m_sourceList, [&](SingleSourceIOSvc *pSource) {
+      return pSource->FindByAccountName(pSearch, pTypeOfSearch);
+    });
 }
 
 vector<ARecord*> MultipleSourceIOSvc::FindByLabel(std::string pSearch, SearchRequest::SearchType pTypeOfSearch)
 {
-  vector<ARecord*> sResult;
-  vector<ARecord*> tmpResult;
-  //loop over sources and add results together
+  UseSources(m_sourceList);
+  return SearchAll(m_sourceList, [&](SingleSourceIOSvc *pSource) {
+      return pSource->FindByLabel(pSearch, pTypeOfSearch);
+    });
+}
+
+vector<ARecord*> MultipleSourceIOSvc::FindByLabelQuery(std::string pQuery)
+{
+  UseSources(m_sourceList);
+  m_statusCode = SC_OK;
+  vector<ARecord*> sResult = SearchAll(m_sourceList, [&](SingleSourceIOSvc *pSource) {
+      return pSource->FindByLabelQuery(pQuery);
+    });
   for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its) {
-    tmpResult = (*its)->FindByLabel(pSearch, pTypeOfSearch);
-    sResult.insert(sResult.end(), tmpResult.begin(), tmpResult.end());
+    if ((*its)->GetErrorMsg(m_errorMsg) >= SC_ERROR) {
+      //same query for all sources: it is not valid
+      m_statusCode = SC_ERROR;
+      return vector<ARecord*>();
+    }
   }
 
   return sResult;
@@ -299,61 +831,82 @@ vector<ARecord*> MultipleSourceIOSvc::FindByLabel(std::string pSearch, SearchReq
 
 ARecord* MultipleSourceIOSvc::FindByAccountId(unsigned long pAccountId)
 {
-  string cSource;
-  cSource = m_idManagerTool->GetSource(pAccountId);
-  SingleSourceIOSvc *cSrc;
-  cSrc = GetSingleSource(cSource);
-  return cSrc->FindByAccountId(pAccountId);
+  //ask directly the sources: each one keeps an index of its records
+  for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its)
+    if ((*its)->HasAccountId(pAccountId)) {
+      UseSources(vector<SingleSourceIOSvc*>(1, *its));
+      return (*its)->FindByAccountId(pAccountId);
+    }
+  *log << ILog::WARNING << "Record not found. AccountId = " << pAccountId << this << ILog::endmsg;
+  return 0;
 }
 
-vector<ARecord*> MultipleSourceIOSvc::GetAllAccounts(int sort)
+ARecord* MultipleSourceIOSvc::FindByUUID(const std::string &pUUID)
 {
-  //Loop over all sources and append all recors one after the other
-  // No sorting is performed.
-  vector<ARecord*> fullRecordList;
+  UseSources(m_sourceList);
   for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its) {
-    vector<ARecord*> recordsToAdd = (*its)->GetAllAccounts(sort);
-    fullRecordList.insert(fullRecordList.end(), recordsToAdd.begin(), recordsToAdd.end());
-  }    
-
-  //now sort them
-  if (sort == ACCOUNTS_SORT_BYNAME) {
-    std::sort(fullRecordList.begin(), fullRecordList.end(), SingleSourceIOSvc::sortByName);
-  } else if (sort == ACCOUNTS_SORT_BYDATE) {
-    std::sort(fullRecordList.begin(), fullRecordList.end(), SingleSourceIOSvc::sortByDate);
-  }  
+    ARecord *record = (*its)->FindByUUID(pUUID);
+    if (record)
+      return record;
+  }
+  *log << ILog::WARNING << "Record not found. UUID = " << pUUID << this << ILog::endmsg;
+  return 0;
+}
 
-  return fullRecordList;
+vector<ARecord*> MultipleSourceIOSvc::GetAllAccounts(int sort)
+{
+  UseSources(m_sourceList);
+  //Each source keeps its records sorted: collect them without copies
+  vector<const vector<ARecord*>*> views;
+  size_t numRecords = 0;
+  for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its) {
+    const vector<ARecord*> &view = (*its)->GetSortedAccounts(sort);
+    if (view.empty())
+      continue;
+    views.push_back(&view);
+    numRecords += view.size();
+  }
+  vector<ARecord*> fullRecordList;
+  bool (*less)(ARecord*, ARecord*) = 0;
+  if (sort == ACCOUNTS_SORT_BYNAME)
+    less = SingleSourceIOSvc::sortByName;
+  else if (sort == ACCOUNTS_SORT_BYDATE)
+    less = SingleSourceIOSvc::sortByDate;
+  if (less == 0 || views.size() == 1) {
+    //no sorting needed: append all records one after the other
+    fullRecordList.reserve(numRecords);
+    for (vector<const vector<ARecord*>*>::iterator itv = views.begin(); itv != views.end(); ++itv)
+      fullRecordList.insert(fullRecordList.end(), (*itv)->begin(), (*itv)->end());
+    return fullRecordList;
+  }
+  return RecordSnapshot::MergeViews(views, less);
 }
 
 vector<string> MultipleSourceIOSvc::GetLabels()
 {
+  UseSources(m_sourceList);
   // loop over sources and build a global label list
-  // very similar to SingleSourceIOSvc::GetLabels()
+  // lists of each source are already unique and sorted: merge them
   vector<string> labelList;  
   for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its) {
     vector<string> addToLabels = (*its)->GetLabels();
-    labelList.insert(labelList.end(), addToLabels.begin(), addToLabels.end());
+    vector<string> merged;
+    merged.reserve(labelList.size() + addToLabels.size());
+    set_union(labelList.begin(), labelList.end(), addToLabels.begin(), addToLabels.end(), back_inserter(merged));
+    labelList.swap(merged);
   }  
-  //now make the list unique, and sorted
-  sort(labelList.begin(), labelList.end());
-  vector<string>::iterator newSize = unique(labelList.begin(), labelList.end());
-  labelList.resize( newSize - labelList.begin() );
 
   return labelList;  
 }
 
 IErrorHandler::StatusCode MultipleSourceIOSvc::Remove(unsigned long pAccountId)
 {
-  string cSource;
-  cSource = m_idManagerTool->GetSource(pAccountId);
-  *log << ILog::DEBUG << "Got source for account Id " << pAccountId << ":" << cSource << this << ILog::endmsg;
-  SingleSourceIOSvc *cSrc;
-  cSrc = GetSingleSource(cSource);
-  if (!cSrc) {
-    *log << ILog::ERROR << "Record not found. Account id = " << pAccountId
-	 << this << ILog::endmsg;
-    return SC_NOT_FOUND;
-  } 
-  return cSrc->Remove(pAccountId);      
+  for (vector<SingleSourceIOSvc*>::iterator its = m_sourceList.begin(); its != m_sourceList.end(); ++its)
+    if ((*its)->HasAccountId(pAccountId)) {
+      UseSources(vector<SingleSourceIOSvc*>(1, *its));
+      return (*its)->Remove(pAccountId);
+    }
+  *log << ILog::ERROR << "Record not found. Account id = " << pAccountId
+       << this << ILog::endmsg;
+  return SC_NOT_FOUND;
 }
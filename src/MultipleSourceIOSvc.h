@@ -16,6 +16,9 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <chrono>
+#include <functional>
 
 /** Implements support for multiple source management.
  * Class to manage multiple SingleSourceIOSvc instances.
@@ -32,8 +35,54 @@ class MultipleSourceIOSvc : public IIOService {
   /// Data member storing the managed SingleSourceIOSvc instances
   std::vector<SingleSourceIOSvc*> m_sourceList;
 
+  /// true between BeginTransaction() and the end of the transaction
+  bool m_inTransaction;
+  /// write changes in background, also for sources created later (see SetWriteBehind())
+  bool m_writeBehind;
+  /// milliseconds without changes before writing in background
+  unsigned int m_writeBehindDelay;
+
+  /// Use of a managed source, for loading it on demand and evicting it
+  struct SourceUsage {
+    bool onDemand; ///< records not in memory: loaded by the first search or change using the source
+    std::chrono::steady_clock::time_point lastUse;
+  };
+  /// Use of each managed source
+  std::map<SingleSourceIOSvc*, SourceUsage> m_usage;
+  /// seconds of no use before a source is evicted, 0 to keep them (see SetEviction())
+  unsigned int m_idleTimeout;
+  /// bytes of records kept in memory before evicting sources, 0 for no limit (see SetEviction())
+  size_t m_memoryBudget;
+
   /// Get pointer to given source
   SingleSourceIOSvc* GetSingleSource(SourceURI pSource);
+
+  /** Mark sources as used now, loading the ones not in memory.
+   * The default source is not changed.
+   * @return SC_OK if all of them are loaded, otherwise the worst status found
+   */
+  StatusCode UseSources(const std::vector<SingleSourceIOSvc*> &pSources);
+
+  /// Unload a source, which will be loaded again on demand. Returns false if it must be kept.
+  bool Evict(SingleSourceIOSvc *pSource);
+
+  /// Parses queries, to find the sources they are about (see SearchedSources())
+  QuerySearchTool m_queryTool;
+
+  /** Run a search on sources concurrently, each source in a single thread.
+   * Sources are independent: the latency is close to the one of the largest source.
+   * @param pSources sources to search, in their order
+   * @param pSearch search of a source
+   * @return results of the sources, one after the other in the order of the sources
+   */
+  std::vector<ARecord*> SearchAll(const std::vector<SingleSourceIOSvc*> &pSources, std::function<std::vector<ARecord*>(SingleSourceIOSvc*)> pSearch);
+
+  /** Sources a search can find records in, in the order of the managed sources.
+   * Queries with source: terms only need the sources they match (see QuerySearchTool::MayMatchSource()):
+   * the others are neither loaded nor searched. Other searches need all sources.
+   * @return false if the query is not valid (status and error message set)
+   */
+  bool SearchedSources(const std::string &pSearch, SearchRequest::SearchType pTypeOfSearch, std::vector<SingleSourceIOSvc*> &pSources);
  public:
   MultipleSourceIOSvc(std::string pName);
   virtual ~MultipleSourceIOSvc();
@@ -47,18 +96,87 @@ class MultipleSourceIOSvc : public IIOService {
    */
   virtual StatusCode Load(SourceURI pSource);
 
+  /** (Re-)Load a list of sources.
+   * Sources are independent from each other: they are read, decrypted and decoded concurrently
+   * (see SingleSourceIOSvc::ReadRecords), so that loading takes about as long as the slowest source.
+   * Their records are then added in the order of pSources, so ids are the same as loading them in turn.
+   * The last source loaded becomes the default one.
+   * @param pSources list of sources to load
+   * @param pResults status of each source, in the order of pSources
+   * @return SC_OK if all sources were loaded, otherwise the worst status found
+   */
+  virtual StatusCode Load(std::vector<SourceURI> pSources, std::vector<StatusCode> &pResults);
+
+  /** Manage a list of sources without loading them.
+   * Each source is loaded the first time it is used: by a search, a change of its records,
+   * or Use(). Sources already managed are left as they are.
+   * As for Load(), the last source becomes the default one.
+   * @param pSources list of sources to register
+   * @return SC_OK if all sources were registered, otherwise the worst status found
+   */
+  virtual StatusCode Register(std::vector<SourceURI> pSources);
+
+  /** Mark a managed source as used now, loading it if it is not in memory.
+   * @param pSource source, which must be managed
+   * @return status of loading, SC_OK if it was already loaded
+   */
+  virtual StatusCode Use(SourceURI pSource);
+
+  /** Evict sources from memory when they are not needed (see EvictIdle()).
+   * Records of evicted sources are wiped, and loaded again when the source is used.
+   * @param pIdleTimeout seconds since its last use before evicting a source, 0 to disable
+   * @param pMemoryBudget bytes of records to keep in memory, 0 for no limit
+   */
+  virtual void SetEviction(unsigned int pIdleTimeout, size_t pMemoryBudget);
+
+  /// true if SetEviction() enabled a timeout or a memory budget
+  bool IsEvictionEnabled();
+
+  /** Evict the sources idle for longer than the timeout, then the least recently used ones
+   * as long as their records are above the memory budget. The most recently used source is kept.
+   * Changes written in background are written first; nothing is evicted during a transaction.
+   * Records of evicted sources are deleted: call it only when no record pointers are held.
+   * @return number of sources evicted
+   */
+  virtual size_t EvictIdle();
+
   /** Check if a given source exists.       
    * Uses SingleSourceIOSvc::SourceExists()
    * Do not load the source.
    */
   virtual StatusCode SourceExists(SourceURI pSource);
 
-  /// Store source
+  /// Store source. Sources not loaded yet are left untouched.
   virtual StatusCode Store();
   
   /// Store source
   virtual StatusCode Store(SourceURI pSource);
 
+  /** @copydoc IIOService::BeginTransaction()
+   * All sources take part in it, also the ones created before its end.
+   */
+  virtual StatusCode BeginTransaction();
+  /** @copydoc IIOService::Commit()
+   * Each changed source is written once. Sources are separate files: if writing one fails,
+   * the others are still committed, and only the failed ones stay in the transaction.
+   */
+  virtual StatusCode Commit();
+  /// @copydoc IIOService::Rollback()
+  virtual StatusCode Rollback();
+  /// @copydoc IIOService::InTransaction()
+  virtual bool InTransaction();
+
+  /** @copydoc IIOService::SetWriteBehind()
+   * Each source has its own background writer.
+   */
+  virtual void SetWriteBehind(bool pEnable, unsigned int pDelay=1000);
+  /// @copydoc IIOService::Flush()
+  virtual StatusCode Flush();
+  /** @copydoc IIOService::GetWriteState()
+   * Pending if any source is, failed if any source failed.
+   */
+  virtual WriteState GetWriteState(std::string &pMsg);
+
   /** Create a new source.
    * This method create a new source.
    * It can be used if source does not exists yet (if Load returns SC_NOT_FOUND, for example)
@@ -69,6 +187,25 @@ class MultipleSourceIOSvc : public IIOService {
    */
   virtual StatusCode NewSource(SourceURI pSource, std::string pOwner="", std::string pKey="");
 
+  /** Progress report of Rekey().
+   * Called once per source, as soon as it has been processed.
+   * Arguments are: source, result, true if source was skipped, number of sources processed, total number of sources.
+   * Calls are serialized, but can come from any thread.
+   */
+  typedef std::function<void(SourceURI, StatusCode, bool, size_t, size_t)> TRekeyProgress;
+
+  /** Re-encrypt a list of sources with a new key.
+   * Sources are independent from each other, so they are processed concurrently.
+   * See SingleSourceIOSvc::Rekey for details on each source.
+   * Sources not yet managed are added, but not loaded.
+   * @param pSources list of sources to re-encrypt
+   * @param pOldKey key the sources are expected to be encrypted for
+   * @param pNewKey key to encrypt the sources for
+   * @param pProgress (optional) function to be notified as each source is done
+   * @return SC_OK if all sources were re-encrypted (or did not need to), otherwise the worst status found
+   */
+  virtual StatusCode Rekey(std::vector<SourceURI> pSources, std::string pOldKey, std::string pNewKey, TRekeyProgress pProgress=0);
+
   /** Add or update existing record.
    * Decide which is the appropriate source. Otherwise use default m_source.
    * @copydoc IIOService::Add(ARecord*, bool)
@@ -76,30 +213,63 @@ class MultipleSourceIOSvc : public IIOService {
   virtual StatusCode Add(ARecord *pARecord, bool flushBuffer=true);
 
   /** Retrieve a given set of records.
-   * Loop over all sources managed.
+   * Sources managed are searched concurrently (see SearchAll()), only the ones
+   * named by source: terms of queries (see SearchedSources()).
    * @copydoc IIOService::Find(std::string, SearchType pTypeOfSearch)
    */
   virtual std::vector<ARecord*> Find(std::string pSearch, SearchRequest::SearchType pTypeOfSearch=SearchRequest::TXT);
 
+  /** Retrieve the records of a search one at a time, as they are found.
+   * Sources are searched concurrently, while pVisitor gets their records in the order of the sources.
+   * Once pVisitor stops the search, the searches still running stop at their next record.
+   * @copydoc IIOService::FindEach(std::string, SearchType, RecordVisitor&)
+   */
+  virtual bool FindEach(std::string pSearch, SearchRequest::SearchType pTypeOfSearch, RecordVisitor &pVisitor);
+
+  /** Snapshot of the records of all sources, made of their current snapshots.
+   * Sources must not be added or removed meanwhile.
+   * @copydoc IIOService::GetSnapshot()
+   */
+  virtual RecordSnapshot::Ptr GetSnapshot();
+
+  /** Retrieve the records best matching a fuzzy pattern, best first.
+   * Sources are ranked concurrently, then their best records are ranked together.
+   * @copydoc IIOService::FindFuzzy(std::string, size_t)
+   */
+  virtual std::vector<ARecord*> FindFuzzy(std::string pSearch, size_t pMaxResults=0);
+
   /** Retrieve a given set of records.
-   * Loop over all sources managed.
+   * All sources managed are searched concurrently.
    * @copydoc IIOService::FindByAccountName(std::string, SearchType pTypeOfSearch)   
    */
   virtual std::vector<ARecord*> FindByAccountName(std::string pSearch, SearchRequest::SearchType pTypeOfSearch=SearchRequest::TXT);
 
   /** Retrieve a given set of records.
-   * Loop over all sources managed.
+   * All sources managed are searched concurrently.
    * @copydoc IIOService::FindByLabel(std::string, SearchType pTypeOfSearch)   
    */
   virtual std::vector<ARecord*> FindByLabel(std::string pSearch, SearchRequest::SearchType pTypeOfSearch=SearchRequest::TXT);  
 
+  /** Retrieve the records whose labels match a query.
+   * All sources managed are searched concurrently.
+   * @copydoc IIOService::FindByLabelQuery(std::string)
+   */
+  virtual std::vector<ARecord*> FindByLabelQuery(std::string pQuery);
+
   /** Retrieve a given record.
    * @copydoc IIOService::FindByAccountId(unsigned long)   
    */
   virtual ARecord* FindByAccountId(unsigned long pAccountId);
 
+  /** Retrieve a given record by its UUID.
+   * All sources managed are looked up, each one by its own index.
+   * @copydoc IIOService::FindByUUID(const std::string&)
+   */
+  virtual ARecord* FindByUUID(const std::string &pUUID);
+
   /** @copydoc IIOService::GetAllAccounts() 
       Loop over existing sources and return a new vector with their complete list.
+      Sources keep their records sorted: their lists are merged, without sorting them again.
    */
   virtual std::vector<ARecord*> GetAllAccounts(int sort);
   
@@ -0,0 +1,446 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: PasswordGeneratorTool.cc
+ Description: Generate random passwords following configurable policies
+ Last Modified: $Id$
+*/
+
+#include "PasswordGeneratorTool.h"
+
+#include "ILog.h"
+#include "IConfigurationService.h"
+#include "MiscUtils.h"
+
+#include <sstream>
+#include <atomic>
+#include <errno.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+
+extern ILog *log;
+extern IConfigurationService *cfgMgr;
+
+using namespace std;
+
+/// Base-2 logarithm for x >= 1 (math.h would clash with the global log service)
+static double Log2(double x)
+{
+  double result = 0.;
+  while (x >= 2.) {
+    x /= 2.;
+    result += 1.;
+  }
+  double bit = 0.5;
+  for (int i=0; i < 20; i++) {
+    x *= x;
+    if (x >= 2.) {
+      x /= 2.;
+      result += bit;
+    }
+    bit /= 2.;
+  }
+  return result;
+}
+
+// ----------------------------------------
+// PasswordPolicy
+// ----------------------------------------
+
+PasswordGeneratorTool::PasswordPolicy::PasswordPolicy(string pName)
+{
+  name = pName;
+  mode = GEN_RANDOM;
+  length = 16;
+  words = 6;
+  classes = "aA1!";
+  separator = "-";
+}
+
+bool PasswordGeneratorTool::PasswordPolicy::IsValid() const
+{
+  for (string::const_iterator itc = classes.begin(); itc != classes.end(); ++itc) {
+    if (GetClassChars(*itc).empty())
+      return false; //unknown class
+  }
+  int nClasses = GetClassSets().size();
+  if (mode == GEN_RANDOM)
+    return (nClasses > 0 && length >= nClasses);
+  if (mode == GEN_PRONOUNCEABLE)
+    return (length >= 2 && length >= nClasses + 1);
+  if (mode == GEN_DICEWARE)
+    return (words > 0);
+  return false;
+}
+
+vector<string> PasswordGeneratorTool::PasswordPolicy::GetClassSets() const
+{
+  vector<string> classSets;
+  string alphabet;
+  for (string::const_iterator itc = classes.begin(); itc != classes.end(); ++itc) {
+    string classChars = GetClassChars(*itc);
+    if (classChars.empty() || alphabet.find(classChars[0]) != string::npos)
+      continue;
+    alphabet += classChars;
+    classSets.push_back(classChars);
+  }
+  return classSets;
+}
+
+string PasswordGeneratorTool::PasswordPolicy::str() const
+{
+  ostringstream outStr;
+  outStr << name << ": ";
+  if (mode == GEN_DICEWARE)
+    outStr << "diceware, " << words << " words, separator '" << separator << "'";
+  else
+    outStr << (mode == GEN_PRONOUNCEABLE ? "pronounceable, " : "random, ") << length << " chars";
+  outStr << ", classes '" << classes << "'";
+  return outStr.str();
+}
+
+// ----------------------------------------
+// EntropyPool
+// ----------------------------------------
+
+PasswordGeneratorTool::EntropyPool::EntropyPool()
+{
+  m_pos = sizeof(m_buffer); //fill at first use
+  m_failed = false;
+}
+
+PasswordGeneratorTool::EntropyPool::~EntropyPool()
+{
+  volatile unsigned char *p = m_buffer;
+  for (size_t i=0; i < sizeof(m_buffer); i++)
+    p[i] = 0;
+}
+
+void PasswordGeneratorTool::EntropyPool::Refill()
+{
+  size_t filled = 0;
+  while (filled < sizeof(m_buffer)) {
+    ssize_t res = getrandom(m_buffer + filled, sizeof(m_buffer) - filled, 0);
+    if (res < 0) {
+      if (errno == EINTR)
+	continue;
+      //never fall back to a weaker source: flag it and let the caller discard the result
+      m_failed = true;
+      break;
+    }
+    filled += res;
+  }
+  m_pos = 0;
+}
+
+uint32_t PasswordGeneratorTool::EntropyPool::Uniform(uint32_t pN)
+{
+  if (pN <= 1)
+    return 0;
+  if (pN <= 256) {
+    //one byte per draw, reject the top values which would bias the modulo
+    uint32_t threshold = 256 % pN;
+    while (true) {
+      if (m_pos >= sizeof(m_buffer))
+	Refill();
+      uint32_t r = m_buffer[m_pos++];
+      if (r >= threshold || m_failed)
+	return r % pN;
+    }
+  }
+  uint32_t threshold = (uint32_t)(-pN) % pN; // 2^32 mod pN
+  while (true) {
+    if (m_pos + 4 > sizeof(m_buffer))
+      Refill();
+    uint32_t r;
+    memcpy(&r, m_buffer + m_pos, 4);
+    m_pos += 4;
+    if (r >= threshold || m_failed)
+      return r % pN;
+  }
+}
+
+// ----------------------------------------
+// PasswordGeneratorTool
+// ----------------------------------------
+
+PasswordGeneratorTool::PasswordGeneratorTool(string pName) : IErrorHandler(pName)
+{
+  m_wordListMap = 0;
+  m_wordListSize = 0;
+}
+
+PasswordGeneratorTool::~PasswordGeneratorTool()
+{
+  FreeWordList();
+}
+
+string PasswordGeneratorTool::GetClassChars(char pClass)
+{
+  switch (pClass) {
+  case 'a':
+    return "abcdefghijklmnopqrstuvwxyz";
+  case 'A':
+    return "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  case '1':
+    return "0123456789";
+  case '!':
+    //no quotes, backslash, comma or spaces: safe to paste in shells, CSV and config files
+    return "!#$%&()*+-./:;<=>?@[]^_{|}~";
+  }
+  return "";
+}
+
+void PasswordGeneratorTool::FreeWordList()
+{
+  if (m_wordListMap)
+    munmap(const_cast<char*>(m_wordListMap), m_wordListSize);
+  m_wordListMap = 0;
+  m_wordListSize = 0;
+  m_words.clear();
+  m_wordListFile.clear();
+}
+
+IErrorHandler::StatusCode PasswordGeneratorTool::SetWordList(string pFileName)
+{
+  FreeWordList();
+  if (pFileName.empty())
+    return m_statusCode = SC_OK;
+  int fd = open(pFileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    *log << ILog::ERROR << "Cannot open word list: " << pFileName << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+    *log << ILog::ERROR << "Empty or unreadable word list: " << pFileName << this << ILog::endmsg;
+    close(fd);
+    return m_statusCode = SC_ERROR;
+  }
+  void *map = mmap(0, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    *log << ILog::ERROR << "Cannot map word list: " << pFileName << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  m_wordListMap = static_cast<const char*>(map);
+  m_wordListSize = fileStat.st_size;
+  m_wordListFile = pFileName;
+
+  //index words: one per line, optionally preceded by dice digits (EFF format: "11111<tab>word")
+  size_t pos = 0;
+  while (pos < m_wordListSize) {
+    const char *eol = static_cast<const char*>(memchr(m_wordListMap + pos, '\n', m_wordListSize - pos));
+    size_t end = eol ? (eol - m_wordListMap) : m_wordListSize;
+    size_t start = pos;
+    size_t digitsEnd = start;
+    while (digitsEnd < end && isdigit((unsigned char)m_wordListMap[digitsEnd]))
+      digitsEnd++;
+    if (digitsEnd > start && digitsEnd < end && isspace((unsigned char)m_wordListMap[digitsEnd]))
+      start = digitsEnd;
+    while (start < end && isspace((unsigned char)m_wordListMap[start]))
+      start++;
+    size_t wordEnd = end;
+    while (wordEnd > start && isspace((unsigned char)m_wordListMap[wordEnd-1]))
+      wordEnd--;
+    if (wordEnd > start)
+      m_words.push_back(make_pair(start, wordEnd - start));
+    pos = end + 1;
+  }
+  if (m_words.size() < 2) {
+    *log << ILog::ERROR << "Word list does not contain enough words: " << pFileName << this << ILog::endmsg;
+    FreeWordList();
+    return m_statusCode = SC_ERROR;
+  }
+  *log << ILog::VERBOSE << "Loaded word list " << pFileName << ": " << (unsigned long)m_words.size() << " words"
+       << this << ILog::endmsg;
+  return m_statusCode = SC_OK;
+}
+
+size_t PasswordGeneratorTool::GetWordListSize()
+{
+  return m_words.size();
+}
+
+IErrorHandler::StatusCode PasswordGeneratorTool::PrepareFor(const PasswordPolicy &pPolicy)
+{
+  if (not pPolicy.IsValid()) {
+    *log << ILog::ERROR << "Invalid password policy: " << pPolicy.str() << this << ILog::endmsg;
+    m_errorMsg = "Invalid password policy: " + pPolicy.name;
+    return m_statusCode = SC_ERROR;
+  }
+  if (pPolicy.mode != GEN_DICEWARE || not m_words.empty())
+    return m_statusCode = SC_OK;
+  //load the configured word list
+  string wordList;
+  if (cfgMgr)
+    wordList = cfgMgr->GetDicewareWordList();
+  if (wordList.empty()) {
+    *log << ILog::ERROR << "No word list configured for diceware policy: " << pPolicy.name << this << ILog::endmsg;
+    m_errorMsg = "No word list configured (DicewareWordList)";
+    return m_statusCode = SC_ERROR;
+  }
+  if (SetWordList(wordList) != SC_OK)
+    m_errorMsg = "Cannot load word list " + wordList;
+  return m_statusCode;
+}
+
+IErrorHandler::StatusCode PasswordGeneratorTool::Generate(const PasswordPolicy &pPolicy, const vector<string> &pClassSets,
+							   const string &pAlphabet, EntropyPool &pPool, string &pPwd)
+{
+  //Note: can run concurrently, do not modify members here
+
+  if (pPolicy.mode == GEN_RANDOM) {
+    //draw all charachters, reject the candidate if a class is missing
+    bool allClasses = false;
+    while (not allClasses) {
+      pPwd.assign(pPolicy.length, ' ');
+      for (size_t i=0; i < pPwd.size(); i++)
+	pPwd[i] = pAlphabet[pPool.Uniform(pAlphabet.size())];
+      allClasses = true;
+      for (vector<string>::const_iterator its = pClassSets.begin(); its != pClassSets.end(); ++its)
+	if (pPwd.find_first_of(*its) == string::npos)
+	  allClasses = false;
+      if (pPool.Failed())
+	break;
+    }
+  } else if (pPolicy.mode == GEN_PRONOUNCEABLE) {
+    static const string consonants("bcdfghjklmnprstvz");
+    static const string vowels("aeiou");
+    pPwd.assign(pPolicy.length, ' ');
+    bool vowel = (pPool.Uniform(2) == 1);
+    for (size_t i=0; i < pPwd.size(); i++) {
+      const string &set = vowel ? vowels : consonants;
+      pPwd[i] = set[pPool.Uniform(set.size())];
+      vowel = !vowel;
+    }
+    //one charachter for each other class, at distinct random positions
+    vector<size_t> freePos;
+    for (size_t i=0; i < pPwd.size(); i++)
+      freePos.push_back(i);
+    for (vector<string>::const_iterator its = pClassSets.begin(); its != pClassSets.end(); ++its) {
+      if ((*its)[0] == 'a')
+	continue; //lower-case letters are there already
+      size_t pick = pPool.Uniform(freePos.size());
+      size_t pos = freePos[pick];
+      freePos.erase(freePos.begin() + pick);
+      if ((*its)[0] == 'A')
+	pPwd[pos] = toupper(pPwd[pos]);
+      else
+	pPwd[pos] = (*its)[pPool.Uniform(its->size())];
+    }
+  } else {
+    //diceware: words, optionally capitalized and with one digit appended to a random word
+    size_t digitWord = pPolicy.words;
+    char digit = 0;
+    if (pPolicy.classes.find('1') != string::npos) {
+      digitWord = pPool.Uniform(pPolicy.words);
+      digit = '0' + pPool.Uniform(10);
+    }
+    pPwd.clear();
+    for (int w=0; w < pPolicy.words; w++) {
+      if (w > 0)
+	pPwd += pPolicy.separator;
+      const pair<size_t, size_t> &word = m_words[pPool.Uniform(m_words.size())];
+      size_t wordStart = pPwd.size();
+      pPwd.append(m_wordListMap + word.first, word.second);
+      if (pPolicy.classes.find('A') != string::npos)
+	pPwd[wordStart] = toupper(pPwd[wordStart]);
+      if ((size_t)w == digitWord)
+	pPwd += digit;
+    }
+  }
+
+  if (pPool.Failed()) {
+    std::fill(pPwd.begin(), pPwd.end(), '\0');
+    pPwd.clear();
+    *log << ILog::ERROR << "Kernel random generator not available." << this << ILog::endmsg;
+    return SC_FATAL;
+  }
+  return SC_OK;
+}
+
+IErrorHandler::StatusCode PasswordGeneratorTool::Generate(const PasswordPolicy &pPolicy, string &pPwd)
+{
+  if (PrepareFor(pPolicy) != SC_OK)
+    return m_statusCode;
+  vector<string> classSets = pPolicy.GetClassSets();
+  m_statusCode = Generate(pPolicy, classSets, CSMUtils::CreateListStr(classSets, ""), m_pool, pPwd);
+  if (m_statusCode != SC_OK)
+    m_errorMsg = "Cannot get random data from the system.";
+  return m_statusCode;
+}
+
+IErrorHandler::StatusCode PasswordGeneratorTool::Generate(string pPolicyName, string &pPwd)
+{
+  PasswordPolicy policy(pPolicyName);
+  if (cfgMgr)
+    policy = cfgMgr->GetPasswordPolicy(pPolicyName);
+  *log << ILog::DEBUG << "Generating password with policy " << policy.str() << this << ILog::endmsg;
+  return Generate(policy, pPwd);
+}
+
+IErrorHandler::StatusCode PasswordGeneratorTool::Generate(const PasswordPolicy &pPolicy, size_t pN, vector<string> &pPwds)
+{
+  pPwds.assign(pN, string());
+  if (PrepareFor(pPolicy) != SC_OK)
+    return m_statusCode;
+  // split in chunks, each thread draws from its own pool
+  const size_t chunkSize = 1024;
+  size_t nChunks = (pN + chunkSize - 1) / chunkSize;
+  vector<string> classSets = pPolicy.GetClassSets();
+  string alphabet = CSMUtils::CreateListStr(classSets, "");
+  std::atomic<bool> failed(false);
+  CSMUtils::ParallelFor(nChunks, [&](size_t pChunk) {
+      EntropyPool pool;
+      size_t last = min(pN, (pChunk + 1) * chunkSize);
+      for (size_t i = pChunk * chunkSize; i < last && not failed; i++)
+	if (Generate(pPolicy, classSets, alphabet, pool, pPwds[i]) != SC_OK)
+	  failed = true;
+    });
+  if (failed) {
+    m_errorMsg = "Cannot get random data from the system.";
+    pPwds.clear();
+    return m_statusCode = SC_FATAL;
+  }
+  *log << ILog::VERBOSE << "Generated " << (unsigned long)pN << " passwords with policy " << pPolicy.str()
+       << this << ILog::endmsg;
+  return m_statusCode = SC_OK;
+}
+
+double PasswordGeneratorTool::EntropyBits(const PasswordPolicy &pPolicy)
+{
+  if (not pPolicy.IsValid())
+    return 0.;
+  vector<string> classSets = pPolicy.GetClassSets();
+  if (pPolicy.mode == GEN_RANDOM)
+    return pPolicy.length * Log2(CSMUtils::CreateListStr(classSets, "").size()); //slight over-estimate: ignores rejected candidates
+  if (pPolicy.mode == GEN_PRONOUNCEABLE) {
+    double bits = 1. + ((pPolicy.length + 1) / 2) * Log2(17.) + (pPolicy.length / 2) * Log2(5.);
+    size_t freePos = pPolicy.length;
+    for (vector<string>::iterator its = classSets.begin(); its != classSets.end(); ++its) {
+      if (its->size() == 26)
+	continue; //lower/upper case: only position matters for upper, nothing for lower
+      bits += Log2(freePos) + Log2(its->size());
+      freePos--;
+    }
+    if (pPolicy.classes.find('A') != string::npos)
+      bits += Log2(pPolicy.length);
+    return bits;
+  }
+  size_t nWords = m_words.size();
+  if (nWords == 0 && PrepareFor(pPolicy) != SC_OK)
+    return 0.;
+  nWords = m_words.size();
+  double bits = pPolicy.words * Log2(nWords);
+  if (pPolicy.classes.find('1') != string::npos)
+    bits += Log2(pPolicy.words) + Log2(10.);
+  return bits;
+}
@@ -0,0 +1,138 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: PasswordGeneratorTool.h
+ Description: Generate random passwords following configurable policies
+ Last Modified: $Id$
+*/
+
+#ifndef __PASSWORD_GENERATOR_TOOL__
+#define __PASSWORD_GENERATOR_TOOL__
+
+#include "IErrorHandler.h"
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdint.h>
+
+/** Generate random passwords following configurable policies.
+ * Randomness is taken from the kernel CSPRNG (getrandom) in blocks, and
+ * characters/words are drawn with rejection sampling so that no outcome is favoured.
+ * Three generation modes are available:
+ * - RANDOM: characters drawn from the enabled character classes, each class appearing at least once
+ * - PRONOUNCEABLE: alternating consonants and vowels, then one character of each other class
+ * - DICEWARE: words drawn from a word list (plain or EFF-style "11111<tab>word" lines)
+ */
+class PasswordGeneratorTool : public IErrorHandler {
+ public:
+  /// Generation modes
+  enum GenMode {
+    GEN_RANDOM=0,
+    GEN_PRONOUNCEABLE,
+    GEN_DICEWARE
+  };
+
+  /** Policy used to generate a password.
+   * Policies are identified by name. The name of a predefined account type
+   * can be used to apply the policy to accounts of that type, "Default" otherwise.
+   */
+  class PasswordPolicy {
+  public:
+    std::string name; ///< policy name
+    GenMode mode; ///< generation mode
+    int length; ///< number of charachters (RANDOM, PRONOUNCEABLE)
+    int words; ///< number of words (DICEWARE)
+    std::string classes; ///< enabled classes: 'a' lower, 'A' upper, '1' digits, '!' symbols
+    std::string separator; ///< word separator (DICEWARE)
+
+    PasswordPolicy(std::string pName="Default");
+    /// Check that the policy can produce a password
+    bool IsValid() const;
+    /// Charachters of each enabled class, duplicates removed
+    std::vector<std::string> GetClassSets() const;
+    /// Human-readable summary, for logging
+    std::string str() const;
+  };
+
+  /** Buffered entropy from the kernel CSPRNG.
+   * Not thread-safe: use one pool per thread.
+   */
+  class EntropyPool {
+  protected:
+    unsigned char m_buffer[4096];
+    size_t m_pos;
+    bool m_failed;
+    void Refill();
+  public:
+    EntropyPool();
+    ~EntropyPool(); ///< wipes the unused entropy
+    /// Uniform integer in [0, pN), pN > 0
+    uint32_t Uniform(uint32_t pN);
+    /// True if the kernel could not provide random bytes
+    bool Failed() const { return m_failed; }
+  };
+
+ protected:
+  /// Entropy used for single password generation
+  EntropyPool m_pool;
+  /// Memory-mapped word list
+  const char *m_wordListMap;
+  size_t m_wordListSize;
+  std::string m_wordListFile;
+  /// (offset, length) of each word inside m_wordListMap
+  std::vector< std::pair<size_t, size_t> > m_words;
+
+  /// Unmap current word list
+  void FreeWordList();
+  /// Make sure the word list configured is loaded (DICEWARE only)
+  StatusCode PrepareFor(const PasswordPolicy &pPolicy);
+  /** Actual generation, independent of internal state except the word list.
+   * pClassSets and pAlphabet (all class sets joined) are computed once by the caller.
+   */
+  StatusCode Generate(const PasswordPolicy &pPolicy, const std::vector<std::string> &pClassSets,
+		      const std::string &pAlphabet, EntropyPool &pPool, std::string &pPwd);
+
+ public:
+  PasswordGeneratorTool(std::string pName);
+  ~PasswordGeneratorTool();
+
+  /** Set the word list used for DICEWARE mode.
+   * The file is memory-mapped and indexed once.
+   * If empty, the one from the configuration service is used when needed.
+   */
+  StatusCode SetWordList(std::string pFileName);
+  /// Number of words available for DICEWARE mode
+  size_t GetWordListSize();
+
+  /** Generate a password using a given policy.
+   * @param pPolicy policy to follow
+   * @param pPwd generated password
+   * @return the status of the operation
+   */
+  StatusCode Generate(const PasswordPolicy &pPolicy, std::string &pPwd);
+
+  /** Generate a password using the policy defined in the configuration.
+   * @param pPolicyName name of the policy (usually the predefined account type)
+   * @param pPwd generated password
+   */
+  StatusCode Generate(std::string pPolicyName, std::string &pPwd);
+
+  /** Generate a batch of passwords.
+   * Work is split among several threads, each with its own entropy pool.
+   * @param pPolicy policy to follow
+   * @param pN number of passwords to generate
+   * @param pPwds output vector, resized to pN
+   */
+  StatusCode Generate(const PasswordPolicy &pPolicy, size_t pN, std::vector<std::string> &pPwds);
+
+  /// Estimated entropy (in bits) of passwords generated with the given policy
+  double EntropyBits(const PasswordPolicy &pPolicy);
+
+  /// Charachters of a given class ('a', 'A', '1', '!')
+  static std::string GetClassChars(char pClass);
+};
+
+#endif
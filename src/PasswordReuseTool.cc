@@ -0,0 +1,287 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: PasswordReuseTool.cc
+ Description: Find passwords reused, as-is or slightly modified, among accounts
+ Last Modified: $Id$
+*/
+
+#include "PasswordReuseTool.h"
+
+#include "ILog.h"
+#include "MiscUtils.h"
+#include "BreachCheckTool.h"
+#include "PasswordGeneratorTool.h"
+#include "PasswordStrengthTool.h"
+
+#include <unordered_map>
+#include <map>
+#include <algorithm>
+#include <string.h>
+#include <ctype.h>
+#include <sys/mman.h>
+
+extern ILog *log;
+
+using namespace std;
+
+namespace {
+  /// 64-bit finalizer (splitmix64), used to derive the MinHash functions
+  inline uint64_t Mix64(uint64_t pX)
+  {
+    pX ^= pX >> 30;
+    pX *= 0xBF58476D1CE4E5B9ULL;
+    pX ^= pX >> 27;
+    pX *= 0x94D049BB133111EBULL;
+    pX ^= pX >> 31;
+    return pX;
+  }
+
+  /// Minimal union-find over item indexes
+  class DisjointSets {
+    vector<size_t> m_parent;
+  public:
+    DisjointSets(size_t pN) : m_parent(pN) {
+      for (size_t k=0; k < pN; k++)
+	m_parent[k] = k;
+    }
+    size_t Find(size_t pK) {
+      while (m_parent[pK] != pK) {
+	m_parent[pK] = m_parent[m_parent[pK]];
+	pK = m_parent[pK];
+      }
+      return pK;
+    }
+    void Union(size_t pA, size_t pB) {
+      pA = Find(pA);
+      pB = Find(pB);
+      if (pA != pB)
+	m_parent[max(pA, pB)] = min(pA, pB);
+    }
+  };
+}
+
+PasswordReuseTool::PasswordReuseTool(string pName) : IErrorHandler(pName)
+{
+  //keep the key out of swap if possible
+  void *keyMem = mmap(0, KEY_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (keyMem == MAP_FAILED) {
+    m_key = 0;
+    *log << ILog::ERROR << "Cannot allocate memory for the reuse key" << this << ILog::endmsg;
+    return;
+  }
+  if (mlock(keyMem, KEY_SIZE) != 0)
+    *log << ILog::VERBOSE << "Cannot lock memory for the reuse key, it may be swapped" << this << ILog::endmsg;
+  m_key = static_cast<unsigned char*>(keyMem);
+  PasswordGeneratorTool::EntropyPool pool;
+  for (int k=0; k < KEY_SIZE; k++)
+    m_key[k] = pool.Uniform(256);
+  if (pool.Failed()) {
+    *log << ILog::ERROR << "Cannot get random bytes for the reuse key" << this << ILog::endmsg;
+    m_statusCode = SC_ERROR;
+  }
+}
+
+PasswordReuseTool::~PasswordReuseTool()
+{
+  if (m_key) {
+    memset(m_key, 0, KEY_SIZE);
+    munlock(m_key, KEY_SIZE);
+    munmap(m_key, KEY_SIZE);
+  }
+}
+
+string PasswordReuseTool::KeyedHash(const string &pSecret) const
+{
+  // HMAC-SHA1
+  string inner(KEY_SIZE, '\0'), outer(KEY_SIZE, '\0');
+  for (int k=0; k < KEY_SIZE; k++) {
+    inner[k] = m_key[k] ^ 0x36;
+    outer[k] = m_key[k] ^ 0x5C;
+  }
+  inner += pSecret;
+  outer += BreachCheckTool::Sha1(inner);
+  string digest = BreachCheckTool::Sha1(outer);
+  std::fill(inner.begin(), inner.end(), '\0');
+  std::fill(outer.begin(), outer.end(), '\0');
+  return digest;
+}
+
+string PasswordReuseTool::Normalize(const string &pSecret)
+{
+  string normalized(pSecret);
+  for (string::iterator itc = normalized.begin(); itc != normalized.end(); ++itc)
+    *itc = PasswordStrengthTool::UnL33t(tolower((unsigned char)*itc));
+  return normalized;
+}
+
+string PasswordReuseTool::Stem(const string &pSecret)
+{
+  size_t first = 0, last = pSecret.size();
+  while (first < last && not isalpha((unsigned char)pSecret[first]))
+    first++;
+  while (last > first && not isalpha((unsigned char)pSecret[last - 1]))
+    last--;
+  return Normalize(pSecret.substr(first, last - first));
+}
+
+size_t PasswordReuseTool::EditDistance(const string &pA, const string &pB, size_t pMax)
+{
+  size_t n = pA.size(), m = pB.size();
+  if ((n > m ? n - m : m - n) > pMax)
+    return pMax + 1;
+  vector<size_t> prev(m + 1), cur(m + 1);
+  for (size_t j=0; j <= m; j++)
+    prev[j] = j;
+  for (size_t i=1; i <= n; i++) {
+    cur[0] = i;
+    size_t rowMin = cur[0];
+    for (size_t j=1; j <= m; j++) {
+      cur[j] = min(min(prev[j] + 1, cur[j-1] + 1), prev[j-1] + (pA[i-1] == pB[j-1] ? 0 : 1));
+      rowMin = min(rowMin, cur[j]);
+    }
+    if (rowMin > pMax)
+      return pMax + 1; //cannot get better
+    prev.swap(cur);
+  }
+  return min(prev[m], pMax + 1);
+}
+
+IErrorHandler::StatusCode PasswordReuseTool::FindReuse(const vector<string> &pSecrets, vector<Group> &pGroups, bool pSimilar)
+{
+  pGroups.clear();
+  if (!m_key || m_statusCode >= SC_ERROR) {
+    m_errorMsg = "No key available to compare secrets";
+    return m_statusCode = SC_ERROR;
+  }
+
+  // --- exact duplicates: group keyed hashes
+  vector<string> digests(pSecrets.size());
+  CSMUtils::ParallelFor(pSecrets.size(), [&](size_t k) {
+      if (not pSecrets[k].empty())
+	digests[k] = KeyedHash(pSecrets[k]);
+    });
+  unordered_map<string, vector<size_t> > byDigest;
+  vector<size_t> representatives; //first secret of each distinct value
+  for (size_t k=0; k < pSecrets.size(); k++) {
+    if (digests[k].empty())
+      continue;
+    vector<size_t> &same = byDigest[digests[k]];
+    if (same.empty())
+      representatives.push_back(k);
+    same.push_back(k);
+  }
+  for (vector<size_t>::iterator itr = representatives.begin(); itr != representatives.end(); ++itr) {
+    vector<size_t> &same = byDigest[digests[*itr]];
+    if (same.size() > 1) {
+      Group group;
+      group.type = REUSE_EXACT;
+      group.members = same;
+      pGroups.push_back(group);
+    }
+  }
+  *log << ILog::VERBOSE << "Found " << (unsigned long)pGroups.size() << " secrets reused as-is among "
+       << (unsigned long)representatives.size() << " distinct ones" << this << ILog::endmsg;
+  if (not pSimilar)
+    return m_statusCode = SC_OK;
+
+  // --- near duplicates, among distinct values only
+  size_t nDistinct = representatives.size();
+  vector<string> normalized(nDistinct);
+  vector< vector<uint64_t> > signatures(nDistinct);
+  // - seeds of the MinHash functions, derived from the key so that signatures are not predictable
+  uint64_t seeds[MINHASH_SIZE];
+  for (int h=0; h < MINHASH_SIZE; h++) {
+    uint64_t seed = 0;
+    for (int b=0; b < 8; b++)
+      seed = (seed << 8) | m_key[(h * 8 + b) % KEY_SIZE];
+    seeds[h] = Mix64(seed + h);
+  }
+  CSMUtils::ParallelFor(nDistinct, [&](size_t r) {
+      normalized[r] = Normalize(pSecrets[representatives[r]]);
+      if (normalized[r].size() < 4)
+	return; //too short to tell
+      //trigrams, with start and end markers
+      string padded = "\x01" + normalized[r] + "\x02";
+      signatures[r].assign(MINHASH_SIZE, ~(uint64_t)0);
+      for (size_t k=0; k + 3 <= padded.size(); k++) {
+	uint64_t shingle = ((uint64_t)(unsigned char)padded[k] << 16) | ((uint64_t)(unsigned char)padded[k+1] << 8) |
+	  (uint64_t)(unsigned char)padded[k+2];
+	for (int h=0; h < MINHASH_SIZE; h++)
+	  signatures[r][h] = min(signatures[r][h], Mix64(shingle ^ seeds[h]));
+      }
+      std::fill(padded.begin(), padded.end(), '\0');
+    });
+
+  DisjointSets similar(nDistinct);
+  // - same stem (keyed hashes of the stems are compared, to avoid keeping a table of them)
+  unordered_map<string, size_t> byStem;
+  for (size_t r=0; r < nDistinct; r++) {
+    string stem = Stem(pSecrets[representatives[r]]);
+    if (stem.size() >= 4) {
+      string stemDigest = KeyedHash(stem);
+      unordered_map<string, size_t>::iterator its = byStem.find(stemDigest);
+      if (its == byStem.end())
+	byStem[stemDigest] = r;
+      else
+	similar.Union(its->second, r);
+    }
+    std::fill(stem.begin(), stem.end(), '\0');
+  }
+  // - LSH on MinHash signatures, candidates confirmed by edit distance
+  const int rows = MINHASH_SIZE / LSH_BANDS;
+  size_t nCandidates = 0;
+  for (int band=0; band < LSH_BANDS; band++) {
+    unordered_map<uint64_t, vector<size_t> > buckets;
+    for (size_t r=0; r < nDistinct; r++) {
+      if (signatures[r].empty())
+	continue;
+      uint64_t bandKey = band;
+      for (int h = band * rows; h < (band + 1) * rows; h++)
+	bandKey = Mix64(bandKey ^ signatures[r][h]);
+      buckets[bandKey].push_back(r);
+    }
+    for (unordered_map<uint64_t, vector<size_t> >::iterator itb = buckets.begin(); itb != buckets.end(); ++itb) {
+      vector<size_t> &bucket = itb->second;
+      if (bucket.size() < 2 || bucket.size() > MAX_BUCKET_SIZE)
+	continue;
+      for (size_t a=0; a < bucket.size(); a++) {
+	for (size_t b=a+1; b < bucket.size(); b++) {
+	  if (similar.Find(bucket[a]) == similar.Find(bucket[b]))
+	    continue;
+	  nCandidates++;
+	  const string &sa = normalized[bucket[a]], &sb = normalized[bucket[b]];
+	  size_t maxDistance = max((size_t)1, min(sa.size(), sb.size()) / 5);
+	  if (EditDistance(sa, sb, maxDistance) <= maxDistance)
+	    similar.Union(bucket[a], bucket[b]);
+	}
+      }
+    }
+  }
+  for (vector<string>::iterator itn = normalized.begin(); itn != normalized.end(); ++itn)
+    std::fill(itn->begin(), itn->end(), '\0');
+
+  // - collect groups of distinct values, each expanded with its exact duplicates
+  map<size_t, vector<size_t> > similarSets;
+  for (size_t r=0; r < nDistinct; r++)
+    similarSets[similar.Find(r)].push_back(r);
+  size_t nSimilar = 0;
+  for (map<size_t, vector<size_t> >::iterator its = similarSets.begin(); its != similarSets.end(); ++its) {
+    if (its->second.size() < 2)
+      continue;
+    Group group;
+    group.type = REUSE_SIMILAR;
+    for (vector<size_t>::iterator itr = its->second.begin(); itr != its->second.end(); ++itr) {
+      vector<size_t> &same = byDigest[digests[representatives[*itr]]];
+      group.members.insert(group.members.end(), same.begin(), same.end());
+    }
+    sort(group.members.begin(), group.members.end());
+    pGroups.push_back(group);
+    nSimilar++;
+  }
+  *log << ILog::VERBOSE << "Found " << (unsigned long)nSimilar << " groups of similar secrets ("
+       << (unsigned long)nCandidates << " candidate pairs checked)" << this << ILog::endmsg;
+  return m_statusCode = SC_OK;
+}
@@ -0,0 +1,78 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: PasswordReuseTool.h
+ Description: Find passwords reused, as-is or slightly modified, among accounts
+ Last Modified: $Id$
+*/
+
+#ifndef __PASSWORD_REUSE_TOOL__
+#define __PASSWORD_REUSE_TOOL__
+
+#include "IErrorHandler.h"
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/** Find passwords reused, as-is or slightly modified, among accounts.
+ * Secrets are compared through a keyed hash (HMAC-SHA1 with a random key held in
+ * locked memory and wiped at the end), so that no table of plain passwords is built.
+ * Exact duplicates are grouped with a hash map.
+ * Near-duplicates are found on a normalized form of the passwords (lower-case,
+ * l33t substitutions undone):
+ * - same stem, i.e. same letters once leading and trailing digits/symbols are removed ("Summer2019!", "summer2020")
+ * - small edit distance: candidate pairs come from MinHash signatures of charachter
+ *   trigrams bucketed in LSH bands, then the edit distance is checked on each pair.
+ */
+class PasswordReuseTool : public IErrorHandler {
+ public:
+  /// Kind of reuse found
+  enum ReuseType {
+    REUSE_EXACT=0,
+    REUSE_SIMILAR
+  };
+
+  /// Group of secrets reused among each others
+  class Group {
+  public:
+    ReuseType type;
+    std::vector<size_t> members; ///< indexes of the secrets given to FindReuse()
+  };
+
+ protected:
+  static const int KEY_SIZE = 64; ///< HMAC-SHA1 block size
+  static const int MINHASH_SIZE = 32; ///< hash functions of each signature
+  static const int LSH_BANDS = 8; ///< MINHASH_SIZE / LSH_BANDS rows per band
+  static const size_t MAX_BUCKET_SIZE = 64; ///< larger LSH buckets are skipped (stems catch most of those)
+
+  /// Key of the HMAC (locked in memory)
+  unsigned char *m_key;
+
+  /// Keyed hash of a secret
+  std::string KeyedHash(const std::string &pSecret) const;
+
+ public:
+  PasswordReuseTool(std::string pName);
+  ~PasswordReuseTool(); ///< wipes the key
+
+  /** Find reused secrets.
+   * Secrets are processed concurrently.
+   * @param pSecrets secrets to be compared (empty ones are ignored)
+   * @param pGroups groups found: exact duplicates first, then similar secrets
+   * @param pSimilar look also for similar (not only identical) secrets
+   * @return the status of the operation
+   */
+  StatusCode FindReuse(const std::vector<std::string> &pSecrets, std::vector<Group> &pGroups, bool pSimilar=true);
+
+  /// Lower-case, l33t substitutions undone
+  static std::string Normalize(const std::string &pSecret);
+  /// Normalized secret without leading and trailing digits and symbols
+  static std::string Stem(const std::string &pSecret);
+  /// Edit (Levenshtein) distance, computed only up to pMax (pMax+1 is returned if larger)
+  static size_t EditDistance(const std::string &pA, const std::string &pB, size_t pMax);
+};
+
+#endif
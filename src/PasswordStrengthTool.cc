@@ -0,0 +1,906 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: PasswordStrengthTool.cc
+ Description: Estimate password strength from the number of guesses needed to crack it
+ Last Modified: $Id$
+*/
+
+#include "PasswordStrengthTool.h"
+
+#include "ILog.h"
+#include "IConfigurationService.h"
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include <deque>
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern ILog *log;
+extern IConfigurationService *cfgMgr;
+
+using namespace std;
+
+// ----------------------------------------
+// Tuning constants (same values as zxcvbn)
+// ----------------------------------------
+static const int MAX_EVAL_LENGTH = 64; ///< longer passwords are evaluated on the first MAX_EVAL_LENGTH charachters
+static const double BRUTEFORCE_CARDINALITY = 10.;
+static const double MIN_GUESSES_BEFORE_GROWING_SEQUENCE = 10000.;
+static const double MIN_SUBMATCH_GUESSES_SINGLE_CHAR = 10.;
+static const double MIN_SUBMATCH_GUESSES_MULTI_CHAR = 50.;
+static const double MIN_YEAR_SPACE = 20.;
+static const int MAX_SEQUENCE_DELTA = 5;
+static const double KEYBOARD_STARTING_POSITIONS = 94.;
+static const double KEYBOARD_AVERAGE_DEGREE = 4.6;
+static const char DICT_MAGIC[8] = {'C','S','M','D','I','C','T','1'};
+
+/// Very common passwords, used when no dictionary is loaded (most common first)
+static const char *BUILTIN_COMMON_WORDS[] = {
+  "123456", "password", "12345678", "qwerty", "123456789", "12345", "1234", "111111", "1234567", "dragon",
+  "123123", "baseball", "abc123", "football", "monkey", "letmein", "shadow", "master", "666666", "qwertyuiop",
+  "123321", "mustang", "1234567890", "michael", "654321", "superman", "1qaz2wsx", "7777777", "121212", "000000",
+  "qazwsx", "123qwe", "killer", "trustno1", "jordan", "jennifer", "zxcvbnm", "asdfgh", "hunter", "buster",
+  "soccer", "harley", "batman", "andrew", "tigger", "sunshine", "iloveyou", "charlie", "robert", "thomas",
+  "hockey", "ranger", "daniel", "starwars", "112233", "george", "computer", "michelle", "jessica", "pepper",
+  "zxcvbn", "555555", "11111111", "131313", "freedom", "777777", "pass", "maggie", "159753", "aaaaaa",
+  "ginger", "princess", "joshua", "cheese", "amanda", "summer", "love", "ashley", "nicole", "chelsea",
+  "matthew", "access", "yankees", "987654321", "dallas", "austin", "thunder", "taylor", "matrix", "admin",
+  "welcome", "secret", "login", "changeme", "passw0rd", "hello", "flower", "qwerty123", "dragon1", "monkey1",
+  0
+};
+
+// ----------------------------------------
+// Helpers
+// ----------------------------------------
+
+/// pBase^pExp for small integer exponents (math.h would clash with the global log service)
+static double Pow(double pBase, int pExp)
+{
+  double result = 1.;
+  for (int i=0; i < pExp; i++)
+    result *= pBase;
+  return result;
+}
+
+static double Factorial(int pN)
+{
+  double result = 1.;
+  for (int i=2; i <= pN; i++)
+    result *= i;
+  return result;
+}
+
+static double NCk(int pN, int pK)
+{
+  if (pK > pN || pK < 0)
+    return 0.;
+  double result = 1.;
+  for (int i=1; i <= pK; i++)
+    result = result * (pN - pK + i) / i;
+  return result;
+}
+
+/// Additional guesses due to capitalization of a dictionary word
+static double UppercaseVariations(const string &pToken)
+{
+  int nUpper = 0, nLower = 0;
+  for (string::const_iterator itc = pToken.begin(); itc != pToken.end(); ++itc) {
+    if (isupper((unsigned char)*itc)) nUpper++;
+    else if (islower((unsigned char)*itc)) nLower++;
+  }
+  if (nUpper == 0)
+    return 1.;
+  // first, last or all upper-case: very common, just double the guesses
+  if (nLower == 0)
+    return 2.;
+  if (nUpper == 1 && (isupper((unsigned char)pToken[0]) || isupper((unsigned char)pToken[pToken.size()-1])))
+    return 2.;
+  double variations = 0.;
+  for (int i=1; i <= min(nUpper, nLower); i++)
+    variations += NCk(nUpper + nLower, i);
+  return variations;
+}
+
+/// Additional guesses due to l33t substitutions of a dictionary word
+static double L33tVariations(const string &pLower, const string &pUnL33t)
+{
+  double variations = 1.;
+  map<char, char> subs; //l33t char -> letter
+  for (size_t k=0; k < pLower.size(); k++)
+    if (pLower[k] != pUnL33t[k])
+      subs[pLower[k]] = pUnL33t[k];
+  for (map<char, char>::iterator its = subs.begin(); its != subs.end(); ++its) {
+    int nSubbed = count(pLower.begin(), pLower.end(), its->first);
+    int nUnsubbed = count(pLower.begin(), pLower.end(), its->second);
+    if (nUnsubbed == 0) {
+      variations *= 2.; //all substituted
+    } else {
+      double possibilities = 0.;
+      for (int i=1; i <= min(nSubbed, nUnsubbed); i++)
+	possibilities += NCk(nSubbed + nUnsubbed, i);
+      variations *= possibilities;
+    }
+  }
+  return variations;
+}
+
+// ----------------------------------------
+// Keyboard layout (qwerty, slanted rows)
+// ----------------------------------------
+namespace {
+  struct KeyboardLayout {
+    int row[128];
+    int col[128];
+    bool shifted[128];
+    KeyboardLayout() {
+      static const char *rows[] = { "`1234567890-=", "qwertyuiop[]\\", "asdfghjkl;'", "zxcvbnm,./" };
+      static const char *shiftedRows[] = { "~!@#$%^&*()_+", "QWERTYUIOP{}|", "ASDFGHJKL:\"", "ZXCVBNM<>?" };
+      static const int rowStart[] = { 0, 1, 1, 1 };
+      for (int c=0; c < 128; c++) {
+	row[c] = -1;
+	col[c] = -1;
+	shifted[c] = false;
+      }
+      for (int r=0; r < 4; r++) {
+	for (int k=0; rows[r][k] != 0; k++) {
+	  row[(int)rows[r][k]] = r;
+	  col[(int)rows[r][k]] = rowStart[r] + k;
+	  row[(int)shiftedRows[r][k]] = r;
+	  col[(int)shiftedRows[r][k]] = rowStart[r] + k;
+	  shifted[(int)shiftedRows[r][k]] = true;
+	}
+      }
+    }
+    /// Direction (0-5) from key pA to adjacent key pB, -1 if not adjacent
+    int Direction(char pA, char pB) const {
+      if (pA < 0 || pB < 0 || row[(int)pA] < 0 || row[(int)pB] < 0)
+	return -1;
+      static const int dRow[] = { 0, 0, -1, -1, 1, 1 };
+      static const int dCol[] = { -1, 1, 0, 1, -1, 0 };
+      for (int d=0; d < 6; d++)
+	if (row[(int)pB] - row[(int)pA] == dRow[d] && col[(int)pB] - col[(int)pA] == dCol[d])
+	  return d;
+      return -1;
+    }
+  };
+  const KeyboardLayout qwertyLayout;
+}
+
+// ----------------------------------------
+// Match and Result
+// ----------------------------------------
+
+PasswordStrengthTool::Match::Match(int pI, int pJ, MatchPattern pPattern, double pGuesses)
+{
+  i = pI;
+  j = pJ;
+  pattern = pPattern;
+  guesses = pGuesses;
+  reversed = false;
+  l33t = false;
+  userInput = false;
+}
+
+PasswordStrengthTool::Result::Result()
+{
+  score = 0;
+  guesses = 1.;
+}
+
+int PasswordStrengthTool::Result::GetLog10Guesses() const
+{
+  int digits = 0;
+  for (double g = guesses; g >= 10.; g /= 10.)
+    digits++;
+  return digits;
+}
+
+string PasswordStrengthTool::Result::GetScoreStr() const
+{
+  static const char *scoreStr[] = { "very weak", "weak", "fair", "strong", "very strong" };
+  return scoreStr[max(0, min(4, score))];
+}
+
+string PasswordStrengthTool::Result::GetFeedback() const
+{
+  if (score >= 3)
+    return "";
+  // give advice on the longest pattern found
+  const Match *longest = 0;
+  for (vector<Match>::const_iterator itm = sequence.begin(); itm != sequence.end(); ++itm) {
+    if (itm->pattern == PM_BRUTEFORCE)
+      continue;
+    if (!longest || (itm->j - itm->i) > (longest->j - longest->i))
+      longest = &(*itm);
+  }
+  if (!longest)
+    return "Use a longer password";
+  switch (longest->pattern) {
+  case PM_DICTIONARY:
+    if (longest->userInput)
+      return "Contains account information";
+    if (longest->l33t)
+      return "Predictable substitutions like '@' for 'a' don't help much";
+    if (longest->reversed)
+      return "Reversed words are easy to guess";
+    return "Contains a common word or password";
+  case PM_SPATIAL:
+    return "Keyboard patterns are easy to guess";
+  case PM_REPEAT:
+    return "Repeats like 'aaa' or 'abcabc' are easy to guess";
+  case PM_SEQUENCE:
+    return "Sequences like 'abc' or '6543' are easy to guess";
+  case PM_DATE:
+    return "Dates and years are easy to guess";
+  default:
+    break;
+  }
+  return "Use a longer password";
+}
+
+// ----------------------------------------
+// PasswordStrengthTool
+// ----------------------------------------
+
+PasswordStrengthTool::PasswordStrengthTool(string pName) : IErrorHandler(pName)
+{
+  m_dictMap = 0;
+  m_dictSize = 0;
+  m_nodes = 0;
+  m_edges = 0;
+  m_nNodes = 0;
+  time_t now = time(0);
+  struct tm nowTm;
+  localtime_r(&now, &nowTm);
+  m_refYear = nowTm.tm_year + 1900;
+}
+
+PasswordStrengthTool::~PasswordStrengthTool()
+{
+  FreeDictionary();
+}
+
+void PasswordStrengthTool::FreeDictionary()
+{
+  if (m_dictMap)
+    munmap(const_cast<char*>(m_dictMap), m_dictSize);
+  m_dictMap = 0;
+  m_dictSize = 0;
+  m_nodes = 0;
+  m_edges = 0;
+  m_nNodes = 0;
+}
+
+bool PasswordStrengthTool::HasDictionary() const
+{
+  return (m_dictMap != 0);
+}
+
+IErrorHandler::StatusCode PasswordStrengthTool::LoadDictionary(string pFileName)
+{
+  FreeDictionary();
+  if (pFileName.empty())
+    return m_statusCode = SC_OK;
+  int fd = open(pFileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    *log << ILog::ERROR << "Cannot open strength dictionary: " << pFileName << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || (size_t)fileStat.st_size < sizeof(DictHeader)) {
+    *log << ILog::ERROR << "Invalid strength dictionary: " << pFileName << this << ILog::endmsg;
+    close(fd);
+    return m_statusCode = SC_ERROR;
+  }
+  void *map = mmap(0, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    *log << ILog::ERROR << "Cannot map strength dictionary: " << pFileName << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  m_dictMap = static_cast<const char*>(map);
+  m_dictSize = fileStat.st_size;
+  const DictHeader *header = reinterpret_cast<const DictHeader*>(m_dictMap);
+  size_t expectedSize = sizeof(DictHeader) + (size_t)header->nNodes * sizeof(DictNode) + (size_t)header->nEdges * sizeof(DictEdge);
+  if (memcmp(header->magic, DICT_MAGIC, sizeof(DICT_MAGIC)) != 0 || header->nNodes == 0 || expectedSize != m_dictSize) {
+    *log << ILog::ERROR << "Not a compiled dictionary (use csm --compile-dict): " << pFileName << this << ILog::endmsg;
+    FreeDictionary();
+    return m_statusCode = SC_ERROR;
+  }
+  m_nNodes = header->nNodes;
+  m_nodes = reinterpret_cast<const DictNode*>(m_dictMap + sizeof(DictHeader));
+  m_edges = reinterpret_cast<const DictEdge*>(m_dictMap + sizeof(DictHeader) + (size_t)m_nNodes * sizeof(DictNode));
+  *log << ILog::VERBOSE << "Loaded strength dictionary " << pFileName << " (" << (unsigned long)m_nNodes << " nodes)"
+       << this << ILog::endmsg;
+  return m_statusCode = SC_OK;
+}
+
+uint32_t PasswordStrengthTool::DictChild(uint32_t pNode, unsigned char pCh) const
+{
+  const DictNode &node = m_nodes[pNode];
+  //binary search among the (sorted) edges of this node
+  uint32_t lo = node.firstEdge;
+  uint32_t hi = node.firstEdge + node.nEdges;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (m_edges[mid].ch < pCh)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo < node.firstEdge + node.nEdges && m_edges[lo].ch == pCh && m_edges[lo].child < m_nNodes)
+    return m_edges[lo].child;
+  return 0;
+}
+
+void PasswordStrengthTool::MatchDictionary(const string &pPwd, const vector<string> &pUserInputs, vector<Match> &pMatches) const
+{
+  int n = pPwd.size();
+  string lower(pPwd);
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  string unl33t(lower);
+  std::transform(unl33t.begin(), unl33t.end(), unl33t.begin(), UnL33t);
+  string reversed(lower.rbegin(), lower.rend());
+  // candidates: plain, l33t-decoded and reversed password
+  const string *candidates[3] = { &lower, &unl33t, &reversed };
+  size_t nCandidates = 3;
+  if (unl33t == lower) {
+    candidates[1] = &reversed;
+    nCandidates = 2;
+  }
+
+  for (size_t c=0; c < nCandidates; c++) {
+    const string &cand = *candidates[c];
+    bool isReversed = (candidates[c] == &reversed);
+    bool isL33t = (candidates[c] == &unl33t);
+    // words found as (start, end, rank, user input)
+    vector<Match> found;
+    // - compiled dictionary
+    if (m_dictMap) {
+      for (int i=0; i < n; i++) {
+	uint32_t node = 0;
+	for (int j=i; j < n; j++) {
+	  node = DictChild(node, (unsigned char)cand[j]);
+	  if (node == 0)
+	    break;
+	  if (m_nodes[node].rank > 0)
+	    found.push_back(Match(i, j, PM_DICTIONARY, m_nodes[node].rank));
+	}
+      }
+    } else {
+      // - built-in list of the most common ones
+      for (int w=0; BUILTIN_COMMON_WORDS[w] != 0; w++) {
+	string word(BUILTIN_COMMON_WORDS[w]);
+	for (size_t pos = cand.find(word); pos != string::npos; pos = cand.find(word, pos+1))
+	  found.push_back(Match(pos, pos + word.size() - 1, PM_DICTIONARY, w + 1));
+      }
+    }
+    // - words related to the account
+    for (size_t w=0; w < pUserInputs.size(); w++) {
+      const string &word = pUserInputs[w];
+      if (word.size() < 3)
+	continue;
+      for (size_t pos = cand.find(word); pos != string::npos; pos = cand.find(word, pos+1)) {
+	found.push_back(Match(pos, pos + word.size() - 1, PM_DICTIONARY, w + 1));
+	found.back().userInput = true;
+      }
+    }
+    // now compute guesses on the original token
+    for (vector<Match>::iterator itm = found.begin(); itm != found.end(); ++itm) {
+      Match m(*itm);
+      if (isReversed) {
+	m.i = n - 1 - itm->j;
+	m.j = n - 1 - itm->i;
+	m.reversed = true;
+      }
+      string token = pPwd.substr(m.i, m.j - m.i + 1);
+      string lowerToken = lower.substr(m.i, m.j - m.i + 1);
+      if (isL33t) {
+	if (lowerToken == unl33t.substr(m.i, m.j - m.i + 1))
+	  continue; //already found as plain word
+	m.l33t = true;
+	m.guesses *= L33tVariations(lowerToken, unl33t.substr(m.i, m.j - m.i + 1));
+      }
+      m.guesses *= UppercaseVariations(token);
+      if (m.reversed)
+	m.guesses *= 2.;
+      if (m.reversed && m.j == m.i)
+	continue; //single charachters read the same in both directions
+      pMatches.push_back(m);
+    }
+  }
+}
+
+void PasswordStrengthTool::MatchSpatial(const string &pPwd, vector<Match> &pMatches) const
+{
+  int n = pPwd.size();
+  int i = 0;
+  while (i < n - 1) {
+    int j = i;
+    int turns = 0;
+    int lastDirection = -1;
+    int nShifted = (pPwd[i] > 0 && qwertyLayout.shifted[(int)pPwd[i]]) ? 1 : 0;
+    while (j + 1 < n) {
+      int direction = qwertyLayout.Direction(pPwd[j], pPwd[j+1]);
+      if (direction < 0)
+	break;
+      if (direction != lastDirection) {
+	turns++;
+	lastDirection = direction;
+      }
+      if (qwertyLayout.shifted[(int)pPwd[j+1]])
+	nShifted++;
+      j++;
+    }
+    int length = j - i + 1;
+    if (length >= 3) {
+      double guesses = 0.;
+      for (int k=2; k <= length; k++) {
+	int possibleTurns = min(turns, k - 1);
+	for (int t=1; t <= possibleTurns; t++)
+	  guesses += NCk(k - 1, t - 1) * KEYBOARD_STARTING_POSITIONS * Pow(KEYBOARD_AVERAGE_DEGREE, t);
+      }
+      int nUnshifted = length - nShifted;
+      if (nShifted == 0 || nUnshifted == 0) {
+	if (nShifted > 0)
+	  guesses *= 2.;
+      } else {
+	double shiftedVariations = 0.;
+	for (int k=1; k <= min(nShifted, nUnshifted); k++)
+	  shiftedVariations += NCk(length, k);
+	guesses *= shiftedVariations;
+      }
+      pMatches.push_back(Match(i, j, PM_SPATIAL, guesses));
+      i = j;
+    } else {
+      i++;
+    }
+  }
+}
+
+void PasswordStrengthTool::MatchRepeat(const string &pPwd, vector<Match> &pMatches, int pDepth) const
+{
+  int n = pPwd.size();
+  int i = 0;
+  while (i < n - 1) {
+    // longest repetition of any unit starting here
+    int bestUnit = 0, bestCount = 0;
+    for (int unit = 1; unit <= (n - i) / 2; unit++) {
+      int count = 1;
+      while (i + (count + 1) * unit <= n && pPwd.compare(i, unit, pPwd, i + count * unit, unit) == 0)
+	count++;
+      if (count >= 2 && unit * count > bestUnit * bestCount) {
+	bestUnit = unit;
+	bestCount = count;
+      }
+    }
+    if (bestCount < 2) {
+      i++;
+      continue;
+    }
+    string unitStr = pPwd.substr(i, bestUnit);
+    double baseGuesses;
+    if (pDepth == 0)
+      baseGuesses = Evaluate(unitStr, vector<string>(), pDepth + 1).guesses;
+    else
+      baseGuesses = Pow(BRUTEFORCE_CARDINALITY, bestUnit);
+    pMatches.push_back(Match(i, i + bestUnit * bestCount - 1, PM_REPEAT, baseGuesses * bestCount));
+    i += bestUnit * bestCount;
+  }
+}
+
+void PasswordStrengthTool::MatchSequence(const string &pPwd, vector<Match> &pMatches) const
+{
+  int n = pPwd.size();
+  if (n < 3)
+    return;
+  int i = 0;
+  int lastDelta = pPwd[1] - pPwd[0];
+  for (int k = 2; k <= n; k++) {
+    int delta = (k < n) ? pPwd[k] - pPwd[k-1] : lastDelta + 1000; //force closing the last sequence
+    if (delta == lastDelta)
+      continue;
+    int j = k - 1;
+    if (j - i >= 2 && lastDelta != 0 && abs(lastDelta) <= MAX_SEQUENCE_DELTA) {
+      string token = pPwd.substr(i, j - i + 1);
+      bool allLower = true, allUpper = true, allDigits = true;
+      for (string::iterator itc = token.begin(); itc != token.end(); ++itc) {
+	allLower = allLower && islower((unsigned char)*itc);
+	allUpper = allUpper && isupper((unsigned char)*itc);
+	allDigits = allDigits && isdigit((unsigned char)*itc);
+      }
+      if (allLower || allUpper || allDigits) {
+	double base;
+	if (strchr("aAzZ019", token[0]))
+	  base = 4.; //obvious starting points
+	else if (allDigits)
+	  base = 10.;
+	else
+	  base = 26.;
+	if (lastDelta < 0)
+	  base *= 2.;
+	pMatches.push_back(Match(i, j, PM_SEQUENCE, base * token.size()));
+      }
+    }
+    i = j;
+    lastDelta = delta;
+  }
+}
+
+namespace {
+  /// Convert a 2-digit year in the most likely 4-digits year
+  int TwoToFourDigitsYear(int pYear)
+  {
+    if (pYear > 99)
+      return pYear;
+    if (pYear > 50)
+      return pYear + 1900;
+    return pYear + 2000;
+  }
+
+  bool IsDayMonth(int pA, int pB)
+  {
+    return ((pA >= 1 && pA <= 31 && pB >= 1 && pB <= 12) || (pB >= 1 && pB <= 31 && pA >= 1 && pA <= 12));
+  }
+
+  /// Check if three numbers can be a date, in any common order. Returns the year, or -1.
+  int DateYear(int pA, int pB, int pC)
+  {
+    int ints[3] = { pA, pB, pC };
+    if (pB > 31 || pB <= 0)
+      return -1;
+    int over12 = 0, over31 = 0, under1 = 0;
+    for (int k=0; k < 3; k++) {
+      if ((ints[k] > 99 && ints[k] < 1000) || ints[k] > 2050)
+	return -1;
+      if (ints[k] > 31) over31++;
+      if (ints[k] > 12) over12++;
+      if (ints[k] <= 0) under1++;
+    }
+    if (over31 >= 2 || over12 == 3 || under1 >= 2)
+      return -1;
+    // year at the end or at the beginning: first look for 4-digits years
+    if (pC >= 1000 && IsDayMonth(pA, pB))
+      return pC;
+    if (pA >= 1000 && IsDayMonth(pB, pC))
+      return pA;
+    if (pC >= 1000 || pA >= 1000)
+      return -1;
+    if (IsDayMonth(pA, pB))
+      return TwoToFourDigitsYear(pC);
+    if (IsDayMonth(pB, pC))
+      return TwoToFourDigitsYear(pA);
+    return -1;
+  }
+}
+
+void PasswordStrengthTool::MatchDate(const string &pPwd, vector<Match> &pMatches) const
+{
+  int n = pPwd.size();
+  // possible splits of digits-only dates, by length (k,l: ends of first and second number)
+  static const int splits[9][4][2] = {
+    {{0,0}}, {{0,0}}, {{0,0}}, {{0,0}},
+    {{1,2}, {2,3}, {0,0}, {0,0}},         // 1 1 91 | 1 11 1 ...
+    {{1,3}, {2,3}, {0,0}, {0,0}},         // 1 11 91 | 11 1 91
+    {{1,2}, {2,4}, {4,5}, {0,0}},         // 1 1 1991 | 11 11 91 | 1991 1 1
+    {{1,3}, {2,3}, {4,5}, {4,6}},         // 1 11 1991 | 11 1 1991 | 1991 1 11 | 1991 11 1
+    {{2,4}, {4,6}, {0,0}, {0,0}}          // 11 11 1991 | 1991 11 11
+  };
+  for (int i=0; i < n; i++) {
+    // - plain year
+    if (i + 4 <= n && (pPwd.compare(i, 2, "19") == 0 || pPwd.compare(i, 2, "20") == 0) &&
+	isdigit((unsigned char)pPwd[i+2]) && isdigit((unsigned char)pPwd[i+3])) {
+      int year = atoi(pPwd.substr(i, 4).c_str());
+      pMatches.push_back(Match(i, i + 3, PM_DATE, max(MIN_YEAR_SPACE, (double)abs(year - m_refYear))));
+    }
+    // - digits only
+    for (int len = 4; len <= 8 && i + len <= n; len++) {
+      if (not isdigit((unsigned char)pPwd[i + len - 1]))
+	break;
+      if (len < 4 || not isdigit((unsigned char)pPwd[i]))
+	continue;
+      bool allDigits = true;
+      for (int k=i; k < i+len; k++)
+	allDigits = allDigits && isdigit((unsigned char)pPwd[k]);
+      if (not allDigits)
+	break;
+      int bestYear = -1;
+      for (int s=0; s < 4 && splits[len][s][0] > 0; s++) {
+	int k = splits[len][s][0], l = splits[len][s][1];
+	int year = DateYear(atoi(pPwd.substr(i, k).c_str()), atoi(pPwd.substr(i + k, l - k).c_str()),
+			    atoi(pPwd.substr(i + l, len - l).c_str()));
+	if (year > 0 && (bestYear < 0 || abs(year - m_refYear) < abs(bestYear - m_refYear)))
+	  bestYear = year;
+      }
+      if (bestYear > 0)
+	pMatches.push_back(Match(i, i + len - 1, PM_DATE, max(MIN_YEAR_SPACE, (double)abs(bestYear - m_refYear)) * 365.));
+    }
+    // - with separators: d{1,4} sep d{1,2} sep d{1,4}
+    int a = i;
+    while (a < n && a - i < 4 && isdigit((unsigned char)pPwd[a]))
+      a++;
+    if (a == i || a >= n || not strchr(" /\\_.-", pPwd[a]))
+      continue;
+    char separator = pPwd[a];
+    int b = a + 1;
+    while (b < n && b - a - 1 < 2 && isdigit((unsigned char)pPwd[b]))
+      b++;
+    if (b == a + 1 || b >= n || pPwd[b] != separator)
+      continue;
+    int c = b + 1;
+    while (c < n && c - b - 1 < 4 && isdigit((unsigned char)pPwd[c]))
+      c++;
+    if (c == b + 1)
+      continue;
+    int year = DateYear(atoi(pPwd.substr(i, a - i).c_str()), atoi(pPwd.substr(a + 1, b - a - 1).c_str()),
+			atoi(pPwd.substr(b + 1, c - b - 1).c_str()));
+    if (year > 0)
+      pMatches.push_back(Match(i, c - 1, PM_DATE, max(MIN_YEAR_SPACE, (double)abs(year - m_refYear)) * 365. * 4.));
+  }
+}
+
+PasswordStrengthTool::Result PasswordStrengthTool::MostGuessableSequence(const string &pPwd, vector<Match> &pMatches) const
+{
+  Result result;
+  int n = pPwd.size();
+  if (n == 0)
+    return result;
+  // minimum guesses for a pattern, so that short matches are not preferred to longer ones
+  for (vector<Match>::iterator itm = pMatches.begin(); itm != pMatches.end(); ++itm) {
+    int length = itm->j - itm->i + 1;
+    if (length < n)
+      itm->guesses = max(itm->guesses, length == 1 ? MIN_SUBMATCH_GUESSES_SINGLE_CHAR : MIN_SUBMATCH_GUESSES_MULTI_CHAR);
+  }
+  vector< vector<const Match*> > matchesByEnd(n);
+  for (vector<Match>::iterator itm = pMatches.begin(); itm != pMatches.end(); ++itm)
+    matchesByEnd[itm->j].push_back(&(*itm));
+
+  // optimal[k][l]: best sequence of l matches covering [0, k]
+  struct Step {
+    bool set;
+    Match m;
+    double pi; ///< product of guesses of the sequence
+    double g; ///< overall guesses of the sequence
+    Step() : set(false), pi(0.), g(0.) {}
+  };
+  vector< vector<Step> > optimal(n, vector<Step>(n + 1));
+  // - add a match at the end of a sequence of (l-1) matches
+  auto update = [&](const Match &m, int l) {
+    int k = m.j;
+    double pi = m.guesses;
+    if (l > 1)
+      pi *= optimal[m.i - 1][l - 1].pi;
+    double g = Factorial(l) * pi + Pow(MIN_GUESSES_BEFORE_GROWING_SEQUENCE, l - 1);
+    // skip if a sequence with no more matches is already better
+    for (int competingL = 1; competingL <= l; competingL++)
+      if (optimal[k][competingL].set && optimal[k][competingL].g <= g)
+	return;
+    Step &step = optimal[k][l];
+    step.set = true;
+    step.m = m;
+    step.pi = pi;
+    step.g = g;
+  };
+  auto bruteforce = [&](int i, int j) {
+    int length = j - i + 1;
+    double guesses = Pow(BRUTEFORCE_CARDINALITY, length);
+    if (length < n)
+      guesses = max(guesses, (length == 1 ? MIN_SUBMATCH_GUESSES_SINGLE_CHAR : MIN_SUBMATCH_GUESSES_MULTI_CHAR) + 1.);
+    return Match(i, j, PM_BRUTEFORCE, guesses);
+  };
+
+  for (int k=0; k < n; k++) {
+    for (vector<const Match*>::iterator itm = matchesByEnd[k].begin(); itm != matchesByEnd[k].end(); ++itm) {
+      if ((*itm)->i > 0) {
+	for (int l=1; l <= n; l++)
+	  if (optimal[(*itm)->i - 1][l].set)
+	    update(**itm, l + 1);
+      } else {
+	update(**itm, 1);
+      }
+    }
+    // brute-force from any position up to k (never two consecutive brute-force matches)
+    update(bruteforce(0, k), 1);
+    for (int i=1; i <= k; i++) {
+      Match bf = bruteforce(i, k);
+      for (int l=1; l <= n; l++) {
+	if (not optimal[i - 1][l].set || optimal[i - 1][l].m.pattern == PM_BRUTEFORCE)
+	  continue;
+	update(bf, l + 1);
+      }
+    }
+  }
+
+  // unwind the best sequence
+  int bestL = 0;
+  for (int l=1; l <= n; l++)
+    if (optimal[n - 1][l].set && (bestL == 0 || optimal[n - 1][l].g < optimal[n - 1][bestL].g))
+      bestL = l;
+  result.guesses = optimal[n - 1][bestL].g;
+  deque<Match> sequence;
+  for (int k = n - 1, l = bestL; k >= 0 && l > 0; l--) {
+    const Match &m = optimal[k][l].m;
+    sequence.push_front(m);
+    k = m.i - 1;
+  }
+  result.sequence.assign(sequence.begin(), sequence.end());
+  return result;
+}
+
+PasswordStrengthTool::Result PasswordStrengthTool::Evaluate(const string &pPwd, const vector<string> &pUserInputs, int pDepth) const
+{
+  vector<Match> matches;
+  MatchDictionary(pPwd, pUserInputs, matches);
+  MatchSpatial(pPwd, matches);
+  MatchRepeat(pPwd, matches, pDepth);
+  MatchSequence(pPwd, matches);
+  MatchDate(pPwd, matches);
+  Result result = MostGuessableSequence(pPwd, matches);
+  if (result.guesses < 1e3 + 5)
+    result.score = 0;
+  else if (result.guesses < 1e6 + 5)
+    result.score = 1;
+  else if (result.guesses < 1e8 + 5)
+    result.score = 2;
+  else if (result.guesses < 1e10 + 5)
+    result.score = 3;
+  else
+    result.score = 4;
+  return result;
+}
+
+PasswordStrengthTool::Result PasswordStrengthTool::Evaluate(const string &pPwd, const vector<string> &pUserInputs) const
+{
+  if (pPwd.size() > (size_t)MAX_EVAL_LENGTH)
+    return Evaluate(pPwd.substr(0, MAX_EVAL_LENGTH), pUserInputs, 0);
+  return Evaluate(pPwd, pUserInputs, 0);
+}
+
+vector<string> PasswordStrengthTool::GetUserInputs(ARecord *pRecord)
+{
+  vector<string> userInputs;
+  if (!pRecord)
+    return userInputs;
+  string text = pRecord->GetAccountName();
+  for (ARecord::TLabelsIterator itl = pRecord->GetLabelsIterBegin(); itl != pRecord->GetLabelsIterEnd(); ++itl)
+    text += " " + *itl;
+  //fields are read one by one with GetField(), which is safe also for sealed records used by several threads
+  vector<string> fieldNames = pRecord->GetFieldNameList();
+  for (vector<string>::iterator itf = fieldNames.begin(); itf != fieldNames.end(); ++itf) {
+    if (cfgMgr && cfgMgr->IsSecretField(*itf))
+      continue;
+    text += " " + pRecord->GetField(*itf);
+  }
+  // split in lower-case alphanumeric words
+  string word;
+  for (size_t k=0; k <= text.size(); k++) {
+    if (k < text.size() && isalnum((unsigned char)text[k])) {
+      word += tolower((unsigned char)text[k]);
+      continue;
+    }
+    if (word.size() >= 3 && find(userInputs.begin(), userInputs.end(), word) == userInputs.end())
+      userInputs.push_back(word);
+    word.clear();
+  }
+  return userInputs;
+}
+
+char PasswordStrengthTool::UnL33t(char pCh)
+{
+  switch (pCh) {
+  case '4': case '@': return 'a';
+  case '8': return 'b';
+  case '(': case '{': case '[': case '<': return 'c';
+  case '3': return 'e';
+  case '6': case '9': return 'g';
+  case '1': case '!': case '|': return 'i';
+  case '0': return 'o';
+  case '$': case '5': return 's';
+  case '+': case '7': return 't';
+  case '%': return 'x';
+  case '2': return 'z';
+  }
+  return pCh;
+}
+
+IErrorHandler::StatusCode PasswordStrengthTool::CompileDictionary(vector<string> pInputFiles, string pOutputFile)
+{
+  // - build the trie in memory
+  vector< vector< pair<unsigned char, uint32_t> > > children(1);
+  vector<uint32_t> ranks(1, 0);
+  uint32_t rank = 0;
+  for (vector<string>::iterator itf = pInputFiles.begin(); itf != pInputFiles.end(); ++itf) {
+    ifstream wordList(itf->c_str());
+    if (not wordList.is_open()) {
+      *log << ILog::ERROR << "Cannot open word list: " << *itf << this << ILog::endmsg;
+      return m_statusCode = SC_ERROR;
+    }
+    string line;
+    while (getline(wordList, line)) {
+      istringstream lineStream(line);
+      string word;
+      lineStream >> word;
+      if (word.empty() || word.size() > (size_t)MAX_EVAL_LENGTH)
+	continue;
+      std::transform(word.begin(), word.end(), word.begin(), ::tolower);
+      rank++;
+      uint32_t node = 0;
+      for (string::iterator itc = word.begin(); itc != word.end(); ++itc) {
+	vector< pair<unsigned char, uint32_t> > &edges = children[node];
+	vector< pair<unsigned char, uint32_t> >::iterator ite = edges.begin();
+	while (ite != edges.end() && ite->first != (unsigned char)*itc)
+	  ++ite;
+	if (ite == edges.end()) {
+	  uint32_t newNode = children.size();
+	  edges.push_back(make_pair((unsigned char)*itc, newNode));
+	  children.push_back(vector< pair<unsigned char, uint32_t> >());
+	  ranks.push_back(0);
+	  node = newNode;
+	} else {
+	  node = ite->second;
+	}
+      }
+      if (ranks[node] == 0)
+	ranks[node] = rank; //keep most common occurrence
+    }
+    *log << ILog::VERBOSE << "Read word list " << *itf << ": " << (unsigned long)rank << " words so far" << this << ILog::endmsg;
+  }
+
+  // - serialize breadth-first, so that edges of each node are contiguous
+  DictHeader header;
+  memcpy(header.magic, DICT_MAGIC, sizeof(DICT_MAGIC));
+  header.nNodes = children.size();
+  vector<DictNode> nodes(children.size());
+  vector<DictEdge> edges;
+  vector<uint32_t> newIndex(children.size(), 0);
+  deque<uint32_t> queue;
+  queue.push_back(0);
+  uint32_t nextIndex = 1;
+  while (not queue.empty()) {
+    uint32_t node = queue.front();
+    queue.pop_front();
+    sort(children[node].begin(), children[node].end());
+    DictNode &outNode = nodes[newIndex[node]];
+    outNode.firstEdge = edges.size();
+    outNode.nEdges = children[node].size();
+    outNode.rank = ranks[node];
+    for (vector< pair<unsigned char, uint32_t> >::iterator ite = children[node].begin(); ite != children[node].end(); ++ite) {
+      newIndex[ite->second] = nextIndex++;
+      DictEdge edge;
+      edge.child = newIndex[ite->second];
+      edge.ch = ite->first;
+      edges.push_back(edge);
+      queue.push_back(ite->second);
+    }
+  }
+  header.nEdges = edges.size();
+
+  // - write to a temporary file, then replace
+  string tmpFile = pOutputFile + ".tmp";
+  ofstream out(tmpFile.c_str(), ios::binary | ios::trunc);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(&nodes[0]), nodes.size() * sizeof(DictNode));
+  if (not edges.empty())
+    out.write(reinterpret_cast<const char*>(&edges[0]), edges.size() * sizeof(DictEdge));
+  out.close();
+  if (out.fail() || rename(tmpFile.c_str(), pOutputFile.c_str()) != 0) {
+    unlink(tmpFile.c_str());
+    *log << ILog::ERROR << "Cannot write compiled dictionary: " << pOutputFile << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  *log << ILog::INFO << "Compiled dictionary " << pOutputFile << ": " << (unsigned long)rank << " words, "
+       << (unsigned long)nodes.size() << " nodes" << this << ILog::endmsg;
+  return m_statusCode = SC_OK;
+}
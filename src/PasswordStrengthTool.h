@@ -0,0 +1,152 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: PasswordStrengthTool.h
+ Description: Estimate password strength from the number of guesses needed to crack it
+ Last Modified: $Id$
+*/
+
+#ifndef __PASSWORD_STRENGTH_TOOL__
+#define __PASSWORD_STRENGTH_TOOL__
+
+#include "IErrorHandler.h"
+#include "ARecord.h"
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/** Estimate password strength from the number of guesses needed to crack it.
+ * Follows the approach of zxcvbn: the password is scanned for known patterns
+ * (dictionary words, keyboard walks, repeats, sequences, dates), each
+ * with an estimate of the guesses an attacker needs to hit it, then the
+ * sequence of non-overlapping patterns (gaps are brute-forced) needing
+ * the least guesses overall is found with dynamic programming.
+ *
+ * Dictionaries are pre-compiled with CompileDictionary() into a trie
+ * which is memory-mapped as-is at load time.
+ * Evaluate() does not modify the tool and can be called from several threads.
+ */
+class PasswordStrengthTool : public IErrorHandler {
+ public:
+  /// Types of pattern matched
+  enum MatchPattern {
+    PM_DICTIONARY=0,
+    PM_SPATIAL,
+    PM_REPEAT,
+    PM_SEQUENCE,
+    PM_DATE,
+    PM_BRUTEFORCE
+  };
+
+  /// A pattern found in the password, covering charachters [i, j]
+  class Match {
+  public:
+    int i, j;
+    MatchPattern pattern;
+    double guesses;
+    bool reversed; ///< dictionary word found reversed
+    bool l33t; ///< dictionary word found with l33t substitutions
+    bool userInput; ///< dictionary word is related to the account
+    Match(int pI=0, int pJ=0, MatchPattern pPattern=PM_BRUTEFORCE, double pGuesses=1.);
+  };
+
+  /// Result of the evaluation
+  class Result {
+  public:
+    int score; ///< 0 (too guessable) to 4 (very unguessable)
+    double guesses; ///< estimated number of guesses
+    std::vector<Match> sequence; ///< patterns making the password
+    Result();
+    /// Order of magnitude of guesses
+    int GetLog10Guesses() const;
+    /// Short description of the score
+    std::string GetScoreStr() const;
+    /// Short advice based on the weakest pattern found (empty if none)
+    std::string GetFeedback() const;
+  };
+
+ protected:
+  /// Layout of the compiled dictionary file
+  struct DictHeader {
+    char magic[8];
+    uint32_t nNodes;
+    uint32_t nEdges;
+  };
+  struct DictNode {
+    uint32_t firstEdge;
+    uint32_t nEdges;
+    uint32_t rank; ///< 0 if no word ends here
+  };
+  struct DictEdge {
+    uint32_t child;
+    uint32_t ch;
+  };
+
+  /// Memory-mapped dictionary
+  const char *m_dictMap;
+  size_t m_dictSize;
+  const DictNode *m_nodes;
+  const DictEdge *m_edges;
+  uint32_t m_nNodes;
+
+  /// Reference year for date patterns
+  int m_refYear;
+
+  /// Unmap current dictionary
+  void FreeDictionary();
+  /// Child of pNode through charachter pCh, 0 if none (root is never a child)
+  uint32_t DictChild(uint32_t pNode, unsigned char pCh) const;
+
+  // --- matchers
+  void MatchDictionary(const std::string &pPwd, const std::vector<std::string> &pUserInputs, std::vector<Match> &pMatches) const;
+  void MatchSpatial(const std::string &pPwd, std::vector<Match> &pMatches) const;
+  void MatchRepeat(const std::string &pPwd, std::vector<Match> &pMatches, int pDepth) const;
+  void MatchSequence(const std::string &pPwd, std::vector<Match> &pMatches) const;
+  void MatchDate(const std::string &pPwd, std::vector<Match> &pMatches) const;
+
+  /// Evaluation without the length cut, used also for repeated sub-tokens
+  Result Evaluate(const std::string &pPwd, const std::vector<std::string> &pUserInputs, int pDepth) const;
+  /// Find the sequence of matches with the minimum number of guesses
+  Result MostGuessableSequence(const std::string &pPwd, std::vector<Match> &pMatches) const;
+
+ public:
+  PasswordStrengthTool(std::string pName);
+  ~PasswordStrengthTool();
+
+  /** Load a compiled dictionary.
+   * @param pFileName file created by CompileDictionary(); if empty, unload the current one
+   */
+  StatusCode LoadDictionary(std::string pFileName);
+
+  /// Check if a dictionary is loaded
+  bool HasDictionary() const;
+
+  /** Evaluate the strength of a password.
+   * @param pPwd password to be evaluated
+   * @param pUserInputs words related to the account (name, user, ...): using them makes the password weaker
+   * @return result of the evaluation
+   */
+  Result Evaluate(const std::string &pPwd, const std::vector<std::string> &pUserInputs = std::vector<std::string>()) const;
+
+  /** Collect words related to an account to be used as user inputs.
+   * Account name, labels and the content of non-secret fields are used.
+   */
+  static std::vector<std::string> GetUserInputs(ARecord *pRecord);
+
+  /// Undo common l33t substitutions ('4' -> 'a', '$' -> 's', ...), one letter per symbol
+  static char UnL33t(char pCh);
+
+  /** Compile word lists into a dictionary file.
+   * Word lists have one word per line, most common first (the position gives the rank).
+   * Only the first space-separated token of each line is used.
+   * @param pInputFiles word lists
+   * @param pOutputFile compiled dictionary
+   * @return the status of the operation
+   */
+  StatusCode CompileDictionary(std::vector<std::string> pInputFiles, std::string pOutputFile);
+};
+
+#endif
@@ -0,0 +1,777 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: QuerySearchTool.cc
+ Description: Implements ISearchTool with a structured query language and an index-aware planner
+ Last Modified: $Id$
+*/
+
+#include "QuerySearchTool.h"
+
+#include "MiscUtils.h"
+#include "FuzzyMatcher.h"
+
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <stdlib.h>
+#include <ctype.h>
+
+extern ILog *log;
+
+using namespace std;
+
+namespace {
+  /// Error message with the position in the query
+  bool QueryError(string &pError, const string &pReason, size_t pPos)
+  {
+    ostringstream msg;
+    msg << pReason << " at position " << pPos;
+    pError = msg.str();
+    return false;
+  }
+
+  /// Order of results
+  bool LessAccountId(ARecord *a, ARecord *b)
+  {
+    return a->GetAccountId() < b->GetAccountId();
+  }
+
+  /// Outcome of a query for all the records of a source, knowing only their source
+  enum SourceOutcome {SO_NONE, SO_SOME, SO_ALL};
+
+  SourceOutcome MatchSource(const QuerySearchTool::Node &pNode, const string &pSourceName)
+  {
+    switch (pNode.type) {
+    case QuerySearchTool::Node::TERM:
+      if (pNode.term.target != QuerySearchTool::TT_SOURCE)
+	return SO_SOME;
+      return pNode.term.Matches(pSourceName) ? SO_ALL : SO_NONE;
+    case QuerySearchTool::Node::NOT:
+      {
+	SourceOutcome operand = MatchSource(pNode.children[0], pSourceName);
+	return operand == SO_SOME ? SO_SOME : (operand == SO_ALL ? SO_NONE : SO_ALL);
+      }
+    case QuerySearchTool::Node::AND:
+      {
+	SourceOutcome outcome = SO_ALL;
+	for (vector<QuerySearchTool::Node>::const_iterator itn = pNode.children.begin(); itn != pNode.children.end(); ++itn)
+	  outcome = min(outcome, MatchSource(*itn, pSourceName));
+	return outcome;
+      }
+    case QuerySearchTool::Node::OR:
+      {
+	SourceOutcome outcome = SO_NONE;
+	for (vector<QuerySearchTool::Node>::const_iterator itn = pNode.children.begin(); itn != pNode.children.end(); ++itn)
+	  outcome = max(outcome, MatchSource(*itn, pSourceName));
+	return outcome;
+      }
+    }
+    return SO_SOME;
+  }
+
+  /// Keeps all the records found
+  class RecordCollector : public RecordVisitor {
+  public:
+    vector<ARecord*> records;
+    virtual bool Visit(ARecord *pRecord)
+    {
+      records.push_back(pRecord);
+      return true;
+    }
+  };
+}
+
+// --- Term
+
+QuerySearchTool::Term::Term()
+{
+  target = TT_ANY;
+  type = SearchRequest::TXT;
+  from = numeric_limits<time_t>::min();
+  to = numeric_limits<time_t>::max();
+}
+
+bool QuerySearchTool::Term::Matches(const string &pValue) const
+{
+  switch (type) {
+  case SearchRequest::TXT:
+    if (regex)
+      return regex->Search(pValue); //wildcards
+    return CSMUtils::FoldCase(pValue).find(folded) != string::npos;
+  case SearchRequest::EXACT:
+    return pValue == pattern;
+  case SearchRequest::REGEX:
+    return regex->Search(pValue);
+  case SearchRequest::FUZZY:
+    return FuzzyMatcher(pattern).Score(pValue) != FuzzyMatcher::NO_MATCH;
+  default:
+    return false;
+  }
+}
+
+bool QuerySearchTool::Term::Matches(const string &pValue, const string &pFoldedValue) const
+{
+  if (type == SearchRequest::TXT && not regex)
+    return pFoldedValue.find(folded) != string::npos;
+  return Matches(pValue);
+}
+
+bool QuerySearchTool::Term::InRange(time_t pTime) const
+{
+  return pTime >= from && pTime < to;
+}
+
+vector<string> QuerySearchTool::Term::GetLiterals() const
+{
+  vector<string> literals;
+  if (type == SearchRequest::TXT && regex) {
+    //the pieces between wildcards
+    size_t begin = 0;
+    while (begin <= pattern.size()) {
+      size_t end = pattern.find_first_of("*?", begin);
+      if (end == string::npos)
+	end = pattern.size();
+      if (end > begin)
+	literals.push_back(pattern.substr(begin, end - begin));
+      begin = end + 1;
+    }
+  } else if (type == SearchRequest::TXT || type == SearchRequest::EXACT) {
+    literals.push_back(pattern);
+  } else if (type == SearchRequest::REGEX) {
+    //the text index holds folded text: only use plain ASCII literals, without their last
+    //character (it may be composed with a following accent)
+    const vector<string> &required = regex->GetRequiredLiterals();
+    for (vector<string>::const_iterator itl = required.begin(); itl != required.end(); ++itl) {
+      bool ascii = true;
+      for (string::const_iterator itc = itl->begin(); itc != itl->end(); ++itc)
+	ascii = ascii && ((unsigned char)*itc < 0x80);
+      if (ascii && itl->size() > 1)
+	literals.push_back(itl->substr(0, itl->size() - 1));
+    }
+  }
+  return literals;
+}
+
+// --- Node
+
+QuerySearchTool::Node::Node()
+{
+  type = AND;
+}
+
+// --- Indexes
+
+QuerySearchTool::Indexes::Indexes(const vector<ARecord*> &pRecords, const string &pSourceName) :
+  m_records(pRecords), m_sourceName(pSourceName)
+{
+
+}
+
+QuerySearchTool::Indexes::~Indexes()
+{
+
+}
+
+const vector<ARecord*> &QuerySearchTool::Indexes::GetRecords() const
+{
+  return m_records;
+}
+
+const string &QuerySearchTool::Indexes::GetSourceName() const
+{
+  return m_sourceName;
+}
+
+bool QuerySearchTool::Indexes::LabelCandidates(const Term &pTerm, RoaringBitmap &pCandidates)
+{
+  return false;
+}
+
+bool QuerySearchTool::Indexes::DateCandidates(const Term &pTerm, RoaringBitmap &pCandidates)
+{
+  return false;
+}
+
+bool QuerySearchTool::Indexes::TextCandidates(const vector<string> &pLiterals, RoaringBitmap &pCandidates)
+{
+  return false;
+}
+
+bool QuerySearchTool::Indexes::IsTextIndexReady()
+{
+  return true;
+}
+
+bool QuerySearchTool::Indexes::HasFieldValues()
+{
+  return true;
+}
+
+// --- QuerySearchTool
+
+QuerySearchTool::QuerySearchTool(string pName) : ISearchTool(pName)
+{
+
+}
+
+QuerySearchTool::~QuerySearchTool()
+{
+
+}
+
+bool QuerySearchTool::Tokenize(const string &pQuery, vector<Token> &pTokens, string &pError) const
+{
+  size_t pos = 0;
+  while (pos < pQuery.size()) {
+    char c = pQuery[pos];
+    if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+      pos++;
+      continue;
+    }
+    Token token;
+    token.pos = pos;
+    token.quoted = false;
+    if (c == '(' || c == ')') {
+      token.type = (c == '(') ? TK_OPEN : TK_CLOSE;
+      pos++;
+      pTokens.push_back(token);
+      continue;
+    }
+    //a term, quoted parts can contain spaces and parentheses
+    token.type = TK_TERM;
+    bool hasQuotes = false;
+    while (pos < pQuery.size() && string(" \t\n\r()").find(pQuery[pos]) == string::npos) {
+      if (pQuery[pos] == '"') {
+	size_t end = pQuery.find('"', pos + 1);
+	if (end == string::npos)
+	  return QueryError(pError, "Missing closing quote", pos);
+	token.quoted = (token.text.empty() && not hasQuotes);
+	token.text += pQuery.substr(pos + 1, end - pos - 1);
+	hasQuotes = true;
+	pos = end + 1;
+      } else {
+	token.quoted = false;
+	token.text += pQuery[pos++];
+      }
+    }
+    if (not hasQuotes) {
+      string keyword = CSMUtils::FoldCase(token.text);
+      if (keyword == "and")
+	token.type = TK_AND;
+      else if (keyword == "or")
+	token.type = TK_OR;
+      else if (keyword == "not")
+	token.type = TK_NOT;
+    }
+    pTokens.push_back(token);
+  }
+  return true;
+}
+
+bool QuerySearchTool::ParseOr(const vector<Token> &pTokens, size_t &pPos, int pDepth, Node &pNode, string &pError) const
+{
+  Node operand;
+  if (not ParseAnd(pTokens, pPos, pDepth, operand, pError))
+    return false;
+  if (pPos >= pTokens.size() || pTokens[pPos].type != TK_OR) {
+    pNode = operand;
+    return true;
+  }
+  pNode.type = Node::OR;
+  pNode.children.push_back(operand);
+  while (pPos < pTokens.size() && pTokens[pPos].type == TK_OR) {
+    pPos++;
+    pNode.children.push_back(Node());
+    if (not ParseAnd(pTokens, pPos, pDepth, pNode.children.back(), pError))
+      return false;
+  }
+  return true;
+}
+
+bool QuerySearchTool::ParseAnd(const vector<Token> &pTokens, size_t &pPos, int pDepth, Node &pNode, string &pError) const
+{
+  pNode.type = Node::AND;
+  pNode.children.push_back(Node());
+  if (not ParseNot(pTokens, pPos, pDepth, pNode.children.back(), pError))
+    return false;
+  while (pPos < pTokens.size()) {
+    TokenType type = pTokens[pPos].type;
+    if (type == TK_AND)
+      pPos++;
+    else if (type != TK_TERM && type != TK_NOT && type != TK_OPEN)
+      break; //not an implicit AND either
+    pNode.children.push_back(Node());
+    if (not ParseNot(pTokens, pPos, pDepth, pNode.children.back(), pError))
+      return false;
+  }
+  if (pNode.children.size() == 1) {
+    Node operand = pNode.children[0];
+    pNode = operand;
+  }
+  return true;
+}
+
+bool QuerySearchTool::ParseNot(const vector<Token> &pTokens, size_t &pPos, int pDepth, Node &pNode, string &pError) const
+{
+  if (pPos >= pTokens.size())
+    return QueryError(pError, "Missing term", pTokens.empty() ? 0 : pTokens.back().pos);
+  const Token &token = pTokens[pPos];
+  if (pDepth > MAX_QUERY_DEPTH)
+    return QueryError(pError, "Query too complex", token.pos);
+  switch (token.type) {
+  case TK_NOT:
+    pPos++;
+    pNode.type = Node::NOT;
+    pNode.children.push_back(Node());
+    return ParseNot(pTokens, pPos, pDepth + 1, pNode.children.back(), pError);
+  case TK_OPEN:
+    pPos++;
+    if (not ParseOr(pTokens, pPos, pDepth + 1, pNode, pError))
+      return false;
+    if (pPos >= pTokens.size() || pTokens[pPos].type != TK_CLOSE)
+      return QueryError(pError, "Missing closing parenthesis", token.pos);
+    pPos++;
+    return true;
+  case TK_TERM:
+    pPos++;
+    return ParseTerm(token, pNode, pError);
+  default:
+    return QueryError(pError, "Missing term", token.pos);
+  }
+}
+
+bool QuerySearchTool::ParseTerm(const Token &pToken, Node &pNode, string &pError) const
+{
+  TermTarget target = TT_ANY;
+  string field, value = pToken.text;
+  size_t colon = pToken.quoted ? string::npos : pToken.text.find(':');
+  if (colon != string::npos && colon > 0) {
+    string prefix = pToken.text.substr(0, colon);
+    bool isField = true;
+    for (string::iterator itc = prefix.begin(); itc != prefix.end(); ++itc)
+      isField = isField && (isalnum((unsigned char)*itc) || *itc == '_' || *itc == '-' || *itc == '.');
+    if (isField) {
+      field = CSMUtils::FoldCase(prefix);
+      value = pToken.text.substr(colon + 1);
+      if (field == "name")
+	target = TT_NAME;
+      else if (field == "label")
+	target = TT_LABEL;
+      else if (field == "source")
+	target = TT_SOURCE;
+      else if (field == "created")
+	target = TT_CREATED;
+      else if (field == "modified")
+	target = TT_MODIFIED;
+      else
+	target = TT_FIELD;
+    }
+  }
+  if (value.empty())
+    return QueryError(pError, "Missing value", pToken.pos);
+  if (target == TT_CREATED || target == TT_MODIFIED) {
+    pNode.type = Node::TERM;
+    pNode.term.target = target;
+    pNode.term.pattern = value;
+    if (not ParseDateRange(value, pNode.term))
+      return QueryError(pError, string("Invalid date '") + value + "' (YYYY, YYYY-MM or YYYY-MM-DD)", pToken.pos);
+    return true;
+  }
+  //match type
+  SearchRequest::SearchType type = SearchRequest::TXT;
+  if (not pToken.quoted && (value[0] == '=' || value[0] == '~') && value.size() > 1) {
+    type = (value[0] == '=') ? SearchRequest::EXACT : SearchRequest::REGEX;
+    value = value.substr(1);
+  }
+  string termError;
+  if (not MakeTerm(target, value, type, pNode, termError))
+    return QueryError(pError, termError, pToken.pos);
+  pNode.term.field = (target == TT_FIELD) ? field : string();
+  if (type == SearchRequest::TXT && not pToken.quoted && value.find_first_of("*?") != string::npos) {
+    //wildcards: the whole value must match
+    string expression = "(?i)^";
+    for (string::iterator itc = value.begin(); itc != value.end(); ++itc) {
+      if (*itc == '*')
+	expression += ".*";
+      else if (*itc == '?')
+	expression += ".";
+      else {
+	if (string("\\^$.|+()[]{}").find(*itc) != string::npos)
+	  expression += '\\';
+	expression += *itc;
+      }
+    }
+    expression += "$";
+    pNode.term.regex = RegexMatcher::Get(expression);
+  }
+  return true;
+}
+
+bool QuerySearchTool::ParseDate(const string &pDate, time_t &pBegin, time_t &pEnd)
+{
+  //YYYY, YYYY-MM or YYYY-MM-DD
+  int parts[3] = {0, 1, 1};
+  size_t nParts = 0, pos = 0;
+  while (pos < pDate.size() && nParts < 3) {
+    size_t end = pDate.find('-', pos);
+    if (end == string::npos)
+      end = pDate.size();
+    string part = pDate.substr(pos, end - pos);
+    if (part.empty() || part.size() > 4 || part.find_first_not_of("0123456789") != string::npos)
+      return false;
+    parts[nParts++] = atoi(part.c_str());
+    pos = end + 1;
+  }
+  if (pos <= pDate.size() || parts[0] < 1900 || parts[1] < 1 || parts[1] > 12 || parts[2] < 1 || parts[2] > 31)
+    return false;
+  struct tm date = {};
+  date.tm_year = parts[0] - 1900;
+  date.tm_mon = parts[1] - 1;
+  date.tm_mday = parts[2];
+  date.tm_isdst = -1;
+  pBegin = mktime(&date);
+  //start of the next period (mktime normalizes the date)
+  date = tm();
+  date.tm_year = parts[0] - 1900 + (nParts == 1 ? 1 : 0);
+  date.tm_mon = parts[1] - 1 + (nParts == 2 ? 1 : 0);
+  date.tm_mday = parts[2] + (nParts == 3 ? 1 : 0);
+  date.tm_isdst = -1;
+  pEnd = mktime(&date);
+  return pBegin != (time_t)-1 && pEnd != (time_t)-1;
+}
+
+bool QuerySearchTool::ParseDateRange(const string &pValue, Term &pTerm)
+{
+  time_t begin, end;
+  pTerm.from = numeric_limits<time_t>::min();
+  pTerm.to = numeric_limits<time_t>::max();
+  size_t dots = pValue.find("..");
+  if (dots != string::npos) {
+    string first = pValue.substr(0, dots), last = pValue.substr(dots + 2);
+    if (first.empty() && last.empty())
+      return false;
+    if (not first.empty()) {
+      if (not ParseDate(first, begin, end))
+	return false;
+      pTerm.from = begin;
+    }
+    if (not last.empty()) {
+      if (not ParseDate(last, begin, end))
+	return false;
+      pTerm.to = end;
+    }
+    return true;
+  }
+  if (pValue.compare(0, 2, ">=") == 0 || pValue.compare(0, 2, "<=") == 0) {
+    if (not ParseDate(pValue.substr(2), begin, end))
+      return false;
+    if (pValue[0] == '>')
+      pTerm.from = begin;
+    else
+      pTerm.to = end;
+    return true;
+  }
+  if (pValue[0] == '>' || pValue[0] == '<') {
+    if (not ParseDate(pValue.substr(1), begin, end))
+      return false;
+    if (pValue[0] == '>')
+      pTerm.from = end;
+    else
+      pTerm.to = begin;
+    return true;
+  }
+  if (not ParseDate(pValue, begin, end))
+    return false;
+  pTerm.from = begin;
+  pTerm.to = end;
+  return true;
+}
+
+bool QuerySearchTool::Parse(const string &pQuery, Node &pRoot, string &pError) const
+{
+  pRoot = Node();
+  pError.clear();
+  vector<Token> tokens;
+  if (not Tokenize(pQuery, tokens, pError))
+    return false;
+  if (tokens.empty())
+    return QueryError(pError, "Empty query", 0);
+  size_t pos = 0;
+  if (not ParseOr(tokens, pos, 0, pRoot, pError))
+    return false;
+  if (pos < tokens.size())
+    return QueryError(pError, "Unexpected token", tokens[pos].pos);
+  return true;
+}
+
+bool QuerySearchTool::MakeTerm(TermTarget pTarget, const string &pPattern, SearchRequest::SearchType pType, Node &pNode, string &pError)
+{
+  pNode = Node();
+  pNode.type = Node::TERM;
+  Term &term = pNode.term;
+  term.target = pTarget;
+  term.pattern = pPattern;
+  term.folded = CSMUtils::FoldCase(pPattern);
+  term.type = pType;
+  if (pType == SearchRequest::REGEX) {
+    //compiled expressions are cached
+    term.regex = RegexMatcher::Get(pPattern);
+    if (not term.regex->IsValid()) {
+      pError = string("Invalid regular expression '") + pPattern + "': " + term.regex->GetError();
+      return false;
+    }
+  } else if (pType != SearchRequest::TXT && pType != SearchRequest::EXACT && pType != SearchRequest::FUZZY) {
+    pError = "Search type not implemented";
+    return false;
+  }
+  return true;
+}
+
+bool QuerySearchTool::PlanTerm(const Term &pTerm, Indexes &pIndexes, bool pCheap, RoaringBitmap &pCandidates)
+{
+  pCandidates.Clear();
+  switch (pTerm.target) {
+  case TT_LABEL:
+    return pIndexes.LabelCandidates(pTerm, pCandidates);
+  case TT_CREATED:
+  case TT_MODIFIED:
+    return pIndexes.DateCandidates(pTerm, pCandidates);
+  case TT_SOURCE:
+    //same source for all records: all of them, or none
+    return not pTerm.Matches(pIndexes.GetSourceName());
+  default:
+    break;
+  }
+  if (pCheap)
+    return false;
+  if (pTerm.target != TT_NAME && not pIndexes.HasFieldValues())
+    return false; //a field value may match without being in the index
+  //matching records contain all the literals of the term
+  return pIndexes.TextCandidates(pTerm.GetLiterals(), pCandidates);
+}
+
+bool QuerySearchTool::Plan(const Node &pNode, Indexes &pIndexes, bool pCheap, RoaringBitmap &pCandidates)
+{
+  pCandidates.Clear();
+  switch (pNode.type) {
+  case Node::TERM:
+    return PlanTerm(pNode.term, pIndexes, pCheap, pCandidates);
+  case Node::OR:
+    //candidates of all operands are needed
+    for (vector<Node>::const_iterator itn = pNode.children.begin(); itn != pNode.children.end(); ++itn) {
+      RoaringBitmap operand;
+      if (not Plan(*itn, pIndexes, pCheap, operand))
+	return false;
+      pCandidates.Or(operand);
+    }
+    return true;
+  case Node::AND:
+    {
+      //the cheap indexes first, the text index only if they are not selective enough
+      bool narrowed = false;
+      vector<bool> planned(pNode.children.size(), false);
+      for (int pass=0; pass < (pCheap ? 1 : 2); pass++) {
+	if (narrowed && (pCandidates.Cardinality() <= FEW_CANDIDATES || not pIndexes.IsTextIndexReady()))
+	  break;
+	for (size_t i=0; i < pNode.children.size(); i++) {
+	  RoaringBitmap operand;
+	  if (planned[i] || not Plan(pNode.children[i], pIndexes, pass == 0, operand))
+	    continue;
+	  planned[i] = true;
+	  if (narrowed)
+	    pCandidates.And(operand);
+	  else
+	    pCandidates = operand;
+	  narrowed = true;
+	}
+      }
+      return narrowed;
+    }
+  default:
+    //NOT: most records usually match, check them all
+    return false;
+  }
+}
+
+bool QuerySearchTool::Matches(const Term &pTerm, ARecord *pRecord, Indexes &pIndexes)
+{
+  bool plainText = (pTerm.type == SearchRequest::TXT && not pTerm.regex);
+  switch (pTerm.target) {
+  case TT_ANY:
+    {
+      if (pTerm.Matches(pRecord->GetAccountName(), pRecord->GetFoldedName()))
+	return true;
+      if (plainText) {
+	if (pRecord->GetFoldedLabels().find(pTerm.folded) != string::npos)
+	  return true;
+	//fields are matched all at once, without keeping a copy of them
+	string buffer;
+	bool matched = (pRecord->GetFoldedFields(buffer).find(pTerm.folded) != string::npos);
+	std::fill(buffer.begin(), buffer.end(), '\0');
+	return matched;
+      }
+      for (ARecord::TLabelsIterator itL = pRecord->GetLabelsIterBegin(); itL != pRecord->GetLabelsIterEnd(); ++itL)
+	if (pTerm.Matches(*itL))
+	  return true;
+      //m_essentials will match with field names anyway
+      //records are shared by concurrent searches: pinned, others cannot seal them while matched
+      ARecord::FieldsPin pin(pRecord);
+      for (ARecord::TFieldsIterator itf = pRecord->GetFieldsIterBegin(); itf != pRecord->GetFieldsIterEnd(); ++itf)
+	if (pTerm.Matches(itf->first) || pTerm.Matches(itf->second))
+	  return true;
+      return false;
+    }
+  case TT_FIELD:
+    {
+      ARecord::FieldsPin pin(pRecord);
+      for (ARecord::TFieldsIterator itf = pRecord->GetFieldsIterBegin(); itf != pRecord->GetFieldsIterEnd(); ++itf)
+	if (CSMUtils::FoldCase(itf->first) == pTerm.field && pTerm.Matches(itf->second))
+	  return true;
+      return false;
+    }
+  case TT_NAME:
+    return pTerm.Matches(pRecord->GetAccountName(), pRecord->GetFoldedName());
+  case TT_LABEL:
+    for (ARecord::TLabelsIterator itL = pRecord->GetLabelsIterBegin(); itL != pRecord->GetLabelsIterEnd(); ++itL)
+      if (pTerm.Matches(*itL))
+	return true;
+    return false;
+  case TT_SOURCE:
+    return pTerm.Matches(pIndexes.GetSourceName());
+  case TT_CREATED:
+    return pTerm.InRange(pRecord->GetCreationTime());
+  case TT_MODIFIED:
+    return pTerm.InRange(pRecord->GetModificationTime());
+  }
+  return false;
+}
+
+bool QuerySearchTool::Matches(const Node &pNode, ARecord *pRecord, Indexes &pIndexes)
+{
+  switch (pNode.type) {
+  case Node::AND:
+    for (vector<Node>::const_iterator itn = pNode.children.begin(); itn != pNode.children.end(); ++itn)
+      if (not Matches(*itn, pRecord, pIndexes))
+	return false;
+    return true;
+  case Node::OR:
+    for (vector<Node>::const_iterator itn = pNode.children.begin(); itn != pNode.children.end(); ++itn)
+      if (Matches(*itn, pRecord, pIndexes))
+	return true;
+    return false;
+  case Node::NOT:
+    return not Matches(pNode.children[0], pRecord, pIndexes);
+  case Node::TERM:
+    return Matches(pNode.term, pRecord, pIndexes);
+  }
+  return false;
+}
+
+bool QuerySearchTool::MayMatchSource(const Node &pQuery, const string &pSourceName)
+{
+  return MatchSource(pQuery, pSourceName) != SO_NONE;
+}
+
+bool QuerySearchTool::Check(const Node &pQuery, Indexes &pIndexes, bool pBuildTextIndex, RecordVisitor &pVisitor)
+{
+  m_statusCode = SC_OK;
+  const vector<ARecord*> &records = pIndexes.GetRecords();
+  //only check the records which may match, if possible
+  RoaringBitmap candidates;
+  bool cheapOnly = not pBuildTextIndex && not pIndexes.IsTextIndexReady();
+  if (Plan(pQuery, pIndexes, cheapOnly, candidates)) {
+    vector<uint32_t> slots = candidates.ToVector();
+    *log << ILog::VERBOSE << "Checking " << (unsigned long)slots.size() << " of " << (unsigned long)records.size()
+	 << " records (from indexes)" << this << ILog::endmsg;
+    for (vector<uint32_t>::iterator its = slots.begin(); its != slots.end(); ++its)
+      if (*its < records.size() && Matches(pQuery, records[*its], pIndexes) && not pVisitor.Visit(records[*its]))
+	return false;
+  } else {
+    *log << ILog::VERBOSE << "Checking all " << (unsigned long)records.size() << " records" << this << ILog::endmsg;
+    for (vector<ARecord*>::const_iterator itr = records.begin(); itr != records.end(); ++itr)
+      if (Matches(pQuery, *itr, pIndexes) && not pVisitor.Visit(*itr))
+	return false;
+  }
+  return true;
+}
+
+vector<ARecord*> QuerySearchTool::Run(const Node &pQuery, Indexes &pIndexes)
+{
+  RecordCollector matches;
+  Check(pQuery, pIndexes, true, matches);
+  sort(matches.records.begin(), matches.records.end(), LessAccountId);
+  return matches.records;
+}
+
+bool QuerySearchTool::Run(const Node &pQuery, Indexes &pIndexes, RecordVisitor &pVisitor)
+{
+  return Check(pQuery, pIndexes, false, pVisitor);
+}
+
+bool QuerySearchTool::Parse(const string &pQuery, Node &pRoot)
+{
+  if (Parse(pQuery, pRoot, m_errorMsg))
+    return true;
+  *log << ILog::ERROR << "Invalid query: " << m_errorMsg << this << ILog::endmsg;
+  m_statusCode = SC_ERROR;
+  return false;
+}
+
+vector<ARecord*> QuerySearchTool::Find(const string &pQuery, Indexes &pIndexes)
+{
+  Node root;
+  if (not Parse(pQuery, root))
+    return vector<ARecord*>();
+  return Run(root, pIndexes);
+}
+
+bool QuerySearchTool::Find(const string &pQuery, Indexes &pIndexes, RecordVisitor &pVisitor)
+{
+  Node root;
+  if (not Parse(pQuery, root))
+    return true;
+  return Run(root, pIndexes, pVisitor);
+}
+
+vector<ARecord*> QuerySearchTool::Find(string pSearch, vector<ARecord*> pData)
+{
+  Indexes noIndexes(pData);
+  return Find(pSearch, noIndexes);
+}
+
+vector<ARecord*> QuerySearchTool::Find(SearchRequest pOptions, vector<ARecord*> pData)
+{
+  Node root;
+  string error;
+  bool valid = true;
+  if (pOptions.fields.empty() || pOptions.fields == "ARecord::AccountName" || pOptions.fields == "ARecord::Label") {
+    TermTarget target = TT_ANY;
+    if (pOptions.fields == "ARecord::AccountName")
+      target = TT_NAME;
+    else if (pOptions.fields == "ARecord::Label")
+      target = TT_LABEL;
+    valid = MakeTerm(target, pOptions.pattern, pOptions.searchTypePattern, root, error);
+  } else {
+    //any of the requested fields
+    root.type = Node::OR;
+    istringstream fields(pOptions.fields);
+    string field;
+    while (valid && getline(fields, field, ',')) {
+      root.children.push_back(Node());
+      valid = MakeTerm(TT_FIELD, pOptions.pattern, pOptions.searchTypePattern, root.children.back(), error);
+      root.children.back().term.field = CSMUtils::FoldCase(CSMUtils::TrimStr(field));
+    }
+  }
+  if (not valid) {
+    m_errorMsg = error;
+    *log << ILog::ERROR << error << this << ILog::endmsg;
+    m_statusCode = SC_ERROR;
+    return vector<ARecord*>();
+  }
+  Indexes noIndexes(pData);
+  return Run(root, noIndexes);
+}
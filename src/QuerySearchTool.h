@@ -0,0 +1,199 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: QuerySearchTool.h
+ Description: Implements ISearchTool with a structured query language and an index-aware planner
+ Last Modified: $Id$
+*/
+
+#ifndef __QUERY_SEARCH_TOOL__
+#define __QUERY_SEARCH_TOOL__
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <time.h>
+
+#include "ISearchTool.h"
+#include "RegexMatcher.h"
+#include "RoaringBitmap.h"
+
+/** Implements ISearchTool with a structured query language.
+ * A query combines terms with AND, OR, NOT and parentheses (case-insensitive operators,
+ * adjacent terms are joined by AND). Terms are:
+ * - text: matches account name, labels, field names or values (e.g. gmail)
+ * - field:value: matches the values of the fields with that name, case-insensitive (e.g. host:db*)
+ * - name:value, label:value: match the account name, a label
+ * - source:value: matches the location of the source of the records
+ * - created:date, modified:date: date ranges. Dates are YYYY, YYYY-MM or YYYY-MM-DD (local time),
+ *   as a single period (modified:2024-03), a range (created:2023..2024-06, modified:..2022)
+ *   or a bound (modified:>2024-01-15, created:<=2023)
+ * Values match as substrings (case-insensitive, TXT), or as wildcard patterns of the whole value
+ * if they contain '*' or '?'. A '=' prefix asks for an exact match (EXACT, e.g. user:=root),
+ * a '~' prefix for a regular expression (REGEX, e.g. ~"^db[0-9]+"). Terms and values with spaces,
+ * parentheses or colons can be quoted: "home banking", note:"see (old)".
+ *
+ * The planner looks for the candidates of a query in the indexes of the records (see Indexes),
+ * preferring the cheap ones (labels, dates, source) and asking the text index only if they
+ * do not narrow the search enough. Only the candidates are then checked against the query.
+ */
+class QuerySearchTool : public ISearchTool {
+ public:
+  /// Maximum nesting of parentheses and NOT in a query
+  static const int MAX_QUERY_DEPTH = 200;
+  /// Candidates from cheap indexes are checked without asking the text index if they are at most this many
+  static const size_t FEW_CANDIDATES = 64;
+
+  /// What a term matches
+  enum TermTarget {
+    TT_ANY, ///< account name, labels, field names or values
+    TT_FIELD, ///< values of the fields with a given name
+    TT_NAME, ///< account name
+    TT_LABEL, ///< labels
+    TT_SOURCE, ///< location of the source
+    TT_CREATED, ///< creation time
+    TT_MODIFIED ///< modification time
+  };
+
+  /// A term of a query
+  class Term {
+  public:
+    TermTarget target;
+    std::string field; ///< case-folded field name (TT_FIELD)
+    std::string pattern; ///< value as written, without the match type prefix
+    std::string folded; ///< case-folded pattern
+    SearchRequest::SearchType type; ///< TXT, EXACT, REGEX or FUZZY
+    std::shared_ptr<RegexMatcher> regex; ///< REGEX, or TXT with wildcards
+    time_t from, to; ///< range [from, to) (TT_CREATED, TT_MODIFIED)
+
+    Term();
+    /// Check a value (of the target of the term)
+    bool Matches(const std::string &pValue) const;
+    /// Same as Matches(), using the case-folded value if possible
+    bool Matches(const std::string &pValue, const std::string &pFoldedValue) const;
+    /// Check a time (TT_CREATED, TT_MODIFIED)
+    bool InRange(time_t pTime) const;
+    /// Texts contained (case-insensitive) by all matching values, used to ask the text index
+    std::vector<std::string> GetLiterals() const;
+  };
+
+  /// A node of a parsed query
+  class Node {
+  public:
+    enum Type {AND, OR, NOT, TERM};
+    Type type;
+    std::vector<Node> children; ///< operands (AND, OR, NOT)
+    Term term; ///< TERM only
+    Node();
+  };
+
+  /** Indexes of the records searched, used by the planner.
+   * This base class has no index (all records are checked): sources override the lookups they can do.
+   * Candidates are given by slot (position of the record in GetRecords()).
+   */
+  class Indexes {
+  protected:
+    const std::vector<ARecord*> &m_records;
+    std::string m_sourceName;
+  public:
+    Indexes(const std::vector<ARecord*> &pRecords, const std::string &pSourceName="");
+    virtual ~Indexes();
+    /// All records
+    const std::vector<ARecord*> &GetRecords() const;
+    /// Location of the source of the records (TT_SOURCE)
+    const std::string &GetSourceName() const;
+    /// Records having a label matching pTerm. Return false if not available.
+    virtual bool LabelCandidates(const Term &pTerm, RoaringBitmap &pCandidates);
+    /// Records whose date is in the range of pTerm. Return false if not available.
+    virtual bool DateCandidates(const Term &pTerm, RoaringBitmap &pCandidates);
+    /// Records containing all of pLiterals (case-insensitive), possibly more. Return false if not available.
+    virtual bool TextCandidates(const std::vector<std::string> &pLiterals, RoaringBitmap &pCandidates);
+    /// false if the text index must be built first (e.g. fields not decrypted yet): only used if nothing else narrows the search
+    virtual bool IsTextIndexReady();
+    /// false if TextCandidates() does not look at field values (e.g. sealed ones): field searches check all records
+    virtual bool HasFieldValues();
+  };
+
+ protected:
+  enum TokenType {TK_TERM, TK_AND, TK_OR, TK_NOT, TK_OPEN, TK_CLOSE};
+  struct Token {
+    TokenType type;
+    std::string text; ///< term as written, quotes removed (TK_TERM)
+    bool quoted; ///< the whole term was quoted: plain text
+    size_t pos; ///< position in the query, for errors
+  };
+  bool Tokenize(const std::string &pQuery, std::vector<Token> &pTokens, std::string &pError) const;
+  bool ParseOr(const std::vector<Token> &pTokens, size_t &pPos, int pDepth, Node &pNode, std::string &pError) const;
+  bool ParseAnd(const std::vector<Token> &pTokens, size_t &pPos, int pDepth, Node &pNode, std::string &pError) const;
+  bool ParseNot(const std::vector<Token> &pTokens, size_t &pPos, int pDepth, Node &pNode, std::string &pError) const;
+  bool ParseTerm(const Token &pToken, Node &pNode, std::string &pError) const;
+  /// Parse a date, set the period it covers [pBegin, pEnd)
+  static bool ParseDate(const std::string &pDate, time_t &pBegin, time_t &pEnd);
+  /// Parse a date term value (single date, range or bound)
+  static bool ParseDateRange(const std::string &pValue, Term &pTerm);
+
+  /** Candidates of a node from the indexes.
+   * @param pCheap only ask cheap indexes (not the text one)
+   * @return false if all records must be checked
+   */
+  bool Plan(const Node &pNode, Indexes &pIndexes, bool pCheap, RoaringBitmap &pCandidates);
+  /// Candidates of a term from the indexes, see Plan()
+  bool PlanTerm(const Term &pTerm, Indexes &pIndexes, bool pCheap, RoaringBitmap &pCandidates);
+  /** Give the records matching a parsed query to pVisitor, in the order of GetRecords().
+   * @param pBuildTextIndex use the text index even if it must be built first
+   * @return false if pVisitor stopped the search
+   */
+  bool Check(const Node &pQuery, Indexes &pIndexes, bool pBuildTextIndex, RecordVisitor &pVisitor);
+  /// Parse a query, setting the status and error message if it is not valid
+  bool Parse(const std::string &pQuery, Node &pRoot);
+  /// Check a record against a node
+  bool Matches(const Node &pNode, ARecord *pRecord, Indexes &pIndexes);
+  /// Check a record against a term
+  bool Matches(const Term &pTerm, ARecord *pRecord, Indexes &pIndexes);
+
+ public:
+  QuerySearchTool(std::string pName);
+  ~QuerySearchTool();
+
+  /** Parse a query, see class description.
+   * @param pError reason why the query is not valid
+   * @return false if the query is not valid
+   */
+  bool Parse(const std::string &pQuery, Node &pRoot, std::string &pError) const;
+  /** Build a single term query.
+   * Used for searches with an explicit type, the pattern is not parsed.
+   * @return false if the pattern is not valid for the type (e.g. regular expression)
+   */
+  static bool MakeTerm(TermTarget pTarget, const std::string &pPattern, SearchRequest::SearchType pType, Node &pNode, std::string &pError);
+  /** Check if records of a source may match a parsed query, from its source: terms alone.
+   * Used to search only the sources a query can find records in, without loading the others.
+   * @return false if no record of the source can match
+   */
+  static bool MayMatchSource(const Node &pQuery, const std::string &pSourceName);
+
+  /// Records matching a parsed query, sorted by account id
+  std::vector<ARecord*> Run(const Node &pQuery, Indexes &pIndexes);
+  /** Give the records matching a parsed query to pVisitor as they are found, in the order of the records.
+   * Records after the one pVisitor stopped at are not checked, and the text index is only used
+   * if it is ready: the time to the first records found does not depend on the number of records.
+   * @return false if pVisitor stopped the search
+   */
+  bool Run(const Node &pQuery, Indexes &pIndexes, RecordVisitor &pVisitor);
+  /** Records matching a query, sorted by account id.
+   * If the query is not valid, the status is set to SC_ERROR and the reason is in the error message.
+   */
+  std::vector<ARecord*> Find(const std::string &pQuery, Indexes &pIndexes);
+  /// Same as Find(const std::string&, Indexes&), giving the records to pVisitor (see Run(const Node&, Indexes&, RecordVisitor&))
+  bool Find(const std::string &pQuery, Indexes &pIndexes, RecordVisitor &pVisitor);
+
+  /// @copydoc ISearchTool::Find(std::string, std::vector<ARecord*>)
+  virtual std::vector<ARecord*> Find(std::string pSearch, std::vector<ARecord*> pData);
+  /** @copydoc ISearchTool::Find(SearchRequest, std::vector<ARecord*>)
+   * pOptions.fields is ARecord::AccountName, ARecord::Label, or a comma-separated list of field names (any by default).
+   */
+  virtual std::vector<ARecord*> Find(SearchRequest pOptions, std::vector<ARecord*> pData);
+};
+
+#endif
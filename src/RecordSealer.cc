@@ -0,0 +1,342 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: RecordSealer.cc
+ Description: Keep field values of records encrypted in memory, opening them on access
+ Last Modified: $Id$
+*/
+
+#include "RecordSealer.h"
+
+#include "ILog.h"
+#include "ARecord.h"
+#include "PasswordGeneratorTool.h"
+
+#include <algorithm>
+#include <thread>
+#include <string.h>
+#include <sys/mman.h>
+
+extern ILog *log;
+
+using namespace std;
+
+// ----------------------------------------
+// ChaCha20 and Poly1305 (RFC 8439)
+// ----------------------------------------
+namespace {
+  inline uint32_t Load32(const unsigned char *pIn)
+  {
+    return (uint32_t)pIn[0] | ((uint32_t)pIn[1] << 8) | ((uint32_t)pIn[2] << 16) | ((uint32_t)pIn[3] << 24);
+  }
+
+  inline void Store32(unsigned char *pOut, uint32_t pValue)
+  {
+    pOut[0] = pValue;
+    pOut[1] = pValue >> 8;
+    pOut[2] = pValue >> 16;
+    pOut[3] = pValue >> 24;
+  }
+
+  inline uint32_t Rotl(uint32_t pX, int pN)
+  {
+    return (pX << pN) | (pX >> (32 - pN));
+  }
+
+  inline void QuarterRound(uint32_t *pS, int pA, int pB, int pC, int pD)
+  {
+    pS[pA] += pS[pB]; pS[pD] = Rotl(pS[pD] ^ pS[pA], 16);
+    pS[pC] += pS[pD]; pS[pB] = Rotl(pS[pB] ^ pS[pC], 12);
+    pS[pA] += pS[pB]; pS[pD] = Rotl(pS[pD] ^ pS[pA], 8);
+    pS[pC] += pS[pD]; pS[pB] = Rotl(pS[pB] ^ pS[pC], 7);
+  }
+
+  /// One 64-bytes block of key stream
+  void ChaChaBlock(const unsigned char *pKey, uint32_t pCounter, const unsigned char *pNonce, unsigned char *pOut)
+  {
+    uint32_t state[16], work[16];
+    state[0] = 0x61707865; state[1] = 0x3320646e; state[2] = 0x79622d32; state[3] = 0x6b206574;
+    for (int k=0; k < 8; k++)
+      state[4 + k] = Load32(pKey + 4*k);
+    state[12] = pCounter;
+    for (int k=0; k < 3; k++)
+      state[13 + k] = Load32(pNonce + 4*k);
+    memcpy(work, state, sizeof(state));
+    for (int round=0; round < 10; round++) {
+      QuarterRound(work, 0, 4, 8, 12);
+      QuarterRound(work, 1, 5, 9, 13);
+      QuarterRound(work, 2, 6, 10, 14);
+      QuarterRound(work, 3, 7, 11, 15);
+      QuarterRound(work, 0, 5, 10, 15);
+      QuarterRound(work, 1, 6, 11, 12);
+      QuarterRound(work, 2, 7, 8, 13);
+      QuarterRound(work, 3, 4, 9, 14);
+    }
+    for (int k=0; k < 16; k++)
+      Store32(pOut + 4*k, work[k] + state[k]);
+    memset(state, 0, sizeof(state));
+    memset(work, 0, sizeof(work));
+  }
+
+  /// XOR pData with the key stream starting at block pCounter
+  void ChaChaXor(const unsigned char *pKey, uint32_t pCounter, const unsigned char *pNonce, string &pData)
+  {
+    unsigned char keyStream[64];
+    for (size_t pos = 0; pos < pData.size(); pos += 64, pCounter++) {
+      ChaChaBlock(pKey, pCounter, pNonce, keyStream);
+      for (size_t k=0; k < 64 && pos + k < pData.size(); k++)
+	pData[pos + k] ^= keyStream[k];
+    }
+    memset(keyStream, 0, sizeof(keyStream));
+  }
+
+  /// Poly1305 one-time authenticator, 26-bit limbs
+  void Poly1305(const unsigned char *pKey, const string &pMsg, unsigned char *pTag)
+  {
+    const uint32_t mask = 0x3ffffff;
+    uint32_t r0 = Load32(pKey + 0) & 0x3ffffff;
+    uint32_t r1 = (Load32(pKey + 3) >> 2) & 0x3ffff03;
+    uint32_t r2 = (Load32(pKey + 6) >> 4) & 0x3ffc0ff;
+    uint32_t r3 = (Load32(pKey + 9) >> 6) & 0x3f03fff;
+    uint32_t r4 = (Load32(pKey + 12) >> 8) & 0x00fffff;
+    uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = 0, h1 = 0, h2 = 0, h3 = 0, h4 = 0;
+    unsigned char block[17];
+    for (size_t pos = 0; pos < pMsg.size(); pos += 16) {
+      size_t len = min((size_t)16, pMsg.size() - pos);
+      memset(block, 0, sizeof(block));
+      memcpy(block, pMsg.data() + pos, len);
+      block[len] = 1; //message bit above the last byte
+      h0 += Load32(block + 0) & mask;
+      h1 += (Load32(block + 3) >> 2) & mask;
+      h2 += (Load32(block + 6) >> 4) & mask;
+      h3 += (Load32(block + 9) >> 6) & mask;
+      h4 += (Load32(block + 12) >> 8) | ((uint32_t)block[16] << 24);
+      uint64_t d0 = (uint64_t)h0*r0 + (uint64_t)h1*s4 + (uint64_t)h2*s3 + (uint64_t)h3*s2 + (uint64_t)h4*s1;
+      uint64_t d1 = (uint64_t)h0*r1 + (uint64_t)h1*r0 + (uint64_t)h2*s4 + (uint64_t)h3*s3 + (uint64_t)h4*s2;
+      uint64_t d2 = (uint64_t)h0*r2 + (uint64_t)h1*r1 + (uint64_t)h2*r0 + (uint64_t)h3*s4 + (uint64_t)h4*s3;
+      uint64_t d3 = (uint64_t)h0*r3 + (uint64_t)h1*r2 + (uint64_t)h2*r1 + (uint64_t)h3*r0 + (uint64_t)h4*s4;
+      uint64_t d4 = (uint64_t)h0*r4 + (uint64_t)h1*r3 + (uint64_t)h2*r2 + (uint64_t)h3*r1 + (uint64_t)h4*r0;
+      uint32_t c;
+      c = d0 >> 26; h0 = d0 & mask;
+      d1 += c; c = d1 >> 26; h1 = d1 & mask;
+      d2 += c; c = d2 >> 26; h2 = d2 & mask;
+      d3 += c; c = d3 >> 26; h3 = d3 & mask;
+      d4 += c; c = d4 >> 26; h4 = d4 & mask;
+      h0 += c * 5; c = h0 >> 26; h0 &= mask;
+      h1 += c;
+    }
+    // full carry, then reduce modulo 2^130-5
+    uint32_t c;
+    c = h1 >> 26; h1 &= mask;
+    h2 += c; c = h2 >> 26; h2 &= mask;
+    h3 += c; c = h3 >> 26; h3 &= mask;
+    h4 += c; c = h4 >> 26; h4 &= mask;
+    h0 += c * 5; c = h0 >> 26; h0 &= mask;
+    h1 += c;
+    uint32_t g0 = h0 + 5; c = g0 >> 26; g0 &= mask;
+    uint32_t g1 = h1 + c; c = g1 >> 26; g1 &= mask;
+    uint32_t g2 = h2 + c; c = g2 >> 26; g2 &= mask;
+    uint32_t g3 = h3 + c; c = g3 >> 26; g3 &= mask;
+    uint32_t g4 = h4 + c - (1UL << 26);
+    uint32_t select = (g4 >> 31) - 1; //all ones if h >= 2^130-5
+    h0 = (h0 & ~select) | (g0 & select);
+    h1 = (h1 & ~select) | (g1 & select);
+    h2 = (h2 & ~select) | (g2 & select);
+    h3 = (h3 & ~select) | (g3 & select);
+    h4 = (h4 & ~select) | (g4 & select);
+    // h + s mod 2^128
+    uint32_t w0 = h0 | (h1 << 26);
+    uint32_t w1 = (h1 >> 6) | (h2 << 20);
+    uint32_t w2 = (h2 >> 12) | (h3 << 14);
+    uint32_t w3 = (h3 >> 18) | (h4 << 8);
+    uint64_t f;
+    f = (uint64_t)w0 + Load32(pKey + 16); Store32(pTag + 0, f);
+    f = (uint64_t)w1 + Load32(pKey + 20) + (f >> 32); Store32(pTag + 4, f);
+    f = (uint64_t)w2 + Load32(pKey + 24) + (f >> 32); Store32(pTag + 8, f);
+    f = (uint64_t)w3 + Load32(pKey + 28) + (f >> 32); Store32(pTag + 12, f);
+  }
+
+  /// Tag of the AEAD construction over associated data and ciphertext
+  void AeadTag(const unsigned char *pKey, const unsigned char *pNonce, const string &pCipher, const string &pAad, unsigned char *pTag)
+  {
+    unsigned char polyKey[64];
+    ChaChaBlock(pKey, 0, pNonce, polyKey);
+    string macData(pAad);
+    macData.append((16 - pAad.size() % 16) % 16, '\0');
+    macData += pCipher;
+    macData.append((16 - pCipher.size() % 16) % 16, '\0');
+    unsigned char lengths[16];
+    Store32(lengths, pAad.size()); Store32(lengths + 4, (uint64_t)pAad.size() >> 32);
+    Store32(lengths + 8, pCipher.size()); Store32(lengths + 12, (uint64_t)pCipher.size() >> 32);
+    macData.append(reinterpret_cast<char*>(lengths), sizeof(lengths));
+    Poly1305(polyKey, macData, pTag);
+    memset(polyKey, 0, sizeof(polyKey));
+  }
+}
+
+string RecordSealer::AeadEncrypt(const unsigned char *pKey, const unsigned char *pNonce, const string &pPlain, const string &pAad)
+{
+  string cipher(pPlain);
+  ChaChaXor(pKey, 1, pNonce, cipher);
+  unsigned char tag[TAG_SIZE];
+  AeadTag(pKey, pNonce, cipher, pAad, tag);
+  cipher.append(reinterpret_cast<char*>(tag), TAG_SIZE);
+  return cipher;
+}
+
+bool RecordSealer::AeadDecrypt(const unsigned char *pKey, const unsigned char *pNonce, const string &pCipher, const string &pAad, string &pPlain)
+{
+  if (pCipher.size() < TAG_SIZE)
+    return false;
+  string cipher = pCipher.substr(0, pCipher.size() - TAG_SIZE);
+  unsigned char tag[TAG_SIZE];
+  AeadTag(pKey, pNonce, cipher, pAad, tag);
+  //constant-time comparison
+  unsigned char diff = 0;
+  for (size_t k=0; k < TAG_SIZE; k++)
+    diff |= tag[k] ^ (unsigned char)pCipher[pCipher.size() - TAG_SIZE + k];
+  if (diff != 0)
+    return false;
+  ChaChaXor(pKey, 1, pNonce, cipher);
+  pPlain.swap(cipher);
+  return true;
+}
+
+// ----------------------------------------
+// RecordSealer
+// ----------------------------------------
+
+RecordSealer::RecordSealer(string pName, size_t pCapacity) : IErrorHandler(pName), m_nonceCounter(0)
+{
+  //records iterated by concurrent threads must not be sealed under their feet:
+  //leave room for a few records per thread besides the ones an action needs
+  m_capacity = max(pCapacity, MIN_CAPACITY + 4 * (size_t)thread::hardware_concurrency());
+  void *keyMem = mmap(0, KEY_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (keyMem == MAP_FAILED) {
+    m_key = 0;
+    *log << ILog::ERROR << "Cannot allocate memory for the sealing key" << this << ILog::endmsg;
+    m_statusCode = SC_ERROR;
+    return;
+  }
+  if (mlock(keyMem, KEY_SIZE) != 0)
+    *log << ILog::WARNING << "Cannot lock memory for the sealing key, it may be swapped" << this << ILog::endmsg;
+  madvise(keyMem, KEY_SIZE, MADV_DONTDUMP);
+  m_key = static_cast<unsigned char*>(keyMem);
+  PasswordGeneratorTool::EntropyPool pool;
+  for (size_t k=0; k < KEY_SIZE; k++)
+    m_key[k] = pool.Uniform(256);
+  if (pool.Failed()) {
+    *log << ILog::ERROR << "Cannot get random bytes for the sealing key" << this << ILog::endmsg;
+    memset(m_key, 0, KEY_SIZE);
+    munlock(m_key, KEY_SIZE);
+    munmap(m_key, KEY_SIZE);
+    m_key = 0;
+    m_statusCode = SC_ERROR;
+    return;
+  }
+  *log << ILog::DEBUG << "Records sealing enabled, keeping at most " << (unsigned long)m_capacity << " records open"
+       << this << ILog::endmsg;
+}
+
+RecordSealer::~RecordSealer()
+{
+  if (m_key) {
+    memset(m_key, 0, KEY_SIZE);
+    munlock(m_key, KEY_SIZE);
+    munmap(m_key, KEY_SIZE);
+  }
+}
+
+bool RecordSealer::IsReady() const
+{
+  return (m_key != 0);
+}
+
+string RecordSealer::Seal(const string &pPlain, const string &pAad)
+{
+  unsigned char nonce[NONCE_SIZE];
+  memset(nonce, 0, NONCE_SIZE);
+  uint64_t counter = m_nonceCounter++;
+  for (int k=0; k < 8; k++)
+    nonce[4 + k] = counter >> (8 * k);
+  string sealed(reinterpret_cast<char*>(nonce), NONCE_SIZE);
+  sealed += AeadEncrypt(m_key, nonce, pPlain, pAad);
+  return sealed;
+}
+
+bool RecordSealer::Open(const string &pSealed, const string &pAad, string &pPlain) const
+{
+  if (pSealed.size() < NONCE_SIZE + TAG_SIZE)
+    return false;
+  return AeadDecrypt(m_key, reinterpret_cast<const unsigned char*>(pSealed.data()), pSealed.substr(NONCE_SIZE), pAad, pPlain);
+}
+
+void RecordSealer::Touch(ARecord *pRecord)
+{
+  unordered_map<ARecord*, list<ARecord*>::iterator>::iterator itp = m_openRecordsPos.find(pRecord);
+  if (itp != m_openRecordsPos.end()) {
+    m_openRecords.splice(m_openRecords.begin(), m_openRecords, itp->second);
+    return;
+  }
+  m_openRecords.push_front(pRecord);
+  m_openRecordsPos[pRecord] = m_openRecords.begin();
+  //seal the least recently used records, skipping the pinned ones
+  list<ARecord*>::iterator itr = m_openRecords.end();
+  while (m_openRecords.size() > m_capacity && itr != m_openRecords.begin()) {
+    --itr;
+    if (m_pins.count(*itr))
+      continue;
+    ARecord *oldest = *itr;
+    itr = m_openRecords.erase(itr);
+    m_openRecordsPos.erase(oldest);
+    oldest->SealFields();
+  }
+}
+
+void RecordSealer::Forget(ARecord *pRecord)
+{
+  lock_guard<recursive_mutex> lock(m_mutex);
+  unordered_map<ARecord*, list<ARecord*>::iterator>::iterator itp = m_openRecordsPos.find(pRecord);
+  if (itp == m_openRecordsPos.end())
+    return;
+  m_openRecords.erase(itp->second);
+  m_openRecordsPos.erase(itp);
+}
+
+void RecordSealer::Pin(ARecord *pRecord)
+{
+  lock_guard<recursive_mutex> lock(m_mutex);
+  m_pins[pRecord]++;
+}
+
+void RecordSealer::Unpin(ARecord *pRecord)
+{
+  lock_guard<recursive_mutex> lock(m_mutex);
+  unordered_map<ARecord*, unsigned int>::iterator itp = m_pins.find(pRecord);
+  if (itp != m_pins.end() && --itp->second == 0)
+    m_pins.erase(itp);
+}
+
+bool RecordSealer::IsPinned(ARecord *pRecord)
+{
+  return m_pins.count(pRecord) > 0;
+}
+
+size_t RecordSealer::GetCapacity() const
+{
+  return m_capacity;
+}
+
+size_t RecordSealer::GetOpenCount()
+{
+  lock_guard<recursive_mutex> lock(m_mutex);
+  return m_openRecords.size();
+}
+
+recursive_mutex &RecordSealer::GetMutex()
+{
+  return m_mutex;
+}
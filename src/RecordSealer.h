@@ -0,0 +1,114 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: RecordSealer.h
+ Description: Keep field values of records encrypted in memory, opening them on access
+ Last Modified: $Id$
+*/
+
+#ifndef __RECORD_SEALER__
+#define __RECORD_SEALER__
+
+#include "IErrorHandler.h"
+
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <stdint.h>
+
+class ARecord;
+
+/** Keep field values of records encrypted ("sealed") in memory, opening them on access.
+ * Values are encrypted with ChaCha20-Poly1305 (RFC 8439) under a random per-session key
+ * held in locked memory; the field name is used as associated data.
+ * ARecord opens its values through this tool when they are accessed and registers itself
+ * in a LRU list of open records: when more than GetCapacity() records are open, the least
+ * recently used ones are sealed again, so that the plaintext resident in memory is bounded
+ * whatever the size of the sources.
+ *
+ * Records can be pinned (see ARecord::FieldsPin) while their fields are iterated: they are
+ * not sealed until unpinned, even if that keeps more than GetCapacity() records open.
+ *
+ * Seal() and Open() are thread-safe. The LRU list is protected by GetMutex(), which ARecord
+ * holds while opening or sealing its fields.
+ */
+class RecordSealer : public IErrorHandler {
+ public:
+  static const size_t KEY_SIZE = 32;
+  static const size_t NONCE_SIZE = 12;
+  static const size_t TAG_SIZE = 16;
+  static const size_t MIN_CAPACITY = 8; ///< records an action may need open at the same time
+
+ protected:
+  /// Session key (locked in memory)
+  unsigned char *m_key;
+  /// Counter used to build unique nonces
+  std::atomic<uint64_t> m_nonceCounter;
+
+  /// Open records, most recently used first
+  std::list<ARecord*> m_openRecords;
+  std::unordered_map<ARecord*, std::list<ARecord*>::iterator> m_openRecordsPos;
+  size_t m_capacity;
+  /// Pinned records, with the number of pins of each
+  std::unordered_map<ARecord*, unsigned int> m_pins;
+  std::recursive_mutex m_mutex;
+
+ public:
+  /** Create the sealer with a new random key.
+   * @param pName name of the tool
+   * @param pCapacity maximum number of records kept open
+   */
+  RecordSealer(std::string pName, size_t pCapacity=64);
+  ~RecordSealer(); ///< wipes the key
+
+  /// Check that the key is available
+  bool IsReady() const;
+
+  /** Encrypt a value.
+   * @param pPlain value to be sealed
+   * @param pAad associated data, needed unchanged to open it
+   * @return nonce, ciphertext and tag
+   */
+  std::string Seal(const std::string &pPlain, const std::string &pAad);
+
+  /** Decrypt a value sealed with Seal().
+   * @param pSealed sealed value
+   * @param pAad associated data
+   * @param pPlain decrypted value
+   * @return false if the value has been tampered with
+   */
+  bool Open(const std::string &pSealed, const std::string &pAad, std::string &pPlain) const;
+
+  /** Mark a record as just opened, sealing the least recently used ones if needed.
+   * To be called with GetMutex() locked.
+   */
+  void Touch(ARecord *pRecord);
+  /// Remove a record from the open ones (e.g. when it is deleted)
+  void Forget(ARecord *pRecord);
+  /// Keep a record from being sealed, until as many Unpin()
+  void Pin(ARecord *pRecord);
+  /// Release a pin of Pin()
+  void Unpin(ARecord *pRecord);
+  /// Check if a record is pinned (to be called with GetMutex() locked)
+  bool IsPinned(ARecord *pRecord);
+
+  /// Maximum number of open records
+  size_t GetCapacity() const;
+  /// Current number of open records
+  size_t GetOpenCount();
+  /// Mutex protecting the open records
+  std::recursive_mutex &GetMutex();
+
+  /// ChaCha20-Poly1305 encryption: returns ciphertext and appends the tag
+  static std::string AeadEncrypt(const unsigned char *pKey, const unsigned char *pNonce,
+				 const std::string &pPlain, const std::string &pAad);
+  /// ChaCha20-Poly1305 decryption of ciphertext+tag; false if authentication fails
+  static bool AeadDecrypt(const unsigned char *pKey, const unsigned char *pNonce,
+			  const std::string &pCipher, const std::string &pAad, std::string &pPlain);
+};
+
+#endif
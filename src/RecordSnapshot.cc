@@ -0,0 +1,144 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: RecordSnapshot.cc
+ Description: Immutable, reference-counted version of the records of the sources
+ Last Modified: $Id$
+*/
+
+#include "RecordSnapshot.h"
+#include "SingleSourceIOSvc.h"
+#include "QuerySearchTool.h"
+#include "FuzzyMatcher.h"
+
+#include <algorithm>
+#include <iterator>
+
+using namespace std;
+
+RecordSnapshot::Epoch::~Epoch()
+{
+  for (vector<ARecord*>::iterator itr = retired.begin(); itr != retired.end(); ++itr)
+    delete *itr;
+  //end the following epochs no longer used one after the other, not recursively
+  shared_ptr<Epoch> following;
+  following.swap(next);
+  while (following && following.use_count() == 1) {
+    shared_ptr<Epoch> after;
+    after.swap(following->next);
+    following.swap(after); //the epoch is deleted with after
+  }
+}
+
+RecordSnapshot::RecordSnapshot(const string &pSourceName, unsigned long pVersion, const vector<ARecord*> &pRecords,
+			       const vector<ARecord*> &pByName, const vector<ARecord*> &pByDate, shared_ptr<Epoch> pEpoch) :
+  m_sourceName(pSourceName), m_version(pVersion), m_records(pRecords), m_byName(pByName), m_byDate(pByDate), m_epoch(pEpoch)
+{
+
+}
+
+RecordSnapshot::RecordSnapshot(const vector<Ptr> &pParts) : m_version(0), m_parts(pParts)
+{
+  vector<const vector<ARecord*>*> byName, byDate;
+  for (vector<Ptr>::const_iterator itp = m_parts.begin(); itp != m_parts.end(); ++itp) {
+    m_version += (*itp)->m_version;
+    m_records.insert(m_records.end(), (*itp)->m_records.begin(), (*itp)->m_records.end());
+    byName.push_back(&(*itp)->m_byName);
+    byDate.push_back(&(*itp)->m_byDate);
+  }
+  m_byName = MergeViews(byName, SingleSourceIOSvc::sortByName);
+  m_byDate = MergeViews(byDate, SingleSourceIOSvc::sortByDate);
+}
+
+RecordSnapshot::~RecordSnapshot()
+{
+
+}
+
+const string &RecordSnapshot::GetSourceName() const
+{
+  return m_sourceName;
+}
+
+unsigned long RecordSnapshot::GetVersion() const
+{
+  return m_version;
+}
+
+size_t RecordSnapshot::Size() const
+{
+  return m_records.size();
+}
+
+const vector<ARecord*> &RecordSnapshot::GetAccounts(int sort) const
+{
+  if (sort == IIOService::ACCOUNTS_SORT_BYNAME)
+    return m_byName;
+  else if (sort == IIOService::ACCOUNTS_SORT_BYDATE)
+    return m_byDate;
+  return m_records;
+}
+
+const vector<RecordSnapshot::Ptr> &RecordSnapshot::GetParts() const
+{
+  return m_parts;
+}
+
+vector<ARecord*> RecordSnapshot::Find(const string &pSearch, SearchRequest::SearchType pTypeOfSearch, string &pError) const
+{
+  pError.clear();
+  if (pTypeOfSearch == SearchRequest::FUZZY) {
+    FuzzyMatcher matcher(pSearch);
+    for (vector<ARecord*>::const_iterator itr = m_records.begin(); itr != m_records.end(); ++itr)
+      matcher.Add(*itr);
+    return matcher.GetResults();
+  }
+  if (not m_parts.empty()) {
+    //each source is searched with its own location (source: terms)
+    vector<ARecord*> sResult;
+    for (vector<Ptr>::const_iterator itp = m_parts.begin(); itp != m_parts.end(); ++itp) {
+      vector<ARecord*> partResult = (*itp)->Find(pSearch, pTypeOfSearch, pError);
+      if (not pError.empty())
+	return vector<ARecord*>(); //same search for all sources: it is not valid
+      sResult.insert(sResult.end(), partResult.begin(), partResult.end());
+    }
+    return sResult;
+  }
+  //a tool for each search: searches can run concurrently
+  QuerySearchTool queryTool("SnapshotSearchTool");
+  QuerySearchTool::Node query;
+  bool valid;
+  if (pTypeOfSearch == SearchRequest::QUERY)
+    valid = queryTool.Parse(pSearch, query, pError);
+  else
+    valid = QuerySearchTool::MakeTerm(QuerySearchTool::TT_ANY, pSearch, pTypeOfSearch, query, pError);
+  if (not valid)
+    return vector<ARecord*>();
+  QuerySearchTool::Indexes noIndexes(m_records, m_sourceName);
+  return queryTool.Run(query, noIndexes);
+}
+
+vector<ARecord*> RecordSnapshot::MergeViews(const vector<const vector<ARecord*>*> &pViews, bool (*pLess)(ARecord*, ARecord*))
+{
+  vector<vector<ARecord*> > runs;
+  for (vector<const vector<ARecord*>*>::const_iterator itv = pViews.begin(); itv != pViews.end(); ++itv)
+    if (not (*itv)->empty())
+      runs.push_back(**itv);
+  if (runs.empty())
+    return vector<ARecord*>();
+  while (runs.size() > 1) {
+    vector<vector<ARecord*> > merged((runs.size() + 1) / 2);
+    for (size_t i=0; i < runs.size(); i += 2) {
+      if (i + 1 == runs.size()) {
+	merged[i / 2].swap(runs[i]);
+	continue;
+      }
+      merged[i / 2].reserve(runs[i].size() + runs[i+1].size());
+      merge(runs[i].begin(), runs[i].end(), runs[i+1].begin(), runs[i+1].end(), back_inserter(merged[i / 2]), pLess);
+    }
+    runs.swap(merged);
+  }
+  return runs[0];
+}
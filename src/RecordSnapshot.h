@@ -0,0 +1,86 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: RecordSnapshot.h
+ Description: Reference-counted version of the records of the sources
+ Last Modified: $Id$
+*/
+
+#ifndef __RECORD_SNAPSHOT__
+#define __RECORD_SNAPSHOT__
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "ARecord.h"
+#include "ISearchTool.h"
+
+/** Version of the records of a source, or of several sources.
+ * Sources publish a new snapshot when records are added, removed or unloaded (read-copy-update):
+ * readers get the current one (see IIOService::GetSnapshot()) and keep it while they use its records,
+ * while the source keeps changing, loading, writing or is evicted.
+ *
+ * Records removed from a source are retired (see Epoch): they are deleted only once no snapshot
+ * which may contain them is in use. What a snapshot fixes is which records there are and their order:
+ * fields of records are still edited in place by the owner of the source (e.g. the GUI), before Store().
+ */
+class RecordSnapshot {
+ public:
+  typedef std::shared_ptr<const RecordSnapshot> Ptr;
+
+  /** Records retired while a snapshot was the current one.
+   * Each snapshot shares the epoch current when it was published. An epoch keeps the next one,
+   * so that it ends only after all older snapshots are released: its records are then deleted.
+   */
+  class Epoch {
+  public:
+    std::vector<ARecord*> retired; ///< deleted with the epoch
+    std::shared_ptr<Epoch> next; ///< epoch of the next snapshot
+    ~Epoch();
+  };
+
+ protected:
+  std::string m_sourceName; ///< empty for several sources
+  unsigned long m_version;
+  std::vector<ARecord*> m_records; ///< in the order of the source
+  std::vector<ARecord*> m_byName; ///< sorted by SingleSourceIOSvc::sortByName
+  std::vector<ARecord*> m_byDate; ///< sorted by SingleSourceIOSvc::sortByDate
+  std::shared_ptr<Epoch> m_epoch;
+  std::vector<Ptr> m_parts; ///< snapshots of the sources, for several sources
+
+ public:
+  /// Snapshot of a source. The views are copied.
+  RecordSnapshot(const std::string &pSourceName, unsigned long pVersion, const std::vector<ARecord*> &pRecords,
+		 const std::vector<ARecord*> &pByName, const std::vector<ARecord*> &pByDate, std::shared_ptr<Epoch> pEpoch);
+  /// Snapshot of several sources: their snapshots are kept, the sorted views merged
+  RecordSnapshot(const std::vector<Ptr> &pParts);
+  ~RecordSnapshot();
+
+  /// Location of the source, empty for several sources
+  const std::string &GetSourceName() const;
+  /// Number of snapshots published by the source before this one (sum of the sources, for several sources)
+  unsigned long GetVersion() const;
+  /// Number of records
+  size_t Size() const;
+  /// All records, sorted as IIOService::GetAllAccounts() (see IIOService::AccountsSorting)
+  const std::vector<ARecord*> &GetAccounts(int sort=0) const;
+  /// Snapshots of the sources (empty for a single source)
+  const std::vector<Ptr> &GetParts() const;
+
+  /** Records matching a search, as IIOService::Find(): all records are checked.
+   * Fuzzy searches return the best matches first.
+   * @param pError reason why the search is not valid
+   */
+  std::vector<ARecord*> Find(const std::string &pSearch, SearchRequest::SearchType pTypeOfSearch, std::string &pError) const;
+
+  /** Merge views each sorted by pLess.
+   * Pairwise k-way merge: log2(k) passes with a single comparison per record each. Records are
+   * scattered in memory and comparisons dominate: a heap would need more of them.
+   */
+  static std::vector<ARecord*> MergeViews(const std::vector<const std::vector<ARecord*>*> &pViews, bool (*pLess)(ARecord*, ARecord*));
+};
+
+#endif
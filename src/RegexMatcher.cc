@@ -0,0 +1,988 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: RegexMatcher.cc
+ Description: Linear-time regular expression matcher, used by REGEX searches
+ Last Modified: $Id$
+*/
+
+#include "RegexMatcher.h"
+
+#include <algorithm>
+#include <sstream>
+#include <ctype.h>
+#include <stdlib.h>
+
+using namespace std;
+
+std::mutex RegexMatcher::s_cacheMutex;
+std::list<std::shared_ptr<RegexMatcher> > RegexMatcher::s_cache;
+
+namespace {
+  const uint32_t MAX_CODE_POINT = 0x10FFFF;
+  /// Maximum nesting of groups
+  const int MAX_NESTING = 200;
+  /// Maximum number of quantifiers applied to the same atom
+  const int MAX_QUANTIFIERS = 10;
+
+  /// Sort and merge ranges
+  void Normalize(RegexMatcher::TCharRanges &pRanges)
+  {
+    sort(pRanges.begin(), pRanges.end());
+    RegexMatcher::TCharRanges merged;
+    for (RegexMatcher::TCharRanges::iterator itr = pRanges.begin(); itr != pRanges.end(); ++itr) {
+      if (not merged.empty() && itr->first <= merged.back().second + 1)
+	merged.back().second = max(merged.back().second, itr->second);
+      else
+	merged.push_back(*itr);
+    }
+    pRanges.swap(merged);
+  }
+
+  /// Code points not in pRanges (normalized)
+  RegexMatcher::TCharRanges Complement(const RegexMatcher::TCharRanges &pRanges)
+  {
+    RegexMatcher::TCharRanges complement;
+    uint32_t next = 0;
+    for (RegexMatcher::TCharRanges::const_iterator itr = pRanges.begin(); itr != pRanges.end(); ++itr) {
+      if (itr->first > next)
+	complement.push_back(make_pair(next, itr->first - 1));
+      next = itr->second + 1;
+    }
+    if (next <= MAX_CODE_POINT)
+      complement.push_back(make_pair(next, MAX_CODE_POINT));
+    return complement;
+  }
+
+  int Utf8Length(uint32_t pCode)
+  {
+    return (pCode < 0x80) ? 1 : (pCode < 0x800) ? 2 : (pCode < 0x10000) ? 3 : 4;
+  }
+
+  void EncodeUtf8(uint32_t pCode, unsigned char *pBytes)
+  {
+    switch (Utf8Length(pCode)) {
+    case 1:
+      pBytes[0] = pCode;
+      break;
+    case 2:
+      pBytes[0] = 0xC0 | (pCode >> 6);
+      pBytes[1] = 0x80 | (pCode & 0x3F);
+      break;
+    case 3:
+      pBytes[0] = 0xE0 | (pCode >> 12);
+      pBytes[1] = 0x80 | ((pCode >> 6) & 0x3F);
+      pBytes[2] = 0x80 | (pCode & 0x3F);
+      break;
+    default:
+      pBytes[0] = 0xF0 | (pCode >> 18);
+      pBytes[1] = 0x80 | ((pCode >> 12) & 0x3F);
+      pBytes[2] = 0x80 | ((pCode >> 6) & 0x3F);
+      pBytes[3] = 0x80 | (pCode & 0x3F);
+    }
+  }
+
+  /** Append the UTF-8 byte sequences matching the code points in [pLo, pHi].
+   * The range is split until each piece is encoded as a plain sequence of byte ranges.
+   */
+  void AddUtf8Range(uint32_t pLo, uint32_t pHi, vector<RegexMatcher::TByteSeq> &pSeqs)
+  {
+    if (pLo > pHi)
+      return;
+    //pieces with the same encoded length
+    const uint32_t lengthLimits[] = {0x7F, 0x7FF, 0xFFFF};
+    for (int k=0; k < 3; k++)
+      if (pLo <= lengthLimits[k] && pHi > lengthLimits[k]) {
+	AddUtf8Range(pLo, lengthLimits[k], pSeqs);
+	AddUtf8Range(lengthLimits[k] + 1, pHi, pSeqs);
+	return;
+      }
+    //pieces where only the leading differing byte is not a full continuation range
+    int len = Utf8Length(pLo);
+    for (int i=1; i < len; i++) {
+      uint32_t mask = (1u << (6*i)) - 1;
+      if ((pLo & ~mask) == (pHi & ~mask))
+	continue;
+      if ((pLo & mask) != 0) {
+	AddUtf8Range(pLo, pLo | mask, pSeqs);
+	AddUtf8Range((pLo | mask) + 1, pHi, pSeqs);
+	return;
+      }
+      if ((pHi & mask) != mask) {
+	AddUtf8Range(pLo, (pHi & ~mask) - 1, pSeqs);
+	AddUtf8Range(pHi & ~mask, pHi, pSeqs);
+	return;
+      }
+    }
+    unsigned char lo[4], hi[4];
+    EncodeUtf8(pLo, lo);
+    EncodeUtf8(pHi, hi);
+    RegexMatcher::TByteSeq seq;
+    for (int k=0; k < len; k++)
+      seq.push_back(make_pair(lo[k], hi[k]));
+    pSeqs.push_back(seq);
+  }
+
+  int HexValue(char pChar)
+  {
+    if (pChar >= '0' && pChar <= '9') return pChar - '0';
+    if (pChar >= 'a' && pChar <= 'f') return pChar - 'a' + 10;
+    if (pChar >= 'A' && pChar <= 'F') return pChar - 'A' + 10;
+    return -1;
+  }
+}
+
+RegexMatcher::RegexMatcher(const string &pPattern) : m_pattern(pPattern)
+{
+  m_pos = 0;
+  m_caseless = false;
+  m_start = -1;
+  m_numClasses = 1;
+  m_markGen = 0;
+  if (m_pattern.compare(0, 4, "(?i)") == 0) {
+    m_caseless = true;
+    m_pos = 4;
+  }
+  // --- Parse
+  int root = ParseAlt(0);
+  if (root >= 0 && m_pos < m_pattern.size())
+    SetError("unmatched )");
+  // --- Build the NFA
+  if (m_error.empty()) {
+    Frag expr = CompileNode(root);
+    int match = AddState(State::MATCH);
+    Patch(expr.outs, match);
+    m_start = expr.start;
+  }
+  if (m_error.empty()) {
+    bool exact;
+    string longest = RequiredLiteral(root, exact, m_literals);
+    if (not longest.empty())
+      m_literals.push_back(longest);
+    //longest first, without duplicates
+    sort(m_literals.begin(), m_literals.end());
+    m_literals.erase(unique(m_literals.begin(), m_literals.end()), m_literals.end());
+    stable_sort(m_literals.begin(), m_literals.end(), [](const string &a, const string &b) { return a.size() > b.size(); });
+  }
+  m_nodes.clear();
+  if (not m_error.empty()) {
+    m_states.clear();
+    m_literals.clear();
+    return;
+  }
+  // --- Byte classes: bytes which are not distinguished by any state share the DFA transitions
+  bool boundary[257];
+  fill(boundary, boundary + 257, false);
+  for (vector<State>::iterator its = m_states.begin(); its != m_states.end(); ++its)
+    if (its->type == State::BYTES && its->lo <= its->hi) {
+      boundary[its->lo] = true;
+      boundary[its->hi + 1] = true;
+    }
+  int byteClass = 0;
+  for (int b=0; b < 256; b++) {
+    if (b > 0 && boundary[b])
+      byteClass++;
+    m_byteClass[b] = byteClass;
+  }
+  m_numClasses = byteClass + 1;
+  m_mark.assign(m_states.size(), 0);
+  ResetDfa();
+}
+
+RegexMatcher::~RegexMatcher()
+{
+
+}
+
+shared_ptr<RegexMatcher> RegexMatcher::Get(const string &pPattern)
+{
+  lock_guard<mutex> lock(s_cacheMutex);
+  for (list<shared_ptr<RegexMatcher> >::iterator itc = s_cache.begin(); itc != s_cache.end(); ++itc)
+    if ((*itc)->m_pattern == pPattern) {
+      s_cache.splice(s_cache.begin(), s_cache, itc); //most recently used first
+      return s_cache.front();
+    }
+  shared_ptr<RegexMatcher> matcher(new RegexMatcher(pPattern));
+  s_cache.push_front(matcher);
+  if (s_cache.size() > CACHE_SIZE)
+    s_cache.pop_back();
+  return matcher;
+}
+
+bool RegexMatcher::IsValid() const
+{
+  return m_error.empty();
+}
+
+const string &RegexMatcher::GetError() const
+{
+  return m_error;
+}
+
+const string &RegexMatcher::GetPattern() const
+{
+  return m_pattern;
+}
+
+const vector<string> &RegexMatcher::GetRequiredLiterals() const
+{
+  return m_literals;
+}
+
+// --- Parsing
+
+bool RegexMatcher::SetError(const string &pError)
+{
+  if (m_error.empty()) {
+    ostringstream msg;
+    msg << pError << " at position " << m_pos;
+    m_error = msg.str();
+  }
+  return false;
+}
+
+int RegexMatcher::NewNode(Node::Kind pKind)
+{
+  Node node;
+  node.kind = pKind;
+  node.min = 0;
+  node.max = 0;
+  m_nodes.push_back(node);
+  return m_nodes.size() - 1;
+}
+
+int RegexMatcher::NewChars(TCharRanges pRanges, bool pNegate)
+{
+  if (m_caseless) {
+    size_t nRanges = pRanges.size();
+    for (size_t k=0; k < nRanges; k++) {
+      uint32_t lo = max(pRanges[k].first, (uint32_t)'A'), hi = min(pRanges[k].second, (uint32_t)'Z');
+      if (lo <= hi)
+	pRanges.push_back(make_pair(lo + 32, hi + 32));
+      lo = max(pRanges[k].first, (uint32_t)'a');
+      hi = min(pRanges[k].second, (uint32_t)'z');
+      if (lo <= hi)
+	pRanges.push_back(make_pair(lo - 32, hi - 32));
+    }
+  }
+  Normalize(pRanges);
+  if (pNegate)
+    pRanges = Complement(pRanges);
+  int node = NewNode(Node::CHARS);
+  for (TCharRanges::iterator itr = pRanges.begin(); itr != pRanges.end(); ++itr)
+    AddUtf8Range(itr->first, min(itr->second, MAX_CODE_POINT), m_nodes[node].seqs);
+  return node;
+}
+
+uint32_t RegexMatcher::ParseCodePoint(bool &pRawByte)
+{
+  unsigned char b = m_pattern[m_pos];
+  pRawByte = false;
+  if (b < 0x80) {
+    m_pos++;
+    return b;
+  }
+  size_t len = 0;
+  uint32_t code = 0;
+  if ((b & 0xE0) == 0xC0 && b >= 0xC2) {
+    len = 2; code = b & 0x1F;
+  } else if ((b & 0xF0) == 0xE0) {
+    len = 3; code = b & 0x0F;
+  } else if ((b & 0xF8) == 0xF0 && b <= 0xF4) {
+    len = 4; code = b & 0x07;
+  }
+  bool valid = (len > 0 && m_pos + len <= m_pattern.size());
+  for (size_t k=1; valid && k < len; k++) {
+    unsigned char cont = m_pattern[m_pos + k];
+    valid = ((cont & 0xC0) == 0x80);
+    code = (code << 6) | (cont & 0x3F);
+  }
+  if (valid && ((len == 3 && code < 0x800) || (len == 4 && code < 0x10000) || code > MAX_CODE_POINT))
+    valid = false; //overlong
+  if (not valid) {
+    m_pos++;
+    pRawByte = true;
+    return b;
+  }
+  m_pos += len;
+  return code;
+}
+
+int RegexMatcher::ParseAlt(int pDepth)
+{
+  if (pDepth > MAX_NESTING) {
+    SetError("too many nested groups");
+    return -1;
+  }
+  vector<int> branches;
+  int branch = ParseConcat(pDepth);
+  if (branch < 0)
+    return -1;
+  branches.push_back(branch);
+  while (m_pos < m_pattern.size() && m_pattern[m_pos] == '|') {
+    m_pos++;
+    branch = ParseConcat(pDepth);
+    if (branch < 0)
+      return -1;
+    branches.push_back(branch);
+  }
+  if (branches.size() == 1)
+    return branches[0];
+  int node = NewNode(Node::ALT);
+  m_nodes[node].children = branches;
+  return node;
+}
+
+int RegexMatcher::ParseConcat(int pDepth)
+{
+  vector<int> items;
+  while (m_pos < m_pattern.size() && m_pattern[m_pos] != '|' && m_pattern[m_pos] != ')') {
+    int atom = ParseAtom(pDepth);
+    if (atom < 0)
+      return -1;
+    atom = ParseQuantifiers(atom);
+    if (atom < 0)
+      return -1;
+    items.push_back(atom);
+  }
+  if (items.empty())
+    return NewNode(Node::EMPTY);
+  if (items.size() == 1)
+    return items[0];
+  int node = NewNode(Node::CONCAT);
+  m_nodes[node].children = items;
+  return node;
+}
+
+int RegexMatcher::ParseAtom(int pDepth)
+{
+  TCharRanges ranges;
+  switch (m_pattern[m_pos]) {
+  case '(': {
+    m_pos++;
+    if (m_pattern.compare(m_pos, 2, "?:") == 0)
+      m_pos += 2;
+    else if (m_pos < m_pattern.size() && m_pattern[m_pos] == '?') {
+      SetError("unsupported group");
+      return -1;
+    }
+    int inner = ParseAlt(pDepth + 1);
+    if (inner < 0)
+      return -1;
+    if (m_pos >= m_pattern.size() || m_pattern[m_pos] != ')') {
+      SetError("missing )");
+      return -1;
+    }
+    m_pos++;
+    return inner;
+  }
+  case '[':
+    m_pos++;
+    return ParseClass();
+  case '.':
+    m_pos++;
+    ranges.push_back(make_pair((uint32_t)'\n', (uint32_t)'\n'));
+    return NewChars(ranges, true);
+  case '^':
+    m_pos++;
+    return NewNode(Node::BOL);
+  case '$':
+    m_pos++;
+    return NewNode(Node::EOL);
+  case '*':
+  case '+':
+  case '?':
+    SetError("nothing to repeat");
+    return -1;
+  case '\\':
+    m_pos++;
+    if (not ParseEscape(ranges))
+      return -1;
+    return NewChars(ranges);
+  default: {
+    bool rawByte;
+    uint32_t code = ParseCodePoint(rawByte);
+    if (rawByte) {
+      //not UTF-8: match the byte itself
+      int node = NewNode(Node::CHARS);
+      m_nodes[node].seqs.push_back(TByteSeq(1, make_pair((unsigned char)code, (unsigned char)code)));
+      return node;
+    }
+    ranges.push_back(make_pair(code, code));
+    return NewChars(ranges);
+  }
+  }
+}
+
+bool RegexMatcher::ParseBounds(int &pMin, int &pMax)
+{
+  //m_pos is at '{'. Return false, without errors, if it is not a repetition (then '{' is a literal)
+  size_t pos = m_pos + 1;
+  size_t digitsStart = pos;
+  while (pos < m_pattern.size() && isdigit((unsigned char)m_pattern[pos]))
+    pos++;
+  if (pos == digitsStart || pos >= m_pattern.size() || pos - digitsStart > 6)
+    return false;
+  pMin = atoi(m_pattern.substr(digitsStart, pos - digitsStart).c_str());
+  pMax = pMin;
+  if (m_pattern[pos] == ',') {
+    pos++;
+    digitsStart = pos;
+    while (pos < m_pattern.size() && isdigit((unsigned char)m_pattern[pos]))
+      pos++;
+    if (pos - digitsStart > 6)
+      return false;
+    pMax = (pos == digitsStart) ? -1 : atoi(m_pattern.substr(digitsStart, pos - digitsStart).c_str());
+  }
+  if (pos >= m_pattern.size() || m_pattern[pos] != '}')
+    return false;
+  m_pos = pos + 1;
+  return true;
+}
+
+int RegexMatcher::ParseQuantifiers(int pAtom)
+{
+  int nQuantifiers = 0;
+  while (m_pos < m_pattern.size()) {
+    int min, max;
+    char c = m_pattern[m_pos];
+    if (c == '*') {
+      min = 0; max = -1; m_pos++;
+    } else if (c == '+') {
+      min = 1; max = -1; m_pos++;
+    } else if (c == '?') {
+      min = 0; max = 1; m_pos++;
+    } else if (c == '{' && ParseBounds(min, max)) {
+      if (min > MAX_REPEAT || max > MAX_REPEAT) {
+	SetError("repetition count too large");
+	return -1;
+      }
+      if (max >= 0 && max < min) {
+	SetError("invalid repetition count");
+	return -1;
+      }
+    } else
+      break;
+    if (++nQuantifiers > MAX_QUANTIFIERS) {
+      SetError("too many repetitions");
+      return -1;
+    }
+    //lazy form: same result when only looking for a match
+    if (m_pos < m_pattern.size() && m_pattern[m_pos] == '?')
+      m_pos++;
+    int node = NewNode(Node::REPEAT);
+    m_nodes[node].children.push_back(pAtom);
+    m_nodes[node].min = min;
+    m_nodes[node].max = max;
+    pAtom = node;
+  }
+  return pAtom;
+}
+
+bool RegexMatcher::ParseEscape(TCharRanges &pRanges)
+{
+  if (m_pos >= m_pattern.size())
+    return SetError("trailing backslash");
+  char c = m_pattern[m_pos++];
+  TCharRanges set;
+  switch (c) {
+  case 'd':
+  case 'D':
+    set.push_back(make_pair((uint32_t)'0', (uint32_t)'9'));
+    break;
+  case 'w':
+  case 'W':
+    set.push_back(make_pair((uint32_t)'0', (uint32_t)'9'));
+    set.push_back(make_pair((uint32_t)'A', (uint32_t)'Z'));
+    set.push_back(make_pair((uint32_t)'_', (uint32_t)'_'));
+    set.push_back(make_pair((uint32_t)'a', (uint32_t)'z'));
+    break;
+  case 's':
+  case 'S':
+    set.push_back(make_pair((uint32_t)'\t', (uint32_t)'\r'));
+    set.push_back(make_pair((uint32_t)' ', (uint32_t)' '));
+    break;
+  case 't': pRanges.push_back(make_pair((uint32_t)'\t', (uint32_t)'\t')); return true;
+  case 'n': pRanges.push_back(make_pair((uint32_t)'\n', (uint32_t)'\n')); return true;
+  case 'r': pRanges.push_back(make_pair((uint32_t)'\r', (uint32_t)'\r')); return true;
+  case 'f': pRanges.push_back(make_pair((uint32_t)'\f', (uint32_t)'\f')); return true;
+  case 'v': pRanges.push_back(make_pair((uint32_t)'\v', (uint32_t)'\v')); return true;
+  case 'x': {
+    //\xHH or \x{H...}
+    uint32_t code = 0;
+    if (m_pos < m_pattern.size() && m_pattern[m_pos] == '{') {
+      size_t close = m_pattern.find('}', m_pos);
+      if (close == string::npos || close == m_pos + 1 || close > m_pos + 7)
+	return SetError("invalid \\x{...} escape");
+      for (size_t k=m_pos + 1; k < close; k++) {
+	if (HexValue(m_pattern[k]) < 0)
+	  return SetError("invalid \\x{...} escape");
+	code = (code << 4) | HexValue(m_pattern[k]);
+      }
+      m_pos = close + 1;
+    } else {
+      if (m_pos + 2 > m_pattern.size() || HexValue(m_pattern[m_pos]) < 0 || HexValue(m_pattern[m_pos + 1]) < 0)
+	return SetError("invalid \\x escape");
+      code = (HexValue(m_pattern[m_pos]) << 4) | HexValue(m_pattern[m_pos + 1]);
+      m_pos += 2;
+    }
+    if (code > MAX_CODE_POINT)
+      return SetError("invalid code point");
+    pRanges.push_back(make_pair(code, code));
+    return true;
+  }
+  default:
+    if (isalnum((unsigned char)c)) {
+      m_pos--;
+      return SetError(string("unsupported escape \\") + c);
+    }
+    //escaped literal
+    m_pos--;
+    bool rawByte;
+    uint32_t code = ParseCodePoint(rawByte);
+    pRanges.push_back(make_pair(code, code));
+    return true;
+  }
+  //character sets
+  if (isupper((unsigned char)c)) {
+    Normalize(set);
+    set = Complement(set);
+  }
+  pRanges.insert(pRanges.end(), set.begin(), set.end());
+  return true;
+}
+
+int RegexMatcher::ParseClass()
+{
+  //m_pos is after '['
+  TCharRanges ranges;
+  bool negate = false;
+  if (m_pos < m_pattern.size() && m_pattern[m_pos] == '^') {
+    negate = true;
+    m_pos++;
+  }
+  bool first = true;
+  while (true) {
+    if (m_pos >= m_pattern.size()) {
+      SetError("missing ]");
+      return -1;
+    }
+    if (m_pattern[m_pos] == ']' && not first) {
+      m_pos++;
+      break;
+    }
+    first = false;
+    // - one character (or a set from an escape)
+    uint32_t lo;
+    bool rawByte;
+    if (m_pattern[m_pos] == '\\') {
+      m_pos++;
+      TCharRanges escaped;
+      if (not ParseEscape(escaped))
+	return -1;
+      if (escaped.size() != 1 || escaped[0].first != escaped[0].second) {
+	ranges.insert(ranges.end(), escaped.begin(), escaped.end());
+	continue; //sets cannot start a range
+      }
+      lo = escaped[0].first;
+    } else
+      lo = ParseCodePoint(rawByte);
+    // - range
+    uint32_t hi = lo;
+    if (m_pos + 1 < m_pattern.size() && m_pattern[m_pos] == '-' && m_pattern[m_pos + 1] != ']') {
+      m_pos++;
+      if (m_pattern[m_pos] == '\\') {
+	m_pos++;
+	TCharRanges escaped;
+	if (not ParseEscape(escaped))
+	  return -1;
+	if (escaped.size() != 1 || escaped[0].first != escaped[0].second) {
+	  SetError("invalid range");
+	  return -1;
+	}
+	hi = escaped[0].first;
+      } else
+	hi = ParseCodePoint(rawByte);
+      if (hi < lo) {
+	SetError("invalid range");
+	return -1;
+      }
+    }
+    ranges.push_back(make_pair(lo, hi));
+  }
+  return NewChars(ranges, negate);
+}
+
+string RegexMatcher::RequiredLiteral(int pNode, bool &pExact, vector<string> &pLiterals)
+{
+  const Node &node = m_nodes[pNode];
+  pExact = false;
+  switch (node.kind) {
+  case Node::EMPTY:
+  case Node::BOL:
+  case Node::EOL:
+    pExact = true; //zero-width
+    return "";
+  case Node::CHARS: {
+    if (node.seqs.size() != 1)
+      return "";
+    string literal;
+    for (TByteSeq::const_iterator itb = node.seqs[0].begin(); itb != node.seqs[0].end(); ++itb) {
+      if (itb->first != itb->second)
+	return "";
+      literal += (char)itb->first;
+    }
+    pExact = true;
+    return literal;
+  }
+  case Node::CONCAT: {
+    //consecutive exact children form a literal, keep the longest one
+    string run, best;
+    bool allExact = true;
+    for (vector<int>::const_iterator itc = node.children.begin(); itc != node.children.end(); ++itc) {
+      bool childExact;
+      string literal = RequiredLiteral(*itc, childExact, pLiterals);
+      if (childExact) {
+	run += literal;
+	continue;
+      }
+      allExact = false;
+      if (not run.empty())
+	pLiterals.push_back(run);
+      if (run.size() > best.size())
+	best = run;
+      run.clear();
+      if (not literal.empty())
+	pLiterals.push_back(literal);
+      if (literal.size() > best.size())
+	best = literal;
+    }
+    if (not allExact && not run.empty())
+      pLiterals.push_back(run);
+    if (run.size() > best.size())
+      best = run;
+    pExact = allExact;
+    return best;
+  }
+  case Node::REPEAT: {
+    if (node.min == 0)
+      return "";
+    bool childExact;
+    string literal = RequiredLiteral(node.children[0], childExact, pLiterals);
+    if (not childExact)
+      return literal;
+    string repeated;
+    for (int k=0; k < node.min; k++)
+      repeated += literal;
+    pExact = (node.min == node.max);
+    return repeated;
+  }
+  case Node::ALT:
+    break;
+  }
+  return "";
+}
+
+// --- NFA construction
+
+int RegexMatcher::AddState(State::Type pType, int pOut, int pOut1, unsigned char pLo, unsigned char pHi)
+{
+  if (m_states.size() >= MAX_NFA_STATES) {
+    SetError("expression too large");
+    return 0;
+  }
+  State state;
+  state.type = pType;
+  state.out = pOut;
+  state.out1 = pOut1;
+  state.lo = pLo;
+  state.hi = pHi;
+  m_states.push_back(state);
+  return m_states.size() - 1;
+}
+
+void RegexMatcher::Patch(const vector<int> &pOuts, int pTarget)
+{
+  if (not m_error.empty())
+    return;
+  for (vector<int>::const_iterator ito = pOuts.begin(); ito != pOuts.end(); ++ito) {
+    if (*ito & 1)
+      m_states[*ito >> 1].out1 = pTarget;
+    else
+      m_states[*ito >> 1].out = pTarget;
+  }
+}
+
+RegexMatcher::Frag RegexMatcher::CompileSeq(const TByteSeq &pSeq)
+{
+  Frag frag;
+  frag.start = -1;
+  int previous = -1;
+  for (TByteSeq::const_iterator itb = pSeq.begin(); itb != pSeq.end(); ++itb) {
+    int state = AddState(State::BYTES, -1, -1, itb->first, itb->second);
+    if (previous < 0)
+      frag.start = state;
+    else
+      m_states[previous].out = state;
+    previous = state;
+  }
+  frag.outs.push_back(previous * 2);
+  return frag;
+}
+
+RegexMatcher::Frag RegexMatcher::CompileAlt(vector<Frag> &pFrags)
+{
+  if (pFrags.empty()) {
+    //empty set of characters: never matches
+    Frag never;
+    never.start = AddState(State::BYTES, -1, -1, 1, 0);
+    never.outs.push_back(never.start * 2);
+    return never;
+  }
+  Frag alt = pFrags.back();
+  for (int k=pFrags.size() - 2; k >= 0; k--) {
+    Frag split;
+    split.start = AddState(State::SPLIT, pFrags[k].start, alt.start);
+    split.outs = pFrags[k].outs;
+    split.outs.insert(split.outs.end(), alt.outs.begin(), alt.outs.end());
+    alt.start = split.start;
+    alt.outs.swap(split.outs);
+  }
+  return alt;
+}
+
+RegexMatcher::Frag RegexMatcher::CompileNode(int pNode)
+{
+  Frag frag;
+  frag.start = 0;
+  if (not m_error.empty())
+    return frag;
+  Node::Kind kind = m_nodes[pNode].kind;
+  switch (kind) {
+  case Node::EMPTY:
+  case Node::BOL:
+  case Node::EOL:
+    frag.start = AddState(kind == Node::EMPTY ? State::EPS : (kind == Node::BOL ? State::BOL : State::EOL));
+    frag.outs.push_back(frag.start * 2);
+    return frag;
+  case Node::CHARS: {
+    vector<Frag> alts;
+    for (size_t k=0; k < m_nodes[pNode].seqs.size(); k++)
+      alts.push_back(CompileSeq(m_nodes[pNode].seqs[k]));
+    return CompileAlt(alts);
+  }
+  case Node::ALT: {
+    vector<Frag> alts;
+    for (size_t k=0; k < m_nodes[pNode].children.size(); k++)
+      alts.push_back(CompileNode(m_nodes[pNode].children[k]));
+    return CompileAlt(alts);
+  }
+  case Node::CONCAT:
+    for (size_t k=0; k < m_nodes[pNode].children.size(); k++) {
+      Frag item = CompileNode(m_nodes[pNode].children[k]);
+      if (k == 0)
+	frag = item;
+      else {
+	Patch(frag.outs, item.start);
+	frag.outs.swap(item.outs);
+      }
+    }
+    return frag;
+  case Node::REPEAT:
+    break;
+  }
+  // --- Repetition: min copies, then either a loop or (max - min) optional copies
+  int child = m_nodes[pNode].children[0];
+  int min = m_nodes[pNode].min, max = m_nodes[pNode].max;
+  bool started = false;
+  vector<int> skips;
+  for (int k=0; (max < 0 || k < max) && m_error.empty(); k++) {
+    Frag item = CompileNode(child);
+    if (k >= min) {
+      //optional copy (or loop)
+      int split = AddState(State::SPLIT, item.start, -1);
+      skips.push_back(split * 2 + 1);
+      if (max < 0)
+	Patch(item.outs, split);
+      item.start = split;
+      if (max < 0)
+	item.outs.clear();
+    }
+    if (not started) {
+      frag = item;
+      started = true;
+    } else {
+      Patch(frag.outs, item.start);
+      frag.outs.swap(item.outs);
+    }
+    if (max < 0 && k >= min)
+      break;
+  }
+  if (not started) {
+    //{0}: matches the empty string
+    frag.start = AddState(State::EPS);
+    frag.outs.push_back(frag.start * 2);
+    return frag;
+  }
+  frag.outs.insert(frag.outs.end(), skips.begin(), skips.end());
+  return frag;
+}
+
+// --- Lazy DFA
+
+void RegexMatcher::AddClosure(int pState, bool pAtStart, bool pAtEnd, vector<int> &pSet)
+{
+  vector<int> stack(1, pState);
+  while (not stack.empty()) {
+    int s = stack.back();
+    stack.pop_back();
+    if (s < 0 || m_mark[s] == m_markGen)
+      continue;
+    m_mark[s] = m_markGen;
+    const State &state = m_states[s];
+    switch (state.type) {
+    case State::EPS:
+      stack.push_back(state.out);
+      break;
+    case State::SPLIT:
+      stack.push_back(state.out1);
+      stack.push_back(state.out);
+      break;
+    case State::BOL:
+      if (pAtStart)
+	stack.push_back(state.out);
+      break;
+    case State::EOL:
+      if (pAtEnd)
+	stack.push_back(state.out);
+      else
+	pSet.push_back(s); //pending: may match at the end of the text
+      break;
+    default:
+      pSet.push_back(s);
+    }
+  }
+}
+
+vector<int> RegexMatcher::Step(const vector<int> &pSet, unsigned char pByte)
+{
+  if (++m_markGen == 0) {
+    fill(m_mark.begin(), m_mark.end(), 0);
+    m_markGen = 1;
+  }
+  vector<int> next;
+  for (vector<int>::const_iterator its = pSet.begin(); its != pSet.end(); ++its) {
+    const State &state = m_states[*its];
+    if (state.type == State::BYTES && state.lo <= pByte && pByte <= state.hi)
+      AddClosure(state.out, false, false, next);
+  }
+  //a match can start at any position
+  AddClosure(m_start, false, false, next);
+  sort(next.begin(), next.end());
+  return next;
+}
+
+int RegexMatcher::GetDfaState(const vector<int> &pSet)
+{
+  map<vector<int>, int>::iterator itd = m_dfaIndex.find(pSet);
+  if (itd != m_dfaIndex.end())
+    return itd->second;
+  int dfaState = m_dfaSets.size();
+  m_dfaIndex[pSet] = dfaState;
+  m_dfaSets.push_back(pSet);
+  m_dfaNext.resize((dfaState + 1) * m_numClasses, -1);
+  char match = pSet.empty() ? -1 : 0; //nothing left to match
+  for (vector<int>::const_iterator its = pSet.begin(); its != pSet.end(); ++its)
+    if (m_states[*its].type == State::MATCH)
+      match = 1;
+  m_dfaMatch.push_back(match);
+  m_dfaEndMatch.push_back(-1);
+  return dfaState;
+}
+
+void RegexMatcher::ResetDfa()
+{
+  m_dfaIndex.clear();
+  m_dfaSets.clear();
+  m_dfaNext.clear();
+  m_dfaMatch.clear();
+  m_dfaEndMatch.clear();
+  if (++m_markGen == 0) {
+    fill(m_mark.begin(), m_mark.end(), 0);
+    m_markGen = 1;
+  }
+  vector<int> startSet;
+  AddClosure(m_start, true, false, startSet);
+  sort(startSet.begin(), startSet.end());
+  GetDfaState(startSet); //always state 0
+}
+
+bool RegexMatcher::EndMatch(int pDfaState)
+{
+  if (m_dfaEndMatch[pDfaState] < 0) {
+    if (++m_markGen == 0) {
+      fill(m_mark.begin(), m_mark.end(), 0);
+      m_markGen = 1;
+    }
+    vector<int> endSet;
+    const vector<int> &dfaSet = m_dfaSets[pDfaState];
+    for (vector<int>::const_iterator its = dfaSet.begin(); its != dfaSet.end(); ++its)
+      if (m_states[*its].type == State::EOL)
+	AddClosure(m_states[*its].out, false, true, endSet);
+    m_dfaEndMatch[pDfaState] = 0;
+    for (vector<int>::iterator its = endSet.begin(); its != endSet.end(); ++its)
+      if (m_states[*its].type == State::MATCH)
+	m_dfaEndMatch[pDfaState] = 1;
+  }
+  return m_dfaEndMatch[pDfaState] > 0;
+}
+
+bool RegexMatcher::Search(const string &pText)
+{
+  if (not IsValid())
+    return false;
+  //cheap pre-filter: most texts do not contain the literals
+  for (vector<string>::iterator itl = m_literals.begin(); itl != m_literals.end(); ++itl)
+    if (pText.find(*itl) == string::npos)
+      return false;
+  lock_guard<mutex> lock(m_mutex);
+  if (pText.empty()) {
+    if (++m_markGen == 0) {
+      fill(m_mark.begin(), m_mark.end(), 0);
+      m_markGen = 1;
+    }
+    vector<int> emptySet;
+    AddClosure(m_start, true, true, emptySet);
+    for (vector<int>::iterator its = emptySet.begin(); its != emptySet.end(); ++its)
+      if (m_states[*its].type == State::MATCH)
+	return true;
+    return false;
+  }
+  if (m_dfaSets.size() >= MAX_DFA_STATES)
+    ResetDfa();
+  int dfaState = 0;
+  for (size_t k=0; k < pText.size(); k++) {
+    if (m_dfaMatch[dfaState] != 0)
+      return m_dfaMatch[dfaState] > 0;
+    unsigned char byte = pText[k];
+    int transition = dfaState * m_numClasses + m_byteClass[byte];
+    int next = m_dfaNext[transition];
+    if (next < 0) {
+      vector<int> nextSet = Step(m_dfaSets[dfaState], byte);
+      if (m_dfaSets.size() >= MAX_DFA_STATES) {
+	//too many states: start again from the current one
+	ResetDfa();
+	next = GetDfaState(nextSet);
+      } else {
+	next = GetDfaState(nextSet);
+	m_dfaNext[transition] = next;
+      }
+    }
+    dfaState = next;
+  }
+  if (m_dfaMatch[dfaState] != 0)
+    return m_dfaMatch[dfaState] > 0;
+  return EndMatch(dfaState);
+}
@@ -0,0 +1,147 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: RegexMatcher.h
+ Description: Linear-time regular expression matcher, used by REGEX searches
+ Last Modified: $Id$
+*/
+
+#ifndef __REGEX_MATCHER__
+#define __REGEX_MATCHER__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+
+/** Linear-time regular expression matcher, used by REGEX searches.
+ * The expression is compiled to a Thompson NFA, which is run as a DFA built lazily while
+ * searching: each byte of the text is examined once, whatever the expression (no backtracking).
+ * The DFA states built are kept for the following searches, up to MAX_DFA_STATES.
+ *
+ * Supported syntax (UTF-8 aware, case sensitive):
+ * - literal characters, '.', classes "[a-z]" and "[^...]", escapes "\d \w \s \D \W \S \t \n \xHH"
+ * - anchors '^' and '$' (beginning and end of the field)
+ * - groups "(...)" and "(?:...)", alternatives '|'
+ * - repetitions '*', '+', '?', "{m}", "{m,}", "{m,n}" (lazy forms are accepted)
+ * - "(?i)" at the beginning of the expression: case insensitive (ASCII letters)
+ * Back-references and look-arounds are not supported.
+ *
+ * Matchers are shared through a cache (see Get()), so that repeated searches compile the
+ * expression once. Search() can be called from several threads.
+ */
+class RegexMatcher {
+ public:
+  /// Compiled expressions kept by Get()
+  static const size_t CACHE_SIZE = 16;
+  /// Maximum number of DFA states, the DFA is restarted when exceeded
+  static const size_t MAX_DFA_STATES = 2048;
+  /// Maximum number of NFA states (size of the compiled expression)
+  static const size_t MAX_NFA_STATES = 20000;
+  /// Maximum value of a repetition count
+  static const int MAX_REPEAT = 1000;
+
+  /// A sequence of byte ranges, one per byte of a UTF-8 encoded character
+  typedef std::vector<std::pair<unsigned char, unsigned char> > TByteSeq;
+  /// Code point ranges, inclusive
+  typedef std::vector<std::pair<uint32_t, uint32_t> > TCharRanges;
+
+ protected:
+  // --- Syntax tree
+  struct Node {
+    enum Kind {EMPTY, CHARS, CONCAT, ALT, REPEAT, BOL, EOL} kind;
+    std::vector<TByteSeq> seqs; ///< CHARS: alternative byte sequences
+    std::vector<int> children; ///< CONCAT, ALT, REPEAT
+    int min, max; ///< REPEAT: bounds (max < 0 if unbounded)
+  };
+  // --- NFA
+  struct State {
+    enum Type {BYTES, EPS, SPLIT, BOL, EOL, MATCH} type;
+    unsigned char lo, hi; ///< BYTES: accepted range
+    int out, out1; ///< next states (out1 for SPLIT only)
+  };
+  /// Partially built NFA: start state and dangling exits (state*2 + which out)
+  struct Frag {
+    int start;
+    std::vector<int> outs;
+  };
+
+  std::string m_pattern;
+  std::string m_error; ///< empty if the expression is valid
+  std::vector<std::string> m_literals; ///< literals every match contains
+
+  // --- Parsing
+  size_t m_pos;
+  bool m_caseless;
+  std::vector<Node> m_nodes;
+  int NewNode(Node::Kind pKind);
+  int NewChars(TCharRanges pRanges, bool pNegate=false);
+  bool SetError(const std::string &pError);
+  int ParseAlt(int pDepth);
+  int ParseConcat(int pDepth);
+  int ParseAtom(int pDepth);
+  int ParseQuantifiers(int pAtom);
+  bool ParseBounds(int &pMin, int &pMax);
+  int ParseClass();
+  /// Parse an escape (after the backslash). Return false if invalid.
+  bool ParseEscape(TCharRanges &pRanges);
+  uint32_t ParseCodePoint(bool &pRawByte);
+  /** Longest literal every match of pNode contains, pExact if pNode matches only that literal.
+   * Literals found on the way, which every match contains, are added to pLiterals.
+   */
+  std::string RequiredLiteral(int pNode, bool &pExact, std::vector<std::string> &pLiterals);
+
+  // --- NFA construction
+  std::vector<State> m_states;
+  int m_start;
+  int AddState(State::Type pType, int pOut=-1, int pOut1=-1, unsigned char pLo=0, unsigned char pHi=0);
+  void Patch(const std::vector<int> &pOuts, int pTarget);
+  Frag CompileNode(int pNode);
+  Frag CompileSeq(const TByteSeq &pSeq);
+  Frag CompileAlt(std::vector<Frag> &pFrags);
+
+  // --- Lazy DFA
+  unsigned char m_byteClass[256]; ///< bytes which behave the same share a class
+  int m_numClasses;
+  std::map<std::vector<int>, int> m_dfaIndex; ///< NFA states -> DFA state
+  std::vector<std::vector<int> > m_dfaSets; ///< DFA state -> NFA states
+  std::vector<int> m_dfaNext; ///< transitions (state * m_numClasses + class), -1 if not built yet
+  std::vector<char> m_dfaMatch; ///< 1 if the state matches, -1 if no match is possible any more
+  std::vector<char> m_dfaEndMatch; ///< matches at the end of the text (-1 unknown)
+  std::vector<unsigned> m_mark; ///< visited NFA states (generation m_markGen)
+  unsigned m_markGen;
+  std::mutex m_mutex;
+  void AddClosure(int pState, bool pAtStart, bool pAtEnd, std::vector<int> &pSet);
+  std::vector<int> Step(const std::vector<int> &pSet, unsigned char pByte);
+  int GetDfaState(const std::vector<int> &pSet);
+  void ResetDfa();
+  bool EndMatch(int pDfaState);
+
+  // --- Cache of compiled expressions
+  static std::mutex s_cacheMutex;
+  static std::list<std::shared_ptr<RegexMatcher> > s_cache;
+
+ public:
+  /// Compile pPattern, check IsValid() before use
+  RegexMatcher(const std::string &pPattern);
+  ~RegexMatcher();
+
+  /// Compiled pPattern, from the cache if it was used recently
+  static std::shared_ptr<RegexMatcher> Get(const std::string &pPattern);
+
+  bool IsValid() const; ///< the expression compiled successfully
+  const std::string &GetError() const; ///< reason why the expression is not valid
+  const std::string &GetPattern() const; ///< the expression
+  /// Literals contained in every match (longest first), to pre-filter texts
+  const std::vector<std::string> &GetRequiredLiterals() const;
+
+  /// True if pText contains a match of the expression
+  bool Search(const std::string &pText);
+};
+
+#endif
@@ -0,0 +1,275 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: RoaringBitmap.cc
+ Description: Compressed bitmap of 32-bit integers, used to index records by label
+ Last Modified: $Id$
+*/
+
+#include "RoaringBitmap.h"
+
+#include <algorithm>
+#include <iterator>
+
+using namespace std;
+
+RoaringBitmap::RoaringBitmap()
+{
+
+}
+
+RoaringBitmap::~RoaringBitmap()
+{
+
+}
+
+size_t RoaringBitmap::LowerBound(uint16_t pKey) const
+{
+  size_t lo = 0, hi = m_containers.size();
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (m_containers[mid].key < pKey)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+void RoaringBitmap::ToBitset(Container &pContainer)
+{
+  if (not pContainer.bits.empty())
+    return;
+  pContainer.bits.assign(BITSET_WORDS, 0);
+  for (vector<uint16_t>::iterator itv = pContainer.values.begin(); itv != pContainer.values.end(); ++itv)
+    pContainer.bits[*itv >> 6] |= (uint64_t)1 << (*itv & 63);
+  vector<uint16_t>().swap(pContainer.values);
+}
+
+void RoaringBitmap::Normalize(Container &pContainer)
+{
+  if (pContainer.bits.empty()) {
+    if (pContainer.count > ARRAY_MAX_SIZE)
+      ToBitset(pContainer);
+    return;
+  }
+  if (pContainer.count > ARRAY_MAX_SIZE)
+    return;
+  //few values left: back to an array
+  pContainer.values.clear();
+  pContainer.values.reserve(pContainer.count);
+  for (size_t w=0; w < BITSET_WORDS; w++)
+    for (uint64_t word = pContainer.bits[w]; word != 0; word &= word - 1)
+      pContainer.values.push_back((uint16_t)(w * 64 + __builtin_ctzll(word)));
+  vector<uint64_t>().swap(pContainer.bits);
+}
+
+RoaringBitmap::Container RoaringBitmap::Combine(const Container &pA, const Container &pB, Operation pOp)
+{
+  Container result;
+  result.key = pA.key;
+  if (pA.bits.empty() && pB.bits.empty()) {
+    //two arrays: merge them
+    back_insert_iterator<vector<uint16_t> > out(result.values);
+    if (pOp == OP_AND)
+      set_intersection(pA.values.begin(), pA.values.end(), pB.values.begin(), pB.values.end(), out);
+    else if (pOp == OP_OR)
+      set_union(pA.values.begin(), pA.values.end(), pB.values.begin(), pB.values.end(), out);
+    else
+      set_difference(pA.values.begin(), pA.values.end(), pB.values.begin(), pB.values.end(), out);
+    result.count = result.values.size();
+  } else if ((pOp == OP_AND && (pA.bits.empty() || pB.bits.empty())) || (pOp == OP_AND_NOT && pA.bits.empty())) {
+    //array and bitset: the result is a subset of the array, filter it
+    bool aIsArray = pA.bits.empty();
+    const Container &array = aIsArray ? pA : pB, &bitset = aIsArray ? pB : pA;
+    bool keepIfSet = (pOp == OP_AND);
+    for (vector<uint16_t>::const_iterator itv = array.values.begin(); itv != array.values.end(); ++itv) {
+      bool isSet = (bitset.bits[*itv >> 6] >> (*itv & 63)) & 1;
+      if (isSet == keepIfSet)
+	result.values.push_back(*itv);
+    }
+    result.count = result.values.size();
+  } else {
+    //at least one bitset: combine word by word
+    Container a(pA), b(pB);
+    ToBitset(a);
+    ToBitset(b);
+    result.bits.resize(BITSET_WORDS);
+    result.count = 0;
+    for (size_t w=0; w < BITSET_WORDS; w++) {
+      if (pOp == OP_AND)
+	result.bits[w] = a.bits[w] & b.bits[w];
+      else if (pOp == OP_OR)
+	result.bits[w] = a.bits[w] | b.bits[w];
+      else
+	result.bits[w] = a.bits[w] & ~b.bits[w];
+      result.count += __builtin_popcountll(result.bits[w]);
+    }
+  }
+  Normalize(result);
+  return result;
+}
+
+void RoaringBitmap::Apply(const RoaringBitmap &pOther, Operation pOp)
+{
+  vector<Container> result;
+  vector<Container>::const_iterator ita = m_containers.begin(), itb = pOther.m_containers.begin();
+  while (ita != m_containers.end() || itb != pOther.m_containers.end()) {
+    if (itb == pOther.m_containers.end() || (ita != m_containers.end() && ita->key < itb->key)) {
+      //only in this bitmap
+      if (pOp != OP_AND)
+	result.push_back(*ita);
+      ++ita;
+    } else if (ita == m_containers.end() || itb->key < ita->key) {
+      //only in the other one
+      if (pOp == OP_OR)
+	result.push_back(*itb);
+      ++itb;
+    } else {
+      Container combined = Combine(*ita, *itb, pOp);
+      if (combined.count > 0)
+	result.push_back(combined);
+      ++ita;
+      ++itb;
+    }
+  }
+  m_containers.swap(result);
+}
+
+RoaringBitmap RoaringBitmap::Range(uint32_t pSize)
+{
+  RoaringBitmap range;
+  for (uint64_t begin = 0; begin < pSize; begin += 65536) {
+    Container container;
+    container.key = (uint16_t)(begin >> 16);
+    container.count = (uint32_t)min<uint64_t>(65536, pSize - begin);
+    container.bits.assign(BITSET_WORDS, 0);
+    for (size_t w=0; w < container.count / 64; w++)
+      container.bits[w] = ~(uint64_t)0;
+    if (container.count % 64)
+      container.bits[container.count / 64] = ((uint64_t)1 << (container.count % 64)) - 1;
+    Normalize(container);
+    range.m_containers.push_back(container);
+  }
+  return range;
+}
+
+void RoaringBitmap::Add(uint32_t pValue)
+{
+  uint16_t key = pValue >> 16, low = pValue & 0xFFFF;
+  size_t pos = LowerBound(key);
+  if (pos == m_containers.size() || m_containers[pos].key != key) {
+    Container container;
+    container.key = key;
+    container.count = 0;
+    m_containers.insert(m_containers.begin() + pos, container);
+  }
+  Container &container = m_containers[pos];
+  if (container.bits.empty()) {
+    vector<uint16_t>::iterator itv = lower_bound(container.values.begin(), container.values.end(), low);
+    if (itv != container.values.end() && *itv == low)
+      return;
+    container.values.insert(itv, low);
+    container.count++;
+    Normalize(container);
+  } else {
+    uint64_t mask = (uint64_t)1 << (low & 63);
+    if (container.bits[low >> 6] & mask)
+      return;
+    container.bits[low >> 6] |= mask;
+    container.count++;
+  }
+}
+
+void RoaringBitmap::Remove(uint32_t pValue)
+{
+  uint16_t key = pValue >> 16, low = pValue & 0xFFFF;
+  size_t pos = LowerBound(key);
+  if (pos == m_containers.size() || m_containers[pos].key != key)
+    return;
+  Container &container = m_containers[pos];
+  if (container.bits.empty()) {
+    vector<uint16_t>::iterator itv = lower_bound(container.values.begin(), container.values.end(), low);
+    if (itv == container.values.end() || *itv != low)
+      return;
+    container.values.erase(itv);
+  } else {
+    uint64_t mask = (uint64_t)1 << (low & 63);
+    if (not (container.bits[low >> 6] & mask))
+      return;
+    container.bits[low >> 6] &= ~mask;
+  }
+  container.count--;
+  if (container.count == 0)
+    m_containers.erase(m_containers.begin() + pos);
+  else
+    Normalize(container);
+}
+
+bool RoaringBitmap::Contains(uint32_t pValue) const
+{
+  uint16_t key = pValue >> 16, low = pValue & 0xFFFF;
+  size_t pos = LowerBound(key);
+  if (pos == m_containers.size() || m_containers[pos].key != key)
+    return false;
+  const Container &container = m_containers[pos];
+  if (container.bits.empty())
+    return binary_search(container.values.begin(), container.values.end(), low);
+  return (container.bits[low >> 6] >> (low & 63)) & 1;
+}
+
+size_t RoaringBitmap::Cardinality() const
+{
+  size_t count = 0;
+  for (vector<Container>::const_iterator itc = m_containers.begin(); itc != m_containers.end(); ++itc)
+    count += itc->count;
+  return count;
+}
+
+bool RoaringBitmap::IsEmpty() const
+{
+  return m_containers.empty();
+}
+
+void RoaringBitmap::Clear()
+{
+  m_containers.clear();
+}
+
+RoaringBitmap &RoaringBitmap::And(const RoaringBitmap &pOther)
+{
+  Apply(pOther, OP_AND);
+  return *this;
+}
+
+RoaringBitmap &RoaringBitmap::Or(const RoaringBitmap &pOther)
+{
+  Apply(pOther, OP_OR);
+  return *this;
+}
+
+RoaringBitmap &RoaringBitmap::AndNot(const RoaringBitmap &pOther)
+{
+  Apply(pOther, OP_AND_NOT);
+  return *this;
+}
+
+vector<uint32_t> RoaringBitmap::ToVector() const
+{
+  vector<uint32_t> values;
+  values.reserve(Cardinality());
+  for (vector<Container>::const_iterator itc = m_containers.begin(); itc != m_containers.end(); ++itc) {
+    uint32_t high = (uint32_t)itc->key << 16;
+    if (itc->bits.empty()) {
+      for (vector<uint16_t>::const_iterator itv = itc->values.begin(); itv != itc->values.end(); ++itv)
+	values.push_back(high | *itv);
+    } else {
+      for (size_t w=0; w < BITSET_WORDS; w++)
+	for (uint64_t word = itc->bits[w]; word != 0; word &= word - 1)
+	  values.push_back(high | (uint32_t)(w * 64 + __builtin_ctzll(word)));
+    }
+  }
+  return values;
+}
@@ -0,0 +1,77 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: RoaringBitmap.h
+ Description: Compressed bitmap of 32-bit integers, used to index records by label
+ Last Modified: $Id$
+*/
+
+#ifndef __ROARING_BITMAP__
+#define __ROARING_BITMAP__
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Compressed bitmap of 32-bit integers (roaring bitmap), used to index records by label.
+ * Values are split by their 16 high bits in containers. A container keeps its 16 low bits
+ * as a sorted array while it has at most ARRAY_MAX_SIZE values, as a 65536-bit bitset otherwise.
+ * Sparse sets (labels used by a few records) are then small, dense ones are plain bitsets,
+ * and both are combined efficiently (see And(), Or(), AndNot()).
+ */
+class RoaringBitmap {
+ public:
+  /// Maximum number of values of a container stored as an array
+  static const size_t ARRAY_MAX_SIZE = 4096;
+  /// Number of 64-bit words of a bitset container
+  static const size_t BITSET_WORDS = 1024;
+
+ protected:
+  /// Values sharing the same 16 high bits
+  struct Container {
+    uint16_t key; ///< high bits
+    uint32_t count; ///< number of values
+    std::vector<uint16_t> values; ///< sorted low bits (array container)
+    std::vector<uint64_t> bits; ///< BITSET_WORDS words (bitset container), empty for array containers
+  };
+  enum Operation {OP_AND, OP_OR, OP_AND_NOT};
+
+  /// Containers, sorted by key
+  std::vector<Container> m_containers;
+
+  /// Position of the container with pKey, or of the first one after it
+  size_t LowerBound(uint16_t pKey) const;
+  /// Convert an array container to a bitset one
+  static void ToBitset(Container &pContainer);
+  /// Use the smallest representation for the values of pContainer
+  static void Normalize(Container &pContainer);
+  /// Combine two containers with the same key
+  static Container Combine(const Container &pA, const Container &pB, Operation pOp);
+  /// Combine with pOther, the result replaces this bitmap
+  void Apply(const RoaringBitmap &pOther, Operation pOp);
+
+ public:
+  RoaringBitmap();
+  ~RoaringBitmap();
+
+  /// Bitmap with all values in [0, pSize)
+  static RoaringBitmap Range(uint32_t pSize);
+
+  void Add(uint32_t pValue); ///< add a value (nothing if present)
+  void Remove(uint32_t pValue); ///< remove a value (nothing if absent)
+  bool Contains(uint32_t pValue) const; ///< true if pValue is in the bitmap
+  size_t Cardinality() const; ///< number of values
+  bool IsEmpty() const; ///< true if there are no values
+  void Clear(); ///< remove all values
+
+  RoaringBitmap &And(const RoaringBitmap &pOther); ///< keep values also in pOther
+  RoaringBitmap &Or(const RoaringBitmap &pOther); ///< add values of pOther
+  RoaringBitmap &AndNot(const RoaringBitmap &pOther); ///< remove values of pOther
+
+  /// Values, in increasing order
+  std::vector<uint32_t> ToVector() const;
+};
+
+#endif
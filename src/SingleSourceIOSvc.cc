@@ -11,14 +11,18 @@
 #include <string>
 // whao.. we need to include it before GnuPGSecurityTool.h or weird compiler errors occur.. I don't know why (maybe gpgme?!)
 #include <algorithm> 
+#include <sstream>
 
 #include "SingleSourceIOSvc.h"
 
 //Specific tools used
 #include "LocalFileStorageTool.h"
 #include "FormatterPlainTextTool.h"
+#include "FormatterTieredTool.h"
 #include "GnuPGSecurityTool.h"
 #include "IConfigurationService.h"
+#include "MiscUtils.h"
+#include "BreachCheckTool.h"
 
 using namespace std;
 
@@ -26,30 +30,95 @@ using namespace std;
 extern ILog *log;
 extern IConfigurationService *cfgMgr;
 
-SingleSourceIOSvc::SingleSourceIOSvc(string pName) : IIOService(pName)
+namespace {
+  /// UUID (RFC 4122) of version pVersion as text, from 16 bytes
+  string FormatUUID(unsigned char *pBytes, unsigned char pVersion)
+  {
+    static const char digits[] = "0123456789abcdef";
+    pBytes[6] = (pBytes[6] & 0x0F) | (pVersion << 4);
+    pBytes[8] = (pBytes[8] & 0x3F) | 0x80; //RFC 4122 variant
+    string uuid;
+    for (size_t k=0; k < 16; k++) {
+      if (k == 4 || k == 6 || k == 8 || k == 10)
+	uuid += '-';
+      uuid += digits[pBytes[k] >> 4];
+      uuid += digits[pBytes[k] & 0xF];
+    }
+    return uuid;
+  }
+
+  /// Random UUID (RFC 4122 version 4) as text, from pPool
+  string NewUUID(PasswordGeneratorTool::EntropyPool &pPool)
+  {
+    unsigned char bytes[16];
+    for (size_t k=0; k < sizeof(bytes); k++)
+      bytes[k] = pPool.Uniform(256);
+    return FormatUUID(bytes, 4);
+  }
+
+  /** UUID of a record read without one, from its source and position (RFC 4122 version 5, URL namespace).
+   * The record gets the same UUID each time the source is loaded (e.g. after being evicted),
+   * until the source is written with it.
+   */
+  string LegacyUUID(const string &pSource, size_t pPosition)
+  {
+    static const unsigned char urlNamespace[16] = {0x6b, 0xa7, 0xb8, 0x11, 0x9d, 0xad, 0x11, 0xd1,
+						   0x80, 0xb4, 0x00, 0xc0, 0x4f, 0xd4, 0x30, 0xc8};
+    ostringstream name;
+    name << pSource << "#" << (unsigned long)pPosition;
+    string digest = BreachCheckTool::Sha1(string(reinterpret_cast<const char*>(urlNamespace), sizeof(urlNamespace)) + name.str());
+    unsigned char bytes[16];
+    for (size_t k=0; k < sizeof(bytes); k++)
+      bytes[k] = digest[k];
+    return FormatUUID(bytes, 5);
+  }
+}
+
+SingleSourceIOSvc::SingleSourceIOSvc(string pName) : IIOService(pName), m_queryTool("QuerySearchTool")
 {
   m_encrypt = false;
   m_zip = false;
+  m_tiered = false;
+  m_searchIndexComplete = true;
   SetOwner("SingleSourceMgrSvc");
   m_storageTool = 0;
   m_formatterTool = 0;
   m_securityTool = 0;
+  m_loading = false;
+  m_loaded = false;
+  m_dataSize = 0;
+  m_inTransaction = false;
+  m_transactionChanged = false;
+  m_writeBehind = false;
+  m_writeBehindDelay = 1000;
+  m_hasPending = false;
+  m_writing = false;
+  m_writeNow = false;
+  m_stopWriter = false;
+  m_writeStatus = SC_OK;
+  m_snapshotVersion = 0;
+  m_epoch = make_shared<RecordSnapshot::Epoch>();
+  Publish();
 }
 
 SingleSourceIOSvc::~SingleSourceIOSvc()
 {
   // free all records
   *log << ILog::INFO << "Freeing memory for source " << m_source.GetURI() << this << ILog::endmsg;
+  //changes written in background must not be lost
+  StopWriter();
+  //records are deleted once the snapshots still in use are released
   for (vector<ARecord*>::iterator itr = m_data.begin(); itr != m_data.end(); ++itr)
-    delete *itr;
+    Retire(*itr);
+  atomic_store(&m_snapshot, RecordSnapshot::Ptr());
+  m_epoch.reset();
   if (m_storageTool)
     delete m_storageTool;
   if (m_formatterTool)
     delete m_formatterTool;
   if (m_securityTool)
     delete m_securityTool;
-  if (m_idManagerTool)
-    delete m_idManagerTool;
+  //m_idManagerTool is shared with the other sources, or freed by IIOService if local
 }
 
 IErrorHandler::StatusCode SingleSourceIOSvc::LoadTools()
@@ -100,10 +169,17 @@ IErrorHandler::StatusCode SingleSourceIOSvc::LoadTools()
       m_formatterTool = new FormatterPlainTextTool("FormatterPlainTextTool", format); //plain text
       m_encrypt = true;
       m_zip = false;
+      m_tiered = false;
+    } else if (format == "cti") { //Cripted-Text Index, records encrypted apart
+      m_formatterTool = new FormatterTieredTool("FormatterTieredTool", format);
+      m_encrypt = true;
+      m_zip = false;
+      m_tiered = true;
     } else if (format == "t") { //plain Text
       m_formatterTool = new FormatterPlainTextTool("FormatterPlainTextTool", format); //plain text
       m_encrypt = false;
       m_zip = false;
+      m_tiered = false;
       log->say(ILog::WARNING, string("Using a non-encrypted data source: ") + m_source.GetURI(), this);
     } else {
       *log << ILog::ERROR << "Unknown source format: " << format << this << ILog::endmsg;
@@ -130,9 +206,19 @@ IErrorHandler::StatusCode SingleSourceIOSvc::LoadTools()
 }
 
 IErrorHandler::StatusCode SingleSourceIOSvc::Load()
+{
+  vector<ARecord *> recordsToAdd;
+  StatusCode sc = ReadRecords(recordsToAdd);
+  if (sc != SC_OK)
+    return sc;
+  return AddLoaded(recordsToAdd);
+}
+
+IErrorHandler::StatusCode SingleSourceIOSvc::ReadRecords(vector<ARecord*> &pRecords)
 {
   StatusCode sc = SC_OK;
   *log << ILog::INFO << "Loading data from source: " << m_source.GetURI() << this << ILog::endmsg;
+  Flush(); //the tools must not be in use in background
   // --- Load tools
   sc = LoadTools();
   if (sc != SC_OK) {
@@ -161,7 +247,7 @@ IErrorHandler::StatusCode SingleSourceIOSvc::Load()
   // -- If data is encrypted, now decrypt
   if (m_encrypt) {
     string plainText;
-    if (m_securityTool->Decrypt(bufStr, plainText) >= SC_ERROR) {
+    if (DecryptData(bufStr, plainText) >= SC_ERROR) {
       // abort only if SC_ERROR, with OK or WARNING go on..
       *log << ILog::ERROR << "Error decrypting source: " 
 	   << m_storageTool->GetErrorMsg() << this << ILog::endmsg;
@@ -178,8 +264,13 @@ IErrorHandler::StatusCode SingleSourceIOSvc::Load()
   if (m_zip)
     return SC_NOT_IMPLEMENTED;
   // -- Decode data into transient vector
-  vector<ARecord *> recordsToAdd;
-  scLocal = m_formatterTool->Decode(bufStr, recordsToAdd, cfgMgr->GetBruteForce());
+  m_dataSize = bufStr.size();
+  {
+    //sources can be read concurrently: records are sealed by AddLoaded(), in the thread owning them
+    ARecord::SealingDeferral deferral;
+    scLocal = m_formatterTool->Decode(bufStr, pRecords, cfgMgr->GetBruteForce());
+  }
+  ISecurityTool::ClearString(bufStr);
   if (scLocal == SC_WARNING) {
     log->say(ILog::WARNING, string("Warning in decoding source ") + m_source.GetURI() + 
 	     string(": ") + m_formatterTool->GetErrorMsg());
@@ -188,15 +279,74 @@ IErrorHandler::StatusCode SingleSourceIOSvc::Load()
 	     string(": ") + m_formatterTool->GetErrorMsg());
     return sc = scLocal;
   }  
-  // -- Add new records to the list
-  for (vector<ARecord *>::iterator itRec = recordsToAdd.begin(); itRec != recordsToAdd.end(); ++itRec) {
+  return m_statusCode = sc;
+}
+
+IErrorHandler::StatusCode SingleSourceIOSvc::AddLoaded(vector<ARecord*> &pRecords)
+{
+  StatusCode scLocal = SC_OK;
+  // -- Add new records to the list, sort the views once at the end
+  m_loading = true;
+  for (vector<ARecord *>::iterator itRec = pRecords.begin(); itRec != pRecords.end(); ++itRec) {
+    if (ARecord::GetSealer())
+      (*itRec)->SealFields(); //decoded without sealing them (see ReadRecords())
+    if ((*itRec)->GetUUID().empty())
+      (*itRec)->SetUUID(LegacyUUID(m_source.GetURI(), itRec - pRecords.begin())); //format without UUIDs
     scLocal = Add(*itRec, false); //no flush on disk, we're loading :)
     if (scLocal != SC_OK)
-      return m_statusCode = scLocal;
+      break;
   }
-  ISecurityTool::ClearString(bufStr);
+  m_loading = false;
+  m_loaded = true;
+  std::sort(m_byName.begin(), m_byName.end(), sortByName);
+  std::sort(m_byDate.begin(), m_byDate.end(), sortByDate);
+  Publish();
+  if (scLocal != SC_OK)
+    return m_statusCode = scLocal;
   *log << ILog::DEBUG << "Finished loading from source: " << m_source.str() << this << ILog::endmsg;
-  return m_statusCode = sc;
+  return m_statusCode = SC_OK;
+}
+
+IErrorHandler::StatusCode SingleSourceIOSvc::Unload()
+{
+  if (m_inTransaction) {
+    *log << ILog::ERROR << "Cannot unload source during a transaction: " << m_source.GetURI() << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  //changes written in background must not be lost
+  if (Flush() >= SC_ERROR) {
+    *log << ILog::ERROR << "Changes not written yet, keeping source: " << m_source.GetURI() << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  *log << ILog::INFO << "Unloading " << (unsigned long)m_data.size() << " records of source: " << m_source.GetURI() << this << ILog::endmsg;
+  //records are deleted once the snapshots still in use are released
+  for (vector<ARecord*>::iterator itr = m_data.begin(); itr != m_data.end(); ++itr) {
+    if (m_idManagerTool)
+      m_idManagerTool->FreeId((*itr)->GetAccountId());
+    Retire(*itr);
+  }
+  m_data.clear();
+  m_idIndex.clear();
+  m_uuidIndex.clear();
+  m_searchIndex.Clear();
+  m_searchIndexComplete = true;
+  m_labelIndex.Clear();
+  m_byName.clear();
+  m_byDate.clear();
+  m_loaded = false;
+  m_dataSize = 0;
+  Publish();
+  return m_statusCode = SC_OK;
+}
+
+bool SingleSourceIOSvc::IsLoaded()
+{
+  return m_loaded;
+}
+
+size_t SingleSourceIOSvc::GetDataSize()
+{
+  return m_dataSize;
 }
 
 IErrorHandler::StatusCode SingleSourceIOSvc::SourceExists()
@@ -204,6 +354,7 @@ IErrorHandler::StatusCode SingleSourceIOSvc::SourceExists()
   //only check if source exists, don't try to read or decrypt
   StatusCode sc = SC_ERROR;
   *log << ILog::INFO << "Testing source: " << m_source.GetURI() << this << ILog::endmsg;
+  Flush(); //the tools must not be in use in background
   // --- Load tools
   sc = LoadTools();
   if (sc != SC_OK) {
@@ -225,8 +376,27 @@ IErrorHandler::StatusCode SingleSourceIOSvc::Store()
 {
   StatusCode sc = SC_OK;
   m_statusCode = sc;
+  if (m_inTransaction) {
+    //written once by Commit()
+    m_transactionChanged = true;
+    return m_statusCode;
+  }
   *log << ILog::INFO << "Storing data to source: " << m_source.GetFullURI() << this << ILog::endmsg;
-  // --- Load tools
+  // --- Records may have been edited in place: keep the search text and indexes up-to-date
+  for (vector<ARecord*>::iterator itr = m_data.begin(); itr != m_data.end(); ++itr) {
+    (*itr)->UpdateSearchText();
+    if (m_searchIndexComplete)
+      m_searchIndex.Update((*itr)->GetAccountId(), *itr);
+    m_labelIndex.Set(itr - m_data.begin(), *itr);
+  }
+  ResortView(m_byName, sortByName);
+  ResortView(m_byDate, sortByDate);
+  //readers see the changes now, without waiting for them to be written
+  Publish();
+  // --- Load tools, not while the background writer uses them
+  unique_lock<mutex> writeLock(m_writeMutex);
+  while (m_writing)
+    m_writeCondition.wait(writeLock);
   LoadTools();
   if (m_statusCode != SC_OK) {
     log->say(ILog::ERROR, "Error loading tools.", this);
@@ -236,62 +406,367 @@ IErrorHandler::StatusCode SingleSourceIOSvc::Store()
   // -- First code the information
   string bufStr;
   sc = m_formatterTool->Code(m_data, bufStr);
+  m_dataSize = bufStr.size();
   if (sc == SC_WARNING) {
     log->say(ILog::WARNING, string("Warning in coding source ") + m_source.GetURI() + 
 	     string(": ") + m_formatterTool->GetErrorMsg());
     m_statusCode = sc;
     m_errorMsg = "See above.";
-  } else if (m_statusCode >= SC_ERROR) {
+  } else if (sc >= SC_ERROR) {
     log->say(ILog::ERROR, string("Error while coding source ") + m_source.GetURI() + 
 	     string(": ") + m_formatterTool->GetErrorMsg());
     m_errorMsg = "See above.";
+    ISecurityTool::ClearString(bufStr);
     return m_statusCode = sc;
   }  
   // -- If zip/cryptation is requested, apply
   if (m_zip)
     return SC_NOT_IMPLEMENTED;
+  if (m_writeBehind) {
+    //replace what was not written yet, the background writer does the rest
+    ISecurityTool::ClearString(m_pendingData);
+    ISecurityTool::ClearString(m_failedData);
+    m_pendingData.swap(bufStr);
+    m_hasPending = true;
+    m_lastChange = chrono::steady_clock::now();
+    m_writeCondition.notify_all();
+    return m_statusCode;
+  }
+  writeLock.unlock();
+  string error;
+  sc = WriteData(bufStr, error);
+  ISecurityTool::ClearString(bufStr);
+  if (sc != SC_OK) {
+    m_errorMsg = "See above.";
+    m_statusCode = sc;
+  }
+  return m_statusCode;
+}
+
+IErrorHandler::StatusCode SingleSourceIOSvc::WriteData(string &pData, string &pError)
+{
+  pError.clear();
+  string chiperText;
   if (m_encrypt) {
-    string chiperText;
-    if (m_securityTool->Encrypt(bufStr, chiperText) >= SC_ERROR) {
+    if (EncryptData(pData, chiperText) >= SC_ERROR) {
       // abort only if SC_ERROR, with OK or WARNING go on..
-      *log << ILog::ERROR << "Error encrypting source: " 
-	   << m_storageTool->GetErrorMsg() << this << ILog::endmsg;
-      return m_statusCode = SC_ERROR;
+      pError = string("Error encrypting source ") + m_source.GetURI() + string(": ") + m_securityTool->GetErrorMsg();
+      log->say(ILog::ERROR, pError);
+      return SC_ERROR;
     }
-    bufStr.clear();
-    bufStr = chiperText;
   }
-  sc = m_storageTool->Store(bufStr);
+  StatusCode sc = m_storageTool->Store(m_encrypt ? chiperText : pData);
+  chiperText.clear();
   if (sc == SC_WARNING) {
-    log->say(ILog::WARNING, string("Warning while writing to source ") + m_source.GetURI() + 
-	     string(": ") + m_storageTool->GetErrorMsg());
-    m_errorMsg = "See above.";
-    m_statusCode = sc;
+    pError = string("Warning while writing to source ") + m_source.GetURI() + string(": ") + m_storageTool->GetErrorMsg();
+    log->say(ILog::WARNING, pError);
   } else if (sc >= SC_ERROR) {
-    log->say(ILog::ERROR, string("Error while writing to source ") + m_source.GetURI() + 
-	     string(": ") + m_storageTool->GetErrorMsg());
-    m_errorMsg = "See above.";
-    m_statusCode = sc;
-    return m_statusCode;
+    pError = string("Error while writing to source ") + m_source.GetURI() + string(": ") + m_storageTool->GetErrorMsg();
+    log->say(ILog::ERROR, pError);
   }
+  return sc;
+}
 
+IErrorHandler::StatusCode SingleSourceIOSvc::EncryptData(const string &pPlain, string &pCipher)
+{
+  if (not m_tiered)
+    return m_securityTool->Encrypt(pPlain, pCipher);
+  //records are already encrypted on their own, only the index needs it
+  string header, index, payloads, cipherIndex;
+  if (not FormatterTieredTool::SplitIndex(pPlain, header, index, payloads))
+    return SC_ERROR;
+  StatusCode sc = m_securityTool->Encrypt(index, cipherIndex);
+  ISecurityTool::ClearString(index);
+  if (sc < SC_ERROR)
+    pCipher = FormatterTieredTool::JoinIndex(header, cipherIndex, payloads);
+  return sc;
+}
+
+IErrorHandler::StatusCode SingleSourceIOSvc::DecryptData(const string &pCipher, string &pPlain)
+{
+  if (not m_tiered)
+    return m_securityTool->Decrypt(pCipher, pPlain);
+  string header, cipherIndex, payloads, index;
+  if (not FormatterTieredTool::SplitIndex(pCipher, header, cipherIndex, payloads))
+    return SC_ERROR;
+  StatusCode sc = m_securityTool->Decrypt(cipherIndex, index);
+  if (sc < SC_ERROR)
+    pPlain = FormatterTieredTool::JoinIndex(header, index, payloads);
+  ISecurityTool::ClearString(index);
+  return sc;
+}
+
+void SingleSourceIOSvc::WriteBehindLoop()
+{
+  unique_lock<mutex> lock(m_writeMutex);
+  while (true) {
+    if (not m_hasPending) {
+      if (m_stopWriter)
+	break;
+      m_writeCondition.wait(lock);
+      continue;
+    }
+    //wait for changes to settle: successive changes are written once
+    chrono::steady_clock::time_point due = m_lastChange + chrono::milliseconds(m_writeBehindDelay);
+    if (not m_writeNow && not m_stopWriter && chrono::steady_clock::now() < due) {
+      m_writeCondition.wait_until(lock, due);
+      continue;
+    }
+    string data;
+    data.swap(m_pendingData);
+    m_hasPending = false;
+    m_writeNow = false;
+    m_writing = true;
+    lock.unlock();
+    string error;
+    StatusCode sc = WriteData(data, error);
+    lock.lock();
+    m_writing = false;
+    m_writeStatus = sc;
+    m_writeError = error;
+    //keep failed data, unless newer data replaces it
+    if (sc >= SC_ERROR && not m_hasPending)
+      m_failedData.swap(data);
+    ISecurityTool::ClearString(data);
+    m_writeCondition.notify_all();
+  }
+}
+
+void SingleSourceIOSvc::StopWriter()
+{
+  if (not m_writer.joinable())
+    return;
+  if (Flush() >= SC_ERROR)
+    *log << ILog::ERROR << "Changes could not be written to source: " << m_source.GetURI() << this << ILog::endmsg;
+  {
+    lock_guard<mutex> lock(m_writeMutex);
+    m_stopWriter = true;
+    m_writeCondition.notify_all();
+  }
+  m_writer.join();
+  m_writeBehind = false;
+  ISecurityTool::ClearString(m_failedData);
+}
+
+void SingleSourceIOSvc::SetWriteBehind(bool pEnable, unsigned int pDelay)
+{
+  if (not pEnable) {
+    StopWriter();
+    return;
+  }
+  {
+    lock_guard<mutex> lock(m_writeMutex);
+    m_writeBehindDelay = pDelay;
+    m_writeBehind = true;
+    m_stopWriter = false;
+  }
+  if (not m_writer.joinable())
+    m_writer = thread(&SingleSourceIOSvc::WriteBehindLoop, this);
+}
+
+IErrorHandler::StatusCode SingleSourceIOSvc::Flush()
+{
+  unique_lock<mutex> lock(m_writeMutex);
+  if (not m_writer.joinable())
+    return m_writeStatus; //nothing written in background
+  //try again what failed
+  if (not m_hasPending && not m_writing && not m_failedData.empty()) {
+    m_pendingData.swap(m_failedData);
+    m_hasPending = true;
+  }
+  m_writeNow = true;
+  m_writeCondition.notify_all();
+  while (m_hasPending || m_writing)
+    m_writeCondition.wait(lock);
+  return m_writeStatus;
+}
+
+IIOService::WriteState SingleSourceIOSvc::GetWriteState(string &pMsg)
+{
+  lock_guard<mutex> lock(m_writeMutex);
+  pMsg.clear();
+  if (m_hasPending || m_writing)
+    return WRITE_PENDING;
+  if (m_writeStatus >= SC_ERROR) {
+    pMsg = m_writeError;
+    return WRITE_FAILED;
+  }
+  return WRITE_DONE;
+}
+
+IErrorHandler::StatusCode SingleSourceIOSvc::BeginTransaction()
+{
+  if (m_inTransaction) {
+    *log << ILog::ERROR << "Transaction already started for source: " << m_source.GetURI() << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  m_inTransaction = true;
+  m_transactionChanged = false;
+  m_transactionSteps.clear();
+  return m_statusCode = SC_OK;
+}
+
+IErrorHandler::StatusCode SingleSourceIOSvc::Commit()
+{
+  if (not m_inTransaction) {
+    *log << ILog::ERROR << "No transaction to commit for source: " << m_source.GetURI() << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  m_inTransaction = false;
+  if (m_transactionChanged || not m_transactionSteps.empty()) {
+    *log << ILog::DEBUG << "Committing " << (unsigned long)m_transactionSteps.size() << " added or removed records to source: "
+	 << m_source.GetURI() << this << ILog::endmsg;
+    StatusCode sc = Store();
+    if (sc >= SC_ERROR) {
+      //nothing lost: can be tried again, or rolled back
+      m_inTransaction = true;
+      return m_statusCode = sc;
+    }
+  }
+  //removed records are gone for good now
+  for (vector<TransactionStep>::iterator itS = m_transactionSteps.begin(); itS != m_transactionSteps.end(); ++itS)
+    if (not itS->added) {
+      m_idManagerTool->FreeId(itS->accountId);
+      Retire(itS->record);
+    }
+  m_transactionSteps.clear();
+  m_transactionChanged = false;
   return m_statusCode;
 }
 
+IErrorHandler::StatusCode SingleSourceIOSvc::Rollback()
+{
+  if (not m_inTransaction) {
+    *log << ILog::ERROR << "No transaction to roll back for source: " << m_source.GetURI() << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  *log << ILog::INFO << "Rolling back " << (unsigned long)m_transactionSteps.size() << " added or removed records of source: "
+       << m_source.GetURI() << this << ILog::endmsg;
+  //undo in reverse order
+  for (vector<TransactionStep>::reverse_iterator itS = m_transactionSteps.rbegin(); itS != m_transactionSteps.rend(); ++itS) {
+    if (itS->added) {
+      unordered_map<unsigned long, size_t>::iterator itIdx = m_idIndex.find(itS->accountId);
+      if (itIdx != m_idIndex.end())
+	Detach(itIdx->second);
+      m_idManagerTool->FreeId(itS->accountId);
+      itS->record->m_accountId = 0;
+      itS->record->SetLock(ARecord::UNLOCKED);
+    } else {
+      //its Id was kept
+      Attach(itS->record);
+    }
+  }
+  m_transactionSteps.clear();
+  m_transactionChanged = false;
+  m_inTransaction = false;
+  return m_statusCode = SC_OK;
+}
+
+bool SingleSourceIOSvc::InTransaction()
+{
+  return m_inTransaction;
+}
+
+IErrorHandler::StatusCode SingleSourceIOSvc::Rekey(std::string pOldKey, std::string pNewKey, bool &pSkipped)
+{
+  pSkipped = false;
+  *log << ILog::INFO << "Re-encrypting source: " << m_source.GetFullURI() << this << ILog::endmsg;
+  Flush(); //the tools must not be in use in background
+  // --- Load tools
+  StatusCode sc = LoadTools();
+  if (sc != SC_OK) {
+    log->say(ILog::ERROR, "Error loading tools.", this);
+    return m_statusCode = sc;
+  }
+  if (!m_encrypt) {
+    *log << ILog::WARNING << "Source is not encrypted, nothing to do: " << m_source.GetURI() << this << ILog::endmsg;
+    pSkipped = true;
+    return m_statusCode = SC_WARNING;
+  }
+  // --- Read and decrypt
+  string bufStr;
+  sc = m_storageTool->Load(bufStr);
+  if (sc >= SC_ERROR) {
+    log->say(ILog::ERROR, string("Error while loading source ") + m_source.GetURI() + 
+	     string(": ") + m_storageTool->GetErrorMsg(), this);
+    return m_statusCode = sc;
+  }
+  string plainText;
+  if (DecryptData(bufStr, plainText) >= SC_ERROR) {
+    *log << ILog::ERROR << "Error decrypting source: " << m_source.GetURI() << this << ILog::endmsg;
+    ISecurityTool::ClearString(plainText);
+    return m_statusCode = SC_ERROR;
+  }
+  // -- Check which key it was encrypted for (even a revoked or expired one)
+  string currentKey = m_securityTool->GetLastRecipient();
+  if (currentKey.empty())
+    currentKey = m_securityTool->GetKey(); //the tool does not tell, assume it was the source key
+  if (m_securityTool->IsSameKey(currentKey, pNewKey)) {
+    *log << ILog::INFO << "Source already encrypted with the new key: " << m_source.GetURI() << this << ILog::endmsg;
+    ISecurityTool::ClearString(plainText);
+    m_key = currentKey;
+    pSkipped = true;
+    return m_statusCode = SC_OK;
+  }
+  if (!m_securityTool->IsSameKey(currentKey, pOldKey)) {
+    if (!cfgMgr->GetBruteForce()) {
+      *log << ILog::ERROR << "Source " << m_source.GetURI() << " is encrypted with key " << currentKey
+	   << ", not with the old key " << pOldKey << ". Use force flag to re-encrypt it anyway." << this << ILog::endmsg;
+      ISecurityTool::ClearString(plainText);
+      return m_statusCode = SC_ERROR;
+    }
+    *log << ILog::WARNING << "Source " << m_source.GetURI() << " is encrypted with key " << currentKey
+	 << ", not with the old key " << pOldKey << ". Re-encrypting anyway." << this << ILog::endmsg;
+  }
+  // --- Encrypt with new key and replace the source
+  if (m_securityTool->SetKey(pNewKey) != SC_OK) {
+    *log << ILog::ERROR << "New key is not valid: " << pNewKey << this << ILog::endmsg;
+    ISecurityTool::ClearString(plainText);
+    return m_statusCode = SC_ERROR;
+  }
+  string chiperText;
+  sc = EncryptData(plainText, chiperText);
+  ISecurityTool::ClearString(plainText);
+  if (sc >= SC_ERROR || chiperText.empty()) {
+    *log << ILog::ERROR << "Error encrypting source: " << m_source.GetURI() << this << ILog::endmsg;
+    return m_statusCode = SC_ERROR;
+  }
+  sc = m_storageTool->Store(chiperText);
+  if (sc >= SC_ERROR) {
+    log->say(ILog::ERROR, string("Error while writing to source ") + m_source.GetURI() + 
+	     string(": ") + m_storageTool->GetErrorMsg(), this);
+    return m_statusCode = sc;
+  }
+  //from now on use the new key for this source
+  m_key = pNewKey;
+  *log << ILog::INFO << "Source re-encrypted: " << m_source.GetURI() << this << ILog::endmsg;
+  return m_statusCode = SC_OK;
+}
+
 IErrorHandler::StatusCode SingleSourceIOSvc::Add(ARecord *pARecord, bool flushBuffer)
 {
   m_statusCode = SC_OK;
 
+  // -- New records get their UUID, copies of records a new one (see AddLoaded() for records loaded without one)
+  if (pARecord->GetUUID().empty() || m_uuidIndex.find(pARecord->GetUUID()) != m_uuidIndex.end()) {
+    string uuid = NewUUID(m_uuidPool);
+    if (m_uuidPool.Failed()) {
+      log->say(ILog::ERROR, "Cannot get random bytes for the UUID of the record.", this);
+      return m_statusCode = SC_ERROR;
+    }
+    pARecord->SetUUID(uuid);
+  }
+
   // -- Assigning an unique accountId to each record and lock the information
   //retrieve new available global ID (needed for multiple source handling)
-  int newId = -1;
+  unsigned long newId = 0;
   if (m_idManagerTool == 0) {
     m_idManagerTool = new IdManagerTool("IdManager");
     m_localIdMgrInstance = true; //flag so that can be freed by IIOService destructor -- ugly
   } 
   newId = m_idManagerTool->GetNewId(m_source.GetURI());
-  if (newId == -1) {
-    // ID Manager Tool not available.. error.
+  if (newId == 0) {
+    // no more ids available.. error.
     log->say(ILog::ERROR, "Error in requesting new ID.", this);
     return m_statusCode = SC_ERROR;
   }
@@ -299,7 +774,11 @@ IErrorHandler::StatusCode SingleSourceIOSvc::Add(ARecord *pARecord, bool flushBu
   pARecord->SetLock(ARecord::LOCKED);
 
   // -- Now append to the list of records
-  m_data.insert(m_data.end(), pARecord);
+  Attach(pARecord);
+  if (m_inTransaction && not m_loading) {
+    TransactionStep step = {true, pARecord, pARecord->m_accountId};
+    m_transactionSteps.push_back(step);
+  }
 
   // -- Flush to media
   if (flushBuffer)
@@ -308,36 +787,185 @@ IErrorHandler::StatusCode SingleSourceIOSvc::Add(ARecord *pARecord, bool flushBu
   return m_statusCode;
 }
 
-bool SingleSourceIOSvc::SMatch(string pPattern, string pField, SearchRequest::SearchType pSType)
+void SingleSourceIOSvc::Attach(ARecord *pARecord)
 {
-  switch (pSType) {
-  case SearchRequest::TXT:
-    {
-      string pField_toUpper = pField;
-      string pPattern_toUpper = pPattern;
-      std::transform(pField.begin(), pField.end(),pField_toUpper.begin(), ::toupper);
-      std::transform(pPattern.begin(), pPattern.end(), pPattern_toUpper.begin(), ::toupper);
-      if (pField_toUpper.find(pPattern_toUpper) != string::npos)
-	return true;
-      return false;
-      break;
-    }
-  case SearchRequest::EXACT:
-    if (pField == pPattern)
-      return true;
+  m_idIndex[pARecord->m_accountId] = m_data.size();
+  m_uuidIndex[pARecord->GetUUID()] = m_data.size();
+  m_labelIndex.Set(m_data.size(), pARecord);
+  m_data.insert(m_data.end(), pARecord);
+  if (pARecord->HasPayload()) {
+    //indexing it would load its fields: wait for a search to need them
+    m_searchIndexComplete = false;
+    m_searchIndex.Clear();
+  } else if (m_searchIndexComplete)
+    m_searchIndex.Add(pARecord->m_accountId, pARecord);
+  if (m_loading) {
+    m_byName.push_back(pARecord);
+    m_byDate.push_back(pARecord);
+  } else {
+    InsertSorted(m_byName, pARecord, sortByName);
+    InsertSorted(m_byDate, pARecord, sortByDate);
+  }
+}
+
+ARecord *SingleSourceIOSvc::Detach(size_t pSlot)
+{
+  ARecord *record = m_data[pSlot];
+  unsigned long accountId = record->GetAccountId();
+  m_idIndex.erase(accountId);
+  m_uuidIndex.erase(record->GetUUID());
+  EraseSorted(m_byName, record, sortByName);
+  EraseSorted(m_byDate, record, sortByDate);
+  //move the last record in its place
+  if (pSlot != m_data.size() - 1) {
+    m_data[pSlot] = m_data.back();
+    m_idIndex[m_data[pSlot]->GetAccountId()] = pSlot;
+    m_uuidIndex[m_data[pSlot]->GetUUID()] = pSlot;
+  }
+  m_data.pop_back();
+  m_labelIndex.RemoveSlot(pSlot);
+  if (m_searchIndexComplete)
+    m_searchIndex.Remove(accountId);
+  return record;
+}
+
+void SingleSourceIOSvc::Publish()
+{
+  shared_ptr<RecordSnapshot::Epoch> epoch = make_shared<RecordSnapshot::Epoch>();
+  RecordSnapshot::Ptr snapshot = make_shared<RecordSnapshot>(m_source.GetURI(), m_snapshotVersion++, m_data, m_byName, m_byDate, epoch);
+  //records retired so far may be in older snapshots: the new epoch ends after them
+  m_epoch->next = epoch;
+  m_epoch = epoch;
+  atomic_store(&m_snapshot, snapshot);
+}
+
+void SingleSourceIOSvc::Retire(ARecord *pRecord)
+{
+  m_epoch->retired.push_back(pRecord);
+}
+
+RecordSnapshot::Ptr SingleSourceIOSvc::GetSnapshot()
+{
+  return atomic_load(&m_snapshot);
+}
+
+void SingleSourceIOSvc::CompleteSearchIndex()
+{
+  if (m_searchIndexComplete)
+    return;
+  *log << ILog::DEBUG << "Indexing " << (unsigned long)m_data.size() << " records for searches" << this << ILog::endmsg;
+  m_searchIndex.Clear();
+  for (vector<ARecord*>::iterator itr = m_data.begin(); itr != m_data.end(); ++itr)
+    m_searchIndex.Add((*itr)->GetAccountId(), *itr);
+  m_searchIndexComplete = true;
+}
+
+SingleSourceIOSvc::QueryIndexes::QueryIndexes(SingleSourceIOSvc *pSvc) :
+  QuerySearchTool::Indexes(pSvc->m_data, pSvc->m_source.GetURI()), m_svc(pSvc)
+{
+
+}
+
+bool SingleSourceIOSvc::QueryIndexes::LabelCandidates(const QuerySearchTool::Term &pTerm, RoaringBitmap &pCandidates)
+{
+  //match the labels of the dictionary once, then collect their records (slots are positions in m_data)
+  LabelIndex &labelIndex = m_svc->m_labelIndex;
+  for (uint32_t id=0; id < labelIndex.GetNumberOfLabels(); id++) {
+    const RoaringBitmap &labelSlots = labelIndex.GetSlots(id);
+    if (labelSlots.IsEmpty())
+      continue; //label not used any more
+    if (pTerm.Matches(labelIndex.GetLabel(id), labelIndex.GetFoldedLabel(id)))
+      pCandidates.Or(labelSlots);
+  }
+  return true;
+}
+
+namespace {
+  /// Comparison of the modification time of a record with a time
+  bool ModifiedBefore(ARecord *pRecord, time_t pTime)
+  {
+    return pRecord->GetModificationTime() < pTime;
+  }
+}
+
+bool SingleSourceIOSvc::QueryIndexes::DateCandidates(const QuerySearchTool::Term &pTerm, RoaringBitmap &pCandidates)
+{
+  if (pTerm.target != QuerySearchTool::TT_MODIFIED)
+    return false; //creation times are not indexed
+  //records edited in place are sorted again by Store()
+  vector<ARecord*> &byDate = m_svc->m_byDate;
+  vector<ARecord*>::iterator itBegin = lower_bound(byDate.begin(), byDate.end(), pTerm.from, ModifiedBefore);
+  vector<ARecord*>::iterator itEnd = lower_bound(itBegin, byDate.end(), pTerm.to, ModifiedBefore);
+  if ((size_t)(itEnd - itBegin) > byDate.size() / 2)
+    return false; //not selective: checking all records is cheaper
+  //add the slots in order, to append to the bitmap
+  vector<uint32_t> slots;
+  slots.reserve(itEnd - itBegin);
+  for (vector<ARecord*>::iterator itr = itBegin; itr != itEnd; ++itr)
+    slots.push_back(m_svc->m_idIndex[(*itr)->GetAccountId()]);
+  sort(slots.begin(), slots.end());
+  for (vector<uint32_t>::iterator its = slots.begin(); its != slots.end(); ++its)
+    pCandidates.Add(*its);
+  return true;
+}
+
+bool SingleSourceIOSvc::QueryIndexes::TextCandidates(const vector<string> &pLiterals, RoaringBitmap &pCandidates)
+{
+  //matches contain all the trigrams of the literals: intersect the ids, then get their slots
+  m_svc->CompleteSearchIndex();
+  vector<unsigned long> ids;
+  bool useIndex = false;
+  for (vector<string>::const_iterator itl = pLiterals.begin(); itl != pLiterals.end(); ++itl) {
+    vector<unsigned long> literalIds;
+    if (not m_svc->m_searchIndex.Candidates(*itl, literalIds))
+      continue; //too short
+    if (useIndex) {
+      vector<unsigned long> both;
+      set_intersection(ids.begin(), ids.end(), literalIds.begin(), literalIds.end(), back_inserter(both));
+      ids.swap(both);
+    } else
+      ids.swap(literalIds);
+    useIndex = true;
+  }
+  if (not useIndex)
     return false;
-    break;
-  case SearchRequest::REGEX:
-    //not implemented yet
-    break;
+  for (vector<unsigned long>::iterator itId = ids.begin(); itId != ids.end(); ++itId) {
+    unordered_map<unsigned long, size_t>::iterator itIdx = m_svc->m_idIndex.find(*itId);
+    if (itIdx != m_svc->m_idIndex.end())
+      pCandidates.Add(itIdx->second);
   }
+  return true;
+}
+
+bool SingleSourceIOSvc::QueryIndexes::IsTextIndexReady()
+{
+  return m_svc->m_searchIndexComplete;
+}
 
-  //not implemented
-  log->say(ILog::ERROR, ("Search type not implemented while searching for") + pPattern + 
-	   string(" in " ) + pField, this);
+bool SingleSourceIOSvc::QueryIndexes::HasFieldValues()
+{
+  return TrigramIndex::HasValues();
+}
+
+bool SingleSourceIOSvc::MakeTerm(QuerySearchTool::TermTarget pTarget, const string &pSearch, SearchRequest::SearchType pTypeOfSearch, QuerySearchTool::Node &pTerm)
+{
+  m_statusCode = SC_OK;
+  if (QuerySearchTool::MakeTerm(pTarget, pSearch, pTypeOfSearch, pTerm, m_errorMsg))
+    return true;
+  *log << ILog::ERROR << m_errorMsg << this << ILog::endmsg;
+  m_statusCode = SC_ERROR;
   return false;
 }
 
+vector<ARecord*> SingleSourceIOSvc::FindTerm(QuerySearchTool::TermTarget pTarget, const string &pSearch, SearchRequest::SearchType pTypeOfSearch)
+{
+  QuerySearchTool::Node term;
+  if (not MakeTerm(pTarget, pSearch, pTypeOfSearch, term))
+    return vector<ARecord*>();
+  QueryIndexes indexes(this);
+  return m_queryTool.Run(term, indexes);
+}
+
 vector<ARecord*> SingleSourceIOSvc::Find(std::string pSearch, SearchRequest::SearchType pTypeOfSearch)
 {
   *log << ILog::VERBOSE << "Performing search of pattern: " << pSearch << ", with type = " << pTypeOfSearch << this << ILog::endmsg;
@@ -346,41 +974,66 @@ vector<ARecord*> SingleSourceIOSvc::Find(std::string pSearch, SearchRequest::Sea
     log->say(ILog::WARNING, string("Data empty. Trying to load from source: ") + m_source.GetURI(), this);
     Load();
   }
-  vector<ARecord*> sRes;
-  for (vector<ARecord*>::iterator itr = m_data.begin(); itr != m_data.end(); ++itr) {
-    //search for account name
-    if (SMatch(pSearch, (*itr)->GetAccountName(), pTypeOfSearch)) {
-      *log << ILog::DEBUG << "Acount name matched search for record Id: " << (*itr)->GetAccountId() << this << ILog::endmsg;
-      addUniqueRecord(*itr, sRes);
-      continue;
-    }
-    //now for labels
-    vector<string> labels = (*itr)->GetLabels();
-    bool found=false;
-    for (vector<string>::iterator itL = labels.begin(); itL != labels.end(); ++itL)
-      if (SMatch(pSearch, *itL, pTypeOfSearch)) {
-	*log << ILog::DEBUG << "Acount labels matched search for record Id: " << (*itr)->GetAccountId() << this << ILog::endmsg;
-	addUniqueRecord(*itr, sRes);
-	found=true;
-	break; //exit labels loop
-      }
-    if (found)
-      continue; //next record
-    //finally for all other fields names and values (m_essentials will match with field names anyway)
-    for (ARecord::TFieldsIterator itf = (*itr)->GetFieldsIterBegin(); itf != (*itr)->GetFieldsIterEnd(); ++itf) {
-      if (SMatch(pSearch, itf->first, pTypeOfSearch) || SMatch(pSearch, itf->second, pTypeOfSearch)) {
-	*log << ILog::DEBUG << "Acount field " << itf->first << " matched search for record Id: " << (*itr)->GetAccountId() << this << ILog::endmsg;
-	addUniqueRecord(*itr, sRes);
-	found = true;
-	break;
-      }      
-    }
-    if (found)
-      continue; //next record -- useless now, but in case we add other checks
-  } // loop over records
+  if (pTypeOfSearch == SearchRequest::FUZZY)
+    return FindFuzzy(pSearch); //all matching records, ranked
+  if (pTypeOfSearch != SearchRequest::QUERY)
+    return FindTerm(QuerySearchTool::TT_ANY, pSearch, pTypeOfSearch);
+  m_statusCode = SC_OK;
+  QueryIndexes indexes(this);
+  vector<ARecord*> sRes = m_queryTool.Find(pSearch, indexes);
+  if (m_queryTool.GetErrorMsg(m_errorMsg) >= SC_ERROR)
+    m_statusCode = SC_ERROR; //"Invalid query: ..."
   return sRes;
 }
 
+bool SingleSourceIOSvc::FindEach(std::string pSearch, SearchRequest::SearchType pTypeOfSearch, RecordVisitor &pVisitor)
+{
+  *log << ILog::VERBOSE << "Performing search of pattern: " << pSearch << ", with type = " << pTypeOfSearch << this << ILog::endmsg;
+  if ((m_data.size() == 0) && !m_source.GetURI().empty()) {
+    //try to load source first
+    log->say(ILog::WARNING, string("Data empty. Trying to load from source: ") + m_source.GetURI(), this);
+    Load();
+  }
+  m_statusCode = SC_OK;
+  if (pTypeOfSearch == SearchRequest::FUZZY) {
+    //records are ranked: all of them are scored first
+    vector<ARecord*> ranked = FindFuzzy(pSearch);
+    for (vector<ARecord*>::iterator itr = ranked.begin(); itr != ranked.end(); ++itr)
+      if (not pVisitor.Visit(*itr))
+	return false;
+    return true;
+  }
+  QueryIndexes indexes(this);
+  if (pTypeOfSearch != SearchRequest::QUERY) {
+    QuerySearchTool::Node term;
+    if (not MakeTerm(QuerySearchTool::TT_ANY, pSearch, pTypeOfSearch, term))
+      return true;
+    return m_queryTool.Run(term, indexes, pVisitor);
+  }
+  bool completed = m_queryTool.Find(pSearch, indexes, pVisitor);
+  if (m_queryTool.GetErrorMsg(m_errorMsg) >= SC_ERROR)
+    m_statusCode = SC_ERROR; //"Invalid query: ..."
+  return completed;
+}
+
+vector<ARecord*> SingleSourceIOSvc::FindFuzzy(std::string pSearch, size_t pMaxResults)
+{
+  FuzzyMatcher matcher(pSearch, pMaxResults);
+  AddFuzzyMatches(matcher);
+  return matcher.GetResults();
+}
+
+void SingleSourceIOSvc::AddFuzzyMatches(FuzzyMatcher &pMatcher)
+{
+  if ((m_data.size() == 0) && !m_source.GetURI().empty()) {
+    //try to load source first
+    log->say(ILog::WARNING, string("Data empty. Trying to load from source: ") + m_source.GetURI(), this);
+    Load();
+  }
+  for (vector<ARecord*>::iterator itr = m_data.begin(); itr != m_data.end(); ++itr)
+    pMatcher.Add(*itr);
+}
+
 IErrorHandler::StatusCode SingleSourceIOSvc::addUniqueRecord(ARecord *newRecord, std::vector<ARecord*> &resultList)
 {
   if (!newRecord) {
@@ -403,15 +1056,7 @@ vector<ARecord*> SingleSourceIOSvc::FindByAccountName(std::string pSearch, Searc
     log->say(ILog::WARNING, string("Data empty. Trying to load from source: ") + m_source.GetURI());
     Load();
   }
-  vector<ARecord*> sRes;
-  for (vector<ARecord*>::iterator itr = m_data.begin(); itr != m_data.end(); ++itr) {
-    //search for account name
-    if (SMatch(pSearch, (*itr)->GetAccountName(), pTypeOfSearch)) {
-      sRes.push_back(*itr);
-      continue;
-    }
-  }
-  return sRes;
+  return FindTerm(QuerySearchTool::TT_NAME, pSearch, pTypeOfSearch);
 }
  
 vector<ARecord*> SingleSourceIOSvc::FindByLabel(std::string pSearch, SearchRequest::SearchType pTypeOfSearch)
@@ -421,89 +1066,131 @@ vector<ARecord*> SingleSourceIOSvc::FindByLabel(std::string pSearch, SearchReque
     log->say(ILog::WARNING, string("Data empty. Trying to load from source: ") + m_source.GetURI());
     Load();
   }
-  vector<ARecord*> sRes;
-  for (vector<ARecord*>::iterator itr = m_data.begin(); itr != m_data.end(); ++itr) {
-    vector<string> labels = (*itr)->GetLabels();
-    for (vector<string>::iterator itL = labels.begin(); itL != labels.end(); ++itL)
-      if (SMatch(pSearch, *itL, pTypeOfSearch)) {
-	sRes.push_back(*itr);
-	break; //exit labels loop
-      }
-  }
-  return sRes;
+  //labels are matched in the dictionary of m_labelIndex
+  return FindTerm(QuerySearchTool::TT_LABEL, pSearch, pTypeOfSearch);
 }    
 
-ARecord* SingleSourceIOSvc::FindByAccountId(unsigned long pAccountId)
+vector<ARecord*> SingleSourceIOSvc::FindByLabelQuery(std::string pQuery)
 {
   if ((m_data.size() == 0) && !m_source.GetURI().empty()) {
     //try to load source first
     log->say(ILog::WARNING, string("Data empty. Trying to load from source: ") + m_source.GetURI());
     Load();
   }
-  for (vector<ARecord*>::iterator itr = m_data.begin(); itr != m_data.end(); ++itr) {
-    if ((*itr)->GetAccountId() == pAccountId) {
-      // record found. Assume no duplicates
-      return *itr;
-    }
+  m_statusCode = SC_OK;
+  RoaringBitmap slots;
+  if (not m_labelIndex.Query(pQuery, slots, m_errorMsg)) {
+    *log << ILog::ERROR << "Invalid label query: " << m_errorMsg << this << ILog::endmsg;
+    m_statusCode = SC_ERROR;
+    return vector<ARecord*>();
   }
+  return GetSlotRecords(slots);
+}
+
+vector<ARecord*> SingleSourceIOSvc::GetSlotRecords(const RoaringBitmap &pSlots)
+{
+  vector<ARecord*> records;
+  vector<uint32_t> slots = pSlots.ToVector();
+  records.reserve(slots.size());
+  for (vector<uint32_t>::iterator its = slots.begin(); its != slots.end(); ++its)
+    records.push_back(m_data[*its]);
+  return records;
+}
+
+ARecord* SingleSourceIOSvc::FindByAccountId(unsigned long pAccountId)
+{
+  if ((m_data.size() == 0) && !m_source.GetURI().empty()) {
+    //try to load source first
+    log->say(ILog::WARNING, string("Data empty. Trying to load from source: ") + m_source.GetURI());
+    Load();
+  }
+  unordered_map<unsigned long, size_t>::iterator itIdx = m_idIndex.find(pAccountId);
+  if (itIdx != m_idIndex.end())
+    return m_data[itIdx->second];
   //record not found
   *log << ILog::WARNING << "Record not found. AccountId = " << pAccountId << this << ILog::endmsg;
   return 0; // return null pointer
 }
 
+bool SingleSourceIOSvc::HasAccountId(unsigned long pAccountId)
+{
+  return m_idIndex.find(pAccountId) != m_idIndex.end();
+}
+
+ARecord* SingleSourceIOSvc::FindByUUID(const string &pUUID)
+{
+  unordered_map<string, size_t>::iterator itIdx = m_uuidIndex.find(pUUID);
+  if (itIdx != m_uuidIndex.end())
+    return m_data[itIdx->second];
+  return 0; //not in this source
+}
+
 vector<ARecord*> SingleSourceIOSvc::GetAllAccounts(int sort)
 {
-  vector<ARecord*> listAccounts;
+  //copy the requested view, already sorted
+  return GetSortedAccounts(sort);
+}
+
+const vector<ARecord*> &SingleSourceIOSvc::GetSortedAccounts(int sort)
+{
   if ((m_data.size() == 0) && !m_source.GetURI().empty()) {
     //try to load source first
     log->say(ILog::WARNING, string("Data empty. Trying to load from source: ") + m_source.GetURI());
     Load();
   }
-  listAccounts = m_data; //copy list of accounts, to enable sorting
+  if (sort == ACCOUNTS_SORT_BYNAME)
+    return m_byName;
+  else if (sort == ACCOUNTS_SORT_BYDATE)
+    return m_byDate;
+  return m_data;
+}
 
-  //sort, if requested
-  if (sort == ACCOUNTS_SORT_BYNAME) {
-    std::sort(listAccounts.begin(), listAccounts.end(), sortByName);
-  } else if (sort == ACCOUNTS_SORT_BYDATE) {
-    std::sort(listAccounts.begin(), listAccounts.end(), sortByDate);
-  }
+void SingleSourceIOSvc::InsertSorted(vector<ARecord*> &pView, ARecord *pRecord, bool (*pLess)(ARecord*, ARecord*))
+{
+  pView.insert(upper_bound(pView.begin(), pView.end(), pRecord, pLess), pRecord);
+}
 
-  return listAccounts;
+void SingleSourceIOSvc::EraseSorted(vector<ARecord*> &pView, ARecord *pRecord, bool (*pLess)(ARecord*, ARecord*))
+{
+  vector<ARecord*>::iterator itr = lower_bound(pView.begin(), pView.end(), pRecord, pLess);
+  if (itr == pView.end() || *itr != pRecord)
+    itr = find(pView.begin(), pView.end(), pRecord); //edited in place since it was sorted
+  if (itr != pView.end())
+    pView.erase(itr);
 }
 
-vector<string> SingleSourceIOSvc::GetLabels()
+void SingleSourceIOSvc::ResortView(vector<ARecord*> &pView, bool (*pLess)(ARecord*, ARecord*))
 {
-  vector<string> labelList;
-  for (vector<ARecord*>::iterator itr = m_data.begin(); itr != m_data.end(); ++itr) {
-    //add to the list
-    labelList.insert(labelList.end(), (*itr)->GetLabelsIterBegin(), (*itr)->GetLabelsIterEnd());
-  }
-  //now make the list unique, and sorted
-  sort(labelList.begin(), labelList.end());
-  vector<string>::iterator newSize = unique(labelList.begin(), labelList.end());
-  labelList.resize( newSize - labelList.begin() );
+  if (not is_sorted(pView.begin(), pView.end(), pLess))
+    std::sort(pView.begin(), pView.end(), pLess);
+}
 
-  return labelList;
+vector<string> SingleSourceIOSvc::GetLabels()
+{
+  //unique and sorted
+  return m_labelIndex.GetLabels();
 }
 
 IErrorHandler::StatusCode SingleSourceIOSvc::Remove(unsigned long pAccountId)
 {
   m_statusCode = SC_OK;
 
-  bool record_found=false;
   //look for the record
-  for (vector<ARecord*>::iterator itr = m_data.begin(); itr != m_data.end(); ++itr) {
-    if ((*itr)->GetAccountId() == pAccountId) {
-      //print warning
-      *log << ILog::INFO << "Removing record with accountId = " << pAccountId << this << ILog::endmsg;
-      //remove this record and free its Id
-      m_data.erase(itr);
+  unordered_map<unsigned long, size_t>::iterator itIdx = m_idIndex.find(pAccountId);
+  if (itIdx != m_idIndex.end()) {
+    //print warning
+    *log << ILog::INFO << "Removing record with accountId = " << pAccountId << this << ILog::endmsg;
+    //remove this record, moving the last one in its place, and free its Id
+    ARecord *record = Detach(itIdx->second);
+    if (m_inTransaction) {
+      //keep the Id until the end of the transaction, the record may be put back
+      TransactionStep step = {false, record, pAccountId};
+      m_transactionSteps.push_back(step);
+    } else {
       m_idManagerTool->FreeId(pAccountId);
-      record_found = true;
-      break;
+      Retire(record);
     }
-  }
-  if (!record_found) {
+  } else {
     *log << ILog::WARNING << "Record to be removed not found. accountId = " << pAccountId << this << ILog::endmsg;
     return m_statusCode = SC_NOT_FOUND;
   }
@@ -527,10 +1214,17 @@ IErrorHandler::StatusCode SingleSourceIOSvc::SetSource(SourceURI pSource)
 
 bool SingleSourceIOSvc::sortByName(ARecord* a, ARecord* b)
 {
-  return (a->GetAccountName() < b->GetAccountName());
+  //keys are references: no copy per comparison
+  int cmp = a->GetNameSortKey().compare(b->GetNameSortKey());
+  if (cmp != 0)
+    return cmp < 0;
+  return a->GetAccountId() < b->GetAccountId();
 }
 
 bool SingleSourceIOSvc::sortByDate(ARecord* a, ARecord* b)
 {
-  return (a->GetModificationTime() < b->GetModificationTime());
+  time_t timeA = a->GetModificationTime(), timeB = b->GetModificationTime();
+  if (timeA != timeB)
+    return timeA < timeB;
+  return a->GetAccountId() < b->GetAccountId();
 }
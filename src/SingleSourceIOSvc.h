@@ -12,12 +12,23 @@
 #define __SINGLESOURCEIO_SERVICE__
 
 #include <vector>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 #include "IIOService.h"
 #include "ARecord.h"
 #include "IStorageTool.h"
 #include "IFormatterTool.h"
 #include "ISecurityTool.h"
+#include "TrigramIndex.h"
+#include "QuerySearchTool.h"
+#include "FuzzyMatcher.h"
+#include "LabelIndex.h"
+#include "PasswordGeneratorTool.h"
 
 /** Implements IIOService for a single source.
  * Load all data in a transient vector.
@@ -28,6 +39,85 @@ class SingleSourceIOSvc : public IIOService {
  protected:
   /// define basic transient storage for data.
   std::vector<ARecord*> m_data;
+  /// index of m_data: account id -> position of the record, maintained by Add() and Remove()
+  std::unordered_map<unsigned long, size_t> m_idIndex;
+  /// index of m_data: UUID -> position of the record, maintained by Add() and Remove()
+  std::unordered_map<std::string, size_t> m_uuidIndex;
+  /// random bytes for the UUIDs of new records
+  PasswordGeneratorTool::EntropyPool m_uuidPool;
+  /// index of the contents of m_data used by searches, maintained by Add(), Remove() and Store()
+  TrigramIndex m_searchIndex;
+  /** false if records were added without indexing them: their fields are not loaded yet
+   * (see ARecord::SetPayload), m_searchIndex is built again by the first search needing it.
+   */
+  bool m_searchIndexComplete;
+  /// index of m_data by label (record slot = position in m_data), maintained by Add(), Remove() and Store()
+  LabelIndex m_labelIndex;
+  /// m_data sorted by name (sortByName), maintained by Add(), Remove() and Store()
+  std::vector<ARecord*> m_byName;
+  /// m_data sorted by modification date (sortByDate), maintained by Add(), Remove() and Store()
+  std::vector<ARecord*> m_byDate;
+  /// true while Load() adds records: views are sorted once at the end, no transaction steps
+  bool m_loading;
+  /// records have been loaded from the source, and not unloaded since (see Unload())
+  bool m_loaded;
+  /// size of the formatted data last read or written, an estimate of the memory used by the records
+  size_t m_dataSize;
+
+  // --- Snapshots
+  /// Last published version of the records (see GetSnapshot()), replaced atomically
+  RecordSnapshot::Ptr m_snapshot;
+  /// Epoch of m_snapshot, where records removed since then are retired
+  std::shared_ptr<RecordSnapshot::Epoch> m_epoch;
+  /// Number of snapshots published
+  unsigned long m_snapshotVersion;
+  /** Publish the records as a new snapshot.
+   * Called by Store() (outside transactions) and Load(): changes are seen by readers once written,
+   * or being written, and a transaction all at once.
+   */
+  void Publish();
+  /// Delete a record removed from m_data once no snapshot uses it
+  void Retire(ARecord *pRecord);
+
+  // --- Transaction
+  /// Record added or removed during a transaction, undone by Rollback()
+  struct TransactionStep {
+    bool added; ///< true if added, false if removed
+    ARecord *record;
+    unsigned long accountId;
+  };
+  /// true between BeginTransaction() and the end of the transaction: Store() only takes note of changes
+  bool m_inTransaction;
+  /// Store() was requested during the transaction
+  bool m_transactionChanged;
+  /// records added and removed during the transaction, in order
+  std::vector<TransactionStep> m_transactionSteps;
+
+  // --- Write-behind (see SetWriteBehind())
+  /// Store() only formats data, m_writer encrypts and writes it
+  bool m_writeBehind;
+  /// background writer thread
+  std::thread m_writer;
+  /// protects the following members, and the tools while m_writer uses them
+  std::mutex m_writeMutex;
+  /// signals new data to write, and the end of writes
+  std::condition_variable m_writeCondition;
+  /// milliseconds without changes before writing
+  unsigned int m_writeBehindDelay;
+  /// formatted data waiting to be written (only the last one counts)
+  std::string m_pendingData;
+  bool m_hasPending; ///< m_pendingData is valid
+  bool m_writing; ///< m_writer is using the tools
+  bool m_writeNow; ///< write without waiting for the delay (Flush())
+  bool m_stopWriter; ///< m_writer must write what is pending and stop
+  /// time of the last change
+  std::chrono::steady_clock::time_point m_lastChange;
+  /// formatted data whose writing failed, written again by Flush()
+  std::string m_failedData;
+  /// status of the last write in background
+  StatusCode m_writeStatus;
+  /// reason of the failure of the last write in background
+  std::string m_writeError;
 
   /// define Storage Tool to be used to physically load/store data
   IStorageTool* m_storageTool;
@@ -41,9 +131,59 @@ class SingleSourceIOSvc : public IIOService {
   bool m_encrypt; 
   /// Regulate if content needs to be gzipped before encryption. Decidec base on file type.
   bool m_zip;
+  /// Only the index of the formatted data is encrypted (see FormatterTieredTool). Decided based on file type.
+  bool m_tiered;
 
-  /// Search helper
-  bool SMatch(std::string pPattern, std::string pField, SearchRequest::SearchType pSType=SearchRequest::TXT);
+  /// Indexes of the records of this source, used by the planner of m_queryTool
+  class QueryIndexes : public QuerySearchTool::Indexes {
+  protected:
+    SingleSourceIOSvc *m_svc;
+  public:
+    QueryIndexes(SingleSourceIOSvc *pSvc);
+    /// Labels from m_labelIndex
+    virtual bool LabelCandidates(const QuerySearchTool::Term &pTerm, RoaringBitmap &pCandidates);
+    /// Modification times from m_byDate
+    virtual bool DateCandidates(const QuerySearchTool::Term &pTerm, RoaringBitmap &pCandidates);
+    /// Trigrams from m_searchIndex, built if needed
+    virtual bool TextCandidates(const std::vector<std::string> &pLiterals, RoaringBitmap &pCandidates);
+    /// false while m_searchIndex is not complete
+    virtual bool IsTextIndexReady();
+    /// see TrigramIndex::HasValues
+    virtual bool HasFieldValues();
+  };
+  /// Runs all searches but fuzzy ones
+  QuerySearchTool m_queryTool;
+  /// Search with a single term (pattern not parsed)
+  std::vector<ARecord*> FindTerm(QuerySearchTool::TermTarget pTarget, const std::string &pSearch, SearchRequest::SearchType pTypeOfSearch);
+  /// Build a single term query, setting the status if pSearch is not valid for the type
+  bool MakeTerm(QuerySearchTool::TermTarget pTarget, const std::string &pSearch, SearchRequest::SearchType pTypeOfSearch, QuerySearchTool::Node &pTerm);
+  /// Records in the slots (positions in m_data) of pSlots
+  std::vector<ARecord*> GetSlotRecords(const RoaringBitmap &pSlots);
+  /** Encrypt (if needed) and write formatted data to the source.
+   * Only uses the storage and security tools, so that it can run in the background writer.
+   * @param pError reason of the failure, or of the warning
+   */
+  StatusCode WriteData(std::string &pData, std::string &pError);
+  /// Encrypt formatted data with the security tool (only the index, if m_tiered)
+  StatusCode EncryptData(const std::string &pPlain, std::string &pCipher);
+  /// Decrypt data encrypted by EncryptData()
+  StatusCode DecryptData(const std::string &pCipher, std::string &pPlain);
+  /// Index again all records in m_searchIndex, if needed
+  void CompleteSearchIndex();
+  /// Main loop of the background writer (see SetWriteBehind())
+  void WriteBehindLoop();
+  /// Write what is pending and stop the background writer
+  void StopWriter();
+  /// Put a record (with its account id) in m_data and in all indexes
+  void Attach(ARecord *pARecord);
+  /// Take the record in pSlot out of m_data and of all indexes, the last record takes its place
+  ARecord *Detach(size_t pSlot);
+  /// Insert a record in a sorted view (binary insertion)
+  static void InsertSorted(std::vector<ARecord*> &pView, ARecord *pRecord, bool (*pLess)(ARecord*, ARecord*));
+  /// Remove a record from a sorted view
+  static void EraseSorted(std::vector<ARecord*> &pView, ARecord *pRecord, bool (*pLess)(ARecord*, ARecord*));
+  /// Sort a view again if records were edited in place (linear if nothing changed)
+  static void ResortView(std::vector<ARecord*> &pView, bool (*pLess)(ARecord*, ARecord*));
   /// Add ARecord to a list, if it does not exists there already.
   StatusCode addUniqueRecord(ARecord *newRecord, std::vector<ARecord*> &resultList);
 
@@ -59,35 +199,118 @@ class SingleSourceIOSvc : public IIOService {
   /// Force (re-)loading of data.
   virtual StatusCode Load();
 
+  /** First step of Load(): read, decrypt and decode the source.
+   * Only the tools of this source are used, and no id is assigned: different sources
+   * can be read concurrently. The records are then added with AddLoaded().
+   * Records are not sealed yet (see ARecord::SealingDeferral): AddLoaded() seals them.
+   * @param pRecords decoded records, owned by the caller until added
+   * @return status of operation (warnings are only logged)
+   */
+  StatusCode ReadRecords(std::vector<ARecord*> &pRecords);
+
+  /** Second step of Load(): add the records read by ReadRecords() and publish them.
+   * Records get their ids in the order of pRecords.
+   */
+  StatusCode AddLoaded(std::vector<ARecord*> &pRecords);
+
+  /** Drop the records from memory, e.g. when the source is not used for a while.
+   * Changes written in background are written first. Records are wiped and deleted as soon as
+   * no snapshot uses them: pointers to them must not be used any more. The source can be loaded again.
+   * Fails during a transaction, or if pending changes cannot be written.
+   */
+  StatusCode Unload();
+  /// true once the records have been loaded, until Unload()
+  bool IsLoaded();
+  /// Approximate memory used by the records: size of their formatted data, as last read or written
+  size_t GetDataSize();
+
   /// Check if source exists
   virtual StatusCode SourceExists();
 
-  /// Flush data to physical source
+  /** Flush data to physical source. Records modified in place are re-indexed for searches.
+   * During a transaction nothing is written until Commit().
+   */
   virtual StatusCode Store();
 
+  /// @copydoc IIOService::BeginTransaction()
+  virtual StatusCode BeginTransaction();
+  /// @copydoc IIOService::Commit()
+  virtual StatusCode Commit();
+  /// @copydoc IIOService::Rollback()
+  virtual StatusCode Rollback();
+  /// @copydoc IIOService::InTransaction()
+  virtual bool InTransaction();
+
+  /** @copydoc IIOService::SetWriteBehind()
+   * Records are formatted by Store(), in the calling thread: only the formatted data is shared
+   * with the background writer, never the records.
+   */
+  virtual void SetWriteBehind(bool pEnable, unsigned int pDelay=1000);
+  /** @copydoc IIOService::Flush()
+   * Can be called from any thread.
+   */
+  virtual StatusCode Flush();
+  /// @copydoc IIOService::GetWriteState()
+  virtual WriteState GetWriteState(std::string &pMsg);
+
+  /** Re-encrypt the source with a new key.
+   * The physical source is decrypted and encrypted again with pNewKey, without decoding its records.
+   * The source is then replaced in one go by the storage tool.
+   * A source already encrypted for pNewKey is left untouched, so an interrupted
+   * rekey can just be run again.
+   * @param pOldKey key the source is expected to be encrypted for
+   * @param pNewKey key to encrypt the source for
+   * @param pSkipped set to true if the source did not need to be re-encrypted
+   * @return status of operation
+   */
+  virtual StatusCode Rekey(std::string pOldKey, std::string pNewKey, bool &pSkipped);
+
   /** Add one record to the local collection
    * @copydoc IIOService::Add(ARecord*, bool)
    */
   virtual StatusCode Add(ARecord *pARecord, bool flushBuffer=true);
 
-  /// @copydoc IIOService::Find()
+  /** @copydoc IIOService::Find()
+   * Searches run through m_queryTool, which only checks the records found in the indexes if possible.
+   */
   virtual std::vector<ARecord*> Find(std::string pSearch, SearchRequest::SearchType pTypeOfSearch=SearchRequest::TXT);
+  /// @copydoc IIOService::FindEach()
+  virtual bool FindEach(std::string pSearch, SearchRequest::SearchType pTypeOfSearch, RecordVisitor &pVisitor);
+  /// @copydoc IIOService::FindFuzzy()
+  virtual std::vector<ARecord*> FindFuzzy(std::string pSearch, size_t pMaxResults=0);
+  /// Score all records with pMatcher, which keeps the best ones (used to rank records of several sources)
+  void AddFuzzyMatches(FuzzyMatcher &pMatcher);
   /// @copydoc IIOService::FindByAccountName()
   virtual std::vector<ARecord*> FindByAccountName(std::string pSearch, SearchRequest::SearchType pTypeOfSearch=SearchRequest::TXT);
   /// @copydoc IIOService::FindByLabel()
   virtual std::vector<ARecord*> FindByLabel(std::string pSearch, SearchRequest::SearchType pTypeOfSearch=SearchRequest::TXT);    
+  /// @copydoc IIOService::FindByLabelQuery()
+  virtual std::vector<ARecord*> FindByLabelQuery(std::string pQuery);
+  /// @copydoc IIOService::GetSnapshot()
+  virtual RecordSnapshot::Ptr GetSnapshot();
   /// @copydoc IIOService::FindByAccountId()
   virtual ARecord* FindByAccountId(unsigned long pAccountId);  
+  /// Check if a record belongs to this source (does not try to load it)
+  bool HasAccountId(unsigned long pAccountId);
+  /// @copydoc IIOService::FindByUUID()
+  virtual ARecord* FindByUUID(const std::string &pUUID);
   /// @copydoc IIOService::GetAllAccounts()
   virtual std::vector<ARecord*> GetAllAccounts(int sort);
+  /** Records sorted as requested, without copying them (loads the source if needed).
+   * The reference is valid until the next change of the records of this source.
+   * Records edited in place keep their position until they are stored.
+   * @param sort one of IIOService::ACCOUNTS_SORT_BYNAME or IIOService::ACCOUNTS_SORT_BYDATE, unsorted otherwise
+   */
+  const std::vector<ARecord*> &GetSortedAccounts(int sort);
 
   /** @copydoc IIOService::GetLabels()
-   * Loop over all elements to find out which are defined labels.
-   * @todo at some point we may want to switch to a label manager
+   * Labels are kept by m_labelIndex, no need to look at the records.
    */
   virtual std::vector<std::string> GetLabels();
   
-  /// Remove a given record
+  /** Remove a given record.
+   * The last record takes its place in the list, so that removal does not depend on the number of records.
+   */
   virtual StatusCode Remove(unsigned long pAccountId);
 
   /** Set Source.
@@ -97,10 +320,12 @@ class SingleSourceIOSvc : public IIOService {
   virtual StatusCode SetSource(SourceURI pSource); ///< see m_source  
 
  public:
-  /** Sorting function by account name. */
+  /** Sorting function by account name.
+   * Uses the collation keys of the records (locale-aware), then account ids for equal names.
+   */
   static bool sortByName(ARecord* a, ARecord* b);
 
-  /** Sorting function by modification date. */
+  /** Sorting function by modification date, then account id. */
   static bool sortByDate(ARecord* a, ARecord* b);
   
 };
@@ -0,0 +1,179 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: TrigramIndex.cc
+ Description: Inverted index of the character trigrams of records, used to speed up searches
+ Last Modified: $Id$
+*/
+
+#include "TrigramIndex.h"
+
+#include "ARecord.h"
+#include "PasswordGeneratorTool.h"
+#include "MiscUtils.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+  /// 64-bit finalizer (splitmix64)
+  inline uint64_t Mix64(uint64_t pX)
+  {
+    pX ^= pX >> 30;
+    pX *= 0xBF58476D1CE4E5B9ULL;
+    pX ^= pX >> 27;
+    pX *= 0x94D049BB133111EBULL;
+    pX ^= pX >> 31;
+    return pX;
+  }
+}
+
+TrigramIndex::TrigramIndex()
+{
+  PasswordGeneratorTool::EntropyPool pool;
+  m_seed = 0;
+  for (int k=0; k < 8; k++)
+    m_seed = (m_seed << 8) | pool.Uniform(256);
+}
+
+TrigramIndex::~TrigramIndex()
+{
+
+}
+
+void TrigramIndex::AddKeys(const string &pText, vector<TKey> &pKeys) const
+{
+  if (pText.size() < MIN_PATTERN_SIZE)
+    return;
+  uint32_t trigram = ((unsigned char)pText[0] << 8) | (unsigned char)pText[1];
+  for (size_t k=2; k < pText.size(); k++) {
+    trigram = ((trigram << 8) | (unsigned char)pText[k]) & 0xFFFFFF;
+    pKeys.push_back((TKey)(Mix64(trigram ^ m_seed) >> 32));
+  }
+}
+
+vector<TrigramIndex::TKey> TrigramIndex::GetKeys(ARecord *pRecord) const
+{
+  vector<TKey> keys;
+  //folded text: lines are separated by '\n', which never appears in the patterns
+  AddKeys(pRecord->GetFoldedName(), keys);
+  AddKeys(pRecord->GetFoldedLabels(), keys);
+  if (HasValues()) {
+    string buffer;
+    AddKeys(pRecord->GetFoldedFields(buffer), keys);
+    std::fill(buffer.begin(), buffer.end(), '\0');
+  } else {
+    //sealed values must not be recoverable from the index
+    vector<string> names = pRecord->GetFieldNameList();
+    for (vector<string>::iterator itn = names.begin(); itn != names.end(); ++itn)
+      AddKeys(CSMUtils::FoldCase(*itn), keys);
+  }
+  sort(keys.begin(), keys.end());
+  keys.erase(unique(keys.begin(), keys.end()), keys.end());
+  return keys;
+}
+
+void TrigramIndex::RemovePostings(unsigned long pId, const vector<TKey> &pKeys)
+{
+  for (vector<TKey>::const_iterator itk = pKeys.begin(); itk != pKeys.end(); ++itk) {
+    unordered_map<TKey, TPostingList>::iterator itp = m_postings.find(*itk);
+    if (itp == m_postings.end())
+      continue;
+    TPostingList &ids = itp->second;
+    TPostingList::iterator pos = lower_bound(ids.begin(), ids.end(), pId);
+    if (pos != ids.end() && *pos == pId)
+      ids.erase(pos);
+    if (ids.empty())
+      m_postings.erase(itp);
+  }
+}
+
+void TrigramIndex::Add(unsigned long pId, ARecord *pRecord)
+{
+  vector<TKey> &keys = m_recordKeys[pId];
+  if (not keys.empty())
+    RemovePostings(pId, keys);
+  keys = GetKeys(pRecord);
+  for (vector<TKey>::iterator itk = keys.begin(); itk != keys.end(); ++itk) {
+    TPostingList &ids = m_postings[*itk];
+    if (ids.empty() || ids.back() < pId)
+      ids.push_back(pId); //usual case: ids are given in increasing order
+    else
+      ids.insert(lower_bound(ids.begin(), ids.end(), pId), pId);
+  }
+}
+
+bool TrigramIndex::Update(unsigned long pId, ARecord *pRecord)
+{
+  unordered_map<unsigned long, vector<TKey> >::iterator itr = m_recordKeys.find(pId);
+  if (itr != m_recordKeys.end() && itr->second == GetKeys(pRecord))
+    return false;
+  Add(pId, pRecord);
+  return true;
+}
+
+void TrigramIndex::Remove(unsigned long pId)
+{
+  unordered_map<unsigned long, vector<TKey> >::iterator itr = m_recordKeys.find(pId);
+  if (itr == m_recordKeys.end())
+    return;
+  RemovePostings(itr->first, itr->second);
+  m_recordKeys.erase(itr);
+}
+
+void TrigramIndex::Clear()
+{
+  m_postings.clear();
+  m_recordKeys.clear();
+}
+
+bool TrigramIndex::Candidates(const string &pPattern, vector<unsigned long> &pIds) const
+{
+  pIds.clear();
+  string pattern = CSMUtils::FoldCase(pPattern);
+  if (pattern.size() < MIN_PATTERN_SIZE)
+    return false;
+  vector<TKey> keys;
+  AddKeys(pattern, keys);
+  sort(keys.begin(), keys.end());
+  keys.erase(unique(keys.begin(), keys.end()), keys.end());
+  // - collect posting lists, shortest first
+  vector<const TPostingList*> lists;
+  for (vector<TKey>::iterator itk = keys.begin(); itk != keys.end(); ++itk) {
+    unordered_map<TKey, TPostingList>::const_iterator itp = m_postings.find(*itk);
+    if (itp == m_postings.end())
+      return true; //no record has this trigram
+    lists.push_back(&itp->second);
+  }
+  sort(lists.begin(), lists.end(), [](const TPostingList *a, const TPostingList *b) { return a->size() < b->size(); });
+  // - intersect them
+  TPostingList current(*lists[0]), next;
+  for (size_t l=1; l < lists.size() && not current.empty(); l++) {
+    const TPostingList &other = *lists[l];
+    next.clear();
+    if (other.size() > 16 * current.size()) {
+      //much longer list: binary search each candidate
+      for (TPostingList::iterator itc = current.begin(); itc != current.end(); ++itc)
+	if (binary_search(other.begin(), other.end(), *itc))
+	  next.push_back(*itc);
+    } else {
+      set_intersection(current.begin(), current.end(), other.begin(), other.end(), back_inserter(next));
+    }
+    current.swap(next);
+  }
+  pIds.assign(current.begin(), current.end());
+  return true;
+}
+
+bool TrigramIndex::HasValues()
+{
+  return (ARecord::GetSealer() == 0);
+}
+
+size_t TrigramIndex::Size() const
+{
+  return m_recordKeys.size();
+}
@@ -0,0 +1,83 @@
+/*
+ Project: Console-Secrets
+ Copyright (C) 2013  Simone Pagan Griso
+ Distributed WITHOUT ANY WARRANTY under the GPL-3.0 licence,
+ see the LICENCE file or visit <http://www.gnu.org/licenses/>
+ File: TrigramIndex.h
+ Description: Inverted index of the character trigrams of records, used to speed up searches
+ Last Modified: $Id$
+*/
+
+#ifndef __TRIGRAM_INDEX__
+#define __TRIGRAM_INDEX__
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+class ARecord;
+
+/** Inverted index of the character trigrams of records, used to speed up searches.
+ * Each record is indexed by the byte trigrams of the case-folded text of its account name, labels,
+ * field names and field values (see ARecord::UpdateSearchText). A substring search only needs to look at the records having
+ * all the trigrams of the pattern: their posting lists are intersected to get the candidates,
+ * which must then be verified by the caller.
+ *
+ * Trigrams are stored as keyed 32-bit hashes (random key per index). The key is kept next to them,
+ * so the hashes of a short value can be brute-forced: when records are sealed (see ARecord::GetSealer),
+ * field values are not indexed and only the other text is (see HasValues).
+ * Collisions only add candidates.
+ */
+class TrigramIndex {
+ protected:
+  typedef uint32_t TKey;
+  typedef std::vector<unsigned long> TPostingList; ///< sorted record ids (whole ids: see IdManagerTool)
+
+  /// Key of the trigram hashes
+  uint64_t m_seed;
+  /// trigram -> records containing it
+  std::unordered_map<TKey, TPostingList> m_postings;
+  /// record -> sorted trigrams it has been indexed with
+  std::unordered_map<unsigned long, std::vector<TKey> > m_recordKeys;
+
+  /// Append the trigrams of pText to pKeys
+  void AddKeys(const std::string &pText, std::vector<TKey> &pKeys) const;
+  /// Sorted, unique trigrams of a record
+  std::vector<TKey> GetKeys(ARecord *pRecord) const;
+  /// Remove pId from the posting lists of pKeys
+  void RemovePostings(unsigned long pId, const std::vector<TKey> &pKeys);
+
+ public:
+  /// Minimum length of a pattern for the index to be useful
+  static const size_t MIN_PATTERN_SIZE = 3;
+
+  TrigramIndex();
+  ~TrigramIndex();
+
+  /// Index a record (replacing a previous version with the same id)
+  void Add(unsigned long pId, ARecord *pRecord);
+  /// Re-index a record if its content changed. Return true if it did.
+  bool Update(unsigned long pId, ARecord *pRecord);
+  /// Remove a record from the index
+  void Remove(unsigned long pId);
+  /// Remove all records
+  void Clear();
+
+  /** Find the records which may contain pPattern (case-insensitive, the pattern is folded).
+   * @param pPattern pattern to be searched
+   * @param pIds sorted ids of candidate records
+   * @return false if the pattern is too short to use the index (all records are candidates)
+   */
+  bool Candidates(const std::string &pPattern, std::vector<unsigned long> &pIds) const;
+
+  /** True if field values are indexed.
+   * If not, the candidates only cover matches of the other text: searches in field values check all the records.
+   */
+  static bool HasValues();
+
+  /// Number of indexed records
+  size_t Size() const;
+};
+
+#endif
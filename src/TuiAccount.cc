@@ -16,6 +16,7 @@
 #include "IIOService.h"
 #include "MultipleSourceIOSvc.h"
 #include "TuiSvc.h"
+#include "ISecurityTool.h"
 
 extern ILog *log;
 extern IConfigurationService *cfgMgr;
@@ -23,6 +24,7 @@ extern IIOService *ioSvc;
 extern TuiSvc *tuiSvc;
 
 #include <algorithm>
+#include <sstream>
 
 using namespace Ncurses;
 using namespace std;
@@ -37,6 +39,10 @@ TuiAccount::TuiAccount(std::string pName) : ITuiPage(pName)
   m_accountFieldWnd = 0;
   m_accountForm = 0;
   m_accountFields = 0;
+  m_pwdGenerator = 0;
+  m_pwdStrength = 0;
+  m_breachCheck = 0;
+  m_breachCheckInit = false;
   m_cfgFieldNameWidth = cfgMgr->GetAccountFieldNameSize();
   m_numberFieldsAccProp = 3; //will be set by Display function, default is 3: Name,Labels,Essentials
   m_maxFieldDisplayHeight = 10; // not more than 10 rows, then becomes scrollable
@@ -48,7 +54,12 @@ TuiAccount::TuiAccount(std::string pName) : ITuiPage(pName)
 
 TuiAccount::~TuiAccount()
 {
-
+  if (m_pwdGenerator)
+    delete m_pwdGenerator;
+  if (m_pwdStrength)
+    delete m_pwdStrength;
+  if (m_breachCheck)
+    delete m_breachCheck;
 }
 
 ARecord *TuiAccount::GetRecord()
@@ -73,6 +84,7 @@ IErrorHandler::StatusCode TuiAccount::NewRecord()
 IErrorHandler::StatusCode TuiAccount::SetRecord(ARecord* pRecord)
 {
   m_record = pRecord;
+  m_accountType.clear(); //not known for existing records
   return m_statusCode = SC_OK;
 }
 
@@ -81,6 +93,7 @@ IErrorHandler::StatusCode TuiAccount::AddRecordFields(ARecord pRecordType, bool
   if (!m_record)
     m_record = new ARecord();
   // add fields
+  ARecord::FieldsPin typePin(&pRecordType); //not sealed while its fields are copied
   for (ARecord::TFieldsIterator itf = pRecordType.GetFieldsIterBegin(); itf != pRecordType.GetFieldsIterEnd(); ++itf) {
     //check if field exists yet, if so, do not add it (unless force=true)
     if (force or not m_record->HasField(itf->first))
@@ -142,6 +155,7 @@ void TuiAccount::SetCommandBar()
     m_commands.push_back(make_pair<string, string>("^N", "New field"));
     m_commands.push_back(make_pair<string, string>("^R", "Remove field"));
     m_commands.push_back(make_pair<string, string>("^F", "Quick-add fields"));
+    m_commands.push_back(make_pair<string, string>("^G", "Generate password"));
   }
   //  m_commands.push_back(make_pair<string, string>("^K", "Cut line"));
   //  m_commands.push_back(make_pair<string, string>("^U", "Un-cut line"));
@@ -198,6 +212,7 @@ IErrorHandler::StatusCode TuiAccount::Display()
     //refresh window
     wrefresh(m_wnd);
     int ch = getch();
+    bool fieldEdited = false; //field content changed by this key
 
     //clear status bar from previous messages
     m_statusBar->StatusBar();
@@ -234,11 +249,13 @@ IErrorHandler::StatusCode TuiAccount::Display()
     case 127: //XFree 4 style
       if (m_fieldsLocked) break; //no action if record is locked
       form_driver(m_accountForm, REQ_DEL_PREV);      
+      fieldEdited = true;
       break;
     case CTRL('d'):
     case KEY_DC:
       if (m_fieldsLocked) break; //no action if record is locked
       form_driver(m_accountForm, REQ_DEL_CHAR);      
+      fieldEdited = true;
       break;
     case CTRL('k'):
       if (m_fieldsLocked) break; //no action if record is locked
@@ -246,6 +263,7 @@ IErrorHandler::StatusCode TuiAccount::Display()
       cutPasteBuffer=TrimStr( static_cast<char*>( field_buffer (m_accountFields[fieldSelected], 0) ) );
       *log << ILog::DEBUG << "Cutting: " << cutPasteBuffer << ILog::endmsg;
       form_driver(m_accountForm, REQ_CLR_EOF);      
+      fieldEdited = true;
       break;
     case CTRL('y'):
       if (m_fieldsLocked) break; //no action if record is locked
@@ -280,6 +298,7 @@ IErrorHandler::StatusCode TuiAccount::Display()
 	if (m_statusCode >= SC_ERROR)
 	  return m_statusCode;      
 	//find corresponding field in m_record to delete
+	ARecord::FieldsPin pin(m_record);
 	ARecord::TFieldsIterator recordF = m_record->GetFieldsIterBegin();
 	//need to loop only to < curF since we're incerementing every time from the beginning
 	for (int curF = 0; curF < selF; curF++)
@@ -328,11 +347,17 @@ IErrorHandler::StatusCode TuiAccount::Display()
 	AddRecordFields(accountType);	
 	if (m_statusCode >= SC_ERROR) 
 	  return m_statusCode;  
+	if (m_accountType.empty())
+	  m_accountType = accountType.GetAccountName();
 	CreateFields();
 	if (m_statusCode >= SC_ERROR) 
 	  return m_statusCode;         
 	break;
       }
+    case CTRL('g'):
+      if (m_fieldsLocked) break; //no action if record is locked
+      GeneratePassword();
+      break;
     case CTRL('l'):
       // call label or essential selection, if applicable
       if (fieldSelected == fLabelsIdx) {
@@ -398,6 +423,8 @@ IErrorHandler::StatusCode TuiAccount::Display()
       } else {
 	// fields unlocked: save record and quit
 	// TODO: ask for confirmation with statusbar
+	if (not ConfirmBreachedPasswords())
+	  break; //keep editing
 	m_statusCode = SC_OK;
 	quitAccount = true;
       }
@@ -406,10 +433,14 @@ IErrorHandler::StatusCode TuiAccount::Display()
     default:
       if (m_fieldsLocked) break; //no action if record is locked
       form_driver(m_accountForm, ch);
+      fieldEdited = true;
       break;
 
     } // end switch of input char
 
+    if (fieldEdited)
+      ShowPasswordStrength();
+
     // handle special actions at field change
     int newFieldSelected = field_index(current_field(m_accountForm));
     if ((newFieldSelected != fieldSelected) and (not m_fieldsLocked)) {
@@ -446,6 +477,11 @@ IErrorHandler::StatusCode TuiAccount::Display()
       } else {
 	//restore (even if not always necessary) usual command bar
 	m_statusBar->CommandBar(m_commands);
+	if (newFieldSelected >= m_numberFieldsAccProp) {
+	  string title(static_cast<char*>(field_userptr(m_accountFields[newFieldSelected])));
+	  if (cfgMgr->IsSecretField(title))
+	    m_statusBar->StatusBar("Press ^G to generate a new password.");
+	}
       }
     }
     fieldSelected = newFieldSelected; //store new selected field
@@ -529,6 +565,7 @@ IErrorHandler::StatusCode TuiAccount::NewAccount()
 
   // --- create new account m_record and add predefined fields (if any)
   NewRecord();
+  m_accountType = accountType.GetAccountName();
   AddRecordFields(accountType,true); //force over-writing of fields (should not be needed)
   if (! (accountType.GetAccountName().empty() || accountType.GetAccountName() == "EMPTY"))
     m_record->SetAccountName(accountType.GetAccountName()); //default account name
@@ -720,6 +757,13 @@ SourceURI TuiAccount::SelectSource()
     sourceSelectedStr = allSources[sourceSelected];
     m_source = sourceSelectedStr; // set also m_source
     m_statusCode = SC_OK;
+    //load it now if it was not used yet (or evicted)
+    StatusCode scLoad = ioSvcM->Use(sourceSelectedStr);
+    if (scLoad >= SC_ERROR && scLoad != SC_NOT_FOUND) {
+      m_errorMsg = "Cannot load the selected source.";
+      sourceSelectedStr.SetURI("");
+      m_statusCode = scLoad;
+    }
   }
 
   //clear screen
@@ -1046,6 +1090,7 @@ void TuiAccount::CreateFields()
   int starty=1; //m_wnd_y; // start from 1, since first row is for title: --- Account properties ---
   totfields += m_record->GetNumberOfFields(); // add number of custom fields
   m_accountFields = new FIELD* [totfields+1]; //space for empty field at the end
+  ARecord::FieldsPin pin(m_record); //fields stay open while iterated
   ARecord::TFieldsIterator itf=m_record->GetFieldsIterBegin();
   for (int idf = 0; idf < totfields; ++idf) {
     // boundary check.. just to be sure
@@ -1133,6 +1178,104 @@ void TuiAccount::CreateFields()
 
 }
 
+void TuiAccount::GeneratePassword()
+{
+  int selF = field_index(current_field(m_accountForm));
+  if (selF == ERR || selF < m_numberFieldsAccProp) {
+    m_statusBar->StatusBar("Select the field to fill with a generated password.");
+    return;
+  }
+  if (!m_pwdGenerator)
+    m_pwdGenerator = new PasswordGeneratorTool("TuiPwdGen");
+  PasswordGeneratorTool::PasswordPolicy policy = cfgMgr->GetPasswordPolicy(m_accountType.empty() ? "Default" : m_accountType);
+  string newPwd;
+  if (m_pwdGenerator->Generate(policy, newPwd) != SC_OK) {
+    m_statusBar->StatusBar(string("Cannot generate password: ") + m_pwdGenerator->GetErrorMsg());
+    return;
+  }
+  //replace field content emulating user input (field size grows as needed)
+  form_driver(m_accountForm, REQ_CLR_FIELD);
+  for (string::iterator itc = newPwd.begin(); itc != newPwd.end(); ++itc)
+    form_driver(m_accountForm, *itc);
+  ISecurityTool::ClearString(newPwd);
+  ostringstream genMsg;
+  genMsg << "New password generated (policy " << policy.name << ", about "
+	 << (int)m_pwdGenerator->EntropyBits(policy) << " bits of entropy)";
+  m_statusBar->StatusBar(genMsg.str());
+}
+
+void TuiAccount::ShowPasswordStrength()
+{
+  int selF = field_index(current_field(m_accountForm));
+  if (selF == ERR || selF < m_numberFieldsAccProp)
+    return;
+  string title(static_cast<char*>(field_userptr(m_accountFields[selF])));
+  if (not cfgMgr->IsSecretField(title))
+    return;
+  if (!m_pwdStrength) {
+    m_pwdStrength = new PasswordStrengthTool("TuiPwdStrength");
+    m_pwdStrength->LoadDictionary(cfgMgr->GetStrengthDictionary());
+  }
+  //sync field buffer with what has been typed so far
+  form_driver(m_accountForm, REQ_VALIDATION);
+  string pwd( TrimStr( static_cast<char*>( field_buffer (m_accountFields[selF], 0) ) ) );
+  if (pwd.empty())
+    return;
+  PasswordStrengthTool::Result strength = m_pwdStrength->Evaluate(pwd, PasswordStrengthTool::GetUserInputs(m_record));
+  ISecurityTool::ClearString(pwd);
+  ostringstream strengthMsg;
+  strengthMsg << "Password strength: " << strength.score << "/4 (" << strength.GetScoreStr()
+	      << "), about 10^" << strength.GetLog10Guesses() << " guesses";
+  string feedback = strength.GetFeedback();
+  if (not feedback.empty())
+    strengthMsg << ". " << feedback;
+  m_statusBar->StatusBar(strengthMsg.str());
+}
+
+bool TuiAccount::ConfirmBreachedPasswords()
+{
+  if (!m_breachCheckInit) {
+    m_breachCheckInit = true;
+    if (not cfgMgr->GetBreachCorpus().empty() || not cfgMgr->GetBreachFilter().empty()) {
+      m_breachCheck = new BreachCheckTool("TuiBreachCheck");
+      if (not cfgMgr->GetBreachFilter().empty())
+	m_breachCheck->LoadFilter(cfgMgr->GetBreachFilter());
+      if (not cfgMgr->GetBreachCorpus().empty())
+	m_breachCheck->LoadCorpus(cfgMgr->GetBreachCorpus());
+    }
+  }
+  if (!m_breachCheck || not m_breachCheck->IsReady())
+    return true; //nothing to check against
+  //sync field buffer with what has been typed so far
+  form_driver(m_accountForm, REQ_VALIDATION);
+  for (int f = m_numberFieldsAccProp; f < field_count(m_accountForm); f++) {
+    string title(static_cast<char*>(field_userptr(m_accountFields[f])));
+    if (not cfgMgr->IsSecretField(title))
+      continue;
+    string pwd( TrimStr( static_cast<char*>( field_buffer (m_accountFields[f], 0) ) ) );
+    if (pwd.empty())
+      continue;
+    long breachCount = m_breachCheck->Check(pwd);
+    ISecurityTool::ClearString(pwd);
+    if (breachCount == 0)
+      continue;
+    ostringstream question;
+    question << title;
+    if (breachCount == BreachCheckTool::BREACH_POSSIBLE)
+      question << " possibly found in known breaches.";
+    else
+      question << " found " << breachCount << " times in known breaches.";
+    question << " Save anyway (y/n)";
+    string answer;
+    m_statusBar->StatusBar(question.str(), answer, TuiStatusBar::SBIN_YN);
+    if (answer != "Y") {
+      set_current_field(m_accountForm, m_accountFields[f]);
+      return false;
+    }
+  }
+  return true;
+}
+
 void TuiAccount::UpdateAndFreeForm()
 {
   m_statusCode = SC_OK;
@@ -1149,6 +1292,7 @@ void TuiAccount::UpdateAndFreeForm()
   // Call this function with the same structure of fields in the record and the form (should always be) or 
   // results can be not quite right in some peculiar cases of multiple same-name fields added/deleted.
   *log << ILog::DEBUG << "Updating m_record." << this << ILog::endmsg;
+  ARecord::FieldsPin pin(m_record); //values are written through recordField: they must stay open
   ARecord::TFieldsIterator recordField = m_record->GetFieldsIterBegin();
   for (int idx = 0; m_accountFields[idx] != NULL; idx++) {
     //get field content and title
@@ -1191,6 +1335,7 @@ void TuiAccount::UpdateAndFreeForm()
       ++recordField;
     }
   } // loop over fields
+  m_record->UpdateSearchText(); //values changed in place
 
   *log << ILog::DEBUG << "m_record updated." << this << ILog::endmsg;
   m_record->SetLock(ARecord::LOCKED);
@@ -18,6 +18,9 @@
 #include "SourceURI.h"
 #include "ARecord.h"
 #include "IConfigurationService.h"
+#include "PasswordGeneratorTool.h"
+#include "PasswordStrengthTool.h"
+#include "BreachCheckTool.h"
 
 /**  Text User Interface editing account page.
  * It also allows selection of destination source and account type.
@@ -35,6 +38,19 @@ class TuiAccount : public ITuiPage {
   /// Store the managed ARecord class containing the actual account info
   ARecord *m_record;
 
+  /// Predefined account type the record was created from (selects the password policy)
+  std::string m_accountType;
+
+  /// Password generator, created at first use
+  PasswordGeneratorTool *m_pwdGenerator;
+
+  /// Password strength estimator, created at first use
+  PasswordStrengthTool *m_pwdStrength;
+
+  /// Breached passwords check, created at first use (0 if not configured)
+  BreachCheckTool *m_breachCheck;
+  bool m_breachCheckInit; ///< true once creation of m_breachCheck has been attempted
+
   /// Command-bar 
   std::vector< std::pair< std::string, std::string > > m_commands;
   
@@ -196,6 +212,21 @@ class TuiAccount : public ITuiPage {
    */
   void CreateFields();
 
+  /** Fill the current field with a generated password.
+   * The policy is chosen from the account type, "Default" if none.
+   */
+  void GeneratePassword();
+
+  /** Show the strength of the password being typed in the status bar.
+   * Only done if the current field is a secret one.
+   */
+  void ShowPasswordStrength();
+
+  /** Check secret fields against known breaches before saving.
+   * @return false if a breached password was found and the user chose to keep editing
+   */
+  bool ConfirmBreachedPasswords();
+
   /** Updates m_record from field content and frees associated memory. */
   void UpdateAndFreeForm();
 
@@ -15,6 +15,8 @@
 #include "MultipleSourceIOSvc.h"
 #include "TuiSvc.h"
 
+#include <unordered_set>
+
 extern ILog *log;
 extern IConfigurationService *cfgMgr;
 extern IIOService *ioSvc;
@@ -113,6 +115,7 @@ IErrorHandler::StatusCode TuiBrowse::Kill()
     delete[] m_loaList;
   }
   m_listOfRecords.clear();
+  m_snapshot.reset();
   m_loaLabels.clear();
   m_loaList = 0;
   m_loaMenu = 0;
@@ -151,7 +154,7 @@ IErrorHandler::StatusCode TuiBrowse::Display()
   int recordSelection = -1; 
   bool quitBrowsing=false;
   while (not quitBrowsing) {
-    int c = getch();
+    int c = m_statusBar->WaitKey();
     m_statusBar->StatusBar(); //clear status bar from previous messages. half_delay set to appropriate value.
     switch (c) {
     case KEY_DOWN:
@@ -188,47 +191,41 @@ IErrorHandler::StatusCode TuiBrowse::Display()
       quitBrowsing=true;
       break;
     case KEY_BACKSPACE:
-      //clear last character of search pattern
-      menu_driver(m_loaMenu, REQ_BACK_PATTERN);
-      break;
-    case KEY_CANCEL:
-      {
-	//delete search pattern and sorting
-	menu_driver(m_loaMenu, REQ_CLEAR_PATTERN);
-	m_sortingMode = IIOService::ACCOUNTS_SORT_NOSORT;
-	vector<ARecord*> newListRecords = ioSvc->GetAllAccounts(m_sortingMode);
-	UpdateListRecords(newListRecords);
-	post_menu(m_loaMenu);
-	//refresh screen
-	wrefresh(m_wnd);
-	break;
+      //clear last character of search pattern (whole UTF-8 character)
+      if (not m_fuzzyPattern.empty()) {
+	size_t last = m_fuzzyPattern.size() - 1;
+	while (last > 0 && (m_fuzzyPattern[last] & 0xC0) == 0x80)
+	  last--;
+	m_fuzzyPattern.erase(last);
+	FilterRecords();
       }
-    case CTRL('s'):
-      //next search match
-      menu_driver(m_loaMenu, REQ_NEXT_MATCH);
       break;
-    case CTRL('a'):
-      //previous search match
-      menu_driver(m_loaMenu, REQ_PREV_MATCH);
+    case KEY_CANCEL:
+      //delete search pattern, label filter and sorting
+      m_fuzzyPattern.clear();
+      m_labelQuery.clear();
+      m_sortingMode = IIOService::ACCOUNTS_SORT_NOSORT;
+      FilterRecords();
       break;
     case CTRL('n'):
-      {
-	m_sortingMode = IIOService::ACCOUNTS_SORT_BYNAME;
-	vector<ARecord*> newListRecords = ioSvc->GetAllAccounts(m_sortingMode);
-	UpdateListRecords(newListRecords);
-	post_menu(m_loaMenu);
-	//refresh screen
-	wrefresh(m_wnd);        
-	break;
-      }
+      m_fuzzyPattern.clear();
+      m_sortingMode = IIOService::ACCOUNTS_SORT_BYNAME;
+      FilterRecords();
+      break;
     case CTRL('d'):
+      m_fuzzyPattern.clear();
+      m_sortingMode = IIOService::ACCOUNTS_SORT_BYDATE;
+      FilterRecords();
+      break;
+    case CTRL('l'):
       {
-	m_sortingMode = IIOService::ACCOUNTS_SORT_BYDATE;
-	vector<ARecord*> newListRecords = ioSvc->GetAllAccounts(m_sortingMode);
-	UpdateListRecords(newListRecords);
-	post_menu(m_loaMenu);
-	//refresh screen
-	wrefresh(m_wnd);
+	//show only the records matching a label query
+	string query, previousQuery = m_labelQuery;
+	m_statusBar->StatusBar("Labels (e.g. work AND NOT old), empty for all:", query);
+	m_labelQuery = TrimStr(query);
+	if (not FilterRecords())
+	  m_labelQuery = previousQuery;
+	SetCommandBarNavigation();
 	break;
       }
     case CTRL('r'):
@@ -239,10 +236,10 @@ IErrorHandler::StatusCode TuiBrowse::Display()
 	break;      
       }
     default:
-      //assume it's a search character
-      if (c < 255) {
-	*log << ILog::VERBOSE << "Add to search buffer: " << (char)c << this << ILog::endmsg;
-	menu_driver(m_loaMenu, (char)c);
+      //assume it's a search character: show best matching records first
+      if (c >= 32 && c < 255) {
+	m_fuzzyPattern += (char)c;
+	FilterRecords();
       }
     }
     wrefresh(m_wnd);
@@ -286,6 +283,9 @@ IErrorHandler::StatusCode TuiBrowse::UpdateListRecords(vector<ARecord*> &newList
   m_loaMenu = 0;
   m_listOfRecords.clear();
   m_loaLabels.clear();
+  //records just found are in the current snapshot: keeping it, they stay valid
+  //if they are removed or their source evicted meanwhile (see RecordSnapshot::Epoch)
+  m_snapshot = ioSvc->GetSnapshot();
 
   //Now assign new list and create menu items
   // format of items: ModificationDate, AccountName
@@ -340,8 +340,7 @@ void TuiBrowse::SetCommandBarNavigation()
   std::vector< std::pair<std::string, std::string> > m_commands;
   m_commands.push_back(make_pair("^C", "Main Menu"));
   m_commands.push_back(make_pair("Del","Clear search"));
-  m_commands.push_back(make_pair("^S", "Next match"));
-  m_commands.push_back(make_pair("^A", "Prev. match"));
+  m_commands.push_back(make_pair("^L", "Filter labels"));
   m_commands.push_back(make_pair("^N", "Order by Name"));
   m_commands.push_back(make_pair("^D", "Order by Date"));
   m_commands.push_back(make_pair("^R", "Remove record"));
@@ -370,7 +369,11 @@ void TuiBrowse::ViewRecord(ARecord *record)
 	m_statusBar->StatusBar("ERROR saving changes. Changes likely not saved.");
       } else {
 	*log << ILog::INFO << "Saved changes to record." << this << ILog::endmsg;
-	m_statusBar->StatusBar("Successfully saved changes.");
+	string writeMsg;
+	if (ioSvc->GetWriteState(writeMsg) == IIOService::WRITE_PENDING)
+	  m_statusBar->StatusBar("Saving changes..."); //written in the background
+	else
+	  m_statusBar->StatusBar("Successfully saved changes.");
       }
     } else if (m_statusCode == SC_ABORT) {
       *log << ILog::INFO << "Aborting editing of account." << this << ILog::endmsg;
@@ -403,14 +406,67 @@ void TuiBrowse::RemoveRecord(ARecord *record)
     }
     //print confirmation and update current list of records
     if (m_statusCode < SC_ERROR) m_statusBar->StatusBar(string("Removed record: ")+nameOfRemoved);
-    vector<ARecord*> newListRecords = ioSvc->GetAllAccounts(m_sortingMode);
-    UpdateListRecords(newListRecords);
-    post_menu(m_loaMenu);
-    //refresh screen
-    wrefresh(m_wnd);  
+    //the removed record must not be shown any more
+    m_fuzzyPattern.clear();
+    if (not FilterRecords()) {
+      m_labelQuery.clear();
+      FilterRecords();
+    }
   } else {
     m_statusBar->StatusBar("Removal CANCELLED.");
   }  
   SetCommandBarNavigation();
 }
 
+
+bool TuiBrowse::FilterRecords()
+{
+  //only rank as many records as fit in the window
+  int nColumns = static_cast<int>(COLS / m_nColsPerItem);
+  if (nColumns < 1) nColumns = 1;
+  size_t maxResults = (m_wnd_lines-1)*nColumns;
+  // --- Records with the requested labels, if any
+  unordered_set<ARecord*> labelMatches;
+  if (not m_labelQuery.empty()) {
+    vector<ARecord*> matches = ioSvc->FindByLabelQuery(m_labelQuery);
+    string errorMsg;
+    if (ioSvc->GetErrorMsg(errorMsg) >= SC_ERROR) {
+      m_statusBar->StatusBar(errorMsg); //"Invalid label query: ..."
+      return false;
+    }
+    labelMatches.insert(matches.begin(), matches.end());
+  }
+  // --- Records to show, keeping their order
+  vector<ARecord*> newListRecords;
+  if (m_fuzzyPattern.empty())
+    newListRecords = ioSvc->GetAllAccounts(m_sortingMode);
+  else
+    newListRecords = ioSvc->FindFuzzy(m_fuzzyPattern, m_labelQuery.empty() ? maxResults : 0);
+  if (not m_labelQuery.empty()) {
+    vector<ARecord*> filtered;
+    for (vector<ARecord*>::iterator itr = newListRecords.begin(); itr != newListRecords.end(); ++itr)
+      if (labelMatches.count(*itr))
+	filtered.push_back(*itr);
+    if (not m_fuzzyPattern.empty() && filtered.size() > maxResults)
+      filtered.resize(maxResults);
+    newListRecords.swap(filtered);
+  }
+  string filter;
+  if (not m_labelQuery.empty())
+    filter = string("Labels: ") + m_labelQuery + string("  ");
+  if (not m_fuzzyPattern.empty())
+    filter += string("Search: ") + m_fuzzyPattern;
+  if (newListRecords.empty() && not filter.empty()) {
+    //keep the current list
+    m_statusBar->StatusBar(string("No account matches. ") + filter);
+    return false;
+  }
+  *log << ILog::VERBOSE << "Search buffer: " << m_fuzzyPattern << ", label query: " << m_labelQuery << this << ILog::endmsg;
+  UpdateListRecords(newListRecords);
+  post_menu(m_loaMenu);
+  //refresh screen
+  wrefresh(m_wnd);
+  if (not filter.empty())
+    m_statusBar->StatusBar(filter);
+  return true;
+}
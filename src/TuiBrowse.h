@@ -13,6 +13,7 @@
 
 #include "ITuiPage.h"
 #include "TuiAccount.h"
+#include "RecordSnapshot.h"
 
 
 /** Text user interface for account browsing / editing. */
@@ -36,6 +37,11 @@ class TuiBrowse : public ITuiPage {
 
   /// Remove record
   void RemoveRecord(ARecord *record);
+
+  /** Show the records matching m_labelQuery, best matching m_fuzzyPattern first (all if both empty).
+   * @return false if no record matches or the query is not valid (the list shown is not changed)
+   */
+  bool FilterRecords();
   
   // ----------------------------------------
   // --- ncurses objects
@@ -61,10 +67,18 @@ class TuiBrowse : public ITuiPage {
 
   ///List of currently displayed records
   std::vector<ARecord*> m_listOfRecords;
+  ///Snapshot the displayed records belong to
+  RecordSnapshot::Ptr m_snapshot;
 
   ///Labels for menu display
   std::vector<std::pair<std::string,std::string> > m_loaLabels;
 
+  ///Characters typed to filter the records (fuzzy search)
+  std::string m_fuzzyPattern;
+
+  ///Label query to filter the records (see IIOService::FindByLabelQuery)
+  std::string m_labelQuery;
+
  public:
 
   // ----------------------------------------
@@ -102,8 +116,6 @@ class TuiBrowse : public ITuiPage {
   /// Number of colimns for displaying each item
   void SetNColumnsPerItem(int pNCols);
 
-  //@TODO Allow filtering of items
-
 };
 
 #endif
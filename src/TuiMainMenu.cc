@@ -142,7 +142,7 @@ IErrorHandler::StatusCode TuiMainMenu::Display()
   //enter the main loop
   menuSelection = NOT_VALID;
   while (menuSelection == NOT_VALID) {
-    int c = getch();
+    int c = m_statusBar->WaitKey(true); //no records in use here
     m_statusBar->StatusBar(); //clear status bar from previous messages. half_delay set to appropriate value.
     switch (c) {
     case KEY_DOWN:
@@ -13,10 +13,12 @@
 #include "IConfigurationService.h"
 #include "TuiSvc.h"
 #include "MiscUtils.h"
+#include "MultipleSourceIOSvc.h"
 
 #include <errno.h>
 
 extern ILog *log;
+extern IIOService *ioSvc;
 extern IConfigurationService *cfgMgr;
 extern TuiSvc *tuiSvc;
 
@@ -36,6 +38,7 @@ TuiStatusBar::TuiStatusBar(string pName) : IErrorHandler(pName)
   m_maxDescriptionSize = 20;
   m_headerFixedString = "CSM, ";
   m_headerFixedString += cfgMgr->version;  
+  m_writeState = IIOService::WRITE_DONE;
 }
 
 TuiStatusBar::~TuiStatusBar()
@@ -157,6 +160,34 @@ void TuiStatusBar::StatusBar(string pStatus, bool pRefresh)
     wrefresh(m_sbwnd);
 }
 
+int TuiStatusBar::WaitKey(bool pIdle)
+{
+  MultipleSourceIOSvc *ioSvcM = dynamic_cast<MultipleSourceIOSvc*>(ioSvc);
+  bool evict = pIdle && ioSvcM && ioSvcM->IsEvictionEnabled();
+  while (true) {
+    string msg;
+    IIOService::WriteState state = ioSvc->GetWriteState(msg);
+    if (state != m_writeState) {
+      if (state == IIOService::WRITE_FAILED)
+	StatusBar(string("ERROR writing changes to disk: ") + msg);
+      else if (state == IIOService::WRITE_DONE)
+	StatusBar("All changes written to disk.");
+      m_writeState = state;
+    }
+    //poll while changes are pending, to report when they are written
+    if (state == IIOService::WRITE_PENDING)
+      timeout(250);
+    else
+      timeout(evict ? 1000 : -1); //check for idle sources every second
+    int c = getch();
+    timeout(-1);
+    if (c != ERR)
+      return c;
+    if (evict)
+      ioSvcM->EvictIdle();
+  }
+}
+
 IErrorHandler::StatusCode TuiStatusBar::StatusBar(string pQuestion, string &pAnswer, TStatusBarInput pInputType)
 {
   m_statusCode = SC_OK;
@@ -16,6 +16,7 @@
 #include <string>
 
 #include "IErrorHandler.h"
+#include "IIOService.h"
 #include "ITuiPage.h"
 
 
@@ -36,6 +37,9 @@ class TuiStatusBar : public IErrorHandler {
   // Keep track of current command bar
   std::vector<std::pair<std::string, std::string> > m_commands;
 
+  /// Last state of the changes being written (write-behind)
+  IIOService::WriteState m_writeState;
+
  public:
   // ----------------------------------------
   // --- Constructor
@@ -88,6 +92,15 @@ class TuiStatusBar : public IErrorHandler {
    */
   StatusCode StatusBar(std::string pQuestion, std::string &pAnswer, TStatusBarInput pInputType = SBIN_STRING);
 
+  /** Wait for a key pressed by the user.
+   * While changes are being written in the background (write-behind),
+   * reports in the status bar when they are written or if writing them failed.
+   * @param pIdle true if no records are in use meanwhile: sources not used for a while
+   *        can be evicted from memory (see MultipleSourceIOSvc::EvictIdle())
+   * @return the key pressed, as getch()
+   */
+  int WaitKey(bool pIdle=false);
+
   // ----------------------------------------
   // --- Command Bar
   // ----------------------------------------  
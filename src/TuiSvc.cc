@@ -112,6 +112,14 @@ IErrorHandler::StatusCode TuiSvc::CloseTui()
   return SC_OK;
 }
 
+void TuiSvc::RestoreTerminal()
+{
+  if (not m_mwnd || isendwin())
+    return;
+  curs_set(1);
+  endwin();
+}
+
 void TuiSvc::MainMenu()
 {
   //create main menu page
@@ -75,6 +75,11 @@ class TuiSvc : public IErrorHandler {
   /// Run the user interface
   virtual StatusCode Run();
 
+  /** Give the terminal back to the shell, from any thread, before the process is terminated.
+   * Used when a signal ends the program while the user interface runs (see FlushOnSignal()).
+   */
+  void RestoreTerminal();
+
   // --- Accessors
   int GetScreenRows(); ///< return number of screen rows
   int GetScreenCols(); ///< return number of screen columns
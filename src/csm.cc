@@ -16,17 +16,41 @@
 #include <sstream>
 #include <getopt.h>
 #include <algorithm>
+#include <set>
+#include <thread>
+#include <signal.h>
+#include <unistd.h>
 
 // --- Base includes
 #include "csm.h"
 
 #include "ISearchTool.h"
+#include "MiscUtils.h"
 
 using namespace std;
 
 void CleanUp();
 void Usage(char **argv);
 std::string cleanForCSV(std::string str);
+RecordSnapshot::Ptr CollectSecretFields(std::vector< std::pair<ARecord*, std::string> > &pSecrets);
+void RekeyProgress(SourceURI pSource, IErrorHandler::StatusCode pResult, bool pSkipped, size_t pDone, size_t pTotal);
+void FlushOnSignal(sigset_t pSignals);
+
+/// Records found by a quick search, up to a limit (0: no limit), only those with the requested labels if any
+class QuickSearchResults : public RecordVisitor {
+public:
+  vector<ARecord*> records;
+  size_t limit;
+  const set<ARecord*> *withLabels; ///< 0: no label query
+  QuickSearchResults(size_t pLimit, const set<ARecord*> *pWithLabels) : limit(pLimit), withLabels(pWithLabels) {}
+  virtual bool Visit(ARecord *pRecord)
+  {
+    if (withLabels && not withLabels->count(pRecord))
+      return true;
+    records.push_back(pRecord);
+    return limit == 0 || records.size() < limit; //stop the search once enough records are found
+  }
+};
 
 /** CSM Main function */
 int main(int argc, char **argv)
@@ -37,6 +61,7 @@ int main(int argc, char **argv)
   runningSecurityChecks = 0;
   ioSvc = 0;
   tuiSvc = 0;
+  recordSealer = 0;
   // --- General initializations
   setlocale (LC_ALL, "");  
   // --- Define CSM services and tools
@@ -55,7 +80,7 @@ int main(int argc, char **argv)
   dynamic_cast<LogLocalFile*>(log)->SetLocalFileName(logFileName);
   log->Init();
   // -- Running Security Service
-  runningSecurityChecks = new DummyRunSecurityService("RunSecSvc");
+  runningSecurityChecks = new LocalRunSecurityService("RunSecSvc");
   // -- IO Service, manage account. Multiple source management.
   ioSvc = new MultipleSourceIOSvc("IOSvc");
 
@@ -69,11 +94,22 @@ int main(int argc, char **argv)
   // - Search options
   bool cfg_verboseSearchResults=false;
   bool cfg_regexSearch=false;
+  bool cfg_fuzzySearch=false;
+  bool cfg_querySearch=false;
+  string cfg_labelQuery;
+  size_t cfg_limit=0; //0: all matches
   // - Create new source
   string cfg_userName;
   string cfg_userKey;
   // - Export to file
   string cfg_exportFilename;
+  // - Password generation
+  long cfg_genNumber=0;
+  string cfg_genPolicy="Default";
+  // - Password strength
+  string cfg_compiledDictFile;
+  // - Breached passwords
+  string cfg_breachFilterFile;
   
   int c;
   //int digit_optind = 0;
@@ -89,6 +125,11 @@ int main(int argc, char **argv)
 	{"config", required_argument, 0, 'c'},
 	//Search options
 	{"regexp", no_argument, 0, 'e'},
+	{"fuzzy", no_argument, 0, 'z'},
+	{"query", no_argument, 0, 'q'},
+	{"label", required_argument, 0, 'l'},
+	{"limit", required_argument, 0, 'n'},
+	{"first", no_argument, 0, 2},
 	{"verbose", no_argument, 0, 'v'},
 	//Create source options
 	{"create", no_argument, 0, 'C'},
@@ -96,10 +137,23 @@ int main(int argc, char **argv)
 	{"user", required_argument, 0, 'u'},
   //Export to CSV file
   {"export-csv", required_argument, 0, 'x'},
+	//Key rotation
+	{"rekey", no_argument, 0, 'R'},
+	//Password generation
+	{"gen", required_argument, 0, 'g'},
+	{"policy", required_argument, 0, 'p'},
+	//Password strength
+	{"compile-dict", required_argument, 0, 'D'},
+	{"audit-strength", no_argument, 0, 'A'},
+	//Breached passwords
+	{"audit-breach", no_argument, 0, 'B'},
+	{"build-breach-filter", required_argument, 0, 'F'},
+	//Reused passwords
+	{"audit-reuse", no_argument, 0, 'U'},
 	//trailer
 	{0, 0, 0, 0}
       };    
-    c = getopt_long (argc, argv, "hs:fc:evCk:u:x:", csm_options, &option_index); 
+    c = getopt_long (argc, argv, "hs:fc:ezql:n:vCk:u:x:Rg:p:D:ABF:U", csm_options, &option_index); 
 
     if (c==-1)
       break;
@@ -121,6 +175,31 @@ int main(int argc, char **argv)
       cfg_regexSearch=true;
       log->say(ILog::INFO, "Use of regexp search set from command-line");
       break;
+    case 'z':
+      cfg_fuzzySearch=true;
+      log->say(ILog::INFO, "Use of fuzzy search set from command-line");
+      break;
+    case 'q':
+      cfg_querySearch=true;
+      log->say(ILog::INFO, "Use of structured query search set from command-line");
+      break;
+    case 'l':
+      cfg_labelQuery = optarg;
+      *log << ILog::INFO << "Label query from command-line: " << cfg_labelQuery << ILog::endmsg;
+      break;
+    case 'n':
+      if (atol(optarg) <= 0) {
+	cerr << "Invalid number of matches to print: " << optarg << endl;
+	Usage(argv);
+	return 1;
+      }
+      cfg_limit = atol(optarg);
+      *log << ILog::INFO << "Search limited from command-line to matches: " << (unsigned long)cfg_limit << ILog::endmsg;
+      break;
+    case 2:
+      cfg_limit = 1;
+      log->say(ILog::INFO, "Search limited from command-line to the first match");
+      break;
     case 'v':
       cfg_verboseSearchResults=true;
       log->say(ILog::INFO, "Verbose search printout set from command-line");
@@ -141,6 +220,46 @@ int main(int argc, char **argv)
       cfg_exportFilename = optarg;
       *log << ILog::INFO << "Export to CSV file:: " << cfg_exportFilename << ILog::endmsg;
       break;
+    case 'R':
+      cfg_action = act_rekey;
+      log->say(ILog::INFO, "Key rotation requested by command-line");
+      break;
+    case 'g':
+      cfg_action = act_generate;
+      cfg_genNumber = atol(optarg);
+      if (cfg_genNumber <= 0) {
+	cerr << "Invalid number of passwords to generate: " << optarg << endl;
+	Usage(argv);
+	return 1;
+      }
+      *log << ILog::INFO << "Password generation requested by command-line: " << (unsigned long)cfg_genNumber << ILog::endmsg;
+      break;
+    case 'p':
+      cfg_genPolicy = optarg;
+      *log << ILog::INFO << "Password policy from command-line: " << cfg_genPolicy << ILog::endmsg;
+      break;
+    case 'D':
+      cfg_action = act_compileDict;
+      cfg_compiledDictFile = optarg;
+      *log << ILog::INFO << "Dictionary compilation requested by command-line: " << cfg_compiledDictFile << ILog::endmsg;
+      break;
+    case 'A':
+      cfg_action = act_auditStrength;
+      log->say(ILog::INFO, "Password strength audit requested by command-line");
+      break;
+    case 'B':
+      cfg_action = act_auditBreach;
+      log->say(ILog::INFO, "Breached passwords audit requested by command-line");
+      break;
+    case 'F':
+      cfg_action = act_buildBreachFilter;
+      cfg_breachFilterFile = optarg;
+      *log << ILog::INFO << "Breach filter build requested by command-line: " << cfg_breachFilterFile << ILog::endmsg;
+      break;
+    case 'U':
+      cfg_action = act_auditReuse;
+      log->say(ILog::INFO, "Reused passwords audit requested by command-line");
+      break;
     case 'h':
     default:
       Usage(argv);
@@ -153,8 +272,8 @@ int main(int argc, char **argv)
     if (not cfg_exportFilename.empty()) {
       //export to CSV file
       cfg_action = act_export;
-    } else if (optind < argc) {
-      //arguments found, perform a quick search on them
+    } else if (optind < argc || not cfg_labelQuery.empty()) {
+      //arguments (or labels) found, perform a quick search on them
       cfg_action = act_quickSearch;
     } else {
       //start gui
@@ -182,6 +301,8 @@ int main(int argc, char **argv)
   }
   cfgMgr->SetBruteForce(cfg_bruteForce);
   if (cfg_regexSearch) cfgMgr->SetSearchType(SearchRequest::REGEX);
+  if (cfg_fuzzySearch) cfgMgr->SetSearchType(SearchRequest::FUZZY);
+  if (cfg_querySearch) cfgMgr->SetSearchType(SearchRequest::QUERY);
   if (not cfg_userKey.empty())
     cfgMgr->SetUserKey(cfg_userKey);
   if (not cfg_userName.empty())
@@ -191,16 +312,30 @@ int main(int argc, char **argv)
   log->SetLogDetail(cfgMgr->logMessagesDetails);
 
 
-  // --- Preliminary checks
-  int currentSecurityLevel = runningSecurityChecks->Run();
-  if (currentSecurityLevel < cfgMgr->minRunSecurityLevel) {
-    ostringstream errMsg;
-    errMsg << "Running Security checks failed. " 
-	   << "Security: " << currentSecurityLevel
-	   << " (required: " << cfgMgr->minRunSecurityLevel << ")" 
-	   << endl;
-    log->say(ILog::FATAL, errMsg.str());
-    return CSM_SECURITY;
+  // --- Preliminary checks: run in background while sources are loaded, result collected before using them
+  runningSecurityChecks->AddSensitivePath(cfg_configFile);
+  vector<string> checkedSources = cfgMgr->inputURI;
+  if (not cfg_sourceURI.empty())
+    checkedSources.assign(1, cfg_sourceURI);
+  for (vector<string>::iterator itS = checkedSources.begin(); itS != checkedSources.end(); ++itS) {
+    SourceURI checkedSource(*itS);
+    if (checkedSource.GetField(SourceURI::TYPE) == "file")
+      runningSecurityChecks->AddSensitivePath(checkedSource.GetField(SourceURI::NAME) + "." +
+					      checkedSource.GetField(SourceURI::FORMAT));
+  }
+  runningSecurityChecks->Start();
+
+  // --- Keep record contents sealed in memory, if requested (before any record is loaded)
+  if (cfgMgr->GetSealRecords()) {
+    recordSealer = new RecordSealer("RecordSealer", cfgMgr->GetSealCacheSize());
+    if (recordSealer->IsReady()) {
+      ARecord::SetSealer(recordSealer);
+    } else {
+      log->say(ILog::ERROR, "Cannot create the key to seal records in memory.");
+      cerr << "WARNING: Record contents will not be sealed in memory. Consult log file: " << logFileName << endl;
+      delete recordSealer;
+      recordSealer = 0;
+    }
   }
 
 #ifndef DEBUG_CSM
@@ -218,7 +353,9 @@ int main(int argc, char **argv)
   ioSvc->SetKey(cfgMgr->GetUserKey());
   bool errorDuringSourceLoading=false;
   bool atLeastOneSourceLoaded=false;
-  if (cfg_action != act_createSource) {
+  bool loadSources = (cfg_action != act_createSource && cfg_action != act_rekey && cfg_action != act_generate &&
+		      cfg_action != act_compileDict && cfg_action != act_buildBreachFilter);
+  if (loadSources) {
     //Load data from source
     SourceURI inSource;
     if (not cfg_sourceURI.empty()) {
@@ -230,22 +367,45 @@ int main(int argc, char **argv)
 	atLeastOneSourceLoaded=true;
       }
     } else {
-      //load from config file
-      for (vector<string>::iterator sourceIt = cfgMgr->inputURI.begin(); sourceIt != cfgMgr->inputURI.end(); ++sourceIt) {
-	inSource.SetURI(*sourceIt);
-	if (ioSvc->Load(inSource) != IErrorHandler::SC_OK) {
-	  *log << ILog::ERROR << "ERROR loading source: " << inSource.GetFullURI() << ILog::endmsg;	  
+      //load from config file, all sources at once
+      vector<SourceURI> inSources;
+      for (vector<string>::iterator sourceIt = cfgMgr->inputURI.begin(); sourceIt != cfgMgr->inputURI.end(); ++sourceIt)
+	inSources.push_back(SourceURI(*sourceIt));
+      vector<IErrorHandler::StatusCode> loadResults;
+      if (cfg_action == act_startGui && cfgMgr->GetLoadOnDemand()) {
+	//sources are loaded when first used
+	if (ioSvc->Register(inSources) >= IErrorHandler::SC_ERROR)
+	  errorDuringSourceLoading=true;
+	loadResults.assign(inSources.size(), IErrorHandler::SC_OK);
+      } else
+	ioSvc->Load(inSources, loadResults);
+      for (size_t idx=0; idx < inSources.size(); idx++) {
+	if (loadResults[idx] != IErrorHandler::SC_OK) {
+	  *log << ILog::ERROR << "ERROR loading source: " << inSources[idx].GetFullURI() << ILog::endmsg;	  
 	  errorDuringSourceLoading=true;  
 	} else {
 	  atLeastOneSourceLoaded=true;
 	}
       }
     }
-    if (not atLeastOneSourceLoaded) {
-      *log << ILog::FATAL << "No sources could be loaded. Exiting" << ILog::endmsg;
-      cerr << "ERROR: No sources could be loaded. Exiting." << endl;
-      return CSM_WRONG_CONFIG;
-    }
+  }
+
+  int currentSecurityLevel = runningSecurityChecks->Wait();
+  if (currentSecurityLevel < cfgMgr->minRunSecurityLevel) {
+    ostringstream errMsg;
+    errMsg << "Running Security checks failed. " 
+	   << "Security: " << currentSecurityLevel
+	   << " (required: " << cfgMgr->minRunSecurityLevel << ")" 
+	   << endl;
+    log->say(ILog::FATAL, errMsg.str());
+    cerr << "FATAL: Running environment is not safe. Consult log file: " << logFileName << endl;
+    CleanUp();
+    return CSM_SECURITY;
+  }
+  if (loadSources && not atLeastOneSourceLoaded) {
+    *log << ILog::FATAL << "No sources could be loaded. Exiting" << ILog::endmsg;
+    cerr << "ERROR: No sources could be loaded. Exiting." << endl;
+    return CSM_WRONG_CONFIG;
   }
 
   if (cfg_action == act_quickSearch) {
@@ -262,7 +422,46 @@ int main(int argc, char **argv)
       if (itA+1 != cmdLineArguments.end())
 	searchPattern += string(" ");
     }
-    resultSearch = ioSvc->Find(searchPattern);
+    //records with the requested labels, if any
+    vector<ARecord*> labelMatches;
+    if (not cfg_labelQuery.empty()) {
+      labelMatches = ioSvc->FindByLabelQuery(cfg_labelQuery);
+      string errorMsg;
+      if (ioSvc->GetErrorMsg(errorMsg) >= IErrorHandler::SC_ERROR)
+	cerr << "ERROR: " << errorMsg << endl; //"Invalid label query: ..."
+    }
+    set<ARecord*> withLabels(labelMatches.begin(), labelMatches.end());
+    QuickSearchResults results(cfg_limit, cfg_labelQuery.empty() ? 0 : &withLabels);
+    if (cmdLineArguments.empty()) {
+      for (vector<ARecord*>::iterator it = labelMatches.begin(); it != labelMatches.end(); ++it)
+	if (not results.Visit(*it))
+	  break;
+    } else if (cfgMgr->GetSearchType() == SearchRequest::FUZZY) {
+      //best matches first
+      size_t maxResults = cfgMgr->GetFuzzyMaxResults();
+      if (maxResults == 0 || (cfg_limit > 0 && cfg_limit < maxResults))
+	maxResults = cfg_limit;
+      results.limit = maxResults;
+      vector<ARecord*> ranked = ioSvc->FindFuzzy(searchPattern, cfg_labelQuery.empty() ? maxResults : 0);
+      for (vector<ARecord*>::iterator it = ranked.begin(); it != ranked.end(); ++it)
+	if (not results.Visit(*it))
+	  break;
+    } else if (cfg_limit > 0) {
+      //stop searching once enough records are found
+      ioSvc->FindEach(searchPattern, cfgMgr->GetSearchType(), results);
+    } else {
+      vector<ARecord*> matches = ioSvc->Find(searchPattern, cfgMgr->GetSearchType());
+      for (vector<ARecord*>::iterator it = matches.begin(); it != matches.end(); ++it)
+	results.Visit(*it);
+    }
+    if (not cmdLineArguments.empty() && cfgMgr->GetSearchType() != SearchRequest::FUZZY) {
+      string errorMsg;
+      if (ioSvc->GetErrorMsg(errorMsg) >= IErrorHandler::SC_ERROR)
+	cerr << "ERROR: " << errorMsg << endl; //invalid regular expression or query
+    }
+    resultSearch.swap(results.records);
+    //records found stay valid while the snapshot taken after the search is kept
+    RecordSnapshot::Ptr snapshot = ioSvc->GetSnapshot();
     if (cfg_verboseSearchResults)
       cout << "CSM MATCHED RECORDS (" << ioSvc->GetSource().str()<< "): " << resultSearch.size() << endl;
     for (vector<ARecord*>::iterator it = resultSearch.begin(); it != resultSearch.end(); ++it) {
@@ -281,6 +480,7 @@ int main(int argc, char **argv)
 	  cout << *eit <<",";
 	cout << endl;
 	cout << " Fields: " << endl;
+	ARecord::FieldsPin pin(*it);
 	for (ARecord::TFieldsIterator fit = (*it)->GetFieldsIterBegin(); fit != (*it)->GetFieldsIterEnd(); ++fit)
 	  cout << "  " << fit->first <<": " << fit->second << endl;
       } else { //non-verbose printing
@@ -305,7 +505,26 @@ int main(int argc, char **argv)
       tuiSvc->SetWelcomeMessage(string("WARNING: An error occurred during source loading. Not all results may be available. Consult log file: ")+logFileName);
     else
       tuiSvc->SetWelcomeMessage("Source data loaded successfully");
+    if (cfgMgr->GetWriteBehind()) {
+      //write changes in the background, but make sure they are written if we are terminated
+      sigset_t signals;
+      sigemptyset(&signals);
+      sigaddset(&signals, SIGTERM);
+      sigaddset(&signals, SIGHUP);
+      sigaddset(&signals, SIGINT);
+      pthread_sigmask(SIG_BLOCK, &signals, 0);
+      thread(FlushOnSignal, signals).detach();
+      ioSvc->SetWriteBehind(true, cfgMgr->GetWriteBehindDelay());
+    }
+    ioSvc->SetEviction(cfgMgr->GetSourceIdleTimeout(), (size_t)cfgMgr->GetSourceMemoryBudget() * 1024 * 1024);
     tuiSvc->Run();
+    if (ioSvc->Flush() >= IErrorHandler::SC_ERROR) {
+      string msg;
+      ioSvc->GetWriteState(msg);
+      cerr << "ERROR: Changes could not be written to disk: " << msg << endl;
+      CleanUp();
+      return CSM_ACTION_ERROR;
+    }
   } else if (cfg_action == act_createSource) {
     log->say(ILog::INFO, "Creating new source from command-line");
     if (cfgMgr->GetUserKey().empty()) {
@@ -372,13 +591,14 @@ int main(int argc, char **argv)
     }
     log->say(ILog::INFO, "New source created successfully");
     cout << "New Source created successfully: " << inSource.GetFullURI() << endl;    
-  } if (cfg_action == act_export) {
+  } else if (cfg_action == act_export) {
     vector<string> csvColumns = {"Name", "Date", "Labels"};    
     log->say(ILog::INFO, "Starting export to CSV file");
-    vector<ARecord*> resultSearch;
-    resultSearch = ioSvc->GetAllAccounts(IIOService::ACCOUNTS_SORT_BYNAME);
+    RecordSnapshot::Ptr snapshot = ioSvc->GetSnapshot(); //records stay valid while kept
+    const vector<ARecord*> &resultSearch = snapshot->GetAccounts(IIOService::ACCOUNTS_SORT_BYNAME);
     //First, find out all possible column names    
-    for (vector<ARecord*>::iterator it = resultSearch.begin(); it != resultSearch.end(); ++it) {
+    for (vector<ARecord*>::const_iterator it = resultSearch.begin(); it != resultSearch.end(); ++it) {
+      ARecord::FieldsPin pin(*it);
       for (ARecord::TFieldsIterator fit = (*it)->GetFieldsIterBegin(); fit != (*it)->GetFieldsIterEnd(); ++fit) {
         if ( std::find_if(csvColumns.begin(), csvColumns.end(), [fit](std::string& element) -> bool { return (element == fit->first);}) == csvColumns.end() )
           csvColumns.push_back(fit->first);
@@ -395,7 +615,7 @@ int main(int argc, char **argv)
       csvOut << cleanStr;
     } //loop over columns
     csvOut << endl;
-    for (vector<ARecord*>::iterator it = resultSearch.begin(); it != resultSearch.end(); ++it) {
+    for (vector<ARecord*>::const_iterator it = resultSearch.begin(); it != resultSearch.end(); ++it) {
       map<string, string> outCsvRow;
       outCsvRow["Name"] = (*it)->GetAccountName();
       outCsvRow["Date"] = (*it)->GetModificationTimeStr();
@@ -407,8 +627,10 @@ int main(int argc, char **argv)
         labels = labels + *lit;
       }
       outCsvRow["Labels"] = labels;
-      for (ARecord::TFieldsIterator fit = (*it)->GetFieldsIterBegin(); fit != (*it)->GetFieldsIterEnd(); ++fit) {
-        outCsvRow[fit->first] = fit->second;
+      {
+	ARecord::FieldsPin pin(*it);
+	for (ARecord::TFieldsIterator fit = (*it)->GetFieldsIterBegin(); fit != (*it)->GetFieldsIterEnd(); ++fit)
+	  outCsvRow[fit->first] = fit->second;
       }
       first_entry=true;
       for (vector<string>::iterator itColNames = csvColumns.begin(); itColNames != csvColumns.end(); ++itColNames) {
@@ -423,6 +645,224 @@ int main(int argc, char **argv)
       csvOut << endl;
     }
     csvOut.close();
+  } else if (cfg_action == act_rekey) {
+    log->say(ILog::INFO, "Re-encrypting sources with a new key");
+    if (cmdLineArguments.size() != 2) {
+      log->say(ILog::FATAL, "Old and new keys must be given for key rotation.");
+      cerr << "Old and new keys must be given for key rotation." << endl;
+      Usage(argv);
+      CleanUp();
+      return CSM_ACTION_ERROR;
+    }
+    vector<SourceURI> rekeySources;
+    if (not cfg_sourceURI.empty()) {
+      rekeySources.push_back(SourceURI(cfg_sourceURI));
+    } else {
+      for (vector<string>::iterator sourceIt = cfgMgr->inputURI.begin(); sourceIt != cfgMgr->inputURI.end(); ++sourceIt)
+	rekeySources.push_back(SourceURI(*sourceIt));
+    }
+    if (rekeySources.empty()) {
+      log->say(ILog::FATAL, "No sources to re-encrypt.");
+      cerr << "ERROR: No sources to re-encrypt." << endl;
+      CleanUp();
+      return CSM_WRONG_CONFIG;
+    }
+    IErrorHandler::StatusCode retRekey;
+    retRekey = ioSvc->Rekey(rekeySources, cmdLineArguments[0], cmdLineArguments[1], RekeyProgress);
+    if (retRekey >= IErrorHandler::SC_ERROR) {
+      log->say(ILog::FATAL, "Error detected while re-encrypting sources");
+      cerr << "ERROR: Not all sources could be re-encrypted. Consult log file: " << logFileName << endl;
+      cerr << "Run the same command again to resume: sources already re-encrypted will be skipped." << endl;
+      CleanUp();
+      return CSM_ACTION_ERROR;
+    }
+    cout << "All sources use the new key. Remember to update UserKey in your configuration file." << endl;
+  } else if (cfg_action == act_generate) {
+    log->say(ILog::INFO, "Generating passwords");
+    PasswordGeneratorTool pwdGenerator("PwdGen");
+    PasswordGeneratorTool::PasswordPolicy policy = cfgMgr->GetPasswordPolicy(cfg_genPolicy);
+    if (policy.name != cfg_genPolicy)
+      *log << ILog::WARNING << "Password policy " << cfg_genPolicy << " not found, using: " << policy.str() << ILog::endmsg;
+    //generate in blocks to bound memory usage, and write each block at once
+    const size_t blockSize = 65536;
+    vector<string> pwds;
+    string outBuffer;
+    for (size_t done = 0; done < (size_t)cfg_genNumber; done += blockSize) {
+      size_t n = min(blockSize, (size_t)cfg_genNumber - done);
+      if (pwdGenerator.Generate(policy, n, pwds) != IErrorHandler::SC_OK) {
+	log->say(ILog::FATAL, "Error generating passwords");
+	cerr << "ERROR: " << pwdGenerator.GetErrorMsg() << endl;
+	CleanUp();
+	return CSM_ACTION_ERROR;
+      }
+      outBuffer.clear();
+      for (vector<string>::iterator itp = pwds.begin(); itp != pwds.end(); ++itp) {
+	outBuffer += *itp;
+	outBuffer += '\n';
+	ISecurityTool::ClearString(*itp);
+      }
+      cout.write(outBuffer.data(), outBuffer.size());
+      ISecurityTool::ClearString(outBuffer);
+    }
+    cout.flush();
+  } else if (cfg_action == act_compileDict) {
+    log->say(ILog::INFO, "Compiling password strength dictionary");
+    if (cmdLineArguments.empty()) {
+      log->say(ILog::FATAL, "No word lists given for dictionary compilation.");
+      cerr << "No word lists given for dictionary compilation." << endl;
+      Usage(argv);
+      CleanUp();
+      return CSM_ACTION_ERROR;
+    }
+    PasswordStrengthTool pwdStrength("PwdStrength");
+    if (pwdStrength.CompileDictionary(cmdLineArguments, cfg_compiledDictFile) != IErrorHandler::SC_OK) {
+      log->say(ILog::FATAL, "Error compiling dictionary");
+      cerr << "ERROR: Dictionary could not be compiled. Consult log file: " << logFileName << endl;
+      CleanUp();
+      return CSM_ACTION_ERROR;
+    }
+    cout << "Dictionary compiled: " << cfg_compiledDictFile << endl;
+    cout << "Set StrengthDictionary in your configuration file to use it." << endl;
+  } else if (cfg_action == act_auditStrength) {
+    log->say(ILog::INFO, "Starting password strength audit");
+    if (errorDuringSourceLoading) {
+      cerr << "WARNING: An error occurred during source loading. Not all accounts may be checked. Consult log file: " << logFileName <<  endl;
+    }
+    PasswordStrengthTool pwdStrength("PwdStrength");
+    if (not cfgMgr->GetStrengthDictionary().empty() &&
+	pwdStrength.LoadDictionary(cfgMgr->GetStrengthDictionary()) != IErrorHandler::SC_OK)
+      cerr << "WARNING: Cannot load strength dictionary, using the built-in list of common passwords." << endl;
+    vector< pair<ARecord*, string> > secrets; //(record, field name)
+    RecordSnapshot::Ptr snapshot = CollectSecretFields(secrets);
+    //evaluate them concurrently (Evaluate() is const and thread-safe)
+    vector<PasswordStrengthTool::Result> results(secrets.size());
+    CSMUtils::ParallelFor(secrets.size(), [&](size_t k) {
+	results[k] = pwdStrength.Evaluate(secrets[k].first->GetField(secrets[k].second),
+					  PasswordStrengthTool::GetUserInputs(secrets[k].first));
+      });
+    //report weakest first (passwords are never printed)
+    vector<size_t> order(secrets.size());
+    for (size_t k=0; k < order.size(); k++)
+      order[k] = k;
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return results[a].score < results[b].score; });
+    int scoreCount[5] = {0, 0, 0, 0, 0};
+    for (vector<size_t>::iterator ito = order.begin(); ito != order.end(); ++ito) {
+      const PasswordStrengthTool::Result &res = results[*ito];
+      scoreCount[res.score]++;
+      if (res.score > 2 && not cfg_verboseSearchResults)
+	continue;
+      cout << res.score << "/4 " << secrets[*ito].first->GetAccountName() << " / " << secrets[*ito].second
+	   << " (" << res.GetScoreStr() << ", about 10^" << res.GetLog10Guesses() << " guesses)";
+      string feedback = res.GetFeedback();
+      if (not feedback.empty())
+	cout << ": " << feedback;
+      cout << endl;
+    }
+    cout << "Checked " << secrets.size() << " secret fields:";
+    for (int s=0; s < 5; s++)
+      cout << " " << scoreCount[s] << " scored " << s << (s < 4 ? "," : "");
+    cout << endl;
+  } else if (cfg_action == act_auditBreach) {
+    log->say(ILog::INFO, "Starting breached passwords audit");
+    if (errorDuringSourceLoading) {
+      cerr << "WARNING: An error occurred during source loading. Not all accounts may be checked. Consult log file: " << logFileName <<  endl;
+    }
+    BreachCheckTool breachCheck("BreachCheck");
+    if (not cfgMgr->GetBreachFilter().empty())
+      breachCheck.LoadFilter(cfgMgr->GetBreachFilter());
+    if (not cfgMgr->GetBreachCorpus().empty())
+      breachCheck.LoadCorpus(cfgMgr->GetBreachCorpus());
+    if (not breachCheck.IsReady()) {
+      log->say(ILog::FATAL, "No breach corpus or filter available.");
+      cerr << "ERROR: Set BreachCorpus or BreachFilter in your configuration file. Consult log file: " << logFileName << endl;
+      CleanUp();
+      return CSM_WRONG_CONFIG;
+    }
+    vector< pair<ARecord*, string> > secrets; //(record, field name)
+    RecordSnapshot::Ptr snapshot = CollectSecretFields(secrets);
+    //hash and look up concurrently (Check() is const and thread-safe)
+    vector<long> breachCount(secrets.size(), 0);
+    CSMUtils::ParallelFor(secrets.size(), [&](size_t k) {
+	breachCount[k] = breachCheck.Check(secrets[k].first->GetField(secrets[k].second));
+      });
+    size_t nBreached = 0, nPossible = 0;
+    for (size_t k=0; k < secrets.size(); k++) {
+      if (breachCount[k] == 0)
+	continue;
+      cout << secrets[k].first->GetAccountName() << " / " << secrets[k].second;
+      if (breachCount[k] == BreachCheckTool::BREACH_POSSIBLE) {
+	nPossible++;
+	cout << ": possibly found in known breaches" << endl;
+      } else {
+	nBreached++;
+	cout << ": found " << breachCount[k] << " times in known breaches" << endl;
+      }
+    }
+    cout << "Checked " << secrets.size() << " secret fields: " << nBreached << " breached";
+    if (nPossible > 0)
+      cout << ", " << nPossible << " possibly breached";
+    cout << "." << endl;
+  } else if (cfg_action == act_buildBreachFilter) {
+    log->say(ILog::INFO, "Building breach filter");
+    string corpusFile = cmdLineArguments.empty() ? cfgMgr->GetBreachCorpus() : cmdLineArguments[0];
+    if (corpusFile.empty()) {
+      log->say(ILog::FATAL, "No breach corpus given.");
+      cerr << "No breach corpus given on command line or in the configuration file (BreachCorpus)." << endl;
+      Usage(argv);
+      CleanUp();
+      return CSM_ACTION_ERROR;
+    }
+    BreachCheckTool breachCheck("BreachCheck");
+    if (breachCheck.BuildFilter(corpusFile, cfg_breachFilterFile) != IErrorHandler::SC_OK) {
+      log->say(ILog::FATAL, "Error building breach filter");
+      cerr << "ERROR: " << breachCheck.GetErrorMsg() << endl;
+      CleanUp();
+      return CSM_ACTION_ERROR;
+    }
+    cout << "Breach filter built: " << cfg_breachFilterFile << endl;
+    cout << "Set BreachFilter in your configuration file to use it." << endl;
+  } else if (cfg_action == act_auditReuse) {
+    log->say(ILog::INFO, "Starting reused passwords audit");
+    if (errorDuringSourceLoading) {
+      cerr << "WARNING: An error occurred during source loading. Not all accounts may be checked. Consult log file: " << logFileName <<  endl;
+    }
+    vector< pair<ARecord*, string> > secrets; //(record, field name)
+    RecordSnapshot::Ptr snapshot = CollectSecretFields(secrets);
+    vector<string> values(secrets.size());
+    for (size_t k=0; k < secrets.size(); k++)
+      values[k] = secrets[k].first->GetField(secrets[k].second);
+    PasswordReuseTool reuseTool("PwdReuse");
+    vector<PasswordReuseTool::Group> groups;
+    IErrorHandler::StatusCode retReuse = reuseTool.FindReuse(values, groups);
+    for (vector<string>::iterator itv = values.begin(); itv != values.end(); ++itv)
+      ISecurityTool::ClearString(*itv);
+    if (retReuse != IErrorHandler::SC_OK) {
+      log->say(ILog::FATAL, "Error looking for reused passwords");
+      cerr << "ERROR: " << reuseTool.GetErrorMsg() << endl;
+      CleanUp();
+      return CSM_ACTION_ERROR;
+    }
+    //report account names (and sources, if several) only
+    bool showSources = (ioSvc->GetManagedSources().size() > 1);
+    size_t nExact = 0, nSimilar = 0;
+    for (vector<PasswordReuseTool::Group>::iterator itg = groups.begin(); itg != groups.end(); ++itg) {
+      if (itg->type == PasswordReuseTool::REUSE_EXACT) {
+	nExact++;
+	cout << "Same password used in " << itg->members.size() << " places:" << endl;
+      } else {
+	nSimilar++;
+	cout << "Similar passwords used in " << itg->members.size() << " places:" << endl;
+      }
+      for (vector<size_t>::iterator itm = itg->members.begin(); itm != itg->members.end(); ++itm) {
+	ARecord *record = secrets[*itm].first;
+	cout << "  " << record->GetAccountName() << " / " << secrets[*itm].second;
+	if (showSources)
+	  cout << " (" << ioSvc->GetAccountSource(record->GetAccountId()) << ")";
+	cout << endl;
+      }
+    }
+    cout << "Checked " << secrets.size() << " secret fields: " << nExact << " reused, "
+	 << nSimilar << " groups of similar ones." << endl;
   } else {
     log->say(ILog::FATAL, "Unable to determine action");
     cerr << "Unrecognized action. Exiting." << endl;    
@@ -451,7 +891,8 @@ int main(int argc, char **argv)
   int test = 4;
 
   if (test == 1 || test == 4) {
-     //test storing
+     //test storing, written once
+    ioSvc->BeginTransaction();
     ARecord *testRec = new ARecord();
     testRec->SetAccountName("DummyAccount1");
     testRec->AddLabel("DummyFolder1");
@@ -487,7 +928,7 @@ int main(int argc, char **argv)
     testRec->AddDebugField(string("Password"), string("Ecavolo"));
     testRec->AddLabel("DummyFolder2");
     ioSvc->Add(testRec);
-    ioSvc->Store();
+    ioSvc->Commit();
   }
   if (test == 2) {
     //test loading
@@ -507,6 +948,7 @@ int main(int argc, char **argv)
 	cout << *eit <<",";
       cout << endl;      
       cout << "  Fields: " << endl;
+      ARecord::FieldsPin pin(*it);
       for (ARecord::TFieldsIterator fit = (*it)->GetFieldsIterBegin(); fit != (*it)->GetFieldsIterEnd(); ++fit)
 	cout << "    " << fit->first <<" <--> " << fit->second << endl;
       cout << endl;
@@ -546,6 +988,10 @@ void CleanUp()
   if (log) log->say(ILog::INFO, "Final clean-up.");
   // --- Free CSM services and tools
   if (ioSvc) delete ioSvc;
+  if (recordSealer) {
+    ARecord::SetSealer(0);
+    delete recordSealer;
+  }
   if (cfgMgr) delete cfgMgr;
   if (runningSecurityChecks) delete runningSecurityChecks;
   if (log) delete log;
@@ -572,6 +1018,11 @@ void Usage(char **argv)
   cerr << "* " << argv[0] << " [options] searchString" << std::endl;  
   cerr << "Free text search for *searchString* pattern. All general options are also valid." << std::endl;
   cerr << "\t -e, --regexp\t Interpret *searchString* as regular expression" << endl;
+  cerr << "\t -z, --fuzzy\t Fuzzy search: best matches of the characters of *searchString* first" << endl;
+  cerr << "\t -q, --query\t Interpret *searchString* as a query, e.g. \"host:db* AND label:work AND modified:2024..\"" << endl;
+  cerr << "\t -l, --label\t Only records whose labels match a query, e.g. \"work AND ssh AND NOT retired\" (*searchString* is optional)" << endl;
+  cerr << "\t -n, --limit N\t Only print the first N matches, stopping the search once found" << endl;
+  cerr << "\t     --first\t Only print the first match (same as --limit 1)" << endl;
   cerr << "\t -v, --verbose\t Full printout of matched records (default: only \"Essentials\" fields)" << endl;
   cerr << endl;
   cerr << "* " << argv[0] << " (--create | -C) --key myKey [options] (newSourceName | --source newSourceName)" << std::endl;
@@ -580,6 +1031,24 @@ void Usage(char **argv)
   cerr << "\t -u, --user\t Set username to be associated to the source (default: " << strHelp_userDefault << ")" << endl;
   cerr << "* " << argv[0] << " (--export | -x outputFile) " << std::endl;
   cerr << "Export to outputFile in CSV format. All general options are also valid." << endl;
+  cerr << "* " << argv[0] << " (--rekey | -R) [options] oldKey newKey" << std::endl;
+  cerr << "Re-encrypt all sources (or the one given with --source) from *oldKey* to *newKey*. All general options are also valid." << endl;
+  cerr << "Sources are processed concurrently and each one is replaced only once fully re-encrypted." << endl;
+  cerr << "If interrupted, run it again: sources already using *newKey* are skipped." << endl;
+  cerr << "* " << argv[0] << " (--gen | -g) N [--policy policyName]" << std::endl;
+  cerr << "Generate N random passwords, one per line. All general options are also valid." << endl;
+  cerr << "\t -p, --policy\t Password policy to use, as defined in the configuration file (default: Default)" << endl;
+  cerr << "* " << argv[0] << " (--compile-dict | -D) outputFile wordList1 [wordList2 ...]" << std::endl;
+  cerr << "Compile word lists (one word per line, most common first) into a dictionary for the password strength check." << endl;
+  cerr << "* " << argv[0] << " (--audit-strength | -A) [options]" << std::endl;
+  cerr << "Check the strength of all passwords (fields listed in SecretFieldNames) and report the weak ones. All general options are also valid." << endl;
+  cerr << "\t -v, --verbose\t Report all passwords, not only the weak ones" << endl;
+  cerr << "* " << argv[0] << " (--audit-breach | -B) [options]" << std::endl;
+  cerr << "Check all passwords against the local corpus of breached passwords (BreachCorpus or BreachFilter). All general options are also valid." << endl;
+  cerr << "* " << argv[0] << " (--build-breach-filter | -F) outputFile [corpusFile]" << std::endl;
+  cerr << "Build a compact filter from the corpus of breached passwords (default: BreachCorpus), for use as BreachFilter." << endl;
+  cerr << "* " << argv[0] << " (--audit-reuse | -U) [options]" << std::endl;
+  cerr << "Find passwords reused, as-is or slightly modified, among all accounts of all sources. All general options are also valid." << endl;
 
   cerr << std::endl;
 }
@@ -602,3 +1071,43 @@ string cleanForCSV(string str)
   }
   return str;
 }
+
+/** Collect all non-empty secret fields (see SecretFieldNames) of the accounts loaded.
+ * @param pSecrets filled with (record, field name) pairs
+ * @return snapshot the records belong to: keep it while using them
+ */
+RecordSnapshot::Ptr CollectSecretFields(std::vector< std::pair<ARecord*, std::string> > &pSecrets)
+{
+  RecordSnapshot::Ptr snapshot = ioSvc->GetSnapshot();
+  const vector<ARecord*> &allAccounts = snapshot->GetAccounts(IIOService::ACCOUNTS_SORT_BYNAME);
+  for (vector<ARecord*>::const_iterator it = allAccounts.begin(); it != allAccounts.end(); ++it) {
+    ARecord::FieldsPin pin(*it);
+    for (ARecord::TFieldsIterator fit = (*it)->GetFieldsIterBegin(); fit != (*it)->GetFieldsIterEnd(); ++fit)
+      if (cfgMgr->IsSecretField(fit->first) && not fit->second.empty())
+	pSecrets.push_back(make_pair(*it, fit->first));
+  }
+  return snapshot;
+}
+
+void RekeyProgress(SourceURI pSource, IErrorHandler::StatusCode pResult, bool pSkipped, size_t pDone, size_t pTotal)
+{
+  cout << "[" << pDone << "/" << pTotal << "] " << pSource.GetFullURI() << ": ";
+  if (pResult >= IErrorHandler::SC_ERROR)
+    cout << "FAILED" << endl;
+  else if (pSkipped)
+    cout << "skipped (already using new key or not encrypted)" << endl;
+  else
+    cout << "re-encrypted" << endl;
+}
+
+void FlushOnSignal(sigset_t pSignals)
+{
+  int sig;
+  if (sigwait(&pSignals, &sig) != 0)
+    return;
+  ioSvc->Flush();
+  //the main thread is not going to leave curses mode: do it for it
+  if (tuiSvc)
+    tuiSvc->RestoreTerminal();
+  _exit(128 + sig);
+}
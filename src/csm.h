@@ -21,7 +21,7 @@
 #include "LogLocalFile.h"
 
 #include "IRunningSecurityService.h"
-#include "DummyRunSecurityService.h"
+#include "LocalRunSecurityService.h"
 
 #include "IIOService.h"
 #include "MultipleSourceIOSvc.h"
@@ -29,6 +29,11 @@
 #include "TuiSvc.h"
 
 #include "GnuPGSecurityTool.h"
+#include "PasswordGeneratorTool.h"
+#include "PasswordStrengthTool.h"
+#include "BreachCheckTool.h"
+#include "PasswordReuseTool.h"
+#include "RecordSealer.h"
 
 //Store pointers to instances the services and tools needed by CSM
 IConfigurationService *cfgMgr; ///< Configuration Manager Service
@@ -36,6 +41,7 @@ ILog *log; ///< Logging Service
 IRunningSecurityService *runningSecurityChecks; ///< Running Security Service
 MultipleSourceIOSvc *ioSvc; ///< IO service
 TuiSvc *tuiSvc; ///< TUI service
+RecordSealer *recordSealer; ///< Keeps record contents sealed in memory (if enabled)
 
 //CSM return codes
 const int CSM_OK=0;
@@ -49,6 +55,13 @@ enum CmdLineActions {
   act_quickSearch,
   act_createSource,
   act_export,
+  act_rekey,
+  act_generate,
+  act_compileDict,
+  act_auditStrength,
+  act_auditBreach,
+  act_buildBreachFilter,
+  act_auditReuse,
   act_nActions
 };
 